@@ -0,0 +1,2520 @@
+// Host benchmark suite for the player logic, built by [env:native].
+//
+//  pio run -e native && .pio/build/native/program [name] [count]
+//
+// Runs every benchmark, or just the one named:
+//  callback  events/sec through midiCallback() and the output path
+//  lcd       LCD bytes and MIDI bytes emitted playing one song
+//  jitter    scheduled vs. actual emit time of a reference song
+//  merge     concurrent producers through MidiMerge, message integrity
+//  tempo     tempo engine drift over a 10 minute song, events kept in ramps
+//  seek      bar index of the reference song and the time to seek each bar
+//  stream    BENCH.RPS (smf2rps of BENCH.MID) against the RAM stream
+//  setlist   two copies of BENCH.MID played through, handover timing
+//  ble       BLE-MIDI packing of the reference song for a few link settings
+//  blein     BLE-MIDI packets decoded back into every kind of message
+//  xform     output transforms loaded from XFORM.CFG, cost per message
+//  sysex     SysEx from the file through the sender, pacing, repeats, BLE
+//  cache     a song kept in the song cache and played back from it
+//  info      song information filled in around the browse cursor
+//  clock     MIDI clock sent with the reference song, and an external one followed
+//  remote    remote control commands on Serial2 and the status pushed back
+//  log       debug log records through the ring and the Serial2 frames
+//  ir        IR frames with synthetic timings through the key classifier
+//  playlist  playlist index build and check for 'count' files (default 500), card changes
+//
+// The reference song BENCH.MID is generated into a scratch SD root.
+
+#include <Arduino.h>
+#include <MD_MIDIFile.h>
+#include <LiquidCrystal.h>
+#include <TinyIRReceiver.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#include "MidiScheduler.h"
+#include "MidiEventStream.h"
+#include "TempoEngine.h"
+#include "SeekIndex.h"
+#include "StreamPlayer.h"
+#include "MidiOutput.h"
+#include "MidiMerge.h"
+#include "LcdShadow.h"
+#include "BleMidiPacker.h"
+#include "BleMidiInput.h"
+#include "MidiTransform.h"
+#include "SysExSender.h"
+#include "SongCache.h"
+#include "SongInfo.h"
+#include "MidiClock.h"
+#include "RemoteControl.h"
+#include "DebugLog.h"
+#include "IRRemoteTinyReceiver.h"
+
+// from main.cpp
+void setup(void);
+void uiLoop(void);
+void midiCallback(midi_event *pev);
+bool midiPreload(void);
+int midiLoad(const char* name);
+uint16_t createPlaylistFile(void);
+extern SDFAT SD;
+extern MD_MIDIFile SMF;
+extern LiquidCrystal LCD;
+extern MidiScheduler midiSched;
+extern MidiEventStream ramSong;
+extern TempoEngine tempoEngine;
+extern SeekIndex seekIndex;
+extern bool bRamPlay;
+extern StreamPlayer rpsSong;
+bool midiSeek(uint16_t bar);
+void midiDrain(MidiMerge& merge, SysExSender& sx, uint32_t nowUs);
+extern MidiOutput midiOutput;
+extern MidiMerge midiMerge;
+extern SysExSender sysexOut;
+extern SongCache songCache;
+extern SongCache::Key fkey;
+extern SongInfo songInfo;
+extern uint32_t parseUs;
+extern uint16_t plCount;
+extern PlaylistIndex playlist;
+extern uint16_t plIndex;
+extern bool bAdvance;
+void midiNextStep(void);
+bool midiNext(void);
+void clockPulse(uint32_t time);
+uint16_t midiBar(void);
+void midiRestart(bool bStart);
+bool midiFill(void);
+extern MidiScheduler clockSched;
+extern RemoteControl remote;
+void settingsLoad(void);
+
+static const char* SONG_ROOT = "/tmp/rp_bench_song";
+static const char* LIST_ROOT = "/tmp/rp_bench_list";
+static const char* SET_ROOT = "/tmp/rp_bench_set";
+static const char* INFO_ROOT = "/tmp/rp_bench_info";
+static const char* SYSX_ROOT = "/tmp/rp_bench_sysex";
+static const char* LOG_CAPTURE = "/tmp/rp_bench_log.bin";  // for tools/logdec
+static const uint32_t SONG_BARS = 16;       // 4/4 at 120 then 140 BPM, about 30 s
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point t0)
+{
+  return(std::chrono::duration<double>(Clock::now() - t0).count());
+}
+
+// Reference song ------------------------------------------------------
+
+static void putVLQ(std::vector<uint8_t>& v, uint32_t n)
+{
+  uint8_t b[4];
+  int i = 0;
+
+  b[i++] = n & 0x7f;
+  while (n >>= 7)
+    b[i++] = 0x80 | (n & 0x7f);
+  while (i--)
+    v.push_back(b[i]);
+}
+
+static void putTrack(FILE* f, const std::vector<uint8_t>& v)
+{
+  uint32_t len = v.size() + 4;
+  uint8_t hdr[8] = { 'M', 'T', 'r', 'k', (uint8_t)(len >> 24), (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)len };
+  uint8_t eot[4] = { 0x00, 0xff, 0x2f, 0x00 };
+
+  fwrite(hdr, 1, sizeof(hdr), f);
+  fwrite(v.data(), 1, v.size(), f);
+  fwrite(eot, 1, sizeof(eot), f);
+}
+
+static void writeReferenceSong(const char* path)
+// Type 1, 480 PPQN: a tempo track with a change half way, a drum track in
+// 16ths and a four note chord track, dense enough to load the DIN link.
+{
+  const uint16_t PPQ = 480;
+  std::vector<uint8_t> t0, t1, t2;
+  FILE* f = fopen(path, "wb");
+  uint8_t mthd[14] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 3, PPQ >> 8, PPQ & 0xff };
+
+  // tempo map
+  uint8_t ts[] = { 0xff, 0x58, 0x04, 4, 2, 24, 8 };
+  t0.push_back(0); t0.insert(t0.end(), ts, ts + sizeof(ts));
+  uint8_t tempo1[] = { 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20 };    // 120 BPM
+  t0.push_back(0); t0.insert(t0.end(), tempo1, tempo1 + sizeof(tempo1));
+  putVLQ(t0, PPQ * 4 * SONG_BARS / 2);
+  uint8_t tempo2[] = { 0xff, 0x51, 0x03, 0x06, 0x8a, 0x1b };    // 140 BPM
+  t0.insert(t0.end(), tempo2, tempo2 + sizeof(tempo2));
+
+  // drums, channel 10
+  for (uint32_t i = 0; i < SONG_BARS * 16; i++)
+  {
+    uint8_t note = (i % 8 == 0) ? 36 : (i % 8 == 4) ? 38 : 42;
+
+    putVLQ(t1, i == 0 ? 0 : PPQ / 8);
+    t1.push_back(0x99); t1.push_back(note); t1.push_back(100);
+    putVLQ(t1, PPQ / 8);
+    t1.push_back(0x89); t1.push_back(note); t1.push_back(0);
+  }
+
+  // chords, channel 1
+  for (uint32_t i = 0; i < SONG_BARS * 4; i++)
+  {
+    uint8_t root = 48 + (i / 4) % 12;
+
+    for (uint8_t n = 0; n < 4; n++)
+    {
+      putVLQ(t2, 0);
+      t2.push_back(0x90); t2.push_back(root + n * 4); t2.push_back(80);
+    }
+    for (uint8_t n = 0; n < 4; n++)
+    {
+      putVLQ(t2, n == 0 ? PPQ : 0);
+      t2.push_back(0x80); t2.push_back(root + n * 4); t2.push_back(0);
+    }
+  }
+
+  fwrite(mthd, 1, sizeof(mthd), f);
+  putTrack(f, t0);
+  putTrack(f, t1);
+  putTrack(f, t2);
+  fclose(f);
+}
+
+static void pressKey(uint8_t command)
+{
+  handleReceivedTinyIRData(0x0, command, 0);
+}
+
+static void serviceOutput(void)
+// Stand in for the esp_timer and output task on the host
+{
+  uint32_t next;
+
+  clockSched.service(clockSched.now(), next);
+  midiSched.service(midiSched.now(), next);
+  midiMerge.drain();
+  midiOutput.flush();
+}
+
+// Benchmarks ----------------------------------------------------------
+
+static void benchCallback(uint32_t count)
+{
+  midi_event ev;
+  Clock::time_point t0 = Clock::now();
+
+  midiOutput.resetStats();
+  Serial.resetBytesOut();
+  midiSched.start();
+  parseUs = 0;
+
+  ev.track = 0;
+  ev.size = 3;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    ev.channel = (i / 64) % 16;
+    ev.data[0] = (i & 1) ? 0x80 : 0x90;
+    ev.data[1] = 36 + i % 48;
+    ev.data[2] = (i & 1) ? 0 : 100;
+    midiCallback(&ev);
+
+    if (midiSched.space() < 2)
+    {
+      uint32_t next;
+
+      midiSched.service(parseUs + 1, next);
+      midiMerge.drain();
+      midiOutput.flush();
+    }
+  }
+  serviceOutput();
+
+  double s = secondsSince(t0);
+  printf("callback: %u events in %.3f s, %.0f events/s, %u bytes out, %u saved by running status\n",
+         count, s, count / s, Serial.bytesOut(), midiOutput.getBytesSaved());
+}
+
+static std::vector<uint8_t> stuckWire;
+static bool bStuck = true;
+
+static size_t stuckPort(const uint8_t* data, size_t size)
+// A port that takes nothing while bStuck is set
+{
+  if (bStuck)
+    return(0);
+  stuckWire.insert(stuckWire.end(), data, data + size);
+  return(size);
+}
+
+static void benchStuck(void)
+// With the port taking nothing, messages past a full ring must be
+// refused and counted, and what was queued must come out intact
+{
+  MidiOutput out(stuckPort);
+  uint32_t queued = 0;
+
+  stuckWire.clear();
+  bStuck = true;
+  for (uint32_t i = 0; i < MOUT_BUFFER_SIZE; i++)
+  {
+    uint8_t msg[3] = { (uint8_t)(0x90 | (i & 1)), (uint8_t)(i & 0x7f), 100 };
+
+    if (out.write(msg, sizeof(msg), false))
+      queued++;
+  }
+  bStuck = false;
+  out.flush();
+
+  bool bOk = (queued + out.getDropped() == MOUT_BUFFER_SIZE && out.getDropped() > 0 &&
+              stuckWire.size() == queued * 3);
+
+  for (uint32_t i = 0; bOk && i < queued; i++)
+    bOk = (stuckWire[i * 3] == (0x90 | (i & 1)) && stuckWire[i * 3 + 1] == (i & 0x7f));
+  printf("callback: port stuck, %u messages queued, %u refused, queue intact -> %s\n",
+         queued, out.getDropped(), bOk ? "OK" : "WRONG");
+}
+
+// IR remote -----------------------------------------------------------
+
+typedef struct
+{
+  uint32_t  ms;         ///< Frame time
+  uint8_t   command;
+  uint8_t   flags;      ///< IRDATA_FLAGS_*
+} IrFrame;
+
+static std::string irRun(IRRemoteTinyReceiver& ir, const IrFrame* frames, size_t count)
+// Feed the frames through the ISR handler and Update() at their times,
+// 1 ms steps in between, and list the results as result and key letters:
+// P press, D double, L long, R repeat
+{
+  std::string out;
+  uint32_t end = frames[count - 1].ms + 500;
+  size_t i = 0;
+
+  for (uint32_t ms = frames[0].ms; ms <= end; ms++)
+  {
+    halSetClock(ms * 1000ULL);
+    for (; i < count && frames[i].ms == ms; i++)
+      handleReceivedTinyIRData(0x0, frames[i].command, frames[i].flags);
+    ir.Update();
+
+    for (IRRemoteTinyReceiver::KeyResult kr; (kr = ir.read()) != IRRemoteTinyReceiver::KEY_NULL; )
+    {
+      out += (kr == IRRemoteTinyReceiver::KEY_DPRESS) ? 'D' : (kr == IRRemoteTinyReceiver::KEY_LONGPRESS) ? 'L' :
+             (kr == IRRemoteTinyReceiver::KEY_RPTPRESS) ? 'R' : 'P';
+      out += (char)ir.getKey();
+      out += ' ';
+    }
+  }
+
+  return(out);
+}
+
+static void benchIr(void)
+// NEC frames and their repeats every 108 ms, as the receiver decodes them,
+// must be classified into the presses the player acts on. Garbage, i.e.
+// unknown codes, repeats of nothing held, repeats after the key has been
+// let go and frames failing the parity check, must give nothing.
+{
+  static IRRemoteTinyReceiver::IRRemoteRxKeyValue keys[] =
+  {
+    { 0x0, 0x07, 'S' },
+    { 0x0, 0x18, 'U' },
+    { 0x0, 0x52, 'D' },
+  };
+  const uint8_t R = IRDATA_FLAGS_IS_REPEAT;
+  uint32_t errors = 0;
+
+  // a press, then a key held for a second: repeats after IR_REPEAT_DELAY
+  // every IR_REPEAT_TIME or the next frame after, long press at 648 ms
+  // ahead of that frame's repeat
+  {
+    IRRemoteTinyReceiver ir(keys, 3);
+    std::vector<IrFrame> f = { { 1000, 0x18, 0 } };
+
+    ir.enableRepeat(true);
+    ir.enableRepeatResult(true);
+    ir.enableLongPress(true);
+    f.push_back({ 2000, 0x07, 0 });
+    for (uint32_t t = 2108; t <= 3000; t += 108)
+      f.push_back({ t, 0x07, R });
+
+    std::string got = irRun(ir, f.data(), f.size());
+    std::string want = "PU PS RS RS LS RS RS RS RS ";
+
+    errors += (got != want);
+    printf("ir: press and hold   %-32s%s\n", got.c_str(), got == want ? "OK" : ("WRONG, want " + want).c_str());
+  }
+
+  // double presses, the third press too late to pair with the second
+  {
+    IRRemoteTinyReceiver ir(keys, 3);
+    IrFrame f[] = { { 1000, 0x52, 0 }, { 1200, 0x52, 0 }, { 1450, 0x52, 0 }, { 1800, 0x52, 0 }, { 1900, 0x18, 0 } };
+
+    ir.enableDoublePress(true);
+    std::string got = irRun(ir, f, sizeof(f) / sizeof(f[0]));
+    std::string want = "PD DD PD PD PU ";
+
+    errors += (got != want);
+    printf("ir: double press     %-32s%s\n", got.c_str(), got == want ? "OK" : ("WRONG, want " + want).c_str());
+  }
+
+  // garbage around one good press
+  {
+    IRRemoteTinyReceiver ir(keys, 3);
+    IrFrame f[] =
+    {
+      { 1000, 0x99, 0 },                             // not one of the keys
+      { 1100, 0x07, R },                             // repeat of nothing held
+      { 1200, 0x52, IRDATA_FLAGS_PARITY_FAILED },    // bad frame
+      { 1300, 0x07, 0 },                             // the good press
+      { 1500, 0x07, R },                             // repeat after the key was let go
+      { 1502, 0x18, R },                             // repeat of another key
+    };
+
+    ir.enableRepeat(true);
+    ir.enableLongPress(true);
+    std::string got = irRun(ir, f, sizeof(f) / sizeof(f[0]));
+    std::string want = "PS ";
+
+    errors += (got != want);
+    printf("ir: garbage          %-32s%s\n", got.c_str(), got == want ? "OK" : ("WRONG, want " + want).c_str());
+  }
+
+  printf("ir: %u frames dropped, %u errors -> %s\n", IRRemoteTinyReceiver::getDropped(), errors,
+         errors == 0 ? "OK" : "WRONG");
+  halRealClock();
+}
+
+static void benchLcd(void)
+// Play the reference song through uiLoop() on a simulated clock
+{
+  const uint32_t songMs = SONG_BARS / 2 * 2000 + SONG_BARS / 2 * 2000 * 120 / 140;
+
+  halSetClock(0);
+  LCD.resetBytes();
+  Serial.resetBytesOut();
+  midiOutput.resetStats();
+
+  for (uint8_t i = 0; i < 5; i++)
+    uiLoop();
+  pressKey(0x07);   // Select
+
+  for (uint32_t ms = 0; ms < songMs; ms++)
+  {
+    halAdvanceClock(1000);
+    uiLoop();
+    serviceOutput();
+  }
+  pressKey(0x1a);   // Right = stop
+  halAdvanceClock(1000);
+  uiLoop();
+  serviceOutput();
+
+  printf("lcd: %u ms song, %u LCD bytes (%.1f/s), %u MIDI bytes, %u saved by running status, peak queue %u\n",
+         songMs, LCD.bytes(), LCD.bytes() * 1000.0 / songMs, Serial.bytesOut(),
+         midiOutput.getBytesSaved(), midiOutput.getPeakDepth());
+  halRealClock();
+}
+
+static std::vector<int32_t> lateness;
+static MidiScheduler* jitterSched = nullptr;
+
+static void jitterEmit(const uint8_t* data, uint8_t size, uint32_t due)
+{
+  (void)data; (void)size;
+  lateness.push_back((int32_t)(jitterSched->now() - due));
+}
+
+static uint32_t hostClock(void)
+{
+  return(micros());
+}
+
+static void benchJitter(uint32_t seconds)
+// Real time on the host: one thread parses ahead while another sleeps
+// until each event is due, the way the esp_timer callback does.
+{
+  MidiScheduler sched(jitterEmit, hostClock);
+  std::atomic<bool> bRun(true);
+
+  jitterSched = &sched;
+  lateness.clear();
+  lateness.reserve(100000);
+
+  tempoEngine.reset();
+  if (SMF.load("BENCH.MID") != MD_MIDIFile::E_OK || !midiPreload())
+  {
+    printf("jitter: reference song did not load\n");
+    return;
+  }
+  SMF.close();
+
+  sched.start();
+  std::thread emitter([&]()
+  {
+    while (bRun)
+    {
+      uint32_t next;
+
+      if (sched.service(sched.now(), next))
+        std::this_thread::sleep_for(std::chrono::microseconds(std::max<int32_t>((int32_t)(next - sched.now()), 0)));
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+
+  // the producer stalls now and again, as uiLoop() does for the LCD and IR
+  while (sched.now() < seconds * 1000000UL)
+  {
+    ramSong.fill(sched, sched.now() + SCHED_LOOKAHEAD_US);
+    std::this_thread::sleep_for(std::chrono::microseconds(500 + rand() % 5000));
+  }
+  bRun = false;
+  emitter.join();
+
+  std::sort(lateness.begin(), lateness.end());
+  size_t n = lateness.size();
+  if (n == 0)
+    return;
+
+  printf("jitter: %zu events, lateness us p50 %d p90 %d p99 %d p99.9 %d max %d, overruns %u\n",
+         n, lateness[n / 2], lateness[n * 9 / 10], lateness[n * 99 / 100], lateness[n * 999 / 1000],
+         lateness[n - 1], sched.getOverruns());
+}
+
+static std::vector<uint32_t> tempoDue;
+static std::vector<uint32_t> tempoMsg;
+
+static void tempoEmit(const uint8_t* data, uint8_t size, uint32_t due)
+{
+  tempoDue.push_back(due);
+  tempoMsg.push_back((data[0] << 16) | (data[1] << 8) | (size > 2 ? data[2] : 0));
+}
+
+static uint32_t tempoClock(void)
+{
+  return(0);
+}
+
+static void benchTempo(void)
+// Drift: ten minutes of ticks at an awkward tempo, advanced in uneven
+// steps, against the exact time. The old whole us per tick sum is shown
+// for comparison.
+// Ramps: the reference song looped for ten minutes of song time with
+// tempo ramps started at random. Every pass must emit the same events in
+// the same order with due times that never go backwards.
+{
+  const uint32_t US_PER_QUARTER = 618557;   // 97 BPM
+  const uint16_t PPQ = 96;
+  const uint64_t SONG_US = 600000000ULL;
+  TempoEngine te;
+  uint64_t ticks = 0;
+  uint64_t wholeUs = 0;
+  uint64_t time = 0;
+  int64_t maxDrift = 0;
+
+  te.setQuarter(US_PER_QUARTER, PPQ);
+  while (time < SONG_US)
+  {
+    uint32_t n = 1 + rand() % 50;
+    uint32_t last = te.getTime();
+
+    time += (uint32_t)(te.advance(n) - last);
+    ticks += n;
+    wholeUs += n * (US_PER_QUARTER / PPQ);
+
+    int64_t drift = (int64_t)time - (int64_t)(ticks * US_PER_QUARTER / PPQ);
+    if (llabs(drift) > maxDrift)
+      maxDrift = llabs(drift);
+  }
+  printf("tempo: drift over %llu ticks, max %lld us (whole us per tick: %lld us)\n",
+         (unsigned long long)ticks, (long long)maxDrift,
+         (long long)(ticks * US_PER_QUARTER / PPQ) - (long long)wholeUs);
+
+  // ramps
+  MidiScheduler sched(tempoEmit, tempoClock);
+  uint32_t horizon = 0;
+  uint32_t ramps = 0;
+  uint32_t errors = 0;
+
+  tempoDue.clear();
+  tempoMsg.clear();
+  tempoEngine.reset();
+  if (SMF.load("BENCH.MID") != MD_MIDIFile::E_OK || !midiPreload())
+  {
+    printf("tempo: reference song did not load\n");
+    return;
+  }
+  SMF.close();
+
+  while (horizon < SONG_US)
+  {
+    uint32_t next;
+
+    horizon += SCHED_LOOKAHEAD_US;
+    ramSong.fill(sched, horizon);
+    sched.service(horizon, next);
+    if (rand() % 20 == 0)
+    {
+      tempoEngine.rampTo((rand() % 8001) - 4000, (rand() % 4) * 250000);
+      ramps++;
+    }
+  }
+
+  uint32_t count = ramSong.getEventCount();
+  size_t passes = tempoMsg.size() / count;
+
+  for (size_t i = 1; i < tempoDue.size(); i++)
+    if ((int32_t)(tempoDue[i] - tempoDue[i - 1]) < 0)
+      errors++;
+  for (size_t i = count; i < tempoMsg.size(); i++)
+    if (tempoMsg[i] != tempoMsg[i % count])
+      errors++;
+
+  printf("tempo: %u ramps, %zu events in %zu passes of %u, %u errors -> %s\n",
+         ramps, tempoMsg.size(), passes, count, errors, errors == 0 ? "intact" : "BROKEN");
+}
+
+static void benchSeek(void)
+{
+  uint32_t worst = 0, total = 0, sections = 0;
+
+  tempoEngine.reset();
+  if (SMF.load("BENCH.MID") != MD_MIDIFile::E_OK || !(bRamPlay = midiPreload()))
+  {
+    printf("seek: reference song did not load\n");
+    return;
+  }
+  SMF.close();
+
+  for (uint16_t bar = 0; bar < seekIndex.getBarCount(); bar++)
+  {
+    Clock::time_point t0 = Clock::now();
+
+    midiSeek(bar);
+    uint32_t us = (uint32_t)(secondsSince(t0) * 1e6);
+    total += us;
+    worst = std::max(worst, us);
+    sections += seekIndex.getBar(bar).section_;
+  }
+  midiSched.flush();
+  bRamPlay = false;
+
+  printf("seek: %u bars, %u sections, bar %u at tick %u, seek us mean %u max %u\n",
+         seekIndex.getBarCount(), sections, SONG_BARS / 2, seekIndex.getBar(SONG_BARS / 2).tick_,
+         total / std::max<uint16_t>(seekIndex.getBarCount(), 1), worst);
+
+  // a long song changing the channel state every bar, so the restore
+  // starts from several snapshots: it must send what the song last set
+  // before each bar, as the song sets it
+  const uint16_t BARS = 100, BAR_TICKS = 4 * 480;
+  std::map<uint16_t, std::vector<uint8_t>> last;     // by status and controller
+  std::vector<std::vector<std::vector<uint8_t>>> want;
+  uint32_t errors = 0;
+
+  ramSong.clear(480);
+  seekIndex.clear();
+  for (uint16_t bar = 0; bar < BARS; bar++)
+  {
+    uint32_t tick = bar * BAR_TICKS;
+    std::vector<std::vector<uint8_t>> msgs = { { 0xb0, 7, (uint8_t)(bar & 0x7f) }, { 0xc0, (uint8_t)(bar / 3) }, { 0x92, 60, 100 } };
+
+    if (bar % 5 == 0)
+      msgs.push_back({ 0xe1, (uint8_t)bar, 0x40 });
+    if (bar == 40)
+      msgs.push_back({ 0xb2, 10, 20 });
+
+    want.emplace_back();
+    for (auto& m : last)
+      want.back().push_back(m.second);
+    std::sort(want.back().begin(), want.back().end());
+
+    uint16_t event = ramSong.getEventCount();
+    for (auto& m : msgs)
+    {
+      ramSong.append(tick, m.data(), m.size());
+      if ((m[0] & 0xf0) != 0x90)
+        last[(m[0] << 8) | ((m[0] & 0xf0) == 0xb0 ? m[1] : 0)] = m;
+    }
+    ramSong.setState(tick, 500000, 0x0404);
+    seekIndex.update(tick, 0x0404, 480, event);
+  }
+  ramSong.end(BARS * BAR_TICKS);
+  seekIndex.end(BARS * BAR_TICKS, ramSong);
+
+  static std::vector<std::vector<uint8_t>> restored;
+  for (uint16_t bar = 0; bar < BARS; bar++)
+  {
+    restored.clear();
+    seekIndex.restoreState(ramSong, bar, [](const uint8_t* data, uint8_t size)
+      { restored.emplace_back(data, data + size); return(true); });
+    std::sort(restored.begin(), restored.end());
+    errors += (bar >= seekIndex.getBarCount() || restored != want[bar]);
+  }
+  ramSong.clear(480);
+  seekIndex.clear();
+
+  printf("seek: %u bars from snapshots every %u, %u wrong restores -> %s\n",
+         BARS, SEEK_SNAP_BARS, errors, errors == 0 ? "OK" : "WRONG");
+}
+
+static void benchStream(void)
+// Both paths run for two passes of the song with no clock, all events
+// emitted straight away, and must give the same messages at the same times
+{
+  MidiScheduler sched(tempoEmit, tempoClock);
+  std::vector<uint32_t> ramDue, ramMsg;
+  uint32_t horizon, errors = 0, worst = 0;
+  Clock::time_point t0;
+  double rpsSecs;
+
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    tempoDue.clear();
+    tempoMsg.clear();
+    tempoEngine.reset();
+    sched.start();
+    if (pass == 0)
+    {
+      if (SMF.load("BENCH.MID") != MD_MIDIFile::E_OK || !midiPreload())
+      {
+        printf("stream: reference song did not load\n");
+        return;
+      }
+      SMF.close();
+      ramSong.restart();
+    }
+    else
+    {
+      if (!rpsSong.open("BENCH.RPS"))
+      {
+        printf("stream: no BENCH.RPS, convert %s/BENCH.MID with smf2rps first\n", SONG_ROOT);
+        return;
+      }
+      rpsSong.looping(true);
+    }
+
+    t0 = Clock::now();
+    for (horizon = 0; horizon < 2 * 30000000UL; horizon += SCHED_LOOKAHEAD_US)
+    {
+      uint32_t next;
+
+      if (pass == 0)
+        ramSong.fill(sched, horizon);
+      else
+        rpsSong.fill(sched, horizon);
+      sched.service(horizon, next);
+    }
+    rpsSecs = secondsSince(t0);
+
+    if (pass == 0)
+    {
+      ramDue = tempoDue;
+      ramMsg = tempoMsg;
+    }
+  }
+  rpsSong.close();
+
+  for (size_t i = 0; i < std::min(ramDue.size(), tempoDue.size()); i++)
+  {
+    uint32_t d = (uint32_t)abs((int32_t)(tempoDue[i] - ramDue[i]));
+
+    worst = std::max(worst, d);
+    errors += (tempoMsg[i] != ramMsg[i]);
+  }
+
+  printf("stream: %zu events from RPS, %zu from RAM, %u differ, max time difference %u us, %.1f ms to play through\n",
+         tempoMsg.size(), ramMsg.size(), errors, worst, rpsSecs * 1000);
+}
+
+static void benchSetList(void)
+// The second song is preloaded in slices while the first one plays, and
+// must follow on with every event at its time in the first song plus the
+// length of the first song
+{
+  MidiScheduler sched(tempoEmit, tempoClock);
+  char path[FS_PATH_MAX];
+  uint32_t horizon, endUs = 0, first = 0, worst = 0, stepMax = 0;
+  bool bHandover = false;
+
+  mkdir(SET_ROOT, 0755);
+  for (uint8_t i = 1; i <= 2; i++)
+  {
+    snprintf(path, sizeof(path), "%s/SET%u.MID", SET_ROOT, i);
+    writeReferenceSong(path);
+  }
+  halSdRoot(SET_ROOT);
+  plCount = createPlaylistFile();
+  plIndex = 0;
+
+  tempoDue.clear();
+  tempoMsg.clear();
+  tempoEngine.reset();
+  sched.start();
+  bAdvance = true;
+  if (plCount != 2 || SMF.load("SET1.MID") != MD_MIDIFile::E_OK || !(bRamPlay = midiPreload()))
+  {
+    printf("setlist: songs did not load\n");
+    bAdvance = false;
+    halSdRoot(SONG_ROOT);
+    plCount = createPlaylistFile();
+    return;
+  }
+  SMF.close();
+  ramSong.restart();
+
+  for (horizon = 0; horizon < 2 * 30000000UL; horizon += SCHED_LOOKAHEAD_US)
+  {
+    uint32_t next;
+    Clock::time_point t0 = Clock::now();
+
+    midiNextStep();
+    stepMax = std::max(stepMax, (uint32_t)(secondsSince(t0) * 1e6));
+    if (!bHandover && ramSong.isEOF())
+    {
+      first = ramSong.getEventCount();
+      endUs = ramSong.getEndTime();
+      bHandover = midiNext();
+    }
+    ramSong.fill(sched, horizon);
+    sched.service(horizon, next);
+  }
+  bAdvance = bRamPlay = false;
+
+  for (size_t i = first; i < tempoDue.size() && i - first < first; i++)
+  {
+    uint32_t d = (uint32_t)abs((int32_t)(tempoDue[i] - tempoDue[i - first] - endUs));
+
+    worst = std::max(worst, d);
+  }
+
+  printf("setlist: %s at %u us, %u + %zu events, max time difference %u us, preload step max %u us\n",
+         bHandover ? "handover" : "NO handover", endUs, first, tempoDue.size() - first, worst, stepMax);
+
+  // behind a song streamed from the card nothing can be preloaded, the
+  // next song is opened at the handover and streamed as well
+  songCache.clear();
+  plIndex = 0;
+  bAdvance = true;
+  midiNextStep();
+  {
+    Clock::time_point t0 = Clock::now();
+    bool bNext = midiNext();
+    uint32_t us = (uint32_t)(secondsSince(t0) * 1e6);
+
+    printf("setlist: after a streamed song, handover in %u us -> %s\n", us,
+           (bNext && !bRamPlay && !SMF.isEOF()) ? "OK" : "WRONG");
+  }
+  SMF.close();
+  midiSched.flush();
+  bAdvance = false;
+
+  halSdRoot(SONG_ROOT);
+  plCount = createPlaylistFile();
+  plIndex = 0;                  // the handover moved on to the second song
+}
+
+// BLE-MIDI packing ----------------------------------------------------
+
+static std::vector<std::vector<uint8_t>> blePackets;
+static std::vector<uint32_t> bleSent;
+static uint32_t bleNow = 0;
+
+static bool bleCapture(const uint8_t* data, uint8_t size)
+{
+  blePackets.push_back(std::vector<uint8_t>(data, data + size));
+  bleSent.push_back(bleNow);
+  return(true);
+}
+
+static void benchBle(void)
+// The song's messages at their due times go through the packer, with the
+// output task waking for the messages due together and at each packet
+// deadline. The
+// packets are decoded again and must give back every message with its
+// timestamp.
+{
+  static const struct { uint16_t mtu_; uint32_t intervalUs_; } LINKS[] =
+    { { 23, 7500 }, { 23, 30000 }, { 185, 15000 }, { 247, 45000 } };
+  MidiScheduler sched(tempoEmit, tempoClock);
+
+  tempoDue.clear();
+  tempoMsg.clear();
+  tempoEngine.reset();
+  sched.start();
+  if (SMF.load("BENCH.MID") != MD_MIDIFile::E_OK || !midiPreload())
+  {
+    printf("ble: reference song did not load\n");
+    return;
+  }
+  SMF.close();
+  ramSong.restart();
+  for (uint32_t horizon = 0; horizon < 30000000UL; horizon += SCHED_LOOKAHEAD_US)
+  {
+    uint32_t next;
+
+    ramSong.fill(sched, horizon);
+    sched.service(horizon, next);
+  }
+
+  for (const auto& link : LINKS)
+  {
+    BleMidiPacker packer(bleCapture);
+    uint32_t last = 0, errors = 0, worst = 0, k = 0;
+    uint64_t total = 0;
+
+    blePackets.clear();
+    bleSent.clear();
+    packer.setLink(link.mtu_, link.intervalUs_);
+
+    for (size_t i = 0; i < tempoMsg.size(); i++)
+    {
+      uint8_t msg[3] = { (uint8_t)(tempoMsg[i] >> 16), (uint8_t)(tempoMsg[i] >> 8), (uint8_t)tempoMsg[i] };
+      uint8_t size = ((msg[0] & 0xe0) == 0xc0) ? 2 : 3;
+      uint32_t w = packer.getWait(last);
+
+      if (w != UINT32_MAX && last + w <= tempoDue[i])
+      {
+        bleNow = last + w;
+        packer.poll(bleNow);
+      }
+      bleNow = last = tempoDue[i];
+      packer.write(msg, size, bleNow);
+      if (i + 1 == tempoMsg.size() || tempoDue[i + 1] != tempoDue[i])
+        packer.poll(bleNow);
+    }
+    packer.flush(bleNow);
+
+    for (size_t p = 0; p < blePackets.size(); p++)
+    {
+      const std::vector<uint8_t>& v = blePackets[p];
+      uint16_t high = v[0] & 0x3f;
+      int16_t  low = -1;
+      uint8_t  status = 0;
+
+      for (size_t j = 1; j < v.size() && k < tempoMsg.size(); k++)
+      {
+        uint32_t msg, ts;
+
+        if (!(v[j] & 0x80))
+        {
+          errors++;
+          break;
+        }
+        if ((v[j] & 0x7f) < low)
+          high++;
+        low = v[j++] & 0x7f;
+        ts = ((high << 7) | low) & 0x1fff;
+        if (v[j] & 0x80)
+          status = v[j++];
+        msg = status << 16 | v[j++] << 8;
+        if ((status & 0xe0) != 0xc0)
+          msg |= v[j++];
+
+        errors += (msg != tempoMsg[k] || ts != ((tempoDue[k] / 1000) & 0x1fff));
+        worst = std::max(worst, bleSent[p] - tempoDue[k]);
+        total += bleSent[p] - tempoDue[k];
+      }
+    }
+    errors += (k != tempoMsg.size());
+
+    printf("ble: MTU %3u, interval %5.1f ms: %zu messages in %zu packets (%.1f per packet), %u bytes, "
+           "added latency mean %u max %u us, %u errors\n",
+           link.mtu_, link.intervalUs_ / 1000.0, tempoMsg.size(), blePackets.size(),
+           (double)tempoMsg.size() / std::max<size_t>(blePackets.size(), 1), packer.getBytes(),
+           (uint32_t)(total / std::max<size_t>(tempoMsg.size(), 1)), worst, errors);
+  }
+
+  // a message after 40 minutes of quiet, past half the range of the us
+  // clock, is as due as one after a second
+  {
+    BleMidiPacker packer(bleCapture);
+    static const uint8_t note[] = { 0x90, 60, 100 };
+    uint32_t idle[] = { 1000000UL, 2400000000UL }, waits[2];
+
+    packer.setLink(23, 7500);
+    for (uint8_t i = 0; i < 2; i++)
+    {
+      packer.write(note, sizeof(note), 0);
+      packer.flush(0);
+      packer.write(note, sizeof(note), idle[i]);
+      waits[i] = packer.getWait(idle[i]);
+      packer.flush(idle[i]);
+    }
+    printf("ble: wait after 1 s idle %u us, after 40 min %u us -> %s\n", waits[0], waits[1],
+           (waits[0] == 0 && waits[1] == 0) ? "OK" : "WRONG");
+  }
+}
+
+static std::vector<std::vector<uint8_t>> bleInMsgs;
+static std::vector<uint8_t> mergeOut;
+
+static size_t mergeCollect(const uint8_t* data, size_t size)
+{
+  mergeOut.insert(mergeOut.end(), data, data + size);
+  return(size);
+}
+
+
+static void bleInCollect(const uint8_t* data, uint16_t size, uint32_t arrivedUs)
+{
+  bleInMsgs.push_back(std::vector<uint8_t>(data, data + size));
+}
+
+static uint32_t bleInFeed(BleMidiInput& in, const std::vector<std::vector<uint8_t>>& packets)
+// Hand the packets over as notifications, decoding whenever the queue is full
+{
+  for (const auto& p : packets)
+    while (!in.receive(p.data(), p.size(), 0))
+      in.process(bleInCollect);
+  in.process(bleInCollect);
+
+  return(in.getErrors());
+}
+
+static void benchBleIn(void)
+// Every channel message on every channel, system common and real time,
+// packed by BleMidiPacker on the smallest link and decoded again, then
+// packets made by hand as other senders write them: running status
+// without timestamps, and SysEx over several packets with real time in
+// between. Last, the SysEx goes through MidiMerge to the output whole.
+{
+  static const uint8_t SYSTEM[][3] = { { 0xf1, 0x23 }, { 0xf2, 0x10, 0x20 }, { 0xf3, 0x05 },
+                                       { 0xf6 }, { 0xf8 }, { 0xfa }, { 0xfb }, { 0xfc }, { 0xfe } };
+  std::vector<std::vector<uint8_t>> sent;
+  BleMidiPacker packer(bleCapture);
+  BleMidiInput in;
+  uint32_t errors = 0;
+
+  blePackets.clear();
+  bleSent.clear();
+  packer.setLink(23, 7500);
+  for (uint8_t type = 0x80; type < 0xf0; type += 0x10)
+    for (uint8_t ch = 0; ch < 16; ch++)
+      for (uint8_t n = 0; n < 3; n++)
+      {
+        uint8_t size = ((type & 0xe0) == 0xc0) ? 2 : 3;
+        uint8_t msg[3] = { (uint8_t)(type | ch), (uint8_t)(n * 40 + ch), (uint8_t)(127 - n) };
+
+        sent.push_back(std::vector<uint8_t>(msg, msg + size));
+        packer.write(msg, size, bleNow += 300);
+        if (n == 2)
+        {
+          const uint8_t* sys = SYSTEM[ch % 9];
+          uint8_t sysSize = (sys[0] == 0xf2) ? 3 : (sys[0] == 0xf1 || sys[0] == 0xf3) ? 2 : 1;
+
+          sent.push_back(std::vector<uint8_t>(sys, sys + sysSize));
+          packer.write(sys, sysSize, bleNow += 300);
+        }
+      }
+  packer.flush(bleNow);
+
+  bleInMsgs.clear();
+  errors += bleInFeed(in, blePackets);
+  errors += (bleInMsgs != sent);
+  printf("blein: %zu messages from %zu packed packets, %zu decoded, %s\n",
+         sent.size(), blePackets.size(), bleInMsgs.size(), (bleInMsgs == sent) ? "identical" : "DIFFERENT");
+
+  // running status, the second message with and the third without a timestamp
+  std::vector<std::vector<uint8_t>> packets =
+  {
+    { 0x80, 0x81, 0x93, 0x3c, 0x40, 0x82, 0x3e, 0x41, 0x40, 0x00 },
+    // SysEx of 150 bytes is too long and dropped, the next message survives
+    { 0x80, 0x81, 0xf0 },
+  };
+  for (uint8_t i = 0; i < 147; i++)
+    packets.back().push_back(i & 0x7f);
+  packets.back().push_back(0x82);
+  packets.back().push_back(0xf7);
+  packets.push_back({ 0x80, 0x83, 0xc5, 0x07 });
+  // SysEx over three packets, with a clock in each continuation
+  packets.push_back({ 0x80, 0x81, 0xf0, 0x7e, 0x7f, 0x06 });
+  packets.push_back({ 0x80, 0x01, 0x02, 0x82, 0xf8, 0x03 });
+  packets.push_back({ 0x80, 0x04, 0x83, 0xf8, 0x05, 0x84, 0xf7, 0x85, 0xb0, 0x07, 0x64 });
+
+  std::vector<std::vector<uint8_t>> expect =
+  {
+    { 0x93, 0x3c, 0x40 }, { 0x93, 0x3e, 0x41 }, { 0x93, 0x40, 0x00 },
+    { 0xc5, 0x07 },
+    { 0xf8 }, { 0xf8 },
+    { 0xf0, 0x7e, 0x7f, 0x06, 0x01, 0x02, 0x03, 0x04, 0x05, 0xf7 },
+    { 0xb0, 0x07, 0x64 },
+  };
+
+  BleMidiInput hand;
+
+  bleInMsgs.clear();
+  uint32_t handErrors = bleInFeed(hand, packets);
+
+  errors += (bleInMsgs != expect) + (handErrors != 1);
+  printf("blein: hand made packets, %zu messages decoded, %u errors counted (1 expected), %s\n",
+         bleInMsgs.size(), handErrors, (bleInMsgs == expect) ? "as expected" : "DIFFERENT");
+
+  // the SysEx through the merge, with player messages queued around it
+  mergeOut.clear();
+  MidiOutput out(mergeCollect);
+  MidiMerge merge(out);
+  const std::vector<uint8_t>& sx = expect[6];
+  uint8_t note[3] = { 0x90, 0x3c, 0x40 };
+
+  merge.push(MidiMerge::SRC_PLAYER, note, sizeof(note));
+  merge.push(MidiMerge::SRC_LIVE, sx.data(), sx.size());
+  merge.push(MidiMerge::SRC_PLAYER, note, sizeof(note));
+  merge.drain();
+  out.flush();
+
+  std::vector<uint8_t> want = { 0x90, 0x3c, 0x40 };
+
+  want.insert(want.end(), sx.begin(), sx.end());
+  want.insert(want.end(), note, note + sizeof(note));
+  errors += (mergeOut != want);
+  printf("blein: SysEx through the merge %s -> %s\n", (mergeOut == want) ? "whole" : "BROKEN",
+         errors == 0 ? "OK" : "FAILED");
+}
+
+static void benchTransform(void)
+// XFORM.CFG in the song root is loaded and a set of messages checked
+// against what the settings should make of them, then the cost per
+// message of a mixed stream through apply()
+{
+  static const struct { uint8_t in_[3]; uint8_t size_; bool bPass_; uint8_t out_[3]; } CASES[] =
+  {
+    { { 0x90, 60, 100 }, 3, true,  { 0x90, 60, 100 } },   // channel 1 untouched
+    { { 0x91, 60, 1 },   3, true,  { 0x93, 48, 20 } },    // 2: to 4, down an octave, vmin 20
+    { { 0x91, 60, 127 }, 3, true,  { 0x93, 48, 120 } },   //    vmax 120
+    { { 0x91, 60, 0 },   3, true,  { 0x93, 48, 0 } },     //    note off stays one
+    { { 0x81, 60, 64 },  3, true,  { 0x83, 48, 64 } },
+    { { 0x91, 40, 64 },  3, false, { 0 } },               //    28 is below low=36
+    { { 0xb1, 7, 100 },  3, true,  { 0xb3, 7, 100 } },
+    { { 0xd1, 30 },      2, false, { 0 } },               //    channel pressure dropped
+    { { 0x92, 60, 64 },  3, false, { 0 } },               // 3: off
+    { { 0xe9, 0, 64 },   3, false, { 0 } },               // 10: bend dropped
+    { { 0x99, 36, 64 },  3, true,  { 0x99, 36, 46 } },    //     curve 150
+    { { 0xfe },          1, false, { 0 } },               // active sensing dropped
+    { { 0xf8 },          1, true,  { 0xf8 } },
+  };
+  char path[FS_PATH_MAX];
+  MidiTransform xf;
+  uint32_t errors = 0;
+  FILE* f;
+
+  errors += !xf.isIdentity();
+
+  snprintf(path, sizeof(path), "%s/%s", SONG_ROOT, MTX_FILE);
+  f = fopen(path, "w");
+  fprintf(f, "# bench settings\n"
+             "2 map=4 transpose=-12 low=36 vmin=20 vmax=120 drop=a\n"
+             "3 map=0\n"
+             "10 curve=150 drop=b   # drums\n"
+             "sys drop=fe\n");
+  fclose(f);
+  errors += !xf.load();
+  remove(path);
+
+  for (const auto& t : CASES)
+  {
+    uint8_t msg[3];
+
+    memcpy(msg, t.in_, sizeof(msg));
+    if (xf.apply(msg, t.size_) != t.bPass_ || (t.bPass_ && memcmp(msg, t.out_, t.size_) != 0))
+    {
+      printf("xform: %02x %02x %02x -> %02x %02x %02x\n", t.in_[0], t.in_[1], t.in_[2], msg[0], msg[1], msg[2]);
+      errors++;
+    }
+  }
+
+  const uint32_t MSGS = 10000000;
+  uint32_t passed = 0;
+  Clock::time_point t0 = Clock::now();
+
+  for (uint32_t i = 0; i < MSGS; i++)
+  {
+    uint8_t msg[3] = { (uint8_t)(0x80 | ((i >> 3) & 0x70) | (i & 0x0f)), (uint8_t)((i >> 4) & 0x7f), (uint8_t)((i >> 11) & 0x7f) };
+
+    passed += xf.apply(msg, 3);
+  }
+
+  double s = secondsSince(t0);
+  printf("xform: %zu cases, %u messages in %.3f s (%.1f ns each, %u passed), %u errors -> %s\n",
+         sizeof(CASES) / sizeof(CASES[0]), MSGS, s, s * 1e9 / MSGS, passed, errors, errors == 0 ? "OK" : "FAILED");
+}
+
+static std::vector<uint8_t> sysexWire;
+static std::vector<uint32_t> sysexWireUs;
+static uint32_t sysexNow = 0;
+
+static size_t sysexCapture(const uint8_t* data, size_t size)
+{
+  sysexWire.insert(sysexWire.end(), data, data + size);
+  sysexWireUs.insert(sysexWireUs.end(), size, sysexNow);
+  return(size);
+}
+
+static const uint8_t GM_RESET[] = { 0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7 };
+
+static std::vector<uint8_t> sysexDump(uint8_t size)
+// A Roland style dump of 'size' bytes, F0 and F7 included
+{
+  std::vector<uint8_t> dump = { 0xf0, 0x41, 0x10, 0x42, 0x12 };
+
+  while (dump.size() < size - 1u)
+    dump.push_back(dump.size() & 0x7f);
+  dump.push_back(0xf7);
+
+  return(dump);
+}
+
+static void writeSysexSong(const char* path, const std::vector<uint8_t>& dump)
+// A one note song with a GM reset and 'dump' at the top
+{
+  std::vector<uint8_t> t;
+  uint8_t mthd[14] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96 };
+
+  t.push_back(0); t.push_back(0xf0); t.push_back(sizeof(GM_RESET) - 1);
+  t.insert(t.end(), GM_RESET + 1, GM_RESET + sizeof(GM_RESET));
+  t.push_back(0); t.push_back(0xf0); t.push_back(dump.size() - 1);
+  t.insert(t.end(), dump.begin() + 1, dump.end());
+  t.push_back(0); t.push_back(0x90); t.push_back(60); t.push_back(100);
+  t.push_back(96); t.push_back(0x80); t.push_back(60); t.push_back(0);
+
+  FILE* f = fopen(path, "wb");
+  fwrite(mthd, 1, sizeof(mthd), f);
+  putTrack(f, t);
+  fclose(f);
+}
+
+static void benchSysex(void)
+// A song with a GM reset and a 48 byte dump at the top is preloaded, and
+// must come out with the SysEx ids in the RAM stream. Then the two
+// blocks and notes due with them go through the sender and merge on a
+// simulated clock, for two passes of the loop: no channel byte may land
+// inside a SysEx, but a clock byte may, the notes due after the blocks
+// must follow them and the ones due before precede them, the blocks must
+// be paced, and the dump must only go out on the first pass. A block
+// after a long idle must go straight out, and one through a stalled port
+// must not be cut short. Then two
+// songs are played as a set list, and the first one's blocks must be
+// freed after the handover. Last, the dump is mirrored over the smallest
+// BLE link and decoded again.
+{
+  const uint32_t GAP_US = 20000;
+  std::vector<uint8_t> dump = sysexDump(48);
+  char path[FS_PATH_MAX];
+  uint32_t errors = 0, refs = 0;
+
+  // the player side, SysEx from the file into the RAM stream
+  snprintf(path, sizeof(path), "%s/SYSEX.MID", SONG_ROOT);
+  writeSysexSong(path, dump);
+  sysexOut.clear();
+  if (SMF.load("SYSEX.MID") != MD_MIDIFile::E_OK || !midiPreload())
+    errors++;
+  SMF.close();
+  remove(path);
+  for (uint16_t i = 0; i < ramSong.getEventCount(); i++)
+    refs += (ramSong.getEvent(i)->status_ == 0xf0);
+  errors += (refs != 2);
+
+  // the output side
+  MidiOutput out(sysexCapture);
+  MidiMerge merge(out);
+  static SysExSender sender(out);
+  uint8_t note[3] = { 0x90, 60, 100 };
+  uint8_t early[3] = { 0x92, 60, 100 };
+  uint8_t live[3] = { 0x91, 60, 100 };
+  uint8_t clock[1] = { 0xf8 };
+  int16_t idReset, idDump;
+
+  merge.setSysExHandler([](uint16_t id) { return(sender.queue(id)); });
+
+  sysexWire.clear();
+  sysexWireUs.clear();
+  sysexNow = 0;
+  sender.setPacing(GAP_US, 32);
+  idReset = sender.store(GM_RESET, sizeof(GM_RESET));
+  idDump = sender.store(dump.data(), dump.size());
+  errors += (sender.store(GM_RESET, sizeof(GM_RESET)) != idReset);   // kept once
+
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    merge.push(MidiMerge::SRC_PLAYER, early, sizeof(early));
+    merge.pushSysEx(MidiMerge::SRC_PLAYER, idReset);
+    merge.pushSysEx(MidiMerge::SRC_PLAYER, idDump);
+    merge.push(MidiMerge::SRC_PLAYER, note, sizeof(note));
+    merge.push(MidiMerge::SRC_CONTROL, live, sizeof(live));
+    for (uint32_t t = 0; t < 200000; t += 250)
+    {
+      sysexNow = pass * 1000000 + t;
+      if (pass == 0 && t == 25000)
+        merge.push(MidiMerge::SRC_LIVE, clock, sizeof(clock));  // while the dump is written
+      if (pass == 0 && t == 30000)
+        merge.push(MidiMerge::SRC_CLOCK, clock, sizeof(clock)); // the song's, not held with its notes
+      midiDrain(merge, sender, sysexNow);
+      out.flush();
+    }
+  }
+
+  // the wire: SysEx whole, the player note after the blocks of its pass
+  uint32_t blocks = 0, notes = 0, earlies = 0, clocksIn = 0, minGap = UINT32_MAX, lastF7 = 0;
+  bool bIn = false;
+
+  for (size_t i = 0; i < sysexWire.size(); i++)
+  {
+    uint8_t b = sysexWire[i];
+
+    if (b == 0xf0)
+    {
+      if (blocks != 0)
+        minGap = std::min(minGap, sysexWireUs[i] - lastF7);
+      bIn = true;
+    }
+    else if (b == 0xf7)
+    {
+      bIn = false;
+      blocks++;
+      lastF7 = sysexWireUs[i];
+    }
+    else if (b >= 0xf8 && bIn)
+      clocksIn++;             // real time may go anywhere
+    else if (b >= 0x80 && bIn)
+      errors++;               // a status inside the SysEx
+    else if (b == 0x90)
+    {
+      // two blocks on the first pass, the reset alone on the second
+      notes++;
+      errors += (blocks != ((notes == 1) ? 2 : 3));
+    }
+    else if (b == 0x92)
+    {
+      earlies++;
+      errors += (blocks != ((earlies == 1) ? 0 : 2));
+    }
+  }
+  errors += (blocks != 3) + (notes != 2) + (earlies != 2) + (clocksIn != 2) + (minGap < GAP_US) +
+            (sender.getSkipped() != 1);
+
+  printf("sysex: %u ids in the RAM stream, %u blocks on the wire, %u repeat skipped, "
+         "%u bytes, gap min %u us\n", refs, blocks, sender.getSkipped(), sender.getBytes(), minGap);
+
+  // a block queued long after the one before, e.g. the reset of the next
+  // song after a long pause, goes out at once
+  {
+    SysExSender idle(out);
+    uint32_t t = 1000, wait;
+    int16_t id;
+    size_t wire;
+    bool bOk;
+
+    idle.setPacing(GAP_US, 32);
+    id = idle.store(GM_RESET, sizeof(GM_RESET));
+    idle.queue(id);
+    idle.poll(t);
+    out.flush();
+    t += 37 * 60000000UL;
+    wire = sysexWire.size();
+    idle.queue(id);
+    wait = idle.getWait(t);
+    idle.poll(t);
+    out.flush();
+    bOk = (wait == 0 && sysexWire.size() == wire + sizeof(GM_RESET));
+    errors += !bOk;
+    printf("sysex: block after 37 minutes idle, wait %u us -> %s\n", wait, bOk ? "OK" : "WRONG");
+  }
+
+  // a port slower than the output with clock filling the ring: the block
+  // waits for room for all of it, then goes out whole with the clock that
+  // still fits around it
+  {
+    static uint32_t portRoom;
+    MidiOutput slow([](const uint8_t* data, size_t size)
+    {
+      size = std::min(size, (size_t)portRoom);
+      portRoom -= size;
+      return(sysexCapture(data, size));
+    });
+    SysExSender slowSx(slow);
+    std::vector<uint8_t> big = sysexDump(200), sent;
+    size_t wire = sysexWire.size();
+    bool bOk;
+
+    slowSx.setPacing(GAP_US, 32);
+    portRoom = 0;
+    while (slow.write(clock, sizeof(clock)))
+      ;                     // the port has stopped taking anything
+    slowSx.queue(slowSx.store(big.data(), big.size()));
+    for (uint32_t t = 0; t < 2000000; t += 250)
+    {
+      portRoom = 1;         // about what the wire takes in 250 us
+      if (t % 1000 == 0)
+        slow.write(clock, sizeof(clock));
+      slowSx.poll(t);
+      slow.flush();
+    }
+    for (size_t i = wire; i < sysexWire.size(); i++)
+    {
+      if (sysexWire[i] != 0xf8)
+        sent.push_back(sysexWire[i]);
+    }
+    bOk = (sent == big);
+    errors += !bOk;
+    printf("sysex: %zu byte block through a stalled port, %u clock bytes dropped, block %s -> %s\n",
+           big.size(), slow.getDropped(), bOk ? "whole" : "BROKEN", bOk ? "OK" : "WRONG");
+  }
+
+  // songs in a set list: at the handover the player frees the blocks only
+  // the song before stored, once the last of them can have gone out. The
+  // blocks both songs use keep their ids and bytes, a freed id is given
+  // out again
+  {
+    std::vector<uint8_t> a = sysexDump(40), b = sysexDump(50), d = sysexDump(70);
+    const uint8_t* data;
+    uint32_t used, endUs;
+    int16_t idD;
+    bool bOk;
+
+    snprintf(path, sizeof(path), "rm -rf %s && mkdir -p %s", SYSX_ROOT, SYSX_ROOT);
+    system(path);
+    snprintf(path, sizeof(path), "%s/SXA.MID", SYSX_ROOT);
+    writeSysexSong(path, a);
+    snprintf(path, sizeof(path), "%s/SXB.MID", SYSX_ROOT);
+    writeSysexSong(path, b);
+    halSdRoot(SYSX_ROOT);
+    plCount = createPlaylistFile();
+    plIndex = 0;
+    songCache.clear();
+    sysexOut.clear();
+    halSetClock(0);
+    midiSched.start();
+    bAdvance = true;
+
+    bOk = (plCount == 2 && SMF.load("SXA.MID") == MD_MIDIFile::E_OK && (bRamPlay = midiPreload()));
+    SMF.close();
+    for (uint8_t i = 0; i < 10; i++)
+      midiNextStep();       // the next song preloaded in slices
+    endUs = ramSong.getEndTime();
+    bOk &= midiNext();
+    used = sysexOut.getUsed();
+    halSetClock(endUs + 100000);
+    midiNextStep();         // too early, the song before may still send
+    bOk &= (sysexOut.getUsed() == used);
+    halSetClock(endUs + 1000000);
+    midiNextStep();
+    bOk &= (used == sizeof(GM_RESET) + a.size() + b.size()) && (sysexOut.getUsed() == sizeof(GM_RESET) + b.size());
+    idD = sysexOut.store(d.data(), d.size());
+    bOk &= (idD >= 0 && sysexOut.getBlock(idD, data) == d.size() && !memcmp(data, d.data(), d.size()));
+
+    errors += !bOk;
+    printf("sysex: %u bytes released at the handover, %u kept -> %s\n", (unsigned)(used - sysexOut.getUsed() + d.size()),
+           (unsigned)(sizeof(GM_RESET) + b.size()), bOk ? "OK" : "WRONG");
+
+    midiSched.flush();
+    sysexOut.clear();
+    bAdvance = bRamPlay = false;
+    halRealClock();
+    halSdRoot(SONG_ROOT);
+    plCount = createPlaylistFile();
+    plIndex = 0;
+  }
+
+  // mirrored to BLE
+  BleMidiPacker packer(bleCapture);
+  BleMidiInput in;
+
+  blePackets.clear();
+  packer.setLink(23, 7500);
+  packer.write(note, sizeof(note), 1000);
+  packer.write(dump.data(), dump.size(), 1000);
+  packer.write(note, sizeof(note), 2000);
+  packer.flush(2000);
+  bleInMsgs.clear();
+  errors += bleInFeed(in, blePackets);
+
+  std::vector<std::vector<uint8_t>> expect = { { note, note + 3 }, dump, { note, note + 3 } };
+
+  errors += (bleInMsgs != expect);
+  printf("sysex: %zu byte dump in %zu BLE packets, decoded %s -> %s\n", dump.size(), blePackets.size(),
+         (bleInMsgs == expect) ? "whole" : "BROKEN", errors == 0 ? "OK" : "FAILED");
+}
+
+// Song cache ----------------------------------------------------------
+
+static SongCache::Key cacheKey(const char* name, uint32_t modified)
+// Key of a file in the song root, as the playlist would give it
+{
+  PlaylistIndex::Entry e;
+  char path[FS_PATH_MAX];
+  struct stat st;
+
+  memset(&e, 0, sizeof(e));
+  snprintf(e.path_, sizeof(e.path_), "%s", name);
+  snprintf(path, sizeof(path), "%s/%s", SONG_ROOT, name);
+  if (stat(path, &st) == 0)
+    e.size_ = st.st_size;
+  e.modified_ = modified;
+
+  return(SongCache::makeKey(e));
+}
+
+static void benchCache(void)
+// A song with SysEx is loaded and kept, then BENCH.MID is loaded over it.
+// Coming back to the first song must give the same events, bars and end
+// time without the card, with its SysEx ids pointing at the same blocks
+// after the sender was cleared and filled differently. A changed date
+// must miss, and shrinking the budget must drop the least recently used.
+{
+  std::vector<uint8_t> dump = sysexDump(100);
+  std::vector<MidiEventStream::Event> events;
+  std::vector<std::vector<uint8_t>> blocks;
+  char path[FS_PATH_MAX];
+  uint32_t errors = 0, bars, endUs, loadUs, getUs, budget = songCache.getBudget();
+
+  snprintf(path, sizeof(path), "%s/CACHE.MID", SONG_ROOT);
+  writeSysexSong(path, dump);
+  songCache.clear();
+  songCache.resetStats();
+  sysexOut.clear();
+
+  // kept on the first load
+  SongCache::Key key = cacheKey("CACHE.MID", 1);
+  Clock::time_point t0 = Clock::now();
+
+  fkey = key;
+  if (midiLoad("CACHE.MID") != MD_MIDIFile::E_OK || !midiPreload())
+    errors++;
+  SMF.close();
+  loadUs = secondsSince(t0) * 1e6;
+  bars = seekIndex.getBarCount();
+  tempoEngine.reset();
+  ramSong.restart();
+  endUs = ramSong.getEndTime();
+  for (uint16_t i = 0; i < ramSong.getEventCount(); i++)
+  {
+    const MidiEventStream::Event* pev = ramSong.getEvent(i);
+    const uint8_t* data = nullptr;
+    uint8_t size = 0;
+
+    events.push_back(*pev);
+    if (pev->status_ == 0xf0)
+      size = sysexOut.getBlock(pev->data_[0] | (pev->data_[1] << 7), data);
+    blocks.push_back(std::vector<uint8_t>(data, data + size));
+  }
+  errors += (songCache.getCount() != 1);
+
+  // another song over it, and the sender as a new song leaves it
+  SongCache::Key other = cacheKey("BENCH.MID", 1);
+
+  fkey = other;
+  if (midiLoad("BENCH.MID") != MD_MIDIFile::E_OK || !midiPreload())
+    errors++;
+  SMF.close();
+  sysexOut.clear();
+  sysexOut.store(GM_RESET, sizeof(GM_RESET));
+  errors += (songCache.getCount() != 2);
+
+  // back from the cache
+  remove(path);
+  t0 = Clock::now();
+  if (!songCache.get(key, ramSong, seekIndex))
+    errors++;
+  getUs = secondsSince(t0) * 1e6;
+  tempoEngine.reset();
+  ramSong.restart();
+  errors += (ramSong.getEventCount() != events.size()) + (seekIndex.getBarCount() != bars) +
+            (ramSong.getEndTime() != endUs);
+  for (uint16_t i = 0; i < ramSong.getEventCount() && i < events.size(); i++)
+  {
+    const MidiEventStream::Event* pev = ramSong.getEvent(i);
+
+    if (pev->status_ == 0xf0)
+    {
+      const uint8_t* data = nullptr;
+      uint8_t size = sysexOut.getBlock(pev->data_[0] | (pev->data_[1] << 7), data);
+
+      errors += (events[i].status_ != 0xf0 || std::vector<uint8_t>(data, data + size) != blocks[i]);
+    }
+    else
+      errors += (memcmp(pev, &events[i], sizeof(*pev)) != 0);
+  }
+
+  // a changed file is loaded again
+  errors += songCache.get(cacheKey("CACHE.MID", 2), ramSong, seekIndex);
+
+  // room for one song only, BENCH.MID was used least recently
+  songCache.setBudget(songCache.getUsed() - 1);
+  errors += (songCache.getCount() != 1) + (songCache.getEvictions() != 1) +
+            songCache.get(other, ramSong, seekIndex) + !songCache.get(key, ramSong, seekIndex);
+
+  printf("cache: %u events, %u bars, load %u us, from cache %u us, hits %u misses %u evictions %u -> %s\n",
+         (unsigned)events.size(), bars, loadUs, getUs, songCache.getHits(), songCache.getMisses(),
+         songCache.getEvictions(), errors == 0 ? "OK" : "FAILED");
+
+  songCache.setBudget(budget);
+  songCache.clear();
+  songCache.resetStats();
+  sysexOut.clear();
+  memset(&fkey, 0, sizeof(fkey));
+}
+
+static const uint32_t MERGE_MSGS = 200000;
+static uint32_t mergeSeq[MidiMerge::SRC_COUNT];
+static uint32_t mergeErrors = 0;
+static uint8_t  mergeStatus = 0;
+static uint8_t  mergeMsg[3];
+static uint8_t  mergeLen = 0;
+
+static size_t mergeCheck(const uint8_t* data, size_t size)
+// Parse the merged stream, running status included, and check every
+// message arrives whole and in order for its source
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    if (data[i] & 0x80)
+    {
+      if (mergeLen != 0)
+        mergeErrors++;        // status in the middle of a message
+      mergeStatus = data[i];
+      mergeLen = 0;
+      continue;
+    }
+
+    mergeMsg[mergeLen++] = data[i];
+    if (mergeLen == 2)
+    {
+      uint8_t src = mergeStatus & 0x0f;
+      uint32_t seq = mergeMsg[0] | (mergeMsg[1] << 7);
+
+      if (src >= MidiMerge::SRC_COUNT || seq != (mergeSeq[src] & 0x3fff))
+        mergeErrors++;
+      else
+        mergeSeq[src]++;
+      mergeLen = 0;
+    }
+  }
+
+  return(size);
+}
+
+static void benchMerge(void)
+{
+  MidiOutput out(mergeCheck);
+  MidiMerge merge(out);
+  std::atomic<int> running(2);
+  Clock::time_point t0 = Clock::now();
+
+  memset(mergeSeq, 0, sizeof(mergeSeq));
+  mergeErrors = 0;
+
+  auto producer = [&](MidiMerge::Source src)
+  {
+    for (uint32_t i = 0; i < MERGE_MSGS; i++)
+    {
+      uint8_t msg[3] = { (uint8_t)(0x90 | src), (uint8_t)(i & 0x7f), (uint8_t)((i >> 7) & 0x7f) };
+
+      while (!merge.push(src, msg, sizeof(msg)))
+        std::this_thread::yield();
+    }
+    running--;
+  };
+
+  std::thread p1(producer, MidiMerge::SRC_PLAYER);
+  std::thread p2(producer, MidiMerge::SRC_LIVE);
+  while (running > 0 || merge.drain() > 0)
+  {
+    merge.drain();
+    out.flush();
+  }
+  p1.join();
+  p2.join();
+  merge.drain();
+  out.flush();
+
+  double s = secondsSince(t0);
+  printf("merge: %u + %u messages in %.3f s, received %u + %u, %u errors -> %s\n",
+         MERGE_MSGS, MERGE_MSGS, s, mergeSeq[MidiMerge::SRC_PLAYER], mergeSeq[MidiMerge::SRC_LIVE],
+         mergeErrors, (mergeErrors == 0 && mergeSeq[0] == MERGE_MSGS && mergeSeq[1] == MERGE_MSGS) ? "intact" : "CORRUPT");
+}
+
+static void benchInfo(void)
+// Songs are browsed from the top of a list: the information around the
+// cursor must fill in by itself, slice by slice, nearest first, and be
+// right for the reference song, a titled song and a broken file. Then
+// the index is opened again and everything known must still be there
+// without reading a song, and moving within the window must not read the
+// index.
+{
+  const uint16_t SONGS = 40;
+  const uint32_t SLICE_US = 2000;
+  char path[FS_PATH_MAX];
+  uint32_t errors = 0, steps = 0, stepMax = 0, scanned, reads, before;
+  PlaylistIndex::Entry e;
+  PlaylistIndex::Meta m;
+
+  snprintf(path, sizeof(path), "rm -rf %s && mkdir -p %s", INFO_ROOT, INFO_ROOT);
+  if (system(path) != 0)
+    return;
+
+  for (uint16_t i = 0; i < SONGS - 2; i++)
+  {
+    snprintf(path, sizeof(path), "%s/S%03u.MID", INFO_ROOT, i);
+    writeReferenceSong(path);
+  }
+  {
+    // 3/4 at 90 BPM, 2 bars, text then a track name with a leading space
+    std::vector<uint8_t> t;
+    uint8_t mthd[14] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96 };
+    uint8_t text[] = { 0xff, 0x01, 0x04, 'n', 'o', 't', 'e' };
+    uint8_t name[] = { 0xff, 0x03, 0x0c, ' ', 'B', 'e', 'n', 'c', 'h', ' ', 'T', 'i', 't', 'l', 'e' };
+    uint8_t ts[] = { 0xff, 0x58, 0x04, 3, 2, 24, 8 };
+    uint8_t tempo[] = { 0xff, 0x51, 0x03, 0x0a, 0x2c, 0x2b };
+
+    t.push_back(0); t.insert(t.end(), text, text + sizeof(text));
+    t.push_back(0); t.insert(t.end(), name, name + sizeof(name));
+    t.push_back(0); t.insert(t.end(), ts, ts + sizeof(ts));
+    t.push_back(0); t.insert(t.end(), tempo, tempo + sizeof(tempo));
+    t.push_back(0); t.push_back(0x90); t.push_back(60); t.push_back(100);
+    putVLQ(t, 96 * 6); t.push_back(60); t.push_back(0);
+
+    snprintf(path, sizeof(path), "%s/TITLE.MID", INFO_ROOT);
+    FILE* f = fopen(path, "wb");
+    fwrite(mthd, 1, sizeof(mthd), f);
+    putTrack(f, t);
+    fclose(f);
+
+    snprintf(path, sizeof(path), "%s/BROKEN.MID", INFO_ROOT);
+    f = fopen(path, "wb");
+    fprintf(f, "MThd");
+    fclose(f);
+  }
+
+  halSdRoot(INFO_ROOT);
+  plCount = createPlaylistFile();
+  errors += (plCount != SONGS);
+
+  // at the top, wait for the window to fill: the cursor and 8 after it,
+  // counted from what the benchmarks before have browsed
+  before = songInfo.getScanned();
+  for (uint32_t n = 0; n < 1000; n++)
+  {
+    Clock::time_point t0 = Clock::now();
+
+    songInfo.step(0, SLICE_US);
+    stepMax = std::max(stepMax, (uint32_t)(secondsSince(t0) * 1e6));
+    steps++;
+  }
+  scanned = songInfo.getScanned() - before;
+  errors += (scanned != SINFO_AHEAD + 1);
+  for (uint16_t i = 0; i < plCount; i++)
+  {
+    songInfo.get(i, e, m);
+    errors += ((m.state_ != PLI_META_NONE) != (i <= SINFO_AHEAD));
+  }
+
+  // sorted by path: BROKEN, S000..S037, TITLE
+  songInfo.get(0, e, m);
+  errors += (m.state_ != PLI_META_BAD);
+  songInfo.get(1, e, m);
+  errors += (m.state_ != PLI_META_OK || m.usPerQuarter_ != 500000 || m.timeSigNum_ != 4 ||
+             m.timeSigDen_ != 4 || m.tracks_ != 3 || m.durationMs_ != 29714 || m.title_[0] != '\0');
+  printf("info: %u songs, %u looked at in %u steps, slice max %u us, S000 %u us/q %u/%u %u ms %u tracks\n",
+         plCount, scanned, steps, stepMax, m.usPerQuarter_, m.timeSigNum_, m.timeSigDen_, m.durationMs_, m.tracks_);
+
+  // at the bottom, the titled song is looked at first
+  for (uint32_t n = 0; n < 1000 && !songInfo.step(plCount - 1, SLICE_US); n++)
+    ;
+  songInfo.get(plCount - 1, e, m);
+  errors += (m.state_ != PLI_META_OK || m.usPerQuarter_ != 666667 || m.timeSigNum_ != 3 ||
+             m.timeSigDen_ != 4 || m.durationMs_ != 4000 || strcmp(m.title_, "Bench Title") != 0);
+  printf("info: %s, %u us/q %u/%u %u ms\n", m.title_, m.usPerQuarter_, m.timeSigNum_, m.timeSigDen_, m.durationMs_);
+
+  // opened again, nothing is read twice
+  plCount = createPlaylistFile();
+  scanned = songInfo.getScanned();
+  reads = songInfo.getReads();
+  for (uint16_t i = 0; i <= SINFO_AHEAD; i++)
+  {
+    songInfo.get(i, e, m);
+    errors += (m.state_ == PLI_META_NONE);
+  }
+  for (uint32_t n = 0; n < 100; n++)
+    songInfo.step(0, SLICE_US);
+  errors += (songInfo.getScanned() != scanned);
+
+  // scrolling within the window
+  Clock::time_point t0 = Clock::now();
+
+  reads = songInfo.getReads();
+  for (uint32_t n = 0; n < 1000; n++)
+    songInfo.get(n % (SINFO_AHEAD + 1), e, m);
+  double scroll = secondsSince(t0);
+
+  errors += (songInfo.getReads() != reads);
+  printf("info: kept over reopening, %.2f us per move in the window -> %s\n",
+         scroll * 1e6 / 1000, errors == 0 ? "OK" : "FAILED");
+
+  halSdRoot(SONG_ROOT);
+  plCount = createPlaylistFile();
+}
+
+static std::vector<uint32_t> clockTimes;
+static std::vector<uint32_t> clockWire;    // when each pulse was written to the port
+static MidiClock* clockFollow = nullptr;
+
+static void clockCapture(uint32_t time)
+{
+  clockTimes.push_back(time);
+}
+
+static std::string clockOrder;             // the clock and transport on the port, in order
+
+static void clockTap(const uint8_t* buf, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    if (buf[i] == 0xf8)
+      clockWire.push_back(micros());
+    if (buf[i] == 0xf2 || buf[i] >= 0xf8)
+      clockOrder += (buf[i] == 0xf2) ? 'P' : "C?SNT"[buf[i] - 0xf8];
+  }
+}
+
+static void clockLocal(uint32_t time)
+{
+  clockFollow->local(time);
+  clockTimes.push_back(time);
+}
+
+static void clockSlave(const char* link, uint32_t jitterUs, uint32_t intervalUs)
+// A minute of a 128 BPM master clock followed by a 120 BPM song, in
+// simulated time. Each pulse arrives up to 'jitterUs' late, or with the
+// next connection event every 'intervalUs' if that is set. The song is
+// worked out a look ahead in front, as the player does. The offset is
+// where the song's pulses fall against the master's over the second half.
+{
+  const uint32_t MASTER_BPM = 128;
+  const uint64_t PERIOD_NS = 60000000000ULL / (MASTER_BPM * TEMPO_PPQ);
+  const uint32_t RUN_US = 60000000;
+  MidiClock mc;
+  TempoEngine te;
+  uint64_t k = 0;
+
+  clockFollow = &mc;
+  clockTimes.clear();
+  te.setQuarter(500000, 480);
+  te.setPulseHandler(clockLocal);
+  mc.start(0);
+
+  for (uint32_t now = 0; now < RUN_US; now += 100)
+  {
+    while ((int32_t)(te.getTime() - (now + SCHED_LOOKAHEAD_US)) < 0)
+      te.advance(10);
+
+    for (;;)
+    {
+      uint32_t ideal = (uint32_t)(k * PERIOD_NS / 1000);
+      uint32_t arrived = ideal + (jitterUs ? rand() % jitterUs : 0);
+      MidiClock::Message m;
+
+      if (intervalUs != 0)
+        arrived = (ideal / intervalUs + 1) * intervalUs;
+      if (arrived > now)
+        break;
+      mc.receive(0xf8, arrived);
+      while (mc.read(m))
+        mc.pulse(m.arrivedUs_);
+      if (mc.hasTempo())
+        te.rampTo((int32_t)mc.getTempo() - 120 * TEMPO_FRAC, 20000);
+      k++;
+    }
+  }
+
+  std::vector<int32_t> offset;
+
+  for (uint64_t i = k / 2; i < k; i++)
+  {
+    uint32_t ideal = (uint32_t)(i * PERIOD_NS / 1000);
+    auto it = std::lower_bound(clockTimes.begin(), clockTimes.end(), ideal);
+    int32_t d = (it == clockTimes.end()) ? INT32_MAX : (int32_t)(*it - ideal);
+
+    if (it != clockTimes.begin() && abs((int32_t)(*(it - 1) - ideal)) < abs(d))
+      d = (int32_t)(*(it - 1) - ideal);
+    offset.push_back(d);
+  }
+  std::sort(offset.begin(), offset.end());
+
+  int64_t sum = 0;
+
+  for (int32_t d : offset)
+    sum += d;
+  printf("clock: follow %-7s %s after %u ms, tempo %u.%02u BPM (master %u), song pulses %lld us "
+         "from the master's, spread %d..%d us\n",
+         link, mc.isLocked() ? "locked" : "NOT LOCKED", mc.getLockUs() / 1000, mc.getTempo() / TEMPO_FRAC,
+         mc.getTempo() % TEMPO_FRAC, MASTER_BPM, (long long)(sum / (int64_t)offset.size()),
+         offset.front(), offset.back());
+}
+
+static void benchClock(void)
+// Pulses of the reference song against the exact times, 24 per quarter
+// at 120 and then 140 BPM. Then the song played through the player, and
+// the pulses timed from due to the port. Then an external clock followed
+// over a serial and a BLE link.
+{
+  uint32_t worst = 0;
+
+  clockTimes.clear();
+  tempoEngine.reset();
+  tempoEngine.setPulseHandler(clockCapture);
+  if (SMF.load("BENCH.MID") != MD_MIDIFile::E_OK || !midiPreload())
+  {
+    tempoEngine.setPulseHandler(clockPulse);
+    printf("clock: reference song did not load\n");
+    return;
+  }
+  SMF.close();
+  ramSong.looping(false);
+  ramSong.restart();
+  ramSong.getEndTime();
+
+  for (size_t i = 0; i < clockTimes.size(); i++)
+  {
+    // 768 pulses at 120 BPM, the rest at 140 BPM, up to the last bar line
+    // just before the end of the song
+    double exact = (i < 768) ? i * 500000.0 / 24 : 16000000.0 + (i - 768) * 428571.0 / 24;
+    uint32_t d = (uint32_t)fabs(clockTimes[i] - exact);
+
+    if (d > worst)
+      worst = d;
+  }
+  printf("clock: %zu pulses in the song (1537 expected), worst %u us from the exact time -> %s\n",
+         clockTimes.size(), worst, (clockTimes.size() == 1537 && worst <= 1) ? "OK" : "WRONG");
+
+  // end to end: the song played on the simulated clock, with the clock
+  // scheduler serviced when due as its esp_timer does and the output task
+  // only coming round every OUTPUT_PASS_US. Each pulse is timed as it is
+  // written to the port, against its exact time.
+  const uint32_t STEP_US = 10;            // resolution of the simulated timer
+  const uint32_t OUTPUT_PASS_US = 2000;
+  const uint32_t PLAY_US = 10000000;
+  std::vector<int32_t> late;
+  int32_t jitter = 0;
+
+  // Then a seek part way through: Stop, Song Position Pointer in order with
+  // the song's messages, and Continue and the pulses only after it.
+  const uint32_t SEEK_US = PLAY_US + 500000;
+  std::string seek;
+
+  midiMerge.drain();                       // nothing left over from the benches before
+  midiOutput.flush();
+  clockWire.clear();
+  clockOrder.clear();
+  Serial.setTap(clockTap);
+  halSetClock(0);
+  tempoEngine.setPulseHandler(clockPulse);
+  bRamPlay = true;
+  midiRestart(true);
+  for (uint32_t t = 0; t < SEEK_US + 100000; t += STEP_US)
+  {
+    uint32_t next;
+
+    halSetClock(t);
+    if (t == SEEK_US)
+      midiSeek(4);
+    if (t % 1000 == 0)
+      midiFill();
+    clockSched.service(clockSched.now(), next);
+    midiSched.service(midiSched.now(), next);
+    if (t % OUTPUT_PASS_US == 0)
+    {
+      midiMerge.drain();
+      midiOutput.flush();
+    }
+  }
+  Serial.setTap(nullptr);
+  midiSched.flush();
+  bRamPlay = false;
+  halRealClock();
+  seek = clockOrder.substr(clockOrder.find('T'), 5);
+
+  clockWire.resize(std::min(clockWire.size(), (size_t)480));   // the first PLAY_US
+  for (size_t i = 0; i < clockWire.size() && i < clockTimes.size(); i++)
+  {
+    late.push_back((int32_t)(clockWire[i] - clockTimes[i]));
+    if (i > 0)
+      jitter = std::max(jitter, abs((int32_t)(clockWire[i] - clockWire[i - 1]) - (int32_t)(clockTimes[i] - clockTimes[i - 1])));
+  }
+  std::sort(late.begin(), late.end());
+  size_t n = late.size();
+  printf("clock: %zu pulses on the port in %u s, output task every %u us, due to port us p50 %d p99 %d max %d, "
+         "interval jitter %d us -> %s\n", n, PLAY_US / 1000000, OUTPUT_PASS_US, n ? late[n / 2] : 0,
+         n ? late[n * 99 / 100] : 0, n ? late[n - 1] : 0, jitter,
+         (n == 480 && late[0] >= 0 && late[n - 1] < 100 && jitter < 100) ? "OK" : "WRONG");
+  printf("clock: seek sends %s -> %s\n", seek.c_str(), (seek == "TPNCC") ? "OK" : "WRONG");
+
+  // following
+  clockSlave("serial", 300, 0);
+  clockSlave("BLE", 0, 7500);
+}
+
+// Remote control ------------------------------------------------------
+
+static const uint8_t REMOTE_ID = 0x7d;     // SERIAL2_QUERY_ID
+static const uint8_t REMOTE_BYTES[RemoteControl::RF_COUNT] = { 1, 2, 2, 3, 2, 2 };
+static FILE* remoteWire = nullptr;
+static long remoteRead = 0;                 // wire bytes taken so far
+static uint32_t remoteField[RemoteControl::RF_COUNT];
+static uint32_t remotePushes = 0;
+static uint32_t remotePushBytes = 0;
+static int remoteClockSource = -1;          // from the last Q_CLOCK answer
+
+static void remoteCommand(uint8_t command, uint32_t value = 0, uint8_t args = 0)
+// One command frame into Serial2, 'args' 7 bit bytes of 'value'
+{
+  uint8_t f[8];
+  uint8_t n = 0;
+
+  f[n++] = 0xf0;
+  f[n++] = REMOTE_ID;
+  f[n++] = command;
+  for (int8_t b = args - 1; b >= 0; b--)
+    f[n++] = (value >> (7 * b)) & 0x7f;
+  f[n++] = 0xf7;
+  Serial2.inject(f, n);
+}
+
+static void remoteTake(void)
+// Decode the status pushes written to Serial2 since the last call
+{
+  std::vector<uint8_t> w;
+  int c;
+
+  fflush(remoteWire);
+  fseek(remoteWire, remoteRead, SEEK_SET);
+  while ((c = fgetc(remoteWire)) != EOF)
+    w.push_back(c);
+  remoteRead += w.size();
+
+  for (size_t i = 0; i + 4 < w.size(); i++)
+  {
+    if (w[i] == 0xf0 && w[i + 1] == REMOTE_ID && w[i + 2] == 0x06)
+      remoteClockSource = w[i + 3];   // Q_CLOCK, the source followed
+    if (w[i] != 0xf0 || w[i + 1] != REMOTE_ID || w[i + 2] != RemoteControl::RC_STATE_PUSH)
+      continue;
+
+    size_t j = i + 4;
+
+    for (uint8_t f = 0; f < RemoteControl::RF_COUNT; f++)
+    {
+      if ((w[i + 3] & (1 << f)) == 0)
+        continue;
+      remoteField[f] = 0;
+      for (uint8_t b = 0; b < REMOTE_BYTES[f]; b++)
+        remoteField[f] = (remoteField[f] << 7) | w[j++];
+    }
+    remotePushes++;
+    remotePushBytes += j + 1 - i;
+    i = j;
+  }
+}
+
+static void remotePass(uint32_t ms = 1)
+// 'ms' uiLoop() passes on the simulated clock
+{
+  for (uint32_t i = 0; i < ms; i++)
+  {
+    halAdvanceClock(1000);
+    uiLoop();
+    serviceOutput();
+    remoteTake();
+  }
+}
+
+static void benchRemote(void)
+// The reference song selected, played, bent, moved and stopped with
+// remote commands. Each command must be acted on in the pass that reads
+// it, and its effect pushed back within RC_PUSH_US. While the song plays
+// the pushes are counted against polling the status every RC_PUSH_US.
+// Then the clock source is set, and read back from SETTINGS.CFG.
+{
+  const uint32_t PLAY_MS = 4000;
+  bool bOk = true;
+  uint32_t cmds;
+
+  halSetClock(0);
+  remoteWire = tmpfile();
+  remoteRead = 0;
+  remotePushes = remotePushBytes = 0;
+  Serial2.setEcho(remoteWire);
+  remoteCommand(RemoteControl::RC_STOP);      // whatever the benchmarks before left playing
+  remotePass(5);
+  remote.resetStats();
+
+  remoteCommand(RemoteControl::RC_WATCH, 1, 1);
+  remotePass();
+  bOk &= (remotePushes == 1 && remoteField[RemoteControl::RF_STATE] == RemoteControl::RS_STOPPED);
+
+  // selected and started in the same pass
+  remoteCommand(RemoteControl::RC_SELECT, 0, 2);
+  remoteCommand(RemoteControl::RC_PLAY);
+  remotePass();
+  cmds = remote.getCommands();
+  remotePass(RC_PUSH_US / 1000);
+  bOk &= (cmds == 2 && remoteField[RemoteControl::RF_STATE] == RemoteControl::RS_PLAYING);
+
+  uint32_t pushes = remotePushes;
+  uint32_t bytes = remotePushBytes;
+
+  remotePass(PLAY_MS);
+  pushes = remotePushes - pushes;
+  bytes = remotePushBytes - bytes;
+  printf("remote: %u ms playing, bar %u, %u pushes of %u bytes, polling every %u ms would take %u frames\n",
+         PLAY_MS, remoteField[RemoteControl::RF_BAR], pushes, bytes, RC_PUSH_US / 1000, PLAY_MS * 1000 / RC_PUSH_US);
+  bOk &= (remoteField[RemoteControl::RF_TIMESIG] == ((4 << 7) | 4));
+
+  // tempo ramp, bar jump
+  remoteCommand(RemoteControl::RC_TEMPO, 100 * TEMPO_FRAC, 3);
+  remotePass(500);
+  bOk &= (remoteField[RemoteControl::RF_TEMPO] == 100 * TEMPO_FRAC);
+  remoteCommand(RemoteControl::RC_SEEK, 8, 2);
+  remotePass();
+  bOk &= (midiBar() == 8);
+  remotePass(RC_PUSH_US / 1000);
+  bOk &= (remoteField[RemoteControl::RF_BAR] == 8);
+
+  // nothing changes while paused, so nothing is pushed
+  remoteCommand(RemoteControl::RC_PAUSE);
+  remotePass();
+  bOk &= midiSched.isPaused();
+  remotePass(RC_PUSH_US / 1000);
+  pushes = remotePushes;
+  remotePass(1000);
+  bOk &= (remotePushes == pushes && remoteField[RemoteControl::RF_STATE] == RemoteControl::RS_PAUSED);
+  remoteCommand(RemoteControl::RC_PLAY);
+  remotePass();
+  bOk &= !midiSched.isPaused();
+
+  // the song started again over the one playing, in one pass
+  remoteCommand(RemoteControl::RC_SELECT, 0, 2);
+  remoteCommand(RemoteControl::RC_PLAY);
+  remotePass();
+  bOk &= (remote.getCommands() == 8);
+  remotePass(RC_PUSH_US / 1000);
+  bOk &= (remoteField[RemoteControl::RF_STATE] == RemoteControl::RS_PLAYING && remoteField[RemoteControl::RF_BAR] == 0);
+
+  // a frame with the wrong arguments is dropped, then stop
+  remoteCommand(RemoteControl::RC_SEEK, 1, 1);
+  remoteCommand(RemoteControl::RC_STOP);
+  remotePass(RC_PUSH_US / 1000 + 1);
+  bOk &= (remoteField[RemoteControl::RF_STATE] == RemoteControl::RS_STOPPED && remote.getRejected() == 1);
+
+  // the clock source, taken at once with no song loaded and kept on the
+  // card, a source that does not exist left alone
+  char path[FS_PATH_MAX];
+  char cfg[32] = "";
+  FILE* f;
+
+  snprintf(path, sizeof(path), "%s/SETTINGS.CFG", SONG_ROOT);
+  remoteCommand(RemoteControl::RC_CLOCK, 1, 1);
+  remoteCommand(RemoteControl::RC_CLOCK, 3, 1);
+  remotePass();
+  remoteCommand(0x06);      // Q_CLOCK, answered as it is read
+  remotePass();
+  bOk &= (remoteClockSource == 1);
+  if ((f = fopen(path, "r")) != nullptr)
+  {
+    cfg[fread(cfg, 1, sizeof(cfg) - 1, f)] = '\0';
+    fclose(f);
+  }
+  bOk &= (strcmp(cfg, "clock=ble\n") == 0);
+  if ((f = fopen(path, "w")) != nullptr)
+  {
+    fputs("clock=serial2\r\n", f);
+    fclose(f);
+  }
+  settingsLoad();
+  remoteCommand(0x06);
+  remotePass();
+  bOk &= (remoteClockSource == 2);
+  remoteCommand(RemoteControl::RC_CLOCK, 0, 1);
+  remotePass();
+  remoteCommand(0x06);
+  remotePass();
+  bOk &= (remoteClockSource == 0);
+  remove(path);
+  bOk &= (remote.getLatency().max_ == 0);
+
+  const LatencyStats::Histogram& h = remote.getLatency();
+
+  printf("remote: %u commands, %u rejected, command to action max %u us, %u pushes in all -> %s\n",
+         remote.getCommands(), remote.getRejected(), h.max_, remote.getPushes(), bOk ? "OK" : "WRONG");
+
+  remoteCommand(RemoteControl::RC_WATCH, 0, 1);
+  remotePass();
+  Serial2.setEcho(nullptr);
+  fclose(remoteWire);
+  halRealClock();
+}
+
+// Debug log -----------------------------------------------------------
+
+static std::vector<uint8_t> logWire;
+
+static size_t logCapture(const uint8_t* data, size_t size)
+{
+  logWire.insert(logWire.end(), data, data + size);
+  return(size);
+}
+
+static uint32_t logValue(const uint8_t*& p, uint8_t bytes)
+{
+  uint32_t v = 0;
+
+  while (bytes-- > 0)
+    v = (v << 7) | *p++;
+
+  return(v);
+}
+
+static void logEntries(std::vector<uint32_t>& values, uint32_t& lost)
+// The values of the entries in the frames captured, in order
+{
+  const uint8_t* p = logWire.data();
+  const uint8_t* end = p + logWire.size();
+
+  while (p < end)
+  {
+    if (*p++ != 0xf0)
+      continue;
+    p += 2;     // id, DLOG_FRAME
+    while (*p != 0xf7)
+    {
+      uint8_t record = *p++;
+
+      if (record == DebugLog::DLR_LOST)
+        lost += logValue(p, 5);
+      else if (record == DebugLog::DLR_TIME)
+        p += 5;
+      else if (record == DebugLog::DLR_DEFINE)
+      {
+        p++;
+        while (*p++ != 0)
+          ;
+      }
+      else
+      {
+        p += record - DebugLog::DLR_ENTRY + 1;
+        uint8_t type = *p & 0x07;
+        uint8_t bytes = *p++ >> 3;
+
+        if (type == DebugLog::DLT_TEXT)
+          while (*p++ != 0)
+            ;
+        else if (type != DebugLog::DLT_NONE)
+          values.push_back(logValue(p, bytes));
+      }
+    }
+  }
+}
+
+static void benchLog(void)
+// The cost of a call against formatting the same text, then three tasks
+// logging as fast as they can while a fourth drains: every record must
+// come out once, in order for each task, or be counted lost. A short log
+// of every kind of value is left in LOG_CAPTURE for tools/logdec.
+{
+  const uint32_t CALLS = 1000000;
+  const uint32_t BATCH = DLOG_SLOTS / 2;
+  const uint32_t TASKS = 3, PER_TASK = 20000;
+  DebugLog* log = new DebugLog(logCapture, 0x7d);
+  double logS = 0, textS = 0;
+  uint32_t textBytes = 0;
+  char sBuf[64];
+
+  // cost per call, drained between batches
+  for (uint32_t i = 0; i < CALLS; i += BATCH)
+  {
+    Clock::time_point t0 = Clock::now();
+
+    for (uint32_t j = 0; j < BATCH; j++)
+      log->put("\nSeek bar ", i + j);
+    logS += secondsSince(t0);
+
+    t0 = Clock::now();
+    for (uint32_t j = 0; j < BATCH; j++)
+      textBytes += snprintf(sBuf, sizeof(sBuf), "%s%u", "\nSeek bar ", i + j);
+    textS += secondsSince(t0);
+
+    while (log->drain())
+      ;
+  }
+  printf("log: %u calls, %.1f ns each, formatted %.1f ns; %zu bytes on Serial2 against %u of text\n",
+         CALLS, logS * 1e9 / CALLS, textS * 1e9 / CALLS, logWire.size(), textBytes);
+  delete log;
+
+  // concurrent
+  std::vector<std::thread> tasks;
+  std::atomic<uint32_t> running(TASKS);
+
+  log = new DebugLog(logCapture, 0x7d);
+  logWire.clear();
+  for (uint32_t k = 0; k < TASKS; k++)
+  {
+    tasks.emplace_back([&, k]()
+    {
+      for (uint32_t i = 0; i < PER_TASK; i++)
+      {
+        log->put(" v ", (k << 24) | i);
+        if (i % 8 == 7)
+          std::this_thread::sleep_for(std::chrono::microseconds(20));
+      }
+      running--;
+    });
+  }
+  while (running > 0)
+    if (!log->drain())
+      std::this_thread::yield();
+  for (auto& t : tasks)
+    t.join();
+  while (log->drain())
+    ;
+
+  std::vector<uint32_t> values;
+  std::vector<int64_t> last(TASKS, -1);
+  uint32_t lost = 0, errors = 0;
+
+  logEntries(values, lost);
+  for (uint32_t v : values)
+  {
+    uint32_t k = v >> 24;
+
+    if (k >= TASKS || (int64_t)(v & 0xffffff) <= last[k])
+      errors++;
+    else
+      last[k] = v & 0xffffff;
+  }
+  errors += (values.size() + lost != TASKS * PER_TASK || lost != log->getLost());
+  printf("log: %u tasks, %zu records out, %u lost, %u frames, %u errors -> %s\n",
+         TASKS, values.size(), lost, log->getFrames(), errors, errors == 0 ? "OK" : "WRONG");
+  delete log;
+
+  // a bit of everything for the decoder
+  log = new DebugLog(logCapture, 0x7d);
+  logWire.clear();
+  log->put("\n[Rhythm Performer]");
+  log->put("\nSeek bar ", (uint16_t)12);
+  log->put("\nNext song ", "/Set 01/Song number 0104 long name.mid");
+  log->put(" gap us ", (int32_t)-250);
+  log->put("\nAddress=", (uint8_t)0x5a, true);
+  log->put(" Command=", (uint8_t)0x07, true);
+  for (uint32_t i = 0; i < DLOG_SLOTS + 2; i++)
+    log->put("\nFlood ", i);
+  log->drain();
+  while (log->drain())
+    ;
+
+  FILE* f = fopen(LOG_CAPTURE, "wb");
+
+  if (f != nullptr)
+  {
+    fwrite(logWire.data(), 1, logWire.size(), f);
+    fclose(f);
+  }
+  printf("log: %u records, %u lost, %zu bytes written to %s\n",
+         log->getRecords(), log->getLost(), logWire.size(), LOG_CAPTURE);
+  delete log;
+}
+
+static void listAdd(const char* name)
+// Add a file, or a folder for a name ending in '/', to the playlist root
+{
+  char path[FS_PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/%s", LIST_ROOT, name);
+  if (name[strlen(name) - 1] == '/')
+    mkdir(path, 0755);
+  else
+  {
+    FILE* f = fopen(path, "wb");
+
+    fprintf(f, "MThd");
+    fclose(f);
+  }
+}
+
+static bool listSorted(void)
+// Every entry of the index after the one before it, on the whole path
+{
+  PlaylistIndex::Entry a, b;
+
+  for (uint16_t i = 1; i < playlist.getCount(); i++)
+  {
+    if (!playlist.get(i - 1, a) || !playlist.get(i, b) || strcasecmp(a.path_, b.path_) >= 0)
+      return(false);
+  }
+
+  return(true);
+}
+
+static void benchPlaylistChanges(uint16_t count, uint32_t unchanged)
+// Changes to a card indexed by benchPlaylist(): songs added in a folder
+// and in a new folder under it must be found, other files must not cause
+// a rebuild, and names alike past the sort key must still sort. A full
+// card must give no index rather than a broken one. 'unchanged' is what
+// a check of the card as indexed opened.
+{
+  const char* LONG = "A folder with a name longer than the sort key/";
+  char path[FS_PATH_MAX];
+  struct stat st;
+  uint32_t walked, opens, errors = 0;
+  int16_t n;
+
+  listAdd("Set 01/Added.mid");
+  errors += (createPlaylistFile() != count + 1);
+  listAdd("Set 01/Live/");
+  listAdd("Set 01/Live/Encore.mid");
+  errors += (createPlaylistFile() != count + 2);
+
+  // walked again without a rebuild, then skipped with the new hashes
+  listAdd("Set 02/notes.txt");
+  walked = halSdOpens();
+  errors += (createPlaylistFile() != count + 2);
+  walked = halSdOpens() - walked;
+  opens = halSdOpens();
+  errors += (createPlaylistFile() != count + 2);
+  opens = halSdOpens() - opens;
+  errors += (walked >= count) + (opens > unchanged + 2);   // and Live/ and the long folder
+
+  snprintf(path, sizeof(path), "%s", LONG);
+  listAdd(path);
+  for (const char* name : { "Track 10.mid", "track 1.mid", "Track 2.mid", "Track 1 (live).mid" })
+  {
+    snprintf(path, sizeof(path), "%s%s", LONG, name);
+    listAdd(path);
+  }
+  errors += (createPlaylistFile() != count + 6) + !listSorted();
+
+  listAdd("Set 03/Missed.mid");
+  halSdFull(true);
+  n = playlist.open();
+  halSdFull(false);
+  snprintf(path, sizeof(path), "%s/%s", LIST_ROOT, PLI_FILE);
+  errors += (n != -1) + (stat(path, &st) == 0);
+  errors += (playlist.open() != count + 7);
+
+  printf("playlist: songs added, long names, full card, another file added opens %u then %u -> %s\n",
+         walked, opens, errors == 0 ? "OK" : "FAILED");
+}
+
+static void benchPlaylist(uint32_t count)
+{
+  char path[FS_PATH_MAX];
+
+  snprintf(path, sizeof(path), "rm -rf %s && mkdir -p %s", LIST_ROOT, LIST_ROOT);
+  if (system(path) != 0)
+    return;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    // a quarter of the songs in subfolders, some with long names
+    if (i % 4 == 0)
+    {
+      snprintf(path, sizeof(path), "%s/Set %02u", LIST_ROOT, i / 100);
+      mkdir(path, 0755);
+      snprintf(path, sizeof(path), "%s/Set %02u/Song number %04u long name.mid", LIST_ROOT, i / 100, i);
+    }
+    else
+      snprintf(path, sizeof(path), "%s/S%05u.MID", LIST_ROOT, i);
+
+    FILE* f = fopen(path, "wb");
+    fprintf(f, "MThd");
+    fclose(f);
+  }
+
+  halSdRoot(LIST_ROOT);
+  Clock::time_point t0 = Clock::now();
+  uint16_t n1 = createPlaylistFile();
+  double cold = secondsSince(t0);
+
+  t0 = Clock::now();
+  uint32_t opens = halSdOpens();
+  uint16_t n2 = createPlaylistFile();
+  double warm = secondsSince(t0);
+  opens = halSdOpens() - opens;
+
+  printf("playlist: %u files, build %.1f ms, unchanged check %.1f ms opening %u (%u/%u indexed)\n",
+         count, cold * 1000, warm * 1000, opens, n1, n2);
+
+  benchPlaylistChanges(n2, opens);
+
+  halSdRoot(SONG_ROOT);
+  plCount = createPlaylistFile();
+}
+
+int main(int argc, char* argv[])
+{
+  const char* which = (argc > 1) ? argv[1] : "all";
+  uint32_t count = (argc > 2) ? atol(argv[2]) : 0;
+  char path[FS_PATH_MAX];
+
+  mkdir(SONG_ROOT, 0755);
+  snprintf(path, sizeof(path), "%s/BENCH.MID", SONG_ROOT);
+  writeReferenceSong(path);
+  halSdRoot(SONG_ROOT);
+
+  halSetClock(0);
+  setup();
+  halRealClock();
+
+  if (!strcmp(which, "all") || !strcmp(which, "callback"))
+  {
+    benchCallback(count ? count : 1000000);
+    benchStuck();
+  }
+  if (!strcmp(which, "all") || !strcmp(which, "lcd"))
+    benchLcd();
+  if (!strcmp(which, "all") || !strcmp(which, "ir"))
+    benchIr();
+  if (!strcmp(which, "all") || !strcmp(which, "jitter"))
+    benchJitter(count ? count : 10);
+  if (!strcmp(which, "all") || !strcmp(which, "tempo"))
+    benchTempo();
+  if (!strcmp(which, "all") || !strcmp(which, "seek"))
+    benchSeek();
+  if (!strcmp(which, "all") || !strcmp(which, "stream"))
+    benchStream();
+  if (!strcmp(which, "all") || !strcmp(which, "setlist"))
+    benchSetList();
+  if (!strcmp(which, "all") || !strcmp(which, "ble"))
+    benchBle();
+  if (!strcmp(which, "all") || !strcmp(which, "blein"))
+    benchBleIn();
+  if (!strcmp(which, "all") || !strcmp(which, "xform"))
+    benchTransform();
+  if (!strcmp(which, "all") || !strcmp(which, "sysex"))
+    benchSysex();
+  if (!strcmp(which, "all") || !strcmp(which, "cache"))
+    benchCache();
+  if (!strcmp(which, "all") || !strcmp(which, "merge"))
+    benchMerge();
+  if (!strcmp(which, "all") || !strcmp(which, "info"))
+    benchInfo();
+  if (!strcmp(which, "all") || !strcmp(which, "clock"))
+    benchClock();
+  if (!strcmp(which, "all") || !strcmp(which, "remote"))
+    benchRemote();
+  if (!strcmp(which, "all") || !strcmp(which, "log"))
+    benchLog();
+  if (!strcmp(which, "all") || !strcmp(which, "playlist"))
+    benchPlaylist(count ? count : 500);
+
+  return(0);
+}
@@ -0,0 +1,121 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+/*
+ * Host stand-ins for the parts of the Arduino-ESP32 core used by the
+ * player, so the logic can be built and measured on Linux ([env:native]).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef uint8_t byte;
+
+#define F(s)        (s)
+#define PROGMEM
+#define IRAM_ATTR
+
+#define DEC         10
+#define HEX         16
+
+#define LOW         0
+#define HIGH        1
+#define INPUT       0
+#define OUTPUT      1
+
+#define SS          5
+#define LED_BUILTIN 2
+#define SERIAL_8N1  0
+#define SERIAL_8E1  1
+
+// Clock ---------------------------------------------------------------
+// Runs from the host monotonic clock unless a bench sets it explicitly.
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+void halSetClock(uint32_t us);    // freeze the clock at 'us'
+void halAdvanceClock(uint32_t us);
+void halRealClock(void);          // back to the host clock
+
+// GPIO ----------------------------------------------------------------
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+// Print / Serial ------------------------------------------------------
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size);
+  size_t write(const char* buf, size_t size) { return write((const uint8_t*)buf, size); }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(double d, int digits = 2);
+  template <class T> size_t println(T v) { return print(v) + print("\r\n"); }
+};
+
+class HardwareSerial : public Print
+{
+public:
+  HardwareSerial(const char* name) : name_(name), bytesOut_(0), inHead_(0), inTail_(0) {}
+
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1) { (void)baud; (void)config; }
+  using Print::write;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int availableForWrite(void) { return 128; }
+  void flush(void) {}
+  void onReceive(void (*cb)(void), bool onlyOnTimeout = false) { (void)cb; (void)onlyOnTimeout; }
+
+  int available(void) { return inTail_ - inHead_; }
+  int read(void) { return available() ? in_[inHead_++ % sizeof(in_)] : -1; }
+  int peek(void) { return available() ? in_[inHead_ % sizeof(in_)] : -1; }
+
+  // host side
+  void inject(const uint8_t* buf, size_t size);
+  uint32_t bytesOut(void) { return bytesOut_; }
+  void resetBytesOut(void) { bytesOut_ = 0; }
+  void setEcho(FILE* f) { echo_ = f; }
+  void setTap(void (*tap)(const uint8_t* buf, size_t size)) { tap_ = tap; }
+
+private:
+  const char* name_;
+  uint32_t    bytesOut_;
+  uint8_t     in_[1024];
+  uint32_t    inHead_, inTail_;
+  FILE*       echo_ = nullptr;
+  void        (*tap_)(const uint8_t* buf, size_t size) = nullptr;  ///< Sees every write, as it is made
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
+
+class EspClass
+{
+
+public:
+  uint32_t getFreeHeap() { return freeHeap_; }
+
+  uint32_t freeHeap_ = 160 * 1024;   ///< About what a board without PSRAM has left with BLE up
+};
+
+extern EspClass ESP;
+
+#include "freertos_stub.h"
+
+#endif // Arduino_h
@@ -0,0 +1,113 @@
+#ifndef BLEMIDI_Transport_h
+#define BLEMIDI_Transport_h
+
+/*
+ * BLE-MIDI / Arduino MIDI library stand-in. Handlers are stored so a
+ * bench can play the part of the remote device by calling them.
+ */
+
+#include <Arduino.h>
+
+#define MIDI_NAMESPACE      midi
+#define BLEMIDI_NAMESPACE   bleMidi
+#define MIDI_CHANNEL_OMNI   0
+#define MIDI_CHANNEL_OFF    17
+
+namespace midi
+{
+  typedef uint8_t Channel;
+  typedef uint8_t DataByte;
+
+  enum MidiType : uint8_t
+  {
+    InvalidType           = 0x00,
+    NoteOff               = 0x80,
+    NoteOn                = 0x90,
+    AfterTouchPoly        = 0xA0,
+    ControlChange         = 0xB0,
+    ProgramChange         = 0xC0,
+    AfterTouchChannel     = 0xD0,
+    PitchBend             = 0xE0,
+    SystemExclusive       = 0xF0,
+    TimeCodeQuarterFrame  = 0xF1,
+    SongPosition          = 0xF2,
+    SongSelect            = 0xF3,
+    TuneRequest           = 0xF6,
+    Clock                 = 0xF8,
+    Start                 = 0xFA,
+    Continue              = 0xFB,
+    Stop                  = 0xFC,
+    ActiveSensing         = 0xFE,
+    SystemReset           = 0xFF,
+  };
+
+  template <class Transport, class Settings>
+  class MidiInterface
+  {
+  public:
+    MidiInterface(Transport& t) : t_(t) {}
+
+    void begin(Channel ch = 1) { (void)ch; }
+    bool read(void) { return false; }
+
+    void setHandleNoteOff(void (*f)(Channel, byte, byte)) { noteOff = f; }
+    void setHandleNoteOn(void (*f)(Channel, byte, byte)) { noteOn = f; }
+    void setHandleAfterTouchPoly(void (*f)(Channel, byte, byte)) { afterTouchPoly = f; }
+    void setHandleControlChange(void (*f)(Channel, byte, byte)) { controlChange = f; }
+    void setHandleProgramChange(void (*f)(Channel, byte)) { programChange = f; }
+    void setHandleAfterTouchChannel(void (*f)(Channel, byte)) { afterTouchChannel = f; }
+    void setHandlePitchBend(void (*f)(Channel, int)) { pitchBend = f; }
+    void setHandleSystemExclusive(void (*f)(byte*, unsigned)) { systemExclusive = f; }
+    void setHandleSongPosition(void (*f)(unsigned)) { songPosition = f; }
+    void setHandleClock(void (*f)(void)) { clock = f; }
+    void setHandleStart(void (*f)(void)) { start = f; }
+    void setHandleContinue(void (*f)(void)) { cont = f; }
+    void setHandleStop(void (*f)(void)) { stop = f; }
+
+    void sendNoteOn(DataByte note, DataByte vel, Channel ch) { (void)note; (void)vel; (void)ch; }
+    void sendNoteOff(DataByte note, DataByte vel, Channel ch) { (void)note; (void)vel; (void)ch; }
+
+    // host side, the handlers as set by the application
+    void (*noteOff)(Channel, byte, byte) = nullptr;
+    void (*noteOn)(Channel, byte, byte) = nullptr;
+    void (*afterTouchPoly)(Channel, byte, byte) = nullptr;
+    void (*controlChange)(Channel, byte, byte) = nullptr;
+    void (*programChange)(Channel, byte) = nullptr;
+    void (*afterTouchChannel)(Channel, byte) = nullptr;
+    void (*pitchBend)(Channel, int) = nullptr;
+    void (*systemExclusive)(byte*, unsigned) = nullptr;
+    void (*songPosition)(unsigned) = nullptr;
+    void (*clock)(void) = nullptr;
+    void (*start)(void) = nullptr;
+    void (*cont)(void) = nullptr;
+    void (*stop)(void) = nullptr;
+
+  private:
+    Transport& t_;
+  };
+}
+
+namespace bleMidi
+{
+  struct MySettings
+  {
+  };
+
+  template <class T>
+  class BLEMIDI_Transport
+  {
+  public:
+    BLEMIDI_Transport(const char* name) { setName(name); }
+
+    void setName(const char* name) { strncpy(name_, name, sizeof(name_) - 1); name_[sizeof(name_) - 1] = '\0'; }
+    void setHandleConnected(void (*f)(void)) { connected = f; }
+    void setHandleDisconnected(void (*f)(void)) { disconnected = f; }
+
+    // host side
+    void (*connected)(void) = nullptr;
+    void (*disconnected)(void) = nullptr;
+    char name_[32] = "";
+  };
+}
+
+#endif // BLEMIDI_Transport_h
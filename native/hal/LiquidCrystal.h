@@ -0,0 +1,38 @@
+#ifndef LiquidCrystal_h
+#define LiquidCrystal_h
+
+#include <Arduino.h>
+
+/*
+ * HD44780 stand-in. Keeps a copy of the display and counts the bytes
+ * that would have been clocked out to the controller.
+ */
+
+class LiquidCrystal : public Print
+{
+public:
+  LiquidCrystal(uint8_t rs, uint8_t en, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7);
+
+  void begin(uint8_t cols, uint8_t rows);
+  void clear(void);
+  void home(void) { setCursor(0, 0); }
+  void noCursor(void) { bytes_++; }
+  void cursor(void) { bytes_++; }
+  void setCursor(uint8_t col, uint8_t row);
+  void createChar(uint8_t location, uint8_t charmap[]) { (void)location; (void)charmap; bytes_ += 9; }
+
+  using Print::write;
+  size_t write(uint8_t b) override;
+
+  // host side
+  uint32_t bytes(void) { return bytes_; }
+  void resetBytes(void) { bytes_ = 0; }
+  const char* row(uint8_t r) { return ddram_[r % 2]; }
+
+private:
+  char      ddram_[2][41];
+  uint8_t   col_, row_;
+  uint32_t  bytes_;
+};
+
+#endif // LiquidCrystal_h
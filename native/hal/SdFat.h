@@ -0,0 +1,116 @@
+#ifndef SdFat_h
+#define SdFat_h
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+
+/*
+ * SdFat stand-in backed by a directory on the host. The card root is
+ * taken from the RP_SD_ROOT environment variable ("sdcard" if not set)
+ * or set with halSdRoot(). Paths are always taken from the card root.
+ * A directory read as a file gives a 32 byte entry for each file in it,
+ * changing with its name, size and date as on the card. As SdFat without
+ * a date callback, writing keeps a file's date and a new file is dated
+ * 2000-01-01. halSdFull()
+ * makes every write fail, as on a full card, and halSdOpens() counts the
+ * files and directories opened.
+ */
+
+#ifndef O_READ
+#define O_READ    O_RDONLY
+#endif
+#ifndef O_WRITE
+#define O_WRITE   O_WRONLY
+#endif
+#define O_AT_END  O_APPEND
+
+#define SPI_FULL_SPEED  0
+#define SPI_HALF_SPEED  1
+#define SPI_DIV3_SPEED  2
+#define SPI_DIV6_SPEED  3
+
+#define FS_PATH_MAX 512
+
+void halSdRoot(const char* dir);
+void halSdFull(bool bFull);
+uint32_t halSdOpens(void);
+const char* halSdPath(const char* path, char* out, size_t size);
+
+class FsFile : public Print
+{
+public:
+  FsFile();
+  ~FsFile() { close(); }
+  FsFile(const FsFile&) = delete;
+  FsFile& operator=(const FsFile&) = delete;
+
+  bool open(const char* path, int oflag = O_READ);
+  bool open(FsFile* dir, const char* name, int oflag = O_READ);
+  bool openNext(FsFile* dir, int oflag = O_READ);
+  bool close(void);
+  bool isOpen(void) const { return fp_ != nullptr || dp_ != nullptr; }
+  operator bool() const { return isOpen(); }
+
+  bool isFile(void) const { return fp_ != nullptr; }
+  bool isDir(void) const { return dp_ != nullptr; }
+  bool isSubDir(void) const { return dp_ != nullptr && path_[strlen(path_) - 1] != '/'; }
+  bool isHidden(void) const;
+  size_t getName(char* name, size_t size);
+  uint8_t getError(void) const { return err_; }
+  bool getModifyDateTime(uint16_t* pdate, uint16_t* ptime);
+
+  int read(void);
+  int read(void* buf, size_t count);
+  int peek(void);
+  int available(void);
+  using Print::write;
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const void* buf, size_t count);
+  size_t write(const uint8_t* buf, size_t count) override { return write((const void*)buf, count); }
+
+  bool seekSet(uint64_t pos);
+  bool seekCur(int64_t offset);
+  uint64_t curPosition(void);
+  uint64_t fileSize(void);
+  bool sync(void);
+  bool truncate(uint64_t length);
+  bool truncate(void) { return truncate(curPosition()); }
+  bool preAllocate(uint64_t length) { (void)length; return isFile(); }
+  bool remove(void);
+  bool rewindDirectory(void);
+  void rewind(void) { seekSet(0); }
+
+private:
+  void keepDate(void);
+
+  FILE*   fp_;
+  DIR*    dp_;
+  char    path_[FS_PATH_MAX];   ///< Host path
+  uint8_t err_;
+  bool    bWritten_;            ///< Written since opened, keepDate() due
+  struct timespec mtime_;       ///< Date when opened
+};
+
+typedef FsFile File;
+typedef FsFile File32;
+typedef FsFile SdFile;
+typedef FsFile SdBaseFile;
+
+class SdFat
+{
+public:
+  bool begin(uint8_t csPin = SS, uint32_t maxSck = SPI_FULL_SPEED);
+  bool exists(const char* path);
+  bool remove(const char* path);
+  bool mkdir(const char* path, bool pFlag = true);
+  bool rmdir(const char* path);
+  bool rename(const char* oldPath, const char* newPath);
+  bool chdir(const char* path = "/") { (void)path; return true; }
+};
+
+typedef SdFat SdFs;
+typedef SdFat SdFat32;
+
+#endif // SdFat_h
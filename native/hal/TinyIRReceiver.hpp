@@ -0,0 +1,39 @@
+#ifndef TinyIRReceiver_hpp
+#define TinyIRReceiver_hpp
+
+/*
+ * TinyIR stand-in. There is no receiver on the host; a bench feeds
+ * frames by calling handleReceivedTinyIRData() itself.
+ */
+
+#include <Arduino.h>
+
+#define IRDATA_FLAGS_IS_REPEAT      0x01
+#define IRDATA_FLAGS_PARITY_FAILED  0x04
+
+struct TinyIRReceiverCallbackDataStruct
+{
+  uint16_t Address;
+  uint8_t  Command;
+  uint8_t  Flags;
+  bool     justWritten;
+};
+
+inline bool initPCIInterruptForTinyReceiver(void) { return true; }
+
+inline void printTinyReceiverResultMinimal(Print* p, uint16_t aAddress, uint8_t aCommand, uint8_t aFlags)
+{
+  p->print("A=0x"); p->print(aAddress, HEX);
+  p->print(" C=0x"); p->print(aCommand, HEX);
+  p->print(aFlags & IRDATA_FLAGS_IS_REPEAT ? " R\r\n" : "\r\n");
+}
+
+#if defined(USE_FAST_PROTOCOL)
+void handleReceivedTinyIRData(uint8_t aCommand, uint8_t aFlags);
+#elif defined(USE_ONKYO_PROTOCOL)
+void handleReceivedTinyIRData(uint16_t aAddress, uint16_t aCommand, uint8_t aFlags);
+#else
+void handleReceivedTinyIRData(uint8_t aAddress, uint8_t aCommand, uint8_t aFlags);
+#endif
+
+#endif // TinyIRReceiver_hpp
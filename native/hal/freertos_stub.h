@@ -0,0 +1,33 @@
+#ifndef freertos_stub_h
+#define freertos_stub_h
+
+/*
+ * The few FreeRTOS calls the player makes. Tasks are not started on the
+ * host, a bench drives the task bodies itself.
+ */
+
+#include <stdint.h>
+
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                1
+#define pdFALSE               0
+#define pdPASS                1
+#define portMAX_DELAY         0xffffffffUL
+#define portTICK_PERIOD_MS    1
+#define pdMS_TO_TICKS(ms)     (ms)
+#define configMAX_PRIORITIES  25
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack,
+                                   void* param, UBaseType_t prio, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+BaseType_t xPortGetCoreID(void);
+
+#endif // freertos_stub_h
@@ -0,0 +1,506 @@
+// Host implementations of the stubbed Arduino, SdFat, LiquidCrystal and
+// FreeRTOS interfaces used by [env:native].
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <LiquidCrystal.h>
+#include <chrono>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Clock ***************************************************************
+
+static bool     fixedClock = false;
+static uint32_t fixedUs = 0;
+
+static uint64_t hostMicros(void)
+{
+  static const auto t0 = std::chrono::steady_clock::now();
+
+  return(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count());
+}
+
+unsigned long micros(void) { return(fixedClock ? fixedUs : (uint32_t)hostMicros()); }
+unsigned long millis(void) { return(micros() / 1000); }
+
+void delay(unsigned long ms)
+{
+  if (fixedClock)
+    fixedUs += ms * 1000;
+  else
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if (fixedClock)
+    fixedUs += us;
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield(void) { std::this_thread::yield(); }
+
+void halSetClock(uint32_t us) { fixedClock = true; fixedUs = us; }
+void halAdvanceClock(uint32_t us) { fixedUs += us; }
+void halRealClock(void) { fixedClock = false; }
+
+// GPIO ****************************************************************
+
+void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+void digitalWrite(uint8_t pin, uint8_t val) { (void)pin; (void)val; }
+
+// Print / Serial ******************************************************
+
+size_t Print::write(const uint8_t* buf, size_t size)
+{
+  size_t n = 0;
+
+  while (size--)
+    n += write(*buf++);
+
+  return(n);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC)
+    return(print('-') + print((unsigned long)-n, base));
+
+  return(print((unsigned long)n, base));
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+
+  snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+  return(print(buf));
+}
+
+size_t Print::print(double d, int digits)
+{
+  char buf[32];
+
+  snprintf(buf, sizeof(buf), "%.*f", digits, d);
+  return(print(buf));
+}
+
+HardwareSerial Serial("Serial");
+HardwareSerial Serial2("Serial2");
+EspClass ESP;
+
+size_t HardwareSerial::write(uint8_t b)
+{
+  return(write(&b, 1));
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t size)
+{
+  bytesOut_ += size;
+  if (echo_ != nullptr)
+    fwrite(buf, 1, size, echo_);
+  if (tap_ != nullptr)
+    tap_(buf, size);
+
+  return(size);
+}
+
+void HardwareSerial::inject(const uint8_t* buf, size_t size)
+{
+  while (size-- && inTail_ - inHead_ < sizeof(in_))
+    in_[inTail_++ % sizeof(in_)] = *buf++;
+}
+
+// LiquidCrystal *******************************************************
+
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t en, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7)
+:col_(0), row_(0), bytes_(0)
+{
+  (void)rs; (void)en; (void)d4; (void)d5; (void)d6; (void)d7;
+  clear();
+}
+
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows)
+{
+  (void)cols; (void)rows;
+  bytes_ += 4;    // function set, display control, entry mode, clear
+}
+
+void LiquidCrystal::clear(void)
+{
+  memset(ddram_, ' ', sizeof(ddram_));
+  ddram_[0][40] = ddram_[1][40] = '\0';
+  col_ = row_ = 0;
+  bytes_++;
+}
+
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row)
+{
+  col_ = col % 40;
+  row_ = row % 2;
+  bytes_++;
+}
+
+size_t LiquidCrystal::write(uint8_t b)
+{
+  ddram_[row_][col_] = b;
+  col_ = (col_ + 1) % 40;
+  bytes_++;
+
+  return(1);
+}
+
+// SdFat ***************************************************************
+
+static char sdRoot[FS_PATH_MAX] = "";
+static bool bSdFull = false;
+static uint32_t sdOpens = 0;
+
+void halSdRoot(const char* dir)
+{
+  strncpy(sdRoot, dir, sizeof(sdRoot) - 1);
+}
+
+void halSdFull(bool bFull)
+{
+  bSdFull = bFull;
+}
+
+uint32_t halSdOpens(void)
+{
+  return(sdOpens);
+}
+
+const char* halSdPath(const char* path, char* out, size_t size)
+// Card path to host path
+{
+  if (sdRoot[0] == '\0')
+    halSdRoot(getenv("RP_SD_ROOT") != nullptr ? getenv("RP_SD_ROOT") : "sdcard");
+
+  snprintf(out, size, "%s%s%s", sdRoot, path[0] == '/' ? "" : "/", path);
+  return(out);
+}
+
+FsFile::FsFile()
+:fp_(nullptr), dp_(nullptr), err_(0), bWritten_(false), mtime_{}
+{
+  path_[0] = '\0';
+}
+
+static bool openHost(FILE** fp, DIR** dp, const char* path, int oflag, struct timespec* mtime)
+{
+  struct stat st;
+  bool bExists = (stat(path, &st) == 0);
+  const char* mode;
+
+  *mtime = bExists ? st.st_mtim : timespec{ 946684800, 0 };   // SdFat's default date
+
+  sdOpens++;
+  if (bExists && S_ISDIR(st.st_mode))
+    return((*dp = opendir(path)) != nullptr);
+
+  if ((oflag & O_ACCMODE) == O_RDONLY)
+    mode = "rb";
+  else if (oflag & O_APPEND)
+    mode = "a+b";
+  else if ((oflag & O_TRUNC) || !bExists)
+    mode = (bExists || (oflag & O_CREAT)) ? "w+b" : nullptr;
+  else
+    mode = "r+b";
+
+  if (mode == nullptr || (!bExists && !(oflag & O_CREAT)))
+    return(false);
+
+  return((*fp = fopen(path, mode)) != nullptr);
+}
+
+bool FsFile::open(const char* path, int oflag)
+{
+  close();
+  halSdPath(path, path_, sizeof(path_));
+  if (!openHost(&fp_, &dp_, path_, oflag, &mtime_))
+    err_ = 1;
+
+  return(isOpen());
+}
+
+bool FsFile::open(FsFile* dir, const char* name, int oflag)
+{
+  close();
+  // a path too long for path_ would open some other file
+  if (snprintf(path_, sizeof(path_), "%s/%s", dir->path_, name) >= (int)sizeof(path_) ||
+      !openHost(&fp_, &dp_, path_, oflag, &mtime_))
+    err_ = 1;
+
+  return(isOpen());
+}
+
+bool FsFile::openNext(FsFile* dir, int oflag)
+{
+  struct dirent* de;
+
+  close();
+  if (dir->dp_ == nullptr)
+    return(false);
+
+  while ((de = readdir(dir->dp_)) != nullptr)
+  {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+
+    if (snprintf(path_, sizeof(path_), "%s/%s", dir->path_, de->d_name) >= (int)sizeof(path_))
+      continue;   // skipped, as the card could not hold its name either
+    if (openHost(&fp_, &dp_, path_, oflag, &mtime_))
+      return(true);
+  }
+
+  return(false);
+}
+
+void FsFile::keepDate(void)
+// Put back the date the file had when opened, written since
+{
+  struct timespec times[2] = { { 0, UTIME_OMIT }, mtime_ };
+
+  if (fp_ != nullptr && bWritten_ && fflush(fp_) == 0)
+    futimens(fileno(fp_), times);
+  bWritten_ = false;
+}
+
+bool FsFile::close(void)
+{
+  keepDate();
+  if (fp_ != nullptr)
+    fclose(fp_);
+  if (dp_ != nullptr)
+    closedir(dp_);
+  fp_ = nullptr;
+  dp_ = nullptr;
+
+  return(true);
+}
+
+bool FsFile::isHidden(void) const
+{
+  const char* name = strrchr(path_, '/');
+
+  return(name != nullptr && name[1] == '.');
+}
+
+size_t FsFile::getName(char* name, size_t size)
+{
+  const char* p = strrchr(path_, '/');
+
+  p = (p == nullptr) ? path_ : p + 1;
+  if (strlen(p) + 1 > size)
+  {
+    if (size > 0)
+      name[0] = '\0';
+    return(0);
+  }
+  strcpy(name, p);
+
+  return(strlen(name));
+}
+
+bool FsFile::getModifyDateTime(uint16_t* pdate, uint16_t* ptime)
+{
+  struct stat st;
+  struct tm tm;
+
+  if (stat(path_, &st) != 0)
+    return(false);
+
+  localtime_r(&st.st_mtime, &tm);
+  *pdate = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+  *ptime = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+
+  return(true);
+}
+
+int FsFile::read(void)
+{
+  return(fp_ != nullptr ? fgetc(fp_) : -1);
+}
+
+static int readDirEntry(DIR* dp, const char* dir, void* buf, size_t count)
+// Next entry of a directory read as a file: a hash of the name, then the
+// size and modification time, 32 bytes like a directory entry on the card
+{
+  struct dirent* de;
+  struct stat st;
+  char path[FS_PATH_MAX];
+  uint32_t entry[8] = { 2166136261UL };
+
+  if (count < sizeof(entry))
+    return(-1);
+
+  do
+    de = readdir(dp);
+  while (de != nullptr && (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0));
+  if (de == nullptr)
+    return(0);
+
+  for (const char* p = de->d_name; *p != '\0'; p++)
+    entry[0] = (entry[0] ^ (uint8_t)*p) * 16777619UL;
+  snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+  if (stat(path, &st) == 0)
+  {
+    entry[1] = (uint32_t)st.st_size;
+    entry[2] = (uint32_t)st.st_mtim.tv_sec;
+    entry[3] = (uint32_t)st.st_mtim.tv_nsec;
+    entry[4] = S_ISDIR(st.st_mode);
+  }
+  memcpy(buf, entry, sizeof(entry));
+
+  return(sizeof(entry));
+}
+
+int FsFile::read(void* buf, size_t count)
+{
+  if (dp_ != nullptr)
+    return(readDirEntry(dp_, path_, buf, count));
+
+  return(fp_ != nullptr ? (int)fread(buf, 1, count, fp_) : -1);
+}
+
+int FsFile::peek(void)
+{
+  int c = read();
+
+  if (c >= 0)
+    ungetc(c, fp_);
+
+  return(c);
+}
+
+int FsFile::available(void)
+{
+  return((int)(fileSize() - curPosition()));
+}
+
+size_t FsFile::write(const void* buf, size_t count)
+{
+  bWritten_ = true;
+  return(fp_ != nullptr && !bSdFull ? fwrite(buf, 1, count, fp_) : 0);
+}
+
+bool FsFile::seekSet(uint64_t pos)
+{
+  return(fp_ != nullptr && fseeko(fp_, pos, SEEK_SET) == 0);
+}
+
+bool FsFile::seekCur(int64_t offset)
+{
+  return(fp_ != nullptr && fseeko(fp_, offset, SEEK_CUR) == 0);
+}
+
+uint64_t FsFile::curPosition(void)
+{
+  return(fp_ != nullptr ? ftello(fp_) : 0);
+}
+
+uint64_t FsFile::fileSize(void)
+{
+  struct stat st;
+
+  if (fp_ != nullptr)
+    fflush(fp_);
+
+  return(stat(path_, &st) == 0 ? st.st_size : 0);
+}
+
+bool FsFile::sync(void)
+{
+  keepDate();
+  return(fp_ != nullptr && fflush(fp_) == 0);
+}
+
+bool FsFile::truncate(uint64_t length)
+{
+  bWritten_ = true;
+  return(fp_ != nullptr && fflush(fp_) == 0 && ftruncate(fileno(fp_), length) == 0);
+}
+
+bool FsFile::remove(void)
+{
+  close();
+  return(unlink(path_) == 0);
+}
+
+bool FsFile::rewindDirectory(void)
+{
+  if (dp_ != nullptr)
+    rewinddir(dp_);
+
+  return(dp_ != nullptr);
+}
+
+bool SdFat::begin(uint8_t csPin, uint32_t maxSck)
+{
+  char p[FS_PATH_MAX];
+  struct stat st;
+
+  (void)csPin; (void)maxSck;
+  return(stat(halSdPath("/", p, sizeof(p)), &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+bool SdFat::exists(const char* path)
+{
+  char p[FS_PATH_MAX];
+  struct stat st;
+
+  return(stat(halSdPath(path, p, sizeof(p)), &st) == 0);
+}
+
+bool SdFat::remove(const char* path)
+{
+  char p[FS_PATH_MAX];
+
+  return(unlink(halSdPath(path, p, sizeof(p))) == 0);
+}
+
+bool SdFat::mkdir(const char* path, bool pFlag)
+{
+  char p[FS_PATH_MAX];
+
+  (void)pFlag;
+  return(::mkdir(halSdPath(path, p, sizeof(p)), 0755) == 0);
+}
+
+bool SdFat::rmdir(const char* path)
+{
+  char p[FS_PATH_MAX];
+
+  return(::rmdir(halSdPath(path, p, sizeof(p))) == 0);
+}
+
+bool SdFat::rename(const char* oldPath, const char* newPath)
+{
+  char p1[FS_PATH_MAX], p2[FS_PATH_MAX];
+
+  return(::rename(halSdPath(oldPath, p1, sizeof(p1)), halSdPath(newPath, p2, sizeof(p2))) == 0);
+}
+
+// FreeRTOS ************************************************************
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack,
+                                   void* param, UBaseType_t prio, TaskHandle_t* handle, BaseType_t core)
+// Tasks are not run on the host, the bench calls what it needs directly
+{
+  (void)task; (void)name; (void)stack; (void)param; (void)prio; (void)core;
+  if (handle != nullptr)
+    *handle = nullptr;
+
+  return(pdPASS);
+}
+
+void vTaskDelay(TickType_t ticks) { delay(ticks * portTICK_PERIOD_MS); }
+void xTaskNotifyGive(TaskHandle_t task) { (void)task; }
+void vTaskDelete(TaskHandle_t task) { (void)task; }
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) { (void)clear; (void)wait; return(0); }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { (void)task; return(0); }
+BaseType_t xPortGetCoreID(void) { return(0); }
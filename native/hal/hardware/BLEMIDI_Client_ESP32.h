@@ -0,0 +1,65 @@
+#ifndef BLEMIDI_Client_ESP32_h
+#define BLEMIDI_Client_ESP32_h
+
+#include <list>
+#include <string>
+#include <BLEMIDI_Transport.h>
+
+namespace bleMidi
+{
+  class BLEMIDI_Client_ESP32
+  {
+  };
+}
+
+class BLEAddress
+{
+public:
+  std::string toString(void) { return "00:00:00:00:00:00"; }
+};
+
+class BLEDevice
+{
+public:
+  static BLEAddress getAddress(void) { return BLEAddress(); }
+};
+
+// The NimBLE client side used for the BLE output. There is never a
+// connection on the host, a bench packs into its own transport.
+class NimBLERemoteCharacteristic
+{
+public:
+  bool writeValue(const uint8_t* data, size_t length, bool response = false) { (void)data; (void)length; (void)response; return(false); }
+  bool canWriteNoResponse(void) { return(true); }
+  typedef void (*notify_callback)(NimBLERemoteCharacteristic* chr, uint8_t* data, size_t length, bool isNotify);
+  bool subscribe(bool notifications = true, notify_callback cb = nullptr) { (void)notifications; (void)cb; return(false); }
+};
+
+class NimBLERemoteService
+{
+public:
+  NimBLERemoteCharacteristic* getCharacteristic(const char* uuid) { (void)uuid; return(nullptr); }
+};
+
+class NimBLEConnInfo
+{
+public:
+  uint16_t getConnInterval(void) { return(6); }
+};
+
+class NimBLEClient
+{
+public:
+  NimBLERemoteService* getService(const char* uuid) { (void)uuid; return(nullptr); }
+  uint16_t getMTU(void) { return(23); }
+  NimBLEConnInfo getConnInfo(void) { return(NimBLEConnInfo()); }
+};
+
+class NimBLEDevice
+{
+public:
+  static size_t getClientListSize(void) { return(0); }
+  static std::list<NimBLEClient*>* getClientList(void) { static std::list<NimBLEClient*> l; return(&l); }
+};
+
+#endif // BLEMIDI_Client_ESP32_h
@@ -0,0 +1,63 @@
+#include "Debug_def.h"
+#include "ActiveNotes.h"
+#include <string.h>
+
+// Active Notes ********************************************************
+
+ActiveNotes::ActiveNotes ()
+{
+  clear();
+};
+
+void ActiveNotes::clear ()
+{
+  memset(on_, 0, sizeof(on_));
+}
+
+void ActiveNotes::update (const uint8_t* data, uint8_t size)
+// Follow one complete message on its way out
+{
+  uint8_t ch = data[0] & 0x0f;
+
+  if (data[0] == 0xff)
+  {
+    clear();        // System Reset
+    return;
+  }
+
+  if (size < 3 || data[0] < 0x80 || data[0] >= 0xf0)
+    return;
+
+  switch (data[0] & 0xf0)
+  {
+  case 0x90:
+    if (data[2] != 0)
+    {
+      on_[ch][data[1] >> 5] |= (1UL << (data[1] & 0x1f));
+      break;
+    }
+    // velocity 0 is a Note Off
+    [[fallthrough]];
+
+  case 0x80:
+    on_[ch][data[1] >> 5] &= ~(1UL << (data[1] & 0x1f));
+    break;
+
+  case 0xb0:
+    if (data[1] == 120 || data[1] == 123)
+      memset(on_[ch], 0, sizeof(on_[ch]));    // All Sound Off, All Notes Off
+    break;
+  }
+}
+
+uint16_t ActiveNotes::count ()
+// Number of notes sounding on all channels
+{
+  uint16_t n = 0;
+
+  for (uint8_t ch = 0; ch < ANOTE_CHANNELS; ch++)
+    for (uint8_t w = 0; w < ANOTE_WORDS; w++)
+      n += __builtin_popcount(on_[ch][w]);
+
+  return(n);
+}
@@ -0,0 +1,38 @@
+#ifndef ActiveNotes_h
+#define ActiveNotes_h
+
+#include <stdint.h>
+
+/*
+ * Bitset of the notes sounding on each channel and of the channels with
+ * the sustain pedal down, as seen by the output.
+ *
+ * update() is called with every message sent, so the set always matches
+ * what the sound module has been told. That allows exact Note Offs to
+ * be sent when playback stops, rather than relying on All Sound Off.
+ * 16 channels x 128 notes take 256 bytes and nothing else is kept, so
+ * the sustain pedals are not followed: they are lifted on every channel
+ * whenever the notes are released.
+ */
+
+#define ANOTE_CHANNELS  16
+#define ANOTE_WORDS     (128 / 32)
+
+class ActiveNotes
+{
+
+public:
+  ActiveNotes ();
+
+  void update(const uint8_t* data, uint8_t size);
+  void clear();
+
+  bool isOn(uint8_t ch, uint8_t note) { return (on_[ch][note >> 5] >> (note & 0x1f)) & 1; }
+  uint32_t getWord(uint8_t ch, uint8_t w) { return on_[ch][w]; }
+  uint16_t count();
+
+private:
+  uint32_t  on_[ANOTE_CHANNELS][ANOTE_WORDS];
+};
+
+#endif // ActiveNotes_h
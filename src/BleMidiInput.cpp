@@ -0,0 +1,205 @@
+#include "Debug_def.h"
+#include "BleMidiInput.h"
+#include <string.h>
+
+// BLE-MIDI Input ******************************************************
+
+BleMidiInput::BleMidiInput ()
+:head_(0), tail_(0), packets_(0), overruns_(0), errors_(0)
+{
+  reset();
+};
+
+void BleMidiInput::reset ()
+// Forget the message in progress, e.g. on a new connection
+{
+  status_ = 0;
+  len_ = need_ = 0;
+  bSysex_ = false;
+  sysexLen_ = 0;
+}
+
+bool BleMidiInput::receive (const uint8_t* data, uint16_t size, uint32_t nowUs)
+// Queue one notification. Called from the BLE stack only.
+{
+  uint16_t t = tail_.load(std::memory_order_relaxed);
+  uint16_t n = (t + 1) & (BLEMIDI_RX_PACKETS - 1);
+
+  if (n == head_.load(std::memory_order_acquire) || size < 2 || size > BLEMIDI_PACKET_MAX)
+  {
+    overruns_++;
+    return(false);
+  }
+
+  queue_[t].arrivedUs_ = nowUs;
+  queue_[t].size_ = size;
+  memcpy(queue_[t].data_, data, size);
+  tail_.store(n, std::memory_order_release);
+
+  return(true);
+}
+
+uint16_t BleMidiInput::process (MessageHandler mh)
+// Decode the queued packets, handing each message to 'mh'.
+// Returns the number of messages.
+{
+  uint16_t h = head_.load(std::memory_order_relaxed);
+  uint16_t count = 0;
+
+  while (h != tail_.load(std::memory_order_acquire))
+  {
+    count += decode(queue_[h], mh);
+    packets_++;
+    h = (h + 1) & (BLEMIDI_RX_PACKETS - 1);
+    head_.store(h, std::memory_order_release);
+  }
+
+  return(count);
+}
+
+void BleMidiInput::sysexByte (uint8_t b)
+{
+  if (sysexLen_ < BLEMIDI_SYSEX_MAX)
+    sysex_[sysexLen_] = b;
+  if (sysexLen_ < UINT16_MAX)
+    sysexLen_++;
+}
+
+uint16_t BleMidiInput::decode (const Packet& p, MessageHandler mh)
+// A packet is a header byte, then messages each behind a timestamp byte.
+// Running status messages may leave out the timestamp as well, and a
+// SysEx carried on from the packet before starts straight after the
+// header. Timestamps are not used, the messages go out as they arrive.
+{
+  uint16_t count = 0;
+  uint16_t i = 1;
+
+  len_ = 0;     // channel messages never span packets
+
+  while (i < p.size_)
+  {
+    uint8_t b = p.data_[i++];
+
+    if (b < 0x80)
+    {
+      // data, of a SysEx or of the current message
+      if (bSysex_)
+        sysexByte(b);
+      else if (status_ == 0)
+        errors_++;
+      else
+      {
+        msg_[1 + len_++] = b;
+        if (len_ == need_)
+        {
+          msg_[0] = status_;
+          mh(msg_, need_ + 1, p.arrivedUs_);
+          count++;
+          len_ = 0;
+          if (status_ >= 0xf0)
+            status_ = 0;    // system common has no running status
+        }
+      }
+      continue;
+    }
+
+    // a timestamp, followed by a status byte or running status data
+    if (i >= p.size_)
+    {
+      errors_++;
+      break;
+    }
+    b = p.data_[i];
+    if (b < 0x80)
+    {
+      if (bSysex_)
+      {
+        errors_++;        // data after a timestamp cannot be SysEx
+        bSysex_ = false;
+      }
+      continue;
+    }
+    i++;
+
+    if (b >= 0xf8)
+    {
+      // real time, anywhere, running status and SysEx carry on
+      mh(&b, 1, p.arrivedUs_);
+      count++;
+      continue;
+    }
+
+    if (bSysex_)
+    {
+      bSysex_ = false;
+      if (b != 0xf7)
+      {
+        errors_++;        // cut short, drop it and take the new status
+        sysexLen_ = 0;
+      }
+      else
+      {
+        sysexByte(b);
+        if (sysexLen_ <= BLEMIDI_SYSEX_MAX)
+        {
+          mh(sysex_, sysexLen_, p.arrivedUs_);
+          count++;
+        }
+        else
+          errors_++;
+        sysexLen_ = 0;
+        continue;
+      }
+    }
+
+    len_ = 0;
+    switch (b & 0xf0)
+    {
+    case 0xc0:
+    case 0xd0:
+      status_ = b;
+      need_ = 1;
+      break;
+
+    case 0xf0:
+      status_ = b;
+      switch (b)
+      {
+      case 0xf0:
+        bSysex_ = true;
+        sysexLen_ = 0;
+        sysexByte(b);
+        status_ = 0;
+        break;
+
+      case 0xf1:    // MTC quarter frame
+      case 0xf3:    // Song Select
+        need_ = 1;
+        break;
+
+      case 0xf2:    // Song Position
+        need_ = 2;
+        break;
+
+      case 0xf6:    // Tune Request
+        mh(&b, 1, p.arrivedUs_);
+        count++;
+        status_ = 0;
+        break;
+
+      default:      // stray F7 and undefined
+        errors_++;
+        status_ = 0;
+        break;
+      }
+      break;
+
+    default:
+      status_ = b;
+      need_ = 2;
+      break;
+    }
+  }
+
+  return(count);
+}
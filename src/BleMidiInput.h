@@ -0,0 +1,68 @@
+#ifndef BleMidiInput_h
+#define BleMidiInput_h
+
+#include <stdint.h>
+#include <atomic>
+#include "BleMidiPacker.h"
+
+/*
+ * Receive side of BLE-MIDI, taking the packets straight from the
+ * notifications of the server.
+ *
+ * receive() is called from the BLE stack for each notification. It only
+ * copies the packet into a small queue, stamped with its arrival time, so
+ * that the stack is never held up. process() is then called from the
+ * receiving task and decodes the packets into complete MIDI messages:
+ * every status and channel as sent, running status with or without
+ * timestamps, system real time between SysEx bytes, and SysEx spread over
+ * several packets, which is collected and handed on whole.
+ */
+
+#define BLEMIDI_RX_PACKETS  8       // queued notifications, must be a power of 2
+#define BLEMIDI_SYSEX_MAX   128     // longest SysEx passed on, F0 and F7 included
+
+class BleMidiInput
+{
+
+public:
+  typedef void (*MessageHandler)(const uint8_t* data, uint16_t size, uint32_t arrivedUs);
+
+  BleMidiInput ();
+
+  bool receive(const uint8_t* data, uint16_t size, uint32_t nowUs);
+  uint16_t process(MessageHandler mh);
+  void reset();
+
+  uint32_t getPackets() { return packets_; }
+  uint32_t getOverruns() { return overruns_; }
+  uint32_t getErrors() { return errors_; }
+
+private:
+  typedef struct
+  {
+    uint32_t  arrivedUs_;
+    uint8_t   size_;
+    uint8_t   data_[BLEMIDI_PACKET_MAX];
+  } Packet;
+
+  uint16_t decode(const Packet& p, MessageHandler mh);
+  void sysexByte(uint8_t b);
+
+  Packet    queue_[BLEMIDI_RX_PACKETS];
+  std::atomic<uint16_t> head_;  ///< Owned by the receiving task
+  std::atomic<uint16_t> tail_;  ///< Owned by the BLE stack
+
+  uint8_t   status_;        ///< Running status, 0 if none
+  uint8_t   msg_[3];
+  uint8_t   len_;           ///< Bytes in msg_
+  uint8_t   need_;          ///< Bytes a message of status_ has
+  bool      bSysex_;        ///< Inside a SysEx
+  uint8_t   sysex_[BLEMIDI_SYSEX_MAX];
+  uint16_t  sysexLen_;      ///< Bytes collected, more than the buffer if too long
+
+  uint32_t  packets_;       ///< Packets decoded
+  uint32_t  overruns_;      ///< Packets lost to a full queue
+  uint32_t  errors_;        ///< Bytes out of place, SysEx too long
+};
+
+#endif // BleMidiInput_h
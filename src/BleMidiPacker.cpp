@@ -0,0 +1,173 @@
+#include "Debug_def.h"
+#include "BleMidiPacker.h"
+#include <string.h>
+
+// BLE-MIDI Packer *****************************************************
+
+BleMidiPacker::BleMidiPacker (SendHandler sh)
+:sh_(sh), capacity_(0), hold_(0), lastUs_(0), len_(0), count_(0), status_(0), openUs_(0),
+ messages_(0), packets_(0), bytes_(0), dropped_(0)
+{
+  memset(&held_, 0, sizeof(held_));
+};
+
+void BleMidiPacker::setLink (uint16_t mtu, uint32_t intervalUs)
+// Size packets for the link, MTU 0 when it is down. The open packet is
+// sent first with the old settings.
+{
+  if (len_ != 0)
+    send(openUs_);
+
+  if (mtu <= 3)
+    capacity_ = 0;
+  else
+    capacity_ = (mtu - 3 < BLEMIDI_PACKET_MAX) ? mtu - 3 : BLEMIDI_PACKET_MAX;
+
+  hold_ = intervalUs;
+  if (hold_ > BLEMIDI_HOLD_MAX)
+    hold_ = BLEMIDI_HOLD_MAX;
+
+  DEBUG("\nBLE packet ", capacity_);
+  DEBUG(" hold us ", hold_);
+}
+
+bool BleMidiPacker::write (const uint8_t* data, uint8_t size, uint32_t nowUs)
+// Add one complete message, timestamped 'nowUs'. The packet is only sent
+// here when it is full, poll() once a batch of messages has been written.
+// Returns false if there is no link or the message can never fit a packet.
+{
+  uint16_t ts = (nowUs / 1000) & 0x1fff;
+  bool bRunning;
+
+  if (capacity_ != 0 && size != 0 && data[0] == 0xf0)
+    return(writeSysex(data, size, nowUs));
+
+  if (capacity_ == 0 || size == 0 || size + 2 > capacity_)
+    return(false);
+
+  bRunning = (len_ != 0 && data[0] == status_);
+  if (len_ + 1 + size - bRunning > capacity_)
+  {
+    send(nowUs);
+    bRunning = false;
+  }
+
+  if (len_ == 0)
+    open(nowUs);
+
+  pkt_[len_++] = 0x80 | (ts & 0x7f);
+  memcpy(&pkt_[len_], &data[bRunning], size - bRunning);
+  len_ += size - bRunning;
+  count_++;
+
+  if (data[0] >= 0x80 && data[0] < 0xf0)
+    status_ = data[0];
+  else if (data[0] < 0xf8)
+    status_ = 0;        // as on the wire, real time leaves it alone
+
+  // nothing more would fit
+  if (capacity_ - len_ < 2)
+    send(nowUs);
+
+  return(true);
+}
+
+bool BleMidiPacker::writeSysex (const uint8_t* data, uint8_t size, uint32_t nowUs)
+// Add a complete SysEx, F0 to F7, over as many packets as it takes. The
+// packets before the last are sent here, the F7 gets its own timestamp.
+{
+  uint8_t ts = 0x80 | ((nowUs / 1000) & 0x7f);
+
+  if (size < 2 || data[size - 1] != 0xf7 || capacity_ < 5)
+    return(false);
+
+  // the timestamp, F0 and a data byte at least
+  if (len_ != 0 && capacity_ - len_ < 3)
+    send(nowUs);
+  if (len_ == 0)
+    open(nowUs);
+  pkt_[len_++] = ts;
+
+  for (uint8_t i = 0; i < size - 1; i++)
+  {
+    if (len_ == capacity_)
+    {
+      send(nowUs);
+      open(nowUs);
+    }
+    pkt_[len_++] = data[i];
+  }
+
+  if (capacity_ - len_ < 2)
+  {
+    send(nowUs);
+    open(nowUs);
+  }
+  pkt_[len_++] = ts;
+  pkt_[len_++] = 0xf7;
+  count_++;
+  status_ = 0;
+
+  if (capacity_ - len_ < 2)
+    send(nowUs);
+
+  return(true);
+}
+
+void BleMidiPacker::open (uint32_t nowUs)
+// Start a packet with its header
+{
+  pkt_[len_++] = 0x80 | (((nowUs / 1000) & 0x1fff) >> 7);
+  openUs_ = nowUs;
+}
+
+void BleMidiPacker::poll (uint32_t nowUs)
+// Send the open packet if a connection interval has passed since the last one
+{
+  if (len_ != 0 && getWait(nowUs) == 0)
+    send(nowUs);
+}
+
+void BleMidiPacker::flush (uint32_t nowUs)
+// Send the open packet now
+{
+  if (len_ != 0)
+    send(nowUs);
+}
+
+uint32_t BleMidiPacker::getWait (uint32_t nowUs)
+// us until the open packet has to go, UINT32_MAX if there is none.
+// The last packet was sent before this one was opened, so no message
+// waits longer than hold_.
+{
+  if (len_ == 0)
+    return(UINT32_MAX);
+
+  // elapsed time stays right however long the link has been idle
+  if (nowUs - lastUs_ >= hold_)
+    return(0);
+
+  return(hold_ - (nowUs - lastUs_));
+}
+
+void BleMidiPacker::send (uint32_t nowUs)
+{
+  if (sh_(pkt_, len_))
+  {
+    lastUs_ = nowUs;
+    packets_++;
+    bytes_ += len_;
+    messages_ += count_;
+    LatencyStats::record(held_, nowUs - openUs_);
+  }
+  else
+    dropped_ += count_;
+
+  len_ = count_ = status_ = 0;
+}
+
+void BleMidiPacker::resetStats ()
+{
+  messages_ = packets_ = bytes_ = dropped_ = 0;
+  memset(&held_, 0, sizeof(held_));
+}
@@ -0,0 +1,75 @@
+#ifndef BleMidiPacker_h
+#define BleMidiPacker_h
+
+#include <stdint.h>
+#include "LatencyStats.h"
+
+/*
+ * Packs MIDI messages into BLE-MIDI packets for the BLE output.
+ *
+ * A packet is a header byte with the high 6 bits of a 13 bit millisecond
+ * timestamp, then each message preceded by a timestamp byte with the low
+ * 7 bits. Channel messages use running status inside a packet, a packet
+ * always starts with a full status byte. A SysEx longer than the room
+ * left carries on in the next packets, straight after their header.
+ *
+ * A packet goes as soon as it is polled if none has been sent for a
+ * connection interval, as the link would carry it at its next connection
+ * event anyway. Otherwise it stays open until then, or until it is full
+ * for the MTU of the link, so that a burst of notes goes out in one write
+ * rather than one write each. The receiver puts the original spacing back
+ * from the timestamps.
+ */
+
+#define BLEMIDI_PACKET_MAX  244     // one LE data PDU with data length extension
+#define BLEMIDI_HOLD_MAX    50000   // us, longest a message waits, well inside the timestamp range
+
+class BleMidiPacker
+{
+
+public:
+  typedef bool (*SendHandler)(const uint8_t* data, uint8_t size);
+
+  BleMidiPacker (SendHandler sh);
+
+  void setLink(uint16_t mtu, uint32_t intervalUs);
+  bool isLinked() { return capacity_ != 0; }
+
+  bool write(const uint8_t* data, uint8_t size, uint32_t nowUs);
+  void poll(uint32_t nowUs);
+  void flush(uint32_t nowUs);
+  uint32_t getWait(uint32_t nowUs);
+
+  uint8_t getCapacity() { return capacity_; }
+  uint32_t getHold() { return hold_; }
+  uint32_t getMessages() { return messages_; }
+  uint32_t getPackets() { return packets_; }
+  uint32_t getBytes() { return bytes_; }
+  uint32_t getDropped() { return dropped_; }
+  const LatencyStats::Histogram& getHeld() { return held_; }
+  void resetStats();
+
+private:
+  bool writeSysex(const uint8_t* data, uint8_t size, uint32_t nowUs);
+  void open(uint32_t nowUs);
+  void send(uint32_t nowUs);
+
+  SendHandler sh_;
+  uint8_t   capacity_;      ///< Packet size for the link, 0 when not connected
+  uint32_t  hold_;          ///< us between packets, the connection interval
+  uint32_t  lastUs_;        ///< Time the last packet was sent
+
+  uint8_t   pkt_[BLEMIDI_PACKET_MAX];
+  uint8_t   len_;           ///< Bytes in the open packet, 0 if none
+  uint8_t   count_;         ///< Messages in the open packet
+  uint8_t   status_;        ///< Running status in the open packet
+  uint32_t  openUs_;        ///< Time the first message was added
+
+  uint32_t  messages_;      ///< Messages sent
+  uint32_t  packets_;       ///< Packets sent
+  uint32_t  bytes_;         ///< Packet bytes sent
+  uint32_t  dropped_;       ///< Messages in packets the link refused
+  LatencyStats::Histogram held_;  ///< us the first message of each packet waited
+};
+
+#endif // BleMidiPacker_h
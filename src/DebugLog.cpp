@@ -0,0 +1,182 @@
+#include <Arduino.h>
+#include "Debug_def.h"
+#include "DebugLog.h"
+#include <string.h>
+
+// Debug Log ***********************************************************
+
+// a text numbered must leave room in the frame for the entry using it
+static const uint8_t ENTRY_MAX = 1 + 5 + 1 + 1 + DLOG_TEXT;
+static const uint8_t DEFINE_TEXT_MAX = DLOG_FRAME_MAX - (3 + 6 + 6 + 1) - ENTRY_MAX - 3;  // header, time, lost, F7
+
+static uint8_t valueBytes(uint32_t v)
+// 7 bit bytes 'v' takes, none for 0
+{
+  uint8_t n = 0;
+
+  for (; v != 0; v >>= 7)
+    n++;
+
+  return(n);
+}
+
+static void putValue(uint8_t* frame, uint8_t& n, uint32_t v, uint8_t bytes)
+// 'bytes' 7 bit bytes of 'v', most significant first
+{
+  while (bytes-- > 0)
+    frame[n++] = (v >> (7 * bytes)) & 0x7f;
+}
+
+static void putText(uint8_t* frame, uint8_t& n, const char* text, uint8_t most)
+{
+  for (uint8_t i = 0; i < most && text[i] != '\0'; i++)
+    frame[n++] = text[i] & 0x7f;
+  frame[n++] = 0;
+}
+
+DebugLog::DebugLog (WriteHandler wh, uint8_t id)
+:wh_(wh), id_(id), head_(0), tail_(0), nextFormat_(0), records_(0), lost_(0), lostSent_(0), frames_(0)
+{
+  for (uint16_t i = 0; i < DLOG_SLOTS; i++)
+    slot_[i].seq_.store(i, std::memory_order_relaxed);
+  memset(format_, 0, sizeof(format_));
+};
+
+void DebugLog::record (const char* fmt, value_type type, uint32_t value, const char* text)
+// Claim the next slot and fill it in, or count the record lost if the
+// drain has not freed it yet
+{
+  uint32_t pos = head_.load(std::memory_order_relaxed);
+  Slot* s;
+
+  for (;;)
+  {
+    s = &slot_[pos & (DLOG_SLOTS - 1)];
+    int32_t d = (int32_t)(s->seq_.load(std::memory_order_acquire) - pos);
+
+    if (d == 0)
+    {
+      if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if (d < 0)
+    {
+      lost_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else
+      pos = head_.load(std::memory_order_relaxed);
+  }
+
+  s->fmt_ = fmt;
+  s->us_ = micros();
+  s->type_ = type;
+  if (type == DLT_TEXT)
+  {
+    strncpy(s->text_, text, DLOG_TEXT - 1);
+    s->text_[DLOG_TEXT - 1] = '\0';
+  }
+  else
+    s->value_ = value;
+  s->seq_.store(pos + 1, std::memory_order_release);
+}
+
+int16_t DebugLog::find (const char* fmt)
+// The number of a text already sent, -1 if it has none
+{
+  for (uint16_t i = 0; i < DLOG_FORMATS; i++)
+  {
+    if (format_[i] == fmt)
+      return(i);
+  }
+
+  return(-1);
+}
+
+bool DebugLog::drain ()
+// Send the records waiting as one frame, as many as fit.
+// Returns false if there was nothing to send.
+{
+  uint8_t frame[DLOG_FRAME_MAX];
+  uint8_t n = 0;
+  uint32_t lastUs = 0;
+  bool bTime = false;
+
+  frame[n++] = 0xf0;
+  frame[n++] = id_;
+  frame[n++] = DLOG_FRAME;
+
+  for (;;)
+  {
+    Slot& s = slot_[tail_ & (DLOG_SLOTS - 1)];
+
+    if (s.seq_.load(std::memory_order_acquire) != tail_ + 1)
+    {
+      // the records lost came after all those sent
+      uint32_t lost = lost_.load(std::memory_order_relaxed);
+
+      if (lost != lostSent_)
+      {
+        frame[n++] = DLR_LOST;
+        putValue(frame, n, lost - lostSent_, 5);
+        lostSent_ = lost;
+      }
+      break;
+    }
+
+    if (!bTime)
+    {
+      // the entries count from the first one
+      bTime = true;
+      lastUs = s.us_;
+      frame[n++] = DLR_TIME;
+      putValue(frame, n, lastUs, 5);
+    }
+
+    // the record goes whole, after its text if that is not numbered yet
+    int16_t f = find(s.fmt_);
+    uint32_t value = (s.type_ == DLT_TEXT || s.type_ == DLT_NONE) ? 0 : s.value_;
+    uint8_t dt = valueBytes(s.us_ - lastUs);
+    uint8_t need = 1 + dt + 1 + 1 + valueBytes(value);
+
+    if (f < 0)
+      need += 1 + 1 + strnlen(s.fmt_, DEFINE_TEXT_MAX) + 1;
+    if (s.type_ == DLT_TEXT)
+      need += strlen(s.text_) + 1;
+    if (n + need + 6 + 1 > DLOG_FRAME_MAX)
+      break;     // room is kept for the lost count
+
+    if (f < 0)
+    {
+      f = nextFormat_;
+      nextFormat_ = (nextFormat_ + 1) % DLOG_FORMATS;
+      format_[f] = s.fmt_;
+      frame[n++] = DLR_DEFINE;
+      frame[n++] = f;
+      putText(frame, n, s.fmt_, DEFINE_TEXT_MAX);
+    }
+
+    frame[n++] = DLR_ENTRY + dt;
+    putValue(frame, n, s.us_ - lastUs, dt);
+    frame[n++] = f;
+    frame[n++] = s.type_ | (valueBytes(value) << 3);
+    if (s.type_ == DLT_TEXT)
+      putText(frame, n, s.text_, DLOG_TEXT);
+    else
+      putValue(frame, n, value, valueBytes(value));
+    lastUs = s.us_;
+
+    s.seq_.store(tail_ + DLOG_SLOTS, std::memory_order_release);
+    tail_++;
+    records_++;
+  }
+
+  if (n == 3)
+    return(false);
+
+  frame[n++] = 0xf7;
+  wh_(frame, n);
+  frames_++;
+
+  return(true);
+}
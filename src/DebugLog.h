@@ -0,0 +1,124 @@
+#ifndef DebugLog_h
+#define DebugLog_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <type_traits>
+
+/*
+ * Binary debug log, the DEBUG macros' backend with DEBUG_LOG set.
+ *
+ * A call only puts a record in a RAM ring: the address of the text, which
+ * must be a string literal, the time and the value. Nothing is formatted
+ * on the device, so Serial stays the MIDI port at the MIDI rate and the
+ * timing being debugged hardly changes. Text values are copied, up to
+ * DLOG_TEXT - 1 characters.
+ *
+ * Any task may put(). The ring has a sequence number per slot, so
+ * producers only contend for the slot index, and a record that finds the
+ * ring full is dropped and counted.
+ *
+ * The UI task drain()s the ring into frames on Serial2 when it has
+ * nothing else to do, framed like the operator queries:
+ *
+ *  F0 id DLOG_FRAME records F7
+ *
+ * Each text is sent once, as a DLR_DEFINE record giving it a number, and
+ * the DLR_ENTRY records after it refer to the number. All bytes are 7
+ * bit, numbers of several bytes most significant first:
+ *
+ *  DLR_TIME time            5 bytes, the time the entries count from
+ *  DLR_DEFINE number text 00
+ *  DLR_ENTRY+n number type+(m << 3) [value | text 00]
+ *                           n bytes of time since the entry before,
+ *                           m bytes of value, a zero takes none
+ *  DLR_LOST count           5 bytes, records dropped after the entries
+ *
+ * Every frame starts with DLR_TIME, so frames decode on their own.
+ *
+ * tools/logdec turns a capture of Serial2 back into the text DEBUG would
+ * have printed, each line stamped with its time.
+ */
+
+#define DLOG_SLOTS        128     // records in the ring, must be a power of 2
+#define DLOG_TEXT         24      // bytes kept of a text value, terminator included
+#define DLOG_FORMATS      128     // texts numbered at a time, the oldest is numbered again, at most 128
+#define DLOG_FRAME_MAX    96      // longest frame sent
+#define DLOG_FRAME        0x20    // frame type after the id
+
+class DebugLog
+{
+
+public:
+  enum value_type : uint8_t
+  {
+    DLT_NONE,     ///< The text alone
+    DLT_INT,
+    DLT_UINT,
+    DLT_HEX,
+    DLT_TEXT,
+  };
+
+  enum record_type : uint8_t
+  {
+    DLR_TIME = 0x01,
+    DLR_DEFINE = 0x02,
+    DLR_LOST = 0x03,
+    DLR_ENTRY = 0x10,   ///< To 0x15, with the bytes of time
+  };
+
+  typedef size_t (*WriteHandler)(const uint8_t* data, size_t size);
+
+  DebugLog (WriteHandler wh, uint8_t id);
+
+  // Any task
+  void put(const char* fmt) { record(fmt, DLT_NONE, 0, nullptr); }
+  void put(const char* fmt, const char* text) { record(fmt, DLT_TEXT, 0, text); }
+  void put(const char* fmt, char* text) { record(fmt, DLT_TEXT, 0, text); }
+  template <typename T> void put(const char* fmt, T v, bool bHex = false)
+    { record(fmt, bHex ? DLT_HEX : std::is_signed<T>::value ? DLT_INT : DLT_UINT, (uint32_t)v, nullptr); }
+
+  // UI task
+  bool drain();
+
+  uint32_t getRecords() { return records_; }
+  uint32_t getLost() { return lost_.load(std::memory_order_relaxed); }
+  uint32_t getFrames() { return frames_; }
+
+private:
+  typedef struct
+  {
+    std::atomic<uint32_t> seq_;   ///< Slot free for position seq_, or filled for seq_ - 1
+    const char* fmt_;
+    uint32_t  us_;
+    uint8_t   type_;
+    union
+    {
+      uint32_t  value_;
+      char      text_[DLOG_TEXT];
+    };
+  } Slot;
+
+  void record(const char* fmt, value_type type, uint32_t value, const char* text);
+  int16_t find(const char* fmt);
+
+  WriteHandler wh_;
+  uint8_t   id_;              ///< SysEx id of the frames
+
+  Slot      slot_[DLOG_SLOTS];
+  std::atomic<uint32_t> head_;  ///< Next position to fill, any task
+  uint32_t  tail_;              ///< Next position to drain, the UI task
+
+  const char* format_[DLOG_FORMATS];  ///< Texts numbered, by number
+  uint8_t   nextFormat_;        ///< Number given next
+
+  uint32_t  records_;           ///< Records sent
+  std::atomic<uint32_t> lost_;  ///< Records dropped with the ring full
+  uint32_t  lostSent_;          ///< Of those, reported
+  uint32_t  frames_;            ///< Frames sent
+};
+
+extern DebugLog debugLog;
+
+#endif // DebugLog_h
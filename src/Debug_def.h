@@ -1,12 +1,30 @@
 #pragma once
 
+#ifndef DEBUG_ON
 #define DEBUG_ON  0
+#endif
+#ifndef DEBUG_LOG
+#define DEBUG_LOG 1   // DEBUG_ON output as binary records on Serial2, see DebugLog.h
+#endif
+
+#if DEBUG_ON && DEBUG_LOG
+
+#include "DebugLog.h"
+
+#define DEBUG(s, x)  debugLog.put(s, x)
+#define DEBUGX(s, x) debugLog.put(s, x, true)
+#define DEBUGS(s)    debugLog.put(s)
+#define DEBUG_SERIAL 0
+#define SERIAL_RATE 31250
+
+#elif DEBUG_ON
 
-#if DEBUG_ON
+#include <Arduino.h>
 
 #define DEBUG(s, x)  do { Serial.print(F(s)); Serial.print(x); } while(false)
 #define DEBUGX(s, x) do { Serial.print(F(s)); Serial.print(F("0x")); Serial.print(x, HEX); } while(false)
 #define DEBUGS(s)    do { Serial.print(F(s)); } while (false)
+#define DEBUG_SERIAL 1  // Serial is taken by the text, not the MIDI port
 #define SERIAL_RATE 115200
 
 #else
@@ -14,8 +32,12 @@
 #define DEBUG(s, x)
 #define DEBUGX(s, x)
 #define DEBUGS(s)
+#define DEBUG_SERIAL 0
 #define SERIAL_RATE 31250
 
 #endif
 
-#define SERIAL2_RATE 115200
\ No newline at end of file
+#define SERIAL2_RATE 115200
+#define SERIAL2_FRAME_SIZE 256    // longest F0..F7 frame accepted on Serial2
+#define SERIAL2_LOOP_BYTES 32     // most Serial2 bytes handled per loop() pass
+#define SERIAL2_QUERY_ID 0x7d     // SysEx ID (non-commercial) of operator queries on Serial2
@@ -6,55 +6,131 @@
 // IR Remote ***********************************************************
 
 #include "TinyIRReceiver.hpp" 
-volatile struct TinyIRReceiverCallbackDataStruct sCallbackData;
 
-IRRemoteTinyReceiver::KeyResult IRRemoteTinyReceiver::keyResult_ = IRRemoteTinyReceiver::KEY_NULL;
-uint8_t IRRemoteTinyReceiver::lastKey_ = 0;
+IRRemoteTinyReceiver::IRFrame IRRemoteTinyReceiver::frames_[IR_FRAME_QUEUE];
+volatile uint8_t IRRemoteTinyReceiver::frameHead_ = 0;
+volatile uint8_t IRRemoteTinyReceiver::frameTail_ = 0;
+volatile uint32_t IRRemoteTinyReceiver::dropped_ = 0;
 
 IRRemoteTinyReceiver::IRRemoteTinyReceiver (IRRemoteRxKeyValue* kv, uint8_t kvSize)
-:kv_(kv), kvSize_(kvSize)
+:kv_(kv), kvSize_(kvSize),
+ dpressEnabled_(false), longEnabled_(false), repeatEnabled_(false), repeatResult_(false),
+ heldKey_(0), pressTime_(0), frameTime_(0), repeatTime_(0), longDone_(false),
+ lastPressKey_(0), lastPressTime_(0),
+ resHead_(0), resTail_(0), keyResult_(KEY_NULL), lastKey_(0)
 {};
 
 void IRRemoteTinyReceiver::Init ()
 {
       // Enables the interrupt generation on change of IR input signal
-      DEBUG("\n", "*****************************");
+      DEBUGS("\n*****************************");
   if (!initPCIInterruptForTinyReceiver()) {
-      DEBUG("\n", F("No interrupt available for pin " STR(IR_RECEIVE_PIN))); // optimized out by the compiler, if not required :-)
+      DEBUGS("\nNo interrupt available for pin " STR(IR_RECEIVE_PIN)); // optimized out by the compiler, if not required :-)
   }
 
 #if defined(USE_FAST_PROTOCOL)
-    DEBUG("\n", F("Ready to receive Fast IR signals at pin " STR(IR_RECEIVE_PIN)));
+    DEBUGS("\nReady to receive Fast IR signals at pin " STR(IR_RECEIVE_PIN));
 #else
-    DEBUG("\n", F("Ready to receive NEC IR signals at pin " STR(IR_RECEIVE_PIN)));
+    DEBUGS("\nReady to receive NEC IR signals at pin " STR(IR_RECEIVE_PIN));
 #endif
 }
 
 void IRRemoteTinyReceiver::Update ()
+// Classify every frame the ISR has queued since the last call, then
+// check for released keys
 {
-      if (sCallbackData.justWritten) {
-        sCallbackData.justWritten = false;
-        keyResult_ = IRRemoteTinyReceiver::KEY_PRESS;
-        IRRemoteTinyReceiver::lastKey_ = FindKey (sCallbackData.Address, sCallbackData.Command);
+    while (frameTail_ != frameHead_)
+    {
+        IRFrame f = frames_[frameTail_];
+        frameTail_ = (frameTail_ + 1) & (IR_FRAME_QUEUE - 1);
 
 #if defined(USE_FAST_PROTOCOL)
-        DEBUG("", F("Command=0x"));
+        DEBUGX("\nCommand=", f.command_);
 #else
-        DEBUG("", F("Address=0x"));
-        DEBUG(sCallbackData.Address, HEX);
-        DEBUG("", F(" Command=0x"));
+        DEBUGX("\nAddress=", f.address_);
+        DEBUGX(" Command=", f.command_);
 #endif
-        DEBUG(sCallbackData.Command, HEX);
-        if (sCallbackData.Flags == IRDATA_FLAGS_IS_REPEAT) {
-            DEBUG("", F(" Repeat"));
+        if (f.flags_ & IRDATA_FLAGS_IS_REPEAT) {
+            DEBUGS(" Repeat");
         }
-        if (sCallbackData.Flags == IRDATA_FLAGS_PARITY_FAILED) {
-            DEBUG("", F(" Parity failed"));
+        if (f.flags_ & IRDATA_FLAGS_PARITY_FAILED) {
+            DEBUGS(" Parity failed");
+            continue;
         }
-        DEBUG("\n", "");
 
-        
+        processFrame(f.time_, FindKey(f.address_, f.command_), f.flags_ & IRDATA_FLAGS_IS_REPEAT);
     }
+
+    processTime(millis());
+}
+
+void IRRemoteTinyReceiver::processFrame (uint32_t t, uint8_t key, bool bRepeat)
+// Classify one decoded frame received at time 't'
+{
+  processTime(t);
+
+  if (key == 0)
+    return;     // not one of our keys
+
+  if (bRepeat)
+  {
+    // NEC repeat frames carry no data, TinyIR fills in the last command
+    if (heldKey_ != key)
+      return;
+
+    frameTime_ = t;
+    if (longEnabled_ && !longDone_ && t - pressTime_ >= IR_LONGPRESS_TIME)
+    {
+      longDone_ = true;
+      result(KEY_LONGPRESS, key);
+    }
+    if (repeatEnabled_ && (int32_t)(t - repeatTime_) >= 0)
+    {
+      repeatTime_ = t + IR_REPEAT_TIME;
+      result(repeatResult_ ? KEY_RPTPRESS : KEY_PRESS, key);
+    }
+    return;
+  }
+
+  // a new press
+  heldKey_ = key;
+  pressTime_ = frameTime_ = t;
+  repeatTime_ = t + IR_REPEAT_DELAY;
+  longDone_ = false;
+
+  if (dpressEnabled_ && key == lastPressKey_ && t - lastPressTime_ < IR_DPRESS_TIME)
+  {
+    lastPressKey_ = 0;
+    result(KEY_DPRESS, key);
+  }
+  else
+  {
+    lastPressKey_ = key;
+    lastPressTime_ = t;
+    result(KEY_PRESS, key);
+  }
+}
+
+void IRRemoteTinyReceiver::processTime (uint32_t t)
+// A held key counts as released once its repeat frames stop
+{
+  if (heldKey_ != 0 && t - frameTime_ > IR_RELEASE_TIME)
+    heldKey_ = 0;
+}
+
+void IRRemoteTinyReceiver::result (KeyResult kr, uint8_t key)
+{
+  uint8_t n = (resHead_ + 1) & (IR_RESULT_QUEUE - 1);
+
+  if (n == resTail_)
+  {
+    dropped_++;
+    return;
+  }
+
+  results_[resHead_].kr_ = kr;
+  results_[resHead_].key_ = key;
+  resHead_ = n;
 }
 
 uint8_t IRRemoteTinyReceiver::FindKey (uint16_t  address, uint8_t command)
@@ -71,10 +147,15 @@ uint8_t IRRemoteTinyReceiver::FindKey (uint16_t  address, uint8_t command)
 }
 
 IRRemoteTinyReceiver::KeyResult IRRemoteTinyReceiver::read()
+// Next key result in order of arrival, the key is then given by getKey()
 {
-  KeyResult keyResult = keyResult_;
-  keyResult_ = KEY_NULL;
-  return keyResult;
+  if (resTail_ == resHead_)
+    return KEY_NULL;
+
+  keyResult_ = results_[resTail_].kr_;
+  lastKey_ = results_[resTail_].key_;
+  resTail_ = (resTail_ + 1) & (IR_RESULT_QUEUE - 1);
+  return keyResult_;
 }
 
 uint8_t IRRemoteTinyReceiver::getKey()
@@ -82,6 +163,22 @@ uint8_t IRRemoteTinyReceiver::getKey()
   return lastKey_;
 }
 
+bool IRRemoteTinyReceiver::pushFrame(const IRFrame& f)
+// Called from the ISR, the only producer of the frame queue
+{
+  uint8_t n = (frameHead_ + 1) & (IR_FRAME_QUEUE - 1);
+
+  if (n == frameTail_)
+  {
+    dropped_++;
+    return false;
+  }
+
+  frames_[frameHead_] = f;
+  frameHead_ = n;
+  return true;
+}
+
 #if defined(USE_FAST_PROTOCOL)
 void handleReceivedTinyIRData(uint8_t aCommand, uint8_t aFlags)
 #elif defined(USE_ONKYO_PROTOCOL)
@@ -90,15 +187,20 @@ void handleReceivedTinyIRData(uint16_t aAddress, uint16_t aCommand, uint8_t aFla
 void handleReceivedTinyIRData(uint8_t aAddress, uint8_t aCommand, uint8_t aFlags)
 #endif
 {
-    DEBUG("\n", "handleReceivedTinyIRData");
-#if defined(ARDUINO_ARCH_MBED) || defined(ESP32)
-    // Copy data for main loop, this is the recommended way for handling a callback :-)
+#if defined(ARDUINO_ARCH_MBED) || defined(ESP32) || defined(NATIVE_BUILD)
+    // Queue a timestamped copy of the frame for the main loop, so a
+    // second press arriving before Update() runs is not lost
+    IRRemoteTinyReceiver::IRFrame f;
+
+    f.time_ = millis();
 #  if !defined(USE_FAST_PROTOCOL)
-    sCallbackData.Address = aAddress;
+    f.address_ = aAddress;
+#  else
+    f.address_ = 0;
 #  endif
-    sCallbackData.Command = aCommand;
-    sCallbackData.Flags = aFlags;
-    sCallbackData.justWritten = true;
+    f.command_ = aCommand;
+    f.flags_ = aFlags;
+    IRRemoteTinyReceiver::pushFrame(f);
 #else
     /*
      * Printing is not allowed in ISR context for any kind of RTOS
@@ -112,4 +214,4 @@ void handleReceivedTinyIRData(uint8_t aAddress, uint8_t aCommand, uint8_t aFlags
     printTinyReceiverResultMinimal(&Serial, aAddress, aCommand, aFlags);
 #  endif
 #endif
-}
\ No newline at end of file
+}
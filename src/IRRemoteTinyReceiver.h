@@ -13,6 +13,15 @@
 
 #define IR_RECEIVE_PIN    32
 
+#define IR_FRAME_QUEUE    16      // frames buffered between the ISR and Update(), power of 2
+#define IR_RESULT_QUEUE   8       // key results waiting for read(), power of 2
+
+#define IR_DPRESS_TIME    300     // ms between presses to count as a double press
+#define IR_LONGPRESS_TIME 600     // ms held to count as a long press
+#define IR_REPEAT_DELAY   400     // ms held before repeats start
+#define IR_REPEAT_TIME    100     // ms between repeats
+#define IR_RELEASE_TIME   150     // ms without a frame to count as released (NEC repeats every 108 ms)
+
 class IRRemoteTinyReceiver
 {
 
@@ -35,6 +44,14 @@ public:
     uint8_t   value_;        ///< Identifier for this key, returned using getKey()
   } IRRemoteRxKeyValue;
 
+  typedef struct
+  {
+    uint32_t  time_;         ///< millis() when the frame was decoded
+    uint16_t  address_;
+    uint8_t   command_;
+    uint8_t   flags_;        ///< TinyIR flags, repeat or parity failed
+  } IRFrame;
+
   IRRemoteTinyReceiver (IRRemoteRxKeyValue* kv, uint8_t kvSize);
 
   static void Init();
@@ -45,12 +62,49 @@ public:
 
   uint8_t FindKey (uint16_t  address, uint8_t command);
 
+  // Press classification, these are all disabled by default
+  void enableDoublePress(bool f) { dpressEnabled_ = f; }
+  void enableLongPress(bool f) { longEnabled_ = f; }
+  void enableRepeat(bool f) { repeatEnabled_ = f; }
+  void enableRepeatResult(bool f) { repeatResult_ = f; }
+
+  // Classifier inputs, fed by Update() from the frame queue. Public so
+  // the classification can be driven with synthetic timings.
+  void processFrame(uint32_t t, uint8_t key, bool bRepeat);
+  void processTime(uint32_t t);
+
+  static bool pushFrame(const IRFrame& f);
+  static uint32_t getDropped() { return dropped_; }
+
 private:
+  void result(KeyResult kr, uint8_t key);
+
   IRRemoteRxKeyValue* kv_;
   uint8_t kvSize_;
-public:
-  static KeyResult keyResult_;
-  static uint8_t   lastKey_;
+
+  // classifier state
+  bool      dpressEnabled_, longEnabled_, repeatEnabled_, repeatResult_;
+  uint8_t   heldKey_;        ///< Key currently held, 0 if none
+  uint32_t  pressTime_;      ///< When heldKey_ went down
+  uint32_t  frameTime_;      ///< Last frame for heldKey_
+  uint32_t  repeatTime_;     ///< Next repeat due
+  bool      longDone_;       ///< Long press already reported for this hold
+  uint8_t   lastPressKey_;   ///< Last key reported as a press, for double press
+  uint32_t  lastPressTime_;
+
+  struct
+  {
+    KeyResult kr_;
+    uint8_t   key_;
+  } results_[IR_RESULT_QUEUE];
+  uint8_t   resHead_, resTail_;
+  KeyResult keyResult_;
+  uint8_t   lastKey_;
+
+  // ISR to Update() frame queue
+  static IRFrame frames_[IR_FRAME_QUEUE];
+  static volatile uint8_t frameHead_, frameTail_;
+  static volatile uint32_t dropped_;
 };
 
-#endif // IRRemoteTinyReceiver_h
\ No newline at end of file
+#endif // IRRemoteTinyReceiver_h
@@ -0,0 +1,93 @@
+#include "Debug_def.h"
+#include "LatencyStats.h"
+#include <string.h>
+
+// Latency Statistics **************************************************
+
+LatencyStats::LatencyStats ()
+:lastLoop_(0), missed_(0), transitions_(0), lastGap_(0), maxGap_(0),
+ head_(0), tail_(0)
+{
+  memset(&late_, 0, sizeof(late_));
+  memset(&loop_, 0, sizeof(loop_));
+};
+
+void LatencyStats::record (Histogram& h, uint32_t v)
+{
+  uint8_t b = 0;
+
+  for (uint32_t x = v >> 1; x != 0 && b < LAT_BUCKETS - 1; x >>= 1)
+    b++;
+
+  h.bucket_[b]++;
+  h.count_++;
+  if (v > h.max_)
+    h.max_ = v;
+}
+
+void LatencyStats::markDue (uint32_t dueUs)
+// Stamp an event that has just been handed to the output stage. Must be
+// called after the event is queued, so that a stamp is never taken out
+// before its event has been written.
+{
+  uint16_t t = tail_.load(std::memory_order_relaxed);
+  uint16_t n = (t + 1) & (LAT_STAMP_QUEUE - 1);
+
+  if (n == head_.load(std::memory_order_acquire))
+  {
+    missed_++;
+    return;
+  }
+
+  stamp_[t] = dueUs;
+  tail_.store(n, std::memory_order_release);
+}
+
+uint16_t LatencyStats::mark ()
+// Position in the stamp queue before the output task drains its sources.
+// Everything stamped up to here is written by the following flush.
+{
+  return(tail_.load(std::memory_order_acquire));
+}
+
+void LatencyStats::markSent (uint16_t mark, uint32_t nowUs)
+// The events stamped before 'mark' have been written to the UART at 'nowUs'
+{
+  uint16_t h = head_.load(std::memory_order_relaxed);
+
+  while (h != mark)
+  {
+    int32_t late = (int32_t)(nowUs - stamp_[h]);
+
+    record(late_, late > 0 ? late : 0);
+    h = (h + 1) & (LAT_STAMP_QUEUE - 1);
+  }
+  head_.store(h, std::memory_order_release);
+}
+
+void LatencyStats::loopTime (uint32_t nowUs)
+// Called at the top of every loop() pass
+{
+  if (lastLoop_ != 0)
+    record(loop_, nowUs - lastLoop_);
+  lastLoop_ = nowUs;
+}
+
+void LatencyStats::transition (uint32_t gapUs)
+// A set list song has started 'gapUs' after the end of the one before
+{
+  transitions_++;
+  lastGap_ = gapUs;
+  if (gapUs > maxGap_)
+    maxGap_ = gapUs;
+}
+
+void LatencyStats::reset ()
+// Clear the histograms. Stamps in flight are kept so the queue stays in step.
+{
+  memset(&late_, 0, sizeof(late_));
+  memset(&loop_, 0, sizeof(loop_));
+  lastLoop_ = 0;
+  missed_ = 0;
+  transitions_ = lastGap_ = maxGap_ = 0;
+}
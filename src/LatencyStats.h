@@ -0,0 +1,72 @@
+#ifndef LatencyStats_h
+#define LatencyStats_h
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Fixed memory timing instrumentation for the output path.
+ *
+ * Each player event is stamped with the system time it became due as it
+ * leaves the scheduler (markDue) and again when the output task has
+ * written its bytes to the UART (markSent). The difference goes into a
+ * lateness histogram. Loop iteration times are kept the same way.
+ *
+ * Histograms use power of 2 buckets: bucket 0 counts values below 2 us,
+ * bucket n counts values from 2^n up to 2^(n+1) us, the last bucket
+ * everything above.
+ */
+
+#define LAT_BUCKETS     16        // 1 us .. 32 ms and over
+#define LAT_STAMP_QUEUE 64        // events in flight, must be a power of 2
+
+class LatencyStats
+{
+
+public:
+  typedef struct
+  {
+    uint32_t  count_;
+    uint32_t  max_;
+    uint32_t  bucket_[LAT_BUCKETS];
+  } Histogram;
+
+  LatencyStats ();
+
+  // Output path, markDue() from the scheduler, markSent() from the output task
+  void markDue(uint32_t dueUs);
+  uint16_t mark();
+  void markSent(uint16_t mark, uint32_t nowUs);
+
+  // Main loop
+  void loopTime(uint32_t nowUs);
+
+  // Set list song changes
+  void transition(uint32_t gapUs);
+
+  void reset();
+
+  const Histogram& getLateness() { return late_; }
+  const Histogram& getLoop() { return loop_; }
+  uint32_t getMissed() { return missed_; }
+  uint32_t getTransitions() { return transitions_; }
+  uint32_t getLastGap() { return lastGap_; }
+  uint32_t getMaxGap() { return maxGap_; }
+
+  static void record(Histogram& h, uint32_t v);
+
+private:
+  Histogram late_;          ///< Due to UART write, us
+  Histogram loop_;          ///< Between loop() passes, us
+  uint32_t  lastLoop_;      ///< Start of the previous loop() pass, 0 if none
+  uint32_t  missed_;        ///< Events not stamped because the queue was full
+  uint32_t  transitions_;   ///< Song changes in set list play
+  uint32_t  lastGap_;       ///< us the last song started late
+  uint32_t  maxGap_;        ///< Worst of those
+
+  uint32_t  stamp_[LAT_STAMP_QUEUE];
+  std::atomic<uint16_t> head_;
+  std::atomic<uint16_t> tail_;
+};
+
+#endif // LatencyStats_h
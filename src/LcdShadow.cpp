@@ -0,0 +1,80 @@
+#include "Debug_def.h"
+#include "LcdShadow.h"
+
+// LCD Shadow **********************************************************
+
+LcdShadow::LcdShadow (LiquidCrystal& lcd)
+:lcd_(lcd), dirty_(false), curR_(0), curC_(LCDS_COLS),
+ period_(1000 / LCDS_DEFAULT_RATE), lastFlush_(0), bytesSent_(0)
+{
+  begin();
+};
+
+void LcdShadow::begin ()
+// Match a display that has just been cleared
+{
+  memset(want_, ' ', sizeof(want_));
+  memset(shown_, ' ', sizeof(shown_));
+  dirty_ = false;
+  curC_ = LCDS_COLS;
+}
+
+void LcdShadow::write (uint8_t r, uint8_t c, const char* msg, bool clrEol)
+// Put a message in the shadow buffer with optional spaces padding the end.
+// Characters beyond the end of the line are dropped.
+{
+  if (r >= LCDS_ROWS)
+    return;
+
+  while (*msg != '\0' && c < LCDS_COLS)
+    want_[r][c++] = *msg++;
+
+  if (clrEol)
+  {
+    while (c < LCDS_COLS)
+      want_[r][c++] = ' ';
+  }
+
+  dirty_ = memcmp(want_, shown_, sizeof(want_)) != 0;
+}
+
+bool LcdShadow::flush (uint32_t nowMs, bool bForce)
+// Send the changed characters to the display, if the rate limit allows.
+// A single unchanged character between two changes is rewritten rather
+// than moving the cursor, as both cost one transfer.
+// Returns true if anything was sent.
+{
+  if (!dirty_ || (!bForce && nowMs - lastFlush_ < period_))
+    return(false);
+
+  for (uint8_t r = 0; r < LCDS_ROWS; r++)
+  {
+    for (uint8_t c = 0; c < LCDS_COLS; c++)
+    {
+      if (want_[r][c] == shown_[r][c])
+        continue;
+
+      if (curR_ != r || curC_ > c || curC_ + 1 < c)
+      {
+        lcd_.setCursor(c, r);
+        bytesSent_++;
+      }
+      else if (curC_ + 1 == c)
+      {
+        lcd_.write(want_[r][c-1]);  // bridge the gap
+        bytesSent_++;
+      }
+
+      lcd_.write(want_[r][c]);
+      bytesSent_++;
+      shown_[r][c] = want_[r][c];
+      curR_ = r;
+      curC_ = c + 1;
+    }
+  }
+
+  dirty_ = false;
+  lastFlush_ = nowMs;
+
+  return(true);
+}
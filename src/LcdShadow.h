@@ -0,0 +1,46 @@
+#ifndef LcdShadow_h
+#define LcdShadow_h
+
+#include <stdint.h>
+#include <LiquidCrystal.h>
+
+/*
+ * Shadow framebuffer for the character LCD.
+ *
+ * Messages are written to RAM only. flush() compares the wanted screen
+ * with what is known to be on the display and sends just the changed
+ * characters, skipping the cursor command when the display address is
+ * already in the right place. Flushes are limited to a maximum rate.
+ */
+
+#define LCDS_ROWS         2
+#define LCDS_COLS         16
+#define LCDS_DEFAULT_RATE 10      // flushes per second
+
+class LcdShadow
+{
+
+public:
+  LcdShadow (LiquidCrystal& lcd);
+
+  void begin();
+  void write(uint8_t r, uint8_t c, const char* msg, bool clrEol = false);
+  bool flush(uint32_t nowMs, bool bForce = false);
+
+  void setRate(uint16_t hz) { period_ = (hz == 0) ? 0 : 1000 / hz; }
+  bool isDirty() { return dirty_; }
+  uint32_t getBytesSent() { return bytesSent_; }
+  void resetStats() { bytesSent_ = 0; }
+
+private:
+  LiquidCrystal& lcd_;
+  char      want_[LCDS_ROWS][LCDS_COLS];  ///< Screen as the application wants it
+  char      shown_[LCDS_ROWS][LCDS_COLS]; ///< Screen as it is on the display
+  bool      dirty_;
+  uint8_t   curR_, curC_;   ///< Display address, LCDS_COLS if unknown
+  uint16_t  period_;        ///< Minimum milliseconds between flushes
+  uint32_t  lastFlush_;
+  uint32_t  bytesSent_;     ///< Characters and cursor commands sent
+};
+
+#endif // LcdShadow_h
@@ -0,0 +1,132 @@
+#include "Debug_def.h"
+#include "MidiClock.h"
+#include "TempoEngine.h"
+#include <stdlib.h>
+
+// MIDI Clock **********************************************************
+
+MidiClock::MidiClock ()
+:head_(0), tail_(0), count_(0), localCount_(0), startUs_(0), period_(0), phase_(0), tempo_(0),
+ inStep_(0), locked_(false), pulses_(0), lockUs_(0), jitter_(0), overruns_(0)
+{};
+
+bool MidiClock::receive (uint8_t status, uint32_t arrivedUs)
+// Queue a real time message from the clock source.
+// Returns false if the queue is full.
+{
+  uint16_t t = tail_.load(std::memory_order_relaxed);
+  uint16_t n = (t + 1) & (MCLK_RX_QUEUE - 1);
+
+  if (n == head_.load(std::memory_order_acquire))
+  {
+    overruns_++;
+    return(false);
+  }
+
+  rx_[t].status_ = status;
+  rx_[t].arrivedUs_ = arrivedUs;
+  tail_.store(n, std::memory_order_release);
+
+  return(true);
+}
+
+bool MidiClock::read (Message& m)
+// Take the next message in the order they came, false if there is none
+{
+  uint16_t h = head_.load(std::memory_order_relaxed);
+
+  if (h == tail_.load(std::memory_order_acquire))
+    return(false);
+
+  m = rx_[h];
+  head_.store((h + 1) & (MCLK_RX_QUEUE - 1), std::memory_order_release);
+
+  return(true);
+}
+
+void MidiClock::start (uint32_t songUs)
+// The song and the external clock start together at song time 'songUs',
+// the pulses of both are counted from here
+{
+  count_ = 0;
+  localCount_ = 0;
+  startUs_ = songUs;
+  phase_ = 0;
+  inStep_ = 0;
+  locked_ = false;
+}
+
+void MidiClock::local (uint32_t songUs)
+// A pulse of the song, as the tempo engine works it out
+{
+  local_[localCount_ & (MCLK_LOCAL - 1)] = songUs;
+  localCount_++;
+}
+
+void MidiClock::pulse (uint32_t songUs)
+// An external clock pulse arrived at song time 'songUs'. Measure the
+// period, compare the phase with the song and work out the tempo to follow.
+{
+  pulses_++;
+  if (count_ > 0)
+  {
+    uint32_t n = (count_ < MCLK_SPAN) ? count_ : MCLK_SPAN - 1;
+    uint32_t last = ext_[(count_ - 1) % MCLK_SPAN];
+
+    period_ = ((uint64_t)(songUs - ext_[(count_ - n) % MCLK_SPAN]) << 8) / n;
+    if (count_ >= MCLK_SPAN)
+    {
+      uint32_t d = abs((int32_t)(songUs - last) - (int32_t)(period_ >> 8));
+
+      if (d > jitter_)
+        jitter_ = d;
+    }
+  }
+  ext_[count_ % MCLK_SPAN] = songUs;
+  count_++;
+
+  // phase against the nearest song pulse, smoothed
+  if (localCount_ > 0)
+  {
+    uint32_t kept = (localCount_ < MCLK_LOCAL) ? localCount_ : MCLK_LOCAL;
+    int32_t e = (int32_t)(songUs - local_[(localCount_ - 1) & (MCLK_LOCAL - 1)]);
+
+    for (uint32_t i = 1; i < kept; i++)
+    {
+      int32_t d = (int32_t)(songUs - local_[(localCount_ - 1 - i) & (MCLK_LOCAL - 1)]);
+
+      if (abs(d) < abs(e))
+        e = d;
+    }
+    phase_ += ((e << 8) - phase_) / MCLK_SMOOTH;
+
+    if (abs(phase_ >> 8) < MCLK_LOCK_US)
+    {
+      if (++inStep_ >= MCLK_LOCK_PULSES && !locked_)
+      {
+        locked_ = true;
+        lockUs_ = songUs - startUs_;
+      }
+    }
+    else
+    {
+      inStep_ = 0;
+      locked_ = false;
+    }
+  }
+
+  // pulses that came together, e.g. in one BLE packet, give no period yet
+  if (count_ < 2 || period_ == 0)
+    return;
+
+  // the measured tempo, bent to take up the phase error
+  int64_t base = ((60000000ULL * TEMPO_FRAC) << 8) / ((uint64_t)period_ * TEMPO_PPQ);
+  int64_t bend = base * (phase_ >> 8) / MCLK_CORRECT_US;
+  int64_t most = base * MCLK_BEND_MAX / 100;
+
+  if (bend > most)
+    bend = most;
+  else if (bend < -most)
+    bend = -most;
+  tempo_ = base - bend;
+}
@@ -0,0 +1,91 @@
+#ifndef MidiClock_h
+#define MidiClock_h
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Following an external MIDI clock.
+ *
+ * The task reading the clock source receive()s each system real time
+ * message stamped with its arrival time, and the player takes them in
+ * order with read(). It acts on Start, Stop and Continue itself and hands
+ * every clock pulse, converted to song time, to pulse().
+ *
+ * The tempo comes from a phase locked loop. The period of the external
+ * clock is measured over the last MCLK_SPAN pulses, so the arrival jitter
+ * of a BLE link or a busy serial port is spread thin. Each external pulse
+ * is also compared with the nearest pulse of the song, which the tempo
+ * engine hands to local(), and the tempo is bent by up to MCLK_BEND_MAX
+ * to take up the smoothed phase error over about MCLK_CORRECT_US. The
+ * clock is locked once the smoothed error has stayed within MCLK_LOCK_US
+ * for MCLK_LOCK_PULSES pulses, and the time that took is kept.
+ *
+ * receive() is called by one task only, everything else by the player.
+ */
+
+#define MCLK_RX_QUEUE     64      // messages waiting to be read, must be a power of 2
+#define MCLK_SPAN         96      // pulses the period is measured over, 4 quarters
+#define MCLK_LOCAL        32      // song pulses kept for the phase, must be a power of 2
+#define MCLK_SMOOTH       8       // phase error smoothing, 1/n of each new error
+#define MCLK_CORRECT_US   1000000 // time to take up a phase error in
+#define MCLK_BEND_MAX     5       // % the tempo may be bent by to do it
+#define MCLK_LOCK_US      2000    // smoothed phase error counted as in step
+#define MCLK_LOCK_PULSES  48      // pulses in step to be locked, 2 quarters
+
+class MidiClock
+{
+
+public:
+  typedef struct
+  {
+    uint8_t   status_;
+    uint32_t  arrivedUs_;
+  } Message;
+
+  MidiClock ();
+
+  // Clock source side
+  bool receive(uint8_t status, uint32_t arrivedUs);
+
+  // Player side
+  bool read(Message& m);
+  void start(uint32_t songUs);
+  void pulse(uint32_t songUs);
+  void local(uint32_t songUs);
+
+  bool hasTempo() { return count_ >= 2; }
+  uint32_t getTempo() { return tempo_; }
+  bool isLocked() { return locked_; }
+  int32_t getPhase() { return phase_ >> 8; }
+
+  uint32_t getPulses() { return pulses_; }
+  uint32_t getLockUs() { return lockUs_; }
+  uint32_t getJitter() { return jitter_; }
+  uint32_t getOverruns() { return overruns_; }
+  void resetStats() { pulses_ = jitter_ = overruns_ = 0; }
+
+private:
+  Message   rx_[MCLK_RX_QUEUE];
+  std::atomic<uint16_t> head_;  ///< Owned by the player
+  std::atomic<uint16_t> tail_;  ///< Owned by the clock source
+
+  uint32_t  ext_[MCLK_SPAN];    ///< Song time of the last external pulses
+  uint32_t  count_;             ///< External pulses since start()
+  uint32_t  local_[MCLK_LOCAL]; ///< Song time of the last song pulses
+  uint32_t  localCount_;
+  uint32_t  startUs_;           ///< Song time of start()
+
+  uint32_t  period_;            ///< External pulse length in us << 8
+  int32_t   phase_;             ///< Smoothed phase error in us << 8, + when the song is ahead
+  uint32_t  tempo_;             ///< To follow, in 1/TEMPO_FRAC BPM
+  uint16_t  inStep_;            ///< Pulses in a row within MCLK_LOCK_US
+  bool      locked_;
+
+  uint32_t  pulses_;            ///< External pulses taken
+  uint32_t  lockUs_;            ///< From start() to lock, the last time it locked
+  uint32_t  jitter_;            ///< Largest pulse interval difference from the period, us
+  uint32_t  overruns_;          ///< Messages lost to a full queue
+};
+
+#endif // MidiClock_h
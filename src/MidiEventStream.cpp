@@ -0,0 +1,265 @@
+#include "Debug_def.h"
+#include "MidiEventStream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+// MIDI Event Stream ***************************************************
+
+MidiEventStream::MidiEventStream (TempoEngine& te)
+:te_(te), events_(nullptr), maxEvents_(0), count_(0), mapCount_(0),
+ ticksPerQuarter_(0), endTick_(0), valid_(false), looping_(false), idx_(0),
+ mapIdx_(0), playTick_(0)
+{};
+
+bool MidiEventStream::begin ()
+// Reserve the event buffer. Done once, early, before the heap fragments.
+{
+  events_ = (Event*)malloc(MES_BUFFER_SIZE);
+  maxEvents_ = (events_ == nullptr) ? 0 : MES_BUFFER_SIZE / sizeof(Event);
+  DEBUG("\nEvent stream capacity ", maxEvents_);
+
+  return(events_ != nullptr);
+}
+
+void MidiEventStream::clear (uint16_t ticksPerQuarter)
+{
+  count_ = 0;
+  mapCount_ = 0;
+  ticksPerQuarter_ = ticksPerQuarter;
+  endTick_ = 0;
+  valid_ = (events_ != nullptr);
+  restart();
+}
+
+bool MidiEventStream::append (uint32_t tick, const uint8_t* data, uint8_t size)
+// Add a channel message at 'tick', or F0 and the two bytes of a SysEx
+// block id. Anything that does not fit the compact format or the buffer
+// invalidates the stream.
+{
+  uint8_t expected = ((data[0] & 0xf0) == 0xc0 || (data[0] & 0xf0) == 0xd0) ? 2 : 3;
+
+  if (!valid_ || count_ >= maxEvents_ || tick > 0xffffff ||
+      data[0] < 0x80 || data[0] > 0xf0 || size != expected)
+  {
+    valid_ = false;
+    return(false);
+  }
+
+  Event* pev = &events_[count_++];
+  pev->tick_ = tick;
+  pev->status_ = data[0];
+  pev->data_[0] = data[1];
+  pev->data_[1] = (size > 2) ? data[2] : 0;
+
+  return(true);
+}
+
+bool MidiEventStream::setState (uint32_t tick, uint32_t usPerQuarter, uint16_t timeSig)
+// Record the tempo and time signature from 'tick' onwards.
+// Only changes are stored.
+{
+  if (!valid_)
+    return(false);
+
+  if (mapCount_ > 0)
+  {
+    MapEntry* last = &map_[mapCount_ - 1];
+
+    if (last->usPerQuarter_ == usPerQuarter && last->timeSig_ == timeSig)
+      return(true);
+    if (last->tick_ == tick)
+      mapCount_--;    // several changes at the same tick, keep the last
+  }
+
+  if (mapCount_ >= MES_MAP_SIZE)
+  {
+    valid_ = false;
+    return(false);
+  }
+
+  map_[mapCount_].tick_ = tick;
+  map_[mapCount_].usPerQuarter_ = usPerQuarter;
+  map_[mapCount_].timeSig_ = timeSig;
+  mapCount_++;
+
+  return(true);
+}
+
+bool MidiEventStream::end (uint32_t tick)
+// Finish building, 'tick' is the length of the song
+{
+  endTick_ = tick;
+  valid_ = valid_ && mapCount_ > 0 && tick <= 0xffffff;
+  restart();
+
+  DEBUG("\nEvent stream events ", count_);
+  DEBUG(" map ", mapCount_);
+  DEBUG(" valid ", valid_);
+
+  return(valid_);
+}
+
+uint32_t MidiEventStream::getImageSize ()
+// Bytes saveImage() writes, the header, tempo map and events only
+{
+  return(sizeof(ImageHeader) + mapCount_ * sizeof(MapEntry) + count_ * sizeof(Event));
+}
+
+void MidiEventStream::saveImage (uint8_t* buf)
+// Copy the finished stream to 'buf', getImageSize() bytes
+{
+  ImageHeader h = { count_, mapCount_, 0, ticksPerQuarter_, endTick_ };
+
+  memcpy(buf, &h, sizeof(h));
+  buf += sizeof(h);
+  memcpy(buf, map_, mapCount_ * sizeof(MapEntry));
+  buf += mapCount_ * sizeof(MapEntry);
+  memcpy(buf, events_, count_ * sizeof(Event));
+}
+
+bool MidiEventStream::loadImage (const uint8_t* buf, uint32_t size)
+// Take the song from a saveImage() copy, ready to play from the top.
+// Returns false if it does not fit, the stream is invalid then.
+{
+  ImageHeader h;
+
+  valid_ = false;
+  if (events_ == nullptr || size < sizeof(h))
+    return(false);
+
+  memcpy(&h, buf, sizeof(h));
+  if (h.count_ > maxEvents_ || h.mapCount_ == 0 || h.mapCount_ > MES_MAP_SIZE ||
+      size != sizeof(h) + h.mapCount_ * sizeof(MapEntry) + h.count_ * sizeof(Event))
+    return(false);
+
+  buf += sizeof(h);
+  memcpy(map_, buf, h.mapCount_ * sizeof(MapEntry));
+  buf += h.mapCount_ * sizeof(MapEntry);
+  memcpy(events_, buf, h.count_ * sizeof(Event));
+  count_ = h.count_;
+  mapCount_ = h.mapCount_;
+  ticksPerQuarter_ = h.ticksPerQuarter_;
+  endTick_ = h.endTick_;
+  valid_ = true;
+  restart();
+
+  return(true);
+}
+
+void MidiEventStream::restart ()
+// Back to the top. The tempo engine is restarted separately by the player.
+{
+  idx_ = 0;
+  mapIdx_ = 0;
+  playTick_ = 0;
+  if (mapCount_ > 0)
+    te_.setQuarter(map_[0].usPerQuarter_, ticksPerQuarter_);
+}
+
+void MidiEventStream::seek (uint16_t event, uint32_t tick)
+// Carry on from 'event' at 'tick', which the tempo engine treats as the
+// time it has reached. The tempo map catches up on the next fill().
+{
+  restart();
+  idx_ = (event > count_) ? count_ : event;
+  playTick_ = tick;
+}
+
+void MidiEventStream::swap (MidiEventStream& other)
+// Exchange songs with 'other', e.g. one preloaded in the background. Only
+// the buffers change hands, each stream keeps its own tempo engine.
+{
+  MapEntry  map[MES_MAP_SIZE];
+
+  std::swap(events_, other.events_);
+  std::swap(maxEvents_, other.maxEvents_);
+  std::swap(count_, other.count_);
+  memcpy(map, map_, sizeof(map));
+  memcpy(map_, other.map_, sizeof(map_));
+  memcpy(other.map_, map, sizeof(map));
+  std::swap(mapCount_, other.mapCount_);
+  std::swap(ticksPerQuarter_, other.ticksPerQuarter_);
+  std::swap(endTick_, other.endTick_);
+  std::swap(valid_, other.valid_);
+  std::swap(looping_, other.looping_);
+  restart();
+  other.restart();
+}
+
+uint32_t MidiEventStream::timeAt (uint32_t t, const uint32_t* horizon)
+// Song time of tick 't', advancing the tempo engine to it and stepping
+// through the tempo changes on the way. 't' must not be behind playTick_.
+// With a 'horizon' the engine is moved on a 16th at a time and stops
+// once it is past it, short of 't', so that a long rest does not hand
+// out its clock pulses all at once.
+{
+  uint32_t step = (ticksPerQuarter_ >= 4) ? ticksPerQuarter_ / 4 : 1;
+
+  for (;;)
+  {
+    while (mapIdx_ + 1 < mapCount_ && map_[mapIdx_ + 1].tick_ <= playTick_)
+      te_.setQuarter(map_[++mapIdx_].usPerQuarter_, ticksPerQuarter_);
+
+    if (playTick_ >= t)
+      break;
+    if (horizon != nullptr && (int32_t)(*horizon - te_.getTime()) <= 0)
+      break;
+
+    uint32_t next = t;
+
+    if (mapIdx_ + 1 < mapCount_ && map_[mapIdx_ + 1].tick_ < t)
+      next = map_[mapIdx_ + 1].tick_;
+    if (horizon != nullptr && next - playTick_ > step)
+      next = playTick_ + step;
+    te_.advance(next - playTick_);
+    playTick_ = next;
+  }
+
+  return(te_.getTime());
+}
+
+bool MidiEventStream::fill (MidiScheduler& sched, uint32_t horizon)
+// Queue the events due before 'horizon' (song time). Times come from the
+// tempo engine, which only moves forward, so a tempo change takes effect
+// from the last event worked out without a jump. Returns true if any
+// events were queued.
+{
+  bool bEvents = false;
+
+  if (!valid_)
+    return(false);
+
+  while (sched.space() >= SCHED_FILL_MARGIN)
+  {
+    if (idx_ >= count_)
+    {
+      if (!looping_)
+        break;
+
+      // wrap around to the top, carrying the song time on
+      timeAt(endTick_, &horizon);
+      if (playTick_ < endTick_)
+        break;
+      restart();
+      if (count_ == 0)
+        break;
+    }
+
+    Event* pev = &events_[idx_];
+    uint32_t t = pev->tick_;
+    uint32_t due = timeAt(t, &horizon);
+
+    if ((int32_t)(horizon - due) <= 0)
+      break;
+
+    uint8_t msg[3] = { (uint8_t)pev->status_, pev->data_[0], pev->data_[1] };
+    uint8_t size = ((msg[0] & 0xf0) == 0xc0 || (msg[0] & 0xf0) == 0xd0) ? 2 : 3;
+
+    sched.push(due, msg, size);
+    idx_++;
+    bEvents = true;
+  }
+
+  return(bEvents);
+}
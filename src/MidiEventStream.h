@@ -0,0 +1,99 @@
+#ifndef MidiEventStream_h
+#define MidiEventStream_h
+
+#include <stdint.h>
+#include "MidiScheduler.h"
+#include "TempoEngine.h"
+
+/*
+ * Pre-parsed, merged event stream for one song held in RAM.
+ *
+ * The song is converted once at load time into a flat array of channel
+ * events sorted by absolute tick (6 bytes per event) plus a small map of
+ * the points where the tempo or time signature changes. Playback then
+ * feeds the scheduler from RAM without touching the SD card, with the
+ * tempo engine turning ticks into song time.
+ */
+
+#define MES_BUFFER_SIZE   (60 * 1024UL)   // bytes reserved for events
+#define MES_MAP_SIZE      64              // tempo/time signature changes
+
+class MidiEventStream
+{
+
+public:
+  typedef struct __attribute__((packed))
+  {
+    uint32_t  tick_   : 24;   ///< Absolute tick from the start of the song
+    uint32_t  status_ : 8;    ///< Status byte including the channel, F0 for a SysEx block id
+    uint8_t   data_[2];       ///< Data bytes, data_[1] unused for 2 byte messages
+  } Event;
+
+  typedef struct
+  {
+    uint32_t  tick_;          ///< First tick this entry applies to
+    uint32_t  usPerQuarter_;  ///< Tempo in microseconds per quarter note
+    uint16_t  timeSig_;       ///< Time signature as returned by getTimeSignature()
+  } MapEntry;
+
+  MidiEventStream (TempoEngine& te);
+
+  bool begin();
+
+  // Building the stream
+  void clear(uint16_t ticksPerQuarter);
+  bool append(uint32_t tick, const uint8_t* data, uint8_t size);
+  bool setState(uint32_t tick, uint32_t usPerQuarter, uint16_t timeSig);
+  bool end(uint32_t tick);
+  bool isValid() { return valid_; }
+  uint16_t getEventCount() { return count_; }
+  const Event* getEvent(uint16_t i) { return &events_[i]; }
+  void setEvent(uint16_t i, const Event& e) { events_[i] = e; }
+
+  // Compact copies, e.g. for the song cache
+  uint32_t getImageSize();
+  void saveImage(uint8_t* buf);
+  bool loadImage(const uint8_t* buf, uint32_t size);
+
+  // Playing the stream
+  void restart();
+  void seek(uint16_t event, uint32_t tick);
+  void swap(MidiEventStream& other);
+  uint32_t getEndTime() { return timeAt(endTick_); }
+  uint32_t getTick() { return playTick_; }
+  uint16_t getTicksPerQuarter() { return ticksPerQuarter_; }
+  bool fill(MidiScheduler& sched, uint32_t horizon);
+  bool isEOF() { return !looping_ && idx_ >= count_; }
+  void looping(bool bMode) { looping_ = bMode; }
+
+  uint16_t getTimeSignature() { return map_[mapIdx_].timeSig_; }
+
+private:
+  typedef struct
+  {
+    uint16_t  count_;
+    uint8_t   mapCount_;
+    uint8_t   reserved_;
+    uint16_t  ticksPerQuarter_;
+    uint32_t  endTick_;
+  } ImageHeader;
+
+  uint32_t timeAt(uint32_t t, const uint32_t* horizon = nullptr);
+
+  TempoEngine& te_;
+  Event*    events_;
+  uint16_t  maxEvents_;
+  uint16_t  count_;
+  MapEntry  map_[MES_MAP_SIZE];
+  uint8_t   mapCount_;
+  uint16_t  ticksPerQuarter_;
+  uint32_t  endTick_;       ///< Length of the song in ticks
+  bool      valid_;
+  bool      looping_;
+
+  uint16_t  idx_;           ///< Next event to schedule
+  uint8_t   mapIdx_;        ///< Map entry in effect at playTick_
+  uint32_t  playTick_;      ///< Tick the tempo engine has reached
+};
+
+#endif // MidiEventStream_h
@@ -0,0 +1,164 @@
+#include "Debug_def.h"
+#include "MidiMerge.h"
+#include "MidiTransform.h"
+#include <string.h>
+
+// MIDI Merge **********************************************************
+
+MidiMerge::MidiMerge (MidiOutput& out)
+:out_(out), wh_(nullptr), sh_(nullptr), xf_(nullptr), locked_(SRC_COUNT)
+{
+  for (uint8_t i = 0; i < SRC_COUNT; i++)
+  {
+    src_[i].head_ = 0;
+    src_[i].tail_ = 0;
+    dropped_[i] = 0;
+  }
+};
+
+bool MidiMerge::push (Source src, const uint8_t* data, uint16_t size)
+// Queue a complete message from 'src', over as many slots as it needs.
+// Each source must only ever be pushed from one task. The message is
+// published with a single store of the tail, so the output task sees all
+// of it or none of it.
+{
+  const uint8_t SLOT = sizeof(src_[0].queue_[0].data_);
+  Channel* c = &src_[src];
+  uint16_t t = c->tail_.load(std::memory_order_relaxed);
+
+  uint16_t used = (t - c->head_.load(std::memory_order_acquire)) & (MMRG_QUEUE_SIZE - 1);
+
+  if (size == 0 || (size + SLOT - 1) / SLOT > MMRG_QUEUE_SIZE - 1 - used)
+  {
+    dropped_[src]++;
+    return(false);
+  }
+
+  for (uint16_t done = 0; done < size; done += SLOT)
+  {
+    uint8_t n = (size - done < SLOT) ? size - done : SLOT;
+
+    c->queue_[t].size_ = n;
+    c->queue_[t].more_ = (done + n < size);
+    memcpy(c->queue_[t].data_, &data[done], n);
+    t = (t + 1) & (MMRG_QUEUE_SIZE - 1);
+  }
+  c->tail_.store(t, std::memory_order_release);
+
+  return(true);
+}
+
+bool MidiMerge::pushOp (Source src, op o, uint16_t value)
+// Queue an op in one slot, as push() does a message
+{
+  Channel* c = &src_[src];
+  uint16_t t = c->tail_.load(std::memory_order_relaxed);
+  uint16_t n = (t + 1) & (MMRG_QUEUE_SIZE - 1);
+
+  if (n == c->head_.load(std::memory_order_acquire))
+  {
+    dropped_[src]++;
+    return(false);
+  }
+
+  c->queue_[t].size_ = 0;
+  c->queue_[t].data_[0] = o;
+  c->queue_[t].data_[1] = value & 0xff;
+  c->queue_[t].data_[2] = value >> 8;
+  c->queue_[t].more_ = false;
+  c->tail_.store(n, std::memory_order_release);
+
+  return(true);
+}
+
+bool MidiMerge::release ()
+// Queue a release of every note sounding at the output, in order with the
+// control messages. Only the task pushing SRC_CONTROL may call this.
+{
+  return(pushOp(SRC_CONTROL, OP_RELEASE, 0));
+}
+
+bool MidiMerge::pushSysEx (Source src, uint16_t id)
+// Queue SysEx block 'id' for the SysEx handler, in order with the other
+// messages from 'src'
+{
+  return(pushOp(src, OP_SYSEX, id));
+}
+
+bool MidiMerge::pushMirror (Source src, uint8_t status)
+// Queue a real time byte that has been written to the port already, for
+// the mirror only
+{
+  return(pushOp(src, OP_MIRROR, status));
+}
+
+uint16_t MidiMerge::space (Source src)
+// Slots that can still be pushed from 'src', a message takes one for
+// every 3 bytes
+{
+  Channel* c = &src_[src];
+
+  return(MMRG_QUEUE_SIZE - 1 - ((c->tail_.load() - c->head_.load()) & (MMRG_QUEUE_SIZE - 1)));
+}
+
+uint16_t MidiMerge::drain (uint8_t hold, bool bRealTime)
+// Move the queued messages to the output, taking one message from each
+// source in turn so that no source can hold up the others, but all of a
+// message that takes several slots before anything else.
+// Playback and live input go through the transform, if there is one,
+// the clock and control messages go out as they are.
+// Live input is not mirrored back to BLE, where it came from.
+// Sources with their bit (1 << Source) set in 'hold' are left for later.
+// With bRealTime only the real time messages at the front of the queues
+// are moved, which may go between the bytes of a SysEx.
+// Only the output task may call this. Returns the number of messages moved.
+{
+  uint16_t count = 0;
+  bool bMore;
+
+  do
+  {
+    bMore = false;
+    for (uint8_t i = 0; i < SRC_COUNT; i++)
+    {
+      Channel* c = &src_[i];
+      uint16_t h = c->head_.load(std::memory_order_relaxed);
+
+      if ((locked_ != SRC_COUNT && locked_ != i) || (hold & (1 << i)) ||
+          h == c->tail_.load(std::memory_order_acquire))
+        continue;
+
+      Message* m = &c->queue_[h];
+
+      if (bRealTime && (m->size_ != 1 || m->data_[0] < 0xf8))
+        continue;
+
+      if (m->size_ == 0 && m->data_[0] == OP_SYSEX)
+      {
+        if (sh_ != nullptr)
+          sh_(m->data_[1] | (m->data_[2] << 8));
+        hold |= (1 << i);     // the messages after it wait for the block
+      }
+      else if (m->size_ == 0 && m->data_[0] == OP_MIRROR)
+        out_.mirror(&m->data_[1], 1);
+      else if (m->size_ == 0)
+        out_.releaseNotes();
+      else if (xf_ == nullptr || i == SRC_CONTROL || i == SRC_CLOCK || locked_ == i)
+        out_.write(m->data_, m->size_, i != SRC_LIVE);   // SysEx goes on as it started
+      else
+      {
+        uint8_t msg[sizeof(m->data_)];
+
+        memcpy(msg, m->data_, m->size_);
+        if (xf_->apply(msg, m->size_))
+          out_.write(msg, m->size_, i != SRC_LIVE);
+      }
+      locked_ = m->more_ ? i : (uint8_t)SRC_COUNT;
+      c->head_.store((h + 1) & (MMRG_QUEUE_SIZE - 1), std::memory_order_release);
+      count++;
+      bMore = true;
+    }
+  } while (bMore);
+
+  return(count);
+}
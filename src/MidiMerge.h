@@ -0,0 +1,98 @@
+#ifndef MidiMerge_h
+#define MidiMerge_h
+
+#include <stdint.h>
+#include <atomic>
+#include "MidiOutput.h"
+
+class MidiTransform;
+
+/*
+ * Lock-free merge of several MIDI sources onto one output.
+ *
+ * Every source (file playback, live BLE input, control messages from
+ * loop()) has its own single producer / single consumer queue of complete
+ * messages. Only the output task drains the queues into MidiOutput, so
+ * the bytes of a message can never be interleaved with another source.
+ * A SysEx takes a slot for every 3 bytes and is drained in one piece.
+ *
+ * A source may also queue the id of a SysEx block held elsewhere, e.g.
+ * by SysExSender. The id is handed to the SysEx handler when the drain
+ * reaches it, so the block goes out after the messages queued before it,
+ * and that source is not drained further in the same pass.
+ *
+ * The clock and transport the song sends have a source of their own, so
+ * they are never held behind the song's messages waiting for a block, and
+ * the real time drain can put the pulses between the bytes of a SysEx.
+ * A byte already written to the port some other way can be queued just
+ * to go to the mirror in order with the rest.
+ */
+
+#define MMRG_QUEUE_SIZE   64      // messages per source, must be a power of 2
+
+class MidiMerge
+{
+
+public:
+  enum Source
+  {
+    SRC_PLAYER,     ///< File playback, pushed from the scheduler
+    SRC_LIVE,       ///< Live input from BLE-MIDI
+    SRC_CONTROL,    ///< Housekeeping from loop()
+    SRC_CLOCK,      ///< Clock and transport sent with the song, from the clock timer
+    SRC_COUNT
+  };
+
+  typedef void (*WakeHandler)(void);
+  typedef bool (*SysExHandler)(uint16_t id);
+
+  MidiMerge (MidiOutput& out);
+
+  void setWakeHandler(WakeHandler wh) { wh_ = wh; }
+  void setTransform(MidiTransform* xf) { xf_ = xf; }
+  void setSysExHandler(SysExHandler sh) { sh_ = sh; }
+
+  bool push(Source src, const uint8_t* data, uint16_t size);
+  bool pushSysEx(Source src, uint16_t id);
+  bool pushMirror(Source src, uint8_t status);
+  void wake() { if (wh_ != nullptr) wh_(); }
+  bool release();
+  uint16_t space(Source src);
+  uint16_t drain(uint8_t hold = 0, bool bRealTime = false);
+
+  uint32_t getDropped(Source src) { return dropped_[src]; }
+
+private:
+  enum op : uint8_t
+  {
+    OP_RELEASE,             ///< Release the sounding notes
+    OP_SYSEX,               ///< Hand the SysEx id in data_[1], data_[2] over
+    OP_MIRROR,              ///< Only mirror the byte in data_[1], it is on the port
+  };
+
+  typedef struct
+  {
+    uint8_t size_;          ///< 0 for an op in data_[0]
+    uint8_t data_[3];
+    bool    more_;          ///< The message goes on in the next slot
+  } Message;
+
+  bool pushOp(Source src, op o, uint16_t value);
+
+  typedef struct
+  {
+    Message queue_[MMRG_QUEUE_SIZE];
+    std::atomic<uint16_t> head_;    ///< Owned by the output task
+    std::atomic<uint16_t> tail_;    ///< Owned by the source
+  } Channel;
+
+  MidiOutput& out_;
+  WakeHandler wh_;
+  SysExHandler sh_;
+  MidiTransform* xf_;       ///< Applied to playback and live input, nullptr for none
+  uint8_t   locked_;        ///< Source in the middle of a message, SRC_COUNT if none
+  Channel   src_[SRC_COUNT];
+  uint32_t  dropped_[SRC_COUNT];
+};
+
+#endif // MidiMerge_h
@@ -0,0 +1,130 @@
+#include "Debug_def.h"
+#include "MidiOutput.h"
+
+// MIDI Output *********************************************************
+
+MidiOutput::MidiOutput (WriteHandler wh)
+:wh_(wh), mh_(nullptr), head_(0), tail_(0), runningStatus_(0), reserved_(0), flushing_(false),
+ bytesIn_(0), bytesSaved_(0), peakDepth_(0), dropped_(0)
+{};
+
+bool MidiOutput::write (const uint8_t* data, uint8_t size, bool bMirror)
+// Queue one complete message. If the ring is full it is flushed first.
+// Should the port still not make room, the message is dropped whole and
+// counted, and false returned. The mirror gets it too unless bMirror is false.
+// Real time may not use the room reserved, anything else uses it up.
+{
+  uint8_t skip = 0;
+  uint8_t status = runningStatus_;
+  uint16_t held = (data[0] >= 0xf8) ? reserved_ : 0;
+
+  if (size == 0)
+    return(false);
+
+  if (data[0] >= 0x80 && data[0] < 0xf0)
+  {
+    // channel message, the status byte can be left out if it repeats
+    if (data[0] == runningStatus_)
+      skip = 1;
+    status = data[0];
+  }
+  else if (data[0] < 0xf8)
+    status = 0;     // system common and SysEx cancel running status
+                    // real time messages leave it alone
+
+  if (MOUT_BUFFER_SIZE - 1 - pending() - held < size - skip)
+  {
+    flush();
+    if (MOUT_BUFFER_SIZE - 1 - pending() - held < size - skip)
+    {
+      dropped_++;
+      return(false);
+    }
+  }
+
+  if (held == 0)
+    reserved_ = (reserved_ > size - skip) ? reserved_ - (size - skip) : 0;
+  runningStatus_ = status;
+  for (uint8_t i = skip; i < size; i++)
+  {
+    buf_[tail_] = data[i];
+    tail_ = (tail_ + 1) & (MOUT_BUFFER_SIZE - 1);
+  }
+
+  notes_.update(data, size);
+  if (bMirror && mh_ != nullptr)
+    mh_(data, size);
+  bytesIn_ += size;
+  bytesSaved_ += skip;
+  if (pending() > peakDepth_)
+    peakDepth_ = pending();
+
+  return(true);
+}
+
+bool MidiOutput::reserve (uint16_t size)
+// Keep room for the next 'size' bytes other than real time, the chunks
+// of a SysEx block, flushing first if needed. False, with nothing
+// reserved, if the port has not taken enough yet.
+{
+  if (MOUT_BUFFER_SIZE - 1 - pending() < size)
+  {
+    flush();
+    if (MOUT_BUFFER_SIZE - 1 - pending() < size)
+    {
+      reserved_ = 0;
+      return(false);
+    }
+  }
+  reserved_ = size;
+
+  return(true);
+}
+
+void MidiOutput::flush ()
+// Hand everything queued to the port, at most two writes for the ring
+{
+  if (flushing_.exchange(true))
+    return;
+
+  while (head_ != tail_)
+  {
+    uint16_t h = head_;
+    uint16_t n = (tail_ >= h) ? tail_ - h : MOUT_BUFFER_SIZE - h;
+
+    n = wh_(&buf_[h], n);
+    if (n == 0)
+      break;        // port refused, try again on the next flush
+    head_ = (h + n) & (MOUT_BUFFER_SIZE - 1);
+  }
+
+  flushing_ = false;
+}
+
+uint16_t MidiOutput::releaseNotes ()
+// Send a Note Off for every note still sounding and lift the sustain
+// pedal on every channel. Returns the number of messages queued.
+{
+  uint16_t count = 0;
+
+  for (uint8_t ch = 0; ch < ANOTE_CHANNELS; ch++)
+  {
+    for (uint8_t w = 0; w < ANOTE_WORDS; w++)
+    {
+      for (uint32_t bits = notes_.getWord(ch, w); bits != 0; bits &= bits - 1)
+      {
+        uint8_t msg[3] = { (uint8_t)(0x80 | ch), (uint8_t)((w << 5) + __builtin_ctz(bits)), 0 };
+
+        write(msg, sizeof(msg));
+        count++;
+      }
+    }
+
+    uint8_t msg[3] = { (uint8_t)(0xb0 | ch), 64, 0 };
+
+    write(msg, sizeof(msg));
+    count++;
+  }
+
+  return(count);
+}
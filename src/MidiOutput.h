@@ -0,0 +1,74 @@
+#ifndef MidiOutput_h
+#define MidiOutput_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "ActiveNotes.h"
+
+/*
+ * Buffered MIDI output stage between the players and the UART.
+ *
+ * Complete messages are added to a byte ring with MIDI running status
+ * applied, i.e. the status byte is left out when it repeats the previous
+ * channel message. flush() hands everything queued to the port in bulk.
+ * The notes left sounding are tracked so they can be released exactly.
+ * Each message can also be handed to a mirror, e.g. the BLE output.
+ *
+ * A SysEx block is written in chunks with reserve() first, so real time
+ * written between the chunks cannot take the room the rest of it needs.
+ *
+ * writeNow() puts a real time byte on the port straight away, ahead of
+ * what is still in the ring. MIDI lets real time go between any two
+ * bytes, so it may be called from another task than the one writing and
+ * flushing, provided the port write handler can be called from both.
+ */
+
+#define MOUT_BUFFER_SIZE  512     // bytes, must be a power of 2
+
+class MidiOutput
+{
+
+public:
+  typedef size_t (*WriteHandler)(const uint8_t* data, size_t size);
+  typedef void (*MirrorHandler)(const uint8_t* data, uint8_t size);
+
+  MidiOutput (WriteHandler wh);
+
+  void setMirror(MirrorHandler mh) { mh_ = mh; }
+
+  bool write(const uint8_t* data, uint8_t size, bool bMirror = true);
+  bool reserve(uint16_t size);
+  bool writeNow(uint8_t status) { return wh_(&status, 1) == 1; }
+  void mirror(const uint8_t* data, uint8_t size) { if (mh_ != nullptr) mh_(data, size); }
+  void flush();
+  void resetRunningStatus() { runningStatus_ = 0; }
+  uint16_t releaseNotes();
+  uint16_t getActiveNotes() { return notes_.count(); }
+
+  uint16_t pending() { return (tail_ - head_) & (MOUT_BUFFER_SIZE - 1); }
+
+  uint32_t getBytesIn() { return bytesIn_; }
+  uint32_t getBytesSaved() { return bytesSaved_; }
+  uint16_t getPeakDepth() { return peakDepth_; }
+  uint32_t getDropped() { return dropped_; }
+  void resetStats() { bytesIn_ = bytesSaved_ = dropped_ = 0; peakDepth_ = 0; }
+
+private:
+  WriteHandler wh_;
+  MirrorHandler mh_;
+  uint8_t   buf_[MOUT_BUFFER_SIZE];
+  volatile uint16_t head_;    ///< Next byte to send
+  volatile uint16_t tail_;    ///< Next free byte
+  uint8_t   runningStatus_;   ///< Last channel status sent, 0 if none
+  uint16_t  reserved_;        ///< Room kept for the rest of a reserved block
+  std::atomic<bool> flushing_;
+  ActiveNotes notes_;
+
+  uint32_t  bytesIn_;         ///< Message bytes offered
+  uint32_t  bytesSaved_;      ///< Status bytes dropped by running status
+  uint16_t  peakDepth_;       ///< Largest number of bytes waiting
+  uint32_t  dropped_;         ///< Messages the port could not make room for
+};
+
+#endif // MidiOutput_h
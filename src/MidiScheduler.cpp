@@ -0,0 +1,212 @@
+#include "Debug_def.h"
+#include "MidiScheduler.h"
+#include <string.h>
+
+#if defined(ESP32)
+#include <esp_timer.h>
+#endif
+
+// MIDI Scheduler ******************************************************
+
+MidiScheduler::MidiScheduler (EmitHandler eh, ClockSource cs)
+:eh_(eh), cs_(cs), fh_(nullptr), ah_(nullptr), follower_(nullptr), origin_(0), pausedAt_(0), paused_(false),
+ overruns_(0), head_(0), tail_(0), armed_(false), alarm_(false), timer_(nullptr)
+{};
+
+void MidiScheduler::begin ()
+{
+#if defined(ESP32)
+  esp_timer_create_args_t args = {};
+
+  args.callback = timerCB;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "midi-sched";
+  if (esp_timer_create(&args, (esp_timer_handle_t*)&timer_) != ESP_OK)
+    DEBUGS("\nScheduler timer create fail");
+#endif
+}
+
+void MidiScheduler::start ()
+// Reset the queue and make 'now' the beginning of the song
+{
+  flush();
+  overruns_ = 0;
+  origin_ = cs_();
+  pausedAt_ = origin_;
+  follow();
+}
+
+void MidiScheduler::flush ()
+// Drop everything that has not been emitted yet
+{
+  std::lock_guard<std::mutex> guard(lock_);
+
+#if defined(ESP32)
+  if (timer_ != nullptr)
+    esp_timer_stop((esp_timer_handle_t)timer_);
+#endif
+  armed_ = false;
+  head_.store(tail_.load());
+  if (follower_ != nullptr)
+    follower_->flush();
+}
+
+void MidiScheduler::pause (bool bMode)
+// Freeze the song clock. Queued events keep their position relative
+// to the song and are emitted late by the length of the pause.
+{
+  if (bMode == paused_)
+    return;
+
+  if (bMode)
+  {
+    pausedAt_ = cs_();
+    paused_ = true;
+  }
+  else
+  {
+    origin_ += cs_() - pausedAt_;
+    paused_ = false;
+    kick();
+  }
+  follow();
+}
+
+void MidiScheduler::follow ()
+// Put the follower on the same song clock as this one
+{
+  if (follower_ == nullptr)
+    return;
+
+  follower_->origin_ = origin_.load();
+  follower_->pausedAt_ = pausedAt_;
+  follower_->paused_ = paused_.load();
+  follower_->kick();
+}
+
+uint32_t MidiScheduler::now ()
+// Current song time in microseconds
+{
+  return((paused_ ? pausedAt_ : cs_()) - origin_);
+}
+
+uint16_t MidiScheduler::space ()
+{
+  return(SCHED_QUEUE_SIZE - 1 - ((tail_.load() - head_.load()) & (SCHED_QUEUE_SIZE - 1)));
+}
+
+bool MidiScheduler::push (uint32_t due, const uint8_t* data, uint8_t size)
+// Queue an event for emission at 'due'. Events must be pushed in time order.
+{
+  uint16_t t = tail_.load(std::memory_order_relaxed);
+  uint16_t n = (t + 1) & (SCHED_QUEUE_SIZE - 1);
+
+  if (n == head_.load(std::memory_order_acquire) || size > sizeof(queue_[0].data_))
+  {
+    overruns_++;
+    return(false);
+  }
+
+  queue_[t].due_ = due;
+  queue_[t].size_ = size;
+  memcpy(queue_[t].data_, data, size);
+  tail_.store(n, std::memory_order_release);
+
+  kick();
+  return(true);
+}
+
+bool MidiScheduler::service (uint32_t nowUs, uint32_t& nextDue)
+// Emit every event that is due at 'nowUs'. Returns false when the queue
+// is empty, otherwise the due time of the next event is set in nextDue.
+{
+  bool bEmitted = false;
+  bool bMore = false;
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    uint16_t h = head_.load(std::memory_order_relaxed);
+
+    while (h != tail_.load(std::memory_order_acquire))
+    {
+      ScheduledEvent* pev = &queue_[h];
+
+      if ((int32_t)(pev->due_ - nowUs) > 0)
+      {
+        nextDue = pev->due_;
+        bMore = true;
+        break;
+      }
+
+      eh_(pev->data_, pev->size_, pev->due_);
+      bEmitted = true;
+      h = (h + 1) & (SCHED_QUEUE_SIZE - 1);
+      head_.store(h, std::memory_order_release);
+    }
+  }
+
+  if (bEmitted && fh_ != nullptr)
+    fh_();
+
+  return(bMore);
+}
+
+void MidiScheduler::kick ()
+// Make sure the emitter timer is running if there is anything to emit
+{
+#if defined(ESP32)
+  if (paused_ || isEmpty() || armed_.exchange(true))
+    return;
+
+  int32_t wait = (int32_t)(queue_[head_.load()].due_ - now());
+  esp_timer_start_once((esp_timer_handle_t)timer_, wait > 0 ? wait : 0);
+#endif
+}
+
+void MidiScheduler::timerCB (void* arg)
+// Runs in the high priority esp_timer task. Emits the due events, or has
+// the alarm handler's task do it.
+{
+  MidiScheduler* s = (MidiScheduler*)arg;
+
+  s->alarm_ = true;
+  if (s->ah_ != nullptr)
+    s->ah_();
+  else
+    s->run();
+}
+
+void MidiScheduler::run ()
+// After the timer has expired, emit the due events and re-arm the timer
+// for the next one. Does nothing if the timer has not expired.
+{
+  if (!alarm_.exchange(false))
+    return;
+
+  for (;;)
+  {
+    uint32_t nextDue;
+
+    if (paused_)
+    {
+      armed_ = false;
+      return;
+    }
+
+    if (service(now(), nextDue))
+    {
+#if defined(ESP32)
+      int32_t wait = (int32_t)(nextDue - now());
+      esp_timer_start_once((esp_timer_handle_t)timer_, wait > 0 ? wait : 0);
+#endif
+      return;
+    }
+
+    // Queue drained. Drop the armed flag, then re-check so that an event
+    // pushed in between does not get stranded.
+    armed_ = false;
+    if (isEmpty() || armed_.exchange(true))
+      return;
+  }
+}
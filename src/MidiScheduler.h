@@ -0,0 +1,95 @@
+#ifndef MidiScheduler_h
+#define MidiScheduler_h
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+/*
+ * Timestamped MIDI event queue with a timer driven emitter.
+ *
+ * The playback FSM parses the song ahead of time and push()es every channel
+ * event with the time (in microseconds since start()) it is due. The events
+ * are emitted by service(), which on the ESP32 is run from a one-shot
+ * esp_timer armed for the head of the queue, so note timing no longer
+ * depends on how often loop() comes around.
+ *
+ * The queue is single producer (loop) / single consumer (timer callback).
+ * With an alarm handler set, the timer only raises the alarm and the
+ * events are emitted by run() in the task the handler wakes, so they can
+ * be on a different core from the timer. flush() may be called by the
+ * producer while the consumer runs.
+ *
+ * A follower scheduler, e.g. for the MIDI clock on a timer of its own,
+ * runs on the same song clock: it is started, flushed and paused along
+ * with this one.
+ */
+
+#define SCHED_QUEUE_SIZE    256       // events, must be a power of 2
+#define SCHED_LOOKAHEAD_US  50000     // how far ahead the song is parsed
+#define SCHED_FILL_MARGIN   16        // free slots needed to parse another tick
+
+class MidiScheduler
+{
+
+public:
+  typedef struct
+  {
+    uint32_t  due_;       ///< Emit time in microseconds since start()
+    uint8_t   size_;      ///< Number of valid bytes in data_
+    uint8_t   data_[3];   ///< Channel message, status byte includes the channel,
+                          ///< or F0 and a SysEx block id, 7 bits each
+  } ScheduledEvent;
+
+  typedef void (*EmitHandler)(const uint8_t* data, uint8_t size, uint32_t due);
+  typedef uint32_t (*ClockSource)(void);
+  typedef void (*FlushHandler)(void);
+  typedef void (*AlarmHandler)(void);
+
+  MidiScheduler (EmitHandler eh, ClockSource cs);
+
+  void setFlushHandler(FlushHandler fh) { fh_ = fh; }
+  void setAlarmHandler(AlarmHandler ah) { ah_ = ah; }
+  void setFollower(MidiScheduler* f) { follower_ = f; }
+
+  void begin();
+  void start();
+  void flush();
+  void pause(bool bMode);
+  bool isPaused() { return paused_; }
+
+  bool push(uint32_t due, const uint8_t* data, uint8_t size);
+  uint16_t space();
+  bool isEmpty() { return head_.load() == tail_.load(); }
+
+  uint32_t now();
+  bool service(uint32_t nowUs, uint32_t& nextDue);
+  void run();
+
+  uint32_t getOverruns() { return overruns_; }
+
+private:
+  void kick();
+  void follow();
+  static void timerCB(void* arg);
+
+  EmitHandler eh_;
+  ClockSource cs_;
+  FlushHandler fh_;         ///< Called after each batch of emitted events
+  AlarmHandler ah_;         ///< Called by the timer to have run() called
+  MidiScheduler* follower_; ///< On the same song clock, nullptr for none
+  std::atomic<uint32_t> origin_;  ///< Clock value at start(), moved on by pauses
+  uint32_t pausedAt_;
+  std::atomic<bool>     paused_;
+  uint32_t overruns_;
+
+  ScheduledEvent queue_[SCHED_QUEUE_SIZE];
+  std::atomic<uint16_t> head_;  ///< Next slot to emit, owned by the consumer
+  std::atomic<uint16_t> tail_;  ///< Next slot to fill, owned by the producer
+  std::atomic<bool>     armed_; ///< Emitter timer is running or about to be
+  std::atomic<bool>     alarm_; ///< Timer has expired, run() has not been called
+  std::mutex lock_;             ///< Between service() and flush()
+  void* timer_;
+};
+
+#endif // MidiScheduler_h
@@ -0,0 +1,276 @@
+#include "Debug_def.h"
+#include "MidiTransform.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// MIDI Transform ******************************************************
+
+constexpr MidiTransform::Channel MidiTransform::DEFAULT_CHANNEL;
+
+MidiTransform::MidiTransform ()
+{
+  reset();
+};
+
+void MidiTransform::reset ()
+// Back to the defaults, passing everything through
+{
+  for (uint8_t ch = 0; ch < 16; ch++)
+    cfg_[ch] = DEFAULT_CHANNEL;
+  sysDrop_ = 0;
+  compile();
+}
+
+void MidiTransform::setChannel (uint8_t ch, const Channel& c)
+// Change the settings of channel 'ch' 0-15, used at the next compile()
+{
+  if (ch < 16)
+    cfg_[ch] = c;
+}
+
+void MidiTransform::setSystemDrop (uint8_t status, bool bDrop)
+// Drop or pass system status 0xF1-0xFF, used at the next compile()
+{
+  if (status <= 0xf0 || status == 0xf7)
+    return;
+
+  if (bDrop)
+    sysDrop_ |= (1 << (status & 0x0f));
+  else
+    sysDrop_ &= ~(1 << (status & 0x0f));
+}
+
+void MidiTransform::compile ()
+// Build the lookup tables from the settings. The tables must not be in
+// use by the output task while this runs.
+{
+  // message type to drop bit, from 0x80 to 0xE0
+  static const uint8_t TYPE_DROP[7] =
+    { MTX_DROP_NOTE, MTX_DROP_NOTE, MTX_DROP_POLY_AT, MTX_DROP_CC, MTX_DROP_PROGRAM, MTX_DROP_CHAN_AT, MTX_DROP_BEND };
+
+  identity_ = (sysDrop_ == 0);
+
+  memset(status_, 0, 0x80);
+  for (uint16_t s = 0x80; s < 0xf0; s++)
+  {
+    const Channel& c = cfg_[s & 0x0f];
+
+    if (c.map_ == MTX_MAP_OFF || (c.drop_ & TYPE_DROP[(s >> 4) - 8]))
+      status_[s] = 0;
+    else if (c.map_ == 0 || c.map_ > 16)
+      status_[s] = s;
+    else
+      status_[s] = (s & 0xf0) | (c.map_ - 1);
+    identity_ = identity_ && (status_[s] == s);
+  }
+  for (uint16_t s = 0xf0; s < 0x100; s++)
+    status_[s] = (sysDrop_ & (1 << (s & 0x0f))) ? 0 : s;
+
+  for (uint8_t ch = 0; ch < 16; ch++)
+  {
+    const Channel& c = cfg_[ch];
+    float range = (c.velMax_ > c.velMin_) ? c.velMax_ - c.velMin_ : 0;
+
+    for (uint8_t i = 0; i < 128; i++)
+    {
+      int16_t n = i + c.transpose_;
+
+      note_[ch][i] = (n < c.low_ || n > c.high_ || n > 127) ? 0xff : n;
+      identity_ = identity_ && (note_[ch][i] == i);
+
+      if (i == 0)
+        vel_[ch][i] = 0;    // note off, stays one
+      else
+      {
+        float v = c.velMin_ + range * powf((i - 1) / 126.0f, c.curve_ / 100.0f);
+
+        vel_[ch][i] = (v < 1) ? 1 : (v > 127) ? 127 : (uint8_t)(v + 0.5f);
+      }
+      identity_ = identity_ && (vel_[ch][i] == i);
+    }
+  }
+}
+
+bool MidiTransform::apply (uint8_t* data, uint8_t size)
+// Transform one complete message in place. Returns false if it is dropped.
+{
+  uint8_t s = status_[data[0]];
+
+  if (s == 0)
+    return(false);
+
+  if (size >= 3 && data[0] < 0xb0)
+  {
+    // note off, note on and poly pressure
+    uint8_t ch = data[0] & 0x0f;
+    uint8_t n = note_[ch][data[1] & 0x7f];
+
+    if (n == 0xff)
+      return(false);
+    data[1] = n;
+    if ((data[0] & 0xf0) == 0x90)
+      data[2] = vel_[ch][data[2] & 0x7f];
+  }
+  data[0] = s;
+
+  return(true);
+}
+
+bool MidiTransform::parseKey (Channel& c, const char* key, const char* val)
+// Change one setting of 'c'. Returns false if it is not understood.
+{
+  long v = atol(val);
+
+  if (!strcmp(key, "map") && v >= 0 && v <= 16)
+    c.map_ = (v == 0) ? MTX_MAP_OFF : v;
+  else if (!strcmp(key, "transpose") && v >= -127 && v <= 127)
+    c.transpose_ = v;
+  else if (!strcmp(key, "low") && v >= 0 && v <= 127)
+    c.low_ = v;
+  else if (!strcmp(key, "high") && v >= 0 && v <= 127)
+    c.high_ = v;
+  else if (!strcmp(key, "curve") && v >= 10 && v <= 255)
+    c.curve_ = v;
+  else if (!strcmp(key, "vmin") && v >= 1 && v <= 127)
+    c.velMin_ = v;
+  else if (!strcmp(key, "vmax") && v >= 1 && v <= 127)
+    c.velMax_ = v;
+  else if (!strcmp(key, "drop"))
+  {
+    static const char TYPES[] = "nkcpab";
+
+    c.drop_ = 0;
+    for (; *val != '\0'; val++)
+    {
+      const char* t = strchr(TYPES, *val);
+
+      if (t == nullptr)
+        return(false);
+      c.drop_ |= 1 << (t - TYPES);
+    }
+  }
+  else
+    return(false);
+
+  return(true);
+}
+
+bool MidiTransform::parseLine (char* line)
+// Take the settings from one line of the file. Returns false if the
+// line is not understood, none of it is used then.
+{
+  const uint8_t KEYS_MAX = 8;
+  char* key[KEYS_MAX];
+  char* val[KEYS_MAX];
+  uint8_t keys = 0;
+  char* tok = strtok(line, " \t\r\n");
+  char* chan = tok;
+  uint8_t first, last;
+
+  if (tok == nullptr || *tok == '#')
+    return(true);
+
+  while ((tok = strtok(nullptr, " \t\r\n")) != nullptr && *tok != '#')
+  {
+    char* eq = strchr(tok, '=');
+
+    if (eq == nullptr || keys == KEYS_MAX)
+      return(false);
+    *eq = '\0';
+    key[keys] = tok;
+    val[keys++] = eq + 1;
+  }
+
+  if (strcmp(chan, "sys") == 0)
+  {
+    // only the drop list, status bytes in hex
+    uint16_t drop = 0;
+
+    if (keys != 1 || strcmp(key[0], "drop") != 0)
+      return(false);
+    for (char* p = val[0]; *p != '\0'; )
+    {
+      char* end;
+      long s = strtol(p, &end, 16);
+
+      if (end == p || s <= 0xf0 || s > 0xff || s == 0xf7)
+        return(false);
+      drop |= (1 << (s & 0x0f));
+      p = (*end == ',') ? end + 1 : end;
+    }
+    sysDrop_ |= drop;
+    return(true);
+  }
+
+  if (strcmp(chan, "*") == 0)
+  {
+    first = 0;
+    last = 15;
+  }
+  else
+  {
+    int ch = atoi(chan);
+
+    if (ch < 1 || ch > 16)
+      return(false);
+    first = last = ch - 1;
+  }
+
+  for (uint8_t i = 0; i < keys; i++)
+  {
+    Channel c = cfg_[first];
+
+    if (!parseKey(c, key[i], val[i]))
+      return(false);
+  }
+
+  for (uint8_t ch = first; ch <= last; ch++)
+    for (uint8_t i = 0; i < keys; i++)
+      parseKey(cfg_[ch], key[i], val[i]);
+
+  return(true);
+}
+
+bool MidiTransform::load (const char* path)
+// Read the settings from 'path' and compile them. The defaults stay if
+// there is no file. Returns false if a line could not be used.
+{
+  SDFILE f;
+  char line[MTX_LINE_MAX];
+  uint8_t len = 0;
+  uint16_t lineNo = 0;
+  bool bOk = true;
+  int c;
+
+  reset();
+  if (!f.open(path, O_READ))
+    return(true);
+
+  do
+  {
+    c = f.read();
+    if (c >= 0 && c != '\n' && len < sizeof(line) - 1)
+    {
+      line[len++] = c;
+      continue;
+    }
+    if (c >= 0 && c != '\n')
+      continue;       // too long, the rest is cut off
+
+    line[len] = '\0';
+    len = 0;
+    lineNo++;
+    if (!parseLine(line))
+    {
+      DEBUG("\nXFORM bad line ", lineNo);
+      bOk = false;
+    }
+  } while (c >= 0);
+
+  f.close();
+  compile();
+  DEBUGS(identity_ ? "\nXFORM none" : "\nXFORM loaded");
+
+  return(bOk);
+}
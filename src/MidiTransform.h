@@ -0,0 +1,86 @@
+#ifndef MidiTransform_h
+#define MidiTransform_h
+
+#include <stdint.h>
+#include <SdFat.h>
+#include <MD_MIDIFile.h>
+
+/*
+ * Per channel transforms applied on the way to the MIDI output: channel
+ * remap, transpose with a note range, velocity curve and message type
+ * filter, and a filter for system common and real time messages.
+ *
+ * The settings are compiled into lookup tables, so the work per message
+ * is a status byte lookup and, for notes, a note and a velocity lookup.
+ * The defaults pass everything through unchanged. A text file on the SD
+ * card can change them, one line per channel:
+ *
+ *  # channel 1-16 or * for all, then any of
+ *  10 map=11 transpose=-12 low=36 high=96 curve=70 vmin=20 vmax=120 drop=ka
+ *  sys drop=fe,f8
+ *
+ *  map       output channel 1-16, 0 drops the channel
+ *  transpose semitones, notes moved outside low..high are dropped
+ *  curve     velocity = vmin + (vmax - vmin) * ((v - 1) / 126) ^ (curve / 100),
+ *            above 100 plays softer, below 100 harder
+ *  drop      n notes, k poly pressure, c control change, p program change,
+ *            a channel pressure, b pitch bend
+ *  sys drop  status bytes F1-FF in hex. SysEx always passes.
+ */
+
+#define MTX_FILE        "XFORM.CFG"
+#define MTX_LINE_MAX    96        // longest line read from the file
+
+#define MTX_MAP_OFF     0xff      // Channel::map_ dropping the channel
+
+#define MTX_DROP_NOTE     0x01    // drop bits for Channel::drop_
+#define MTX_DROP_POLY_AT  0x02
+#define MTX_DROP_CC       0x04
+#define MTX_DROP_PROGRAM  0x08
+#define MTX_DROP_CHAN_AT  0x10
+#define MTX_DROP_BEND     0x20
+
+class MidiTransform
+{
+
+public:
+  typedef struct
+  {
+    uint8_t   map_;         ///< Output channel 1-16, 0 to keep it, MTX_MAP_OFF to drop it
+    int8_t    transpose_;   ///< Semitones
+    uint8_t   low_;         ///< Lowest note passed, after transposing
+    uint8_t   high_;        ///< Highest note passed, after transposing
+    uint8_t   curve_;       ///< Velocity curve exponent in 1/100, 100 linear
+    uint8_t   velMin_;      ///< Velocity for the softest note on
+    uint8_t   velMax_;      ///< Velocity for the hardest note on
+    uint8_t   drop_;        ///< MTX_DROP_* bits
+  } Channel;
+
+  static constexpr Channel DEFAULT_CHANNEL = { 0, 0, 0, 127, 100, 1, 127, 0 };
+
+  MidiTransform ();
+
+  void reset();
+  bool load(const char* path = MTX_FILE);
+  void setChannel(uint8_t ch, const Channel& c);
+  const Channel& getChannel(uint8_t ch) { return cfg_[ch]; }
+  void setSystemDrop(uint8_t status, bool bDrop);
+  void compile();
+
+  bool isIdentity() { return identity_; }
+  bool apply(uint8_t* data, uint8_t size);
+
+private:
+  bool parseLine(char* line);
+  bool parseKey(Channel& c, const char* key, const char* val);
+
+  Channel   cfg_[16];             ///< Settings, channels 0-15
+  uint16_t  sysDrop_;             ///< Bit n drops status 0xF0 + n
+
+  uint8_t   status_[256];         ///< Output status by input status, 0 to drop
+  uint8_t   note_[16][128];       ///< Output note by input channel and note, 0xff to drop
+  uint8_t   vel_[16][128];        ///< Note on velocity by input channel and velocity
+  bool      identity_;            ///< The tables change nothing
+};
+
+#endif // MidiTransform_h
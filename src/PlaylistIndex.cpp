@@ -0,0 +1,477 @@
+#include "Debug_def.h"
+#include "PlaylistIndex.h"
+#include <ctype.h>
+#include <stdlib.h>
+
+// Playlist Index ******************************************************
+
+static const uint32_t FNV_OFFSET = 2166136261UL;
+static const uint32_t FNV_PRIME = 16777619UL;
+
+typedef struct
+{
+  uint16_t  group_;             ///< Same for entries whose paths match so far
+  uint16_t  rec_;               ///< Record number in the scan order file
+  char      key_[PLI_SORT_KEY]; ///< Lower case part of the path
+} SortKey;
+
+static int compareKeys(const void* a, const void* b)
+{
+  const SortKey* ka = (const SortKey*)a;
+  const SortKey* kb = (const SortKey*)b;
+  int r = (ka->group_ != kb->group_) ? (int)ka->group_ - (int)kb->group_ : memcmp(ka->key_, kb->key_, PLI_SORT_KEY);
+
+  return(r != 0 ? r : (int)ka->rec_ - (int)kb->rec_);
+}
+
+static bool sortKeys(SDFILE& tmp, SortKey* keys, uint16_t count)
+// Sort the entries in 'tmp' on the whole path, PLI_SORT_KEY characters a
+// pass. Entries whose paths match so far share a group and only those
+// have their next characters read, so a pass costs one read for each
+// entry still tied. False if the file could not be read.
+{
+  PlaylistIndex::Entry e;
+  bool bTied = true;
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    keys[i].group_ = 0;
+    keys[i].rec_ = i;
+  }
+
+  for (uint8_t at = 0; at < PLI_PATH_SIZE && bTied; at += PLI_SORT_KEY)
+  {
+    uint16_t prev = 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+      if ((i == 0 || keys[i - 1].group_ != keys[i].group_) &&
+          (i + 1 == count || keys[i + 1].group_ != keys[i].group_))
+        continue;   // alone in its group, already in place
+
+      if (!tmp.seekSet((uint32_t)keys[i].rec_ * sizeof(e)) || tmp.read(&e, sizeof(e)) != sizeof(e))
+        return(false);
+      for (uint8_t j = 0; j < PLI_SORT_KEY; j++)
+        keys[i].key_[j] = (at + j < PLI_PATH_SIZE) ? tolower((uint8_t)e.path_[at + j]) : '\0';
+    }
+    qsort(keys, count, sizeof(SortKey), compareKeys);
+
+    // Regroup, numbering each group by where it starts so the order of
+    // the groups is kept in the next pass
+    bTied = false;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      uint16_t group = keys[i].group_;
+
+      if (i > 0 && group == prev && memcmp(keys[i - 1].key_, keys[i].key_, PLI_SORT_KEY) == 0)
+      {
+        keys[i].group_ = keys[i - 1].group_;
+        bTied = true;
+      }
+      else
+        keys[i].group_ = i;
+      prev = group;
+    }
+  }
+
+  return(true);
+}
+
+PlaylistIndex::PlaylistIndex (SDFAT& sd, FileFilter ff)
+:sd_(sd), ff_(ff), count_(0), fingerprint_(0), keys_(nullptr), folderCount_(0), folderPos_(0)
+{
+  path_[0] = '\0';
+};
+
+void PlaylistIndex::hash (uint32_t& h, const void* data, size_t size)
+// FNV-1a, good enough to notice a changed card
+{
+  const uint8_t* p = (const uint8_t*)data;
+
+  while (size--)
+  {
+    h ^= *p++;
+    h *= FNV_PRIME;
+  }
+}
+
+uint32_t PlaylistIndex::dirHash (SDFILE& dir)
+// Hash over the raw entries of 'dir', read straight from the directory
+// without opening anything. A file added, removed, renamed or rewritten
+// in the folder changes it.
+{
+  uint8_t   entry[PLI_DIR_ENTRY];
+  uint32_t  h = FNV_OFFSET;
+
+  dir.rewindDirectory();
+  while (dir.read(entry, sizeof(entry)) == sizeof(entry))
+    hash(h, entry, sizeof(entry));
+  dir.rewindDirectory();
+
+  return(h);
+}
+
+uint16_t PlaylistIndex::scan (SDFILE& dir, uint8_t len, uint8_t depth, SDFILE* out, SDFILE* folders)
+// Walk 'dir', whose path is in path_[0..len), and its subdirectories.
+// Each folder's path and songs are hashed on their own and added to
+// fingerprint_, so the order the folders are found in does not matter.
+// If 'out' is given every song is written to it as an Entry and every
+// folder to 'folders'. While an index is being checked, a folder whose
+// directory hashes the same as in the index is skipped. Returns the
+// number of songs found.
+{
+  SDFILE    f;
+  uint16_t  count = 0, songs = 0;
+  uint32_t  fp = FNV_OFFSET, dh = dirHash(dir), key = FNV_OFFSET;
+  int32_t   k;
+
+  hash(key, path_, len);
+  k = findFolder(key);
+  if (k >= 0 && readFolder(k) && folder_.dirHash_ == dh)
+    return(skip(k, len, depth));
+
+  hash(fp, path_, len);
+  while (f.openNext(&dir, O_READ))
+  {
+    if (!f.isHidden() && f.getName(&path_[len], PLI_PATH_SIZE - len) > 0)
+    {
+      uint8_t n = strlen(&path_[len]);
+
+      if (f.isDir())
+      {
+        if (depth < PLI_MAX_DEPTH && len + n + 1 < PLI_PATH_SIZE - 1)
+        {
+          path_[len + n] = '/';
+          path_[len + n + 1] = '\0';
+          count += scan(f, len + n + 1, depth + 1, out, folders);
+        }
+      }
+      else if (f.isFile() && ff_(&path_[len]))
+      {
+        Entry     e;
+        uint16_t  date = 0, time = 0;
+
+        memset(&e, 0, sizeof(e));
+        strcpy(e.path_, path_);
+        e.nameOffset_ = len;
+        e.depth_ = depth;
+        e.size_ = f.fileSize();
+        f.getModifyDateTime(&date, &time);
+        e.modified_ = ((uint32_t)date << 16) | time;
+
+        hash(fp, e.path_, len + n);
+        hash(fp, &e.size_, sizeof(e.size_));
+        hash(fp, &e.modified_, sizeof(e.modified_));
+
+        if (out != nullptr)
+          out->write(&e, sizeof(e));
+        songs++;
+      }
+    }
+    f.close();
+  }
+  path_[len] = '\0';
+  fingerprint_ += fp;
+
+  if (folders != nullptr)
+  {
+    memset(&folder_, 0, sizeof(folder_));
+    strcpy(folder_.path_, path_);
+    folder_.depth_ = depth;
+    folder_.songs_ = songs;
+    folder_.dirHash_ = dh;
+    folder_.fingerprint_ = fp;
+    folders->write(&folder_, sizeof(folder_));
+    folderCount_++;
+  }
+  else if (k >= 0 && readFolder(k) && folder_.songs_ == songs && folder_.fingerprint_ == fp)
+  {
+    // Something other than a song changed, keep the new hash so the
+    // folder is skipped next time
+    folder_.dirHash_ = dh;
+    if (idxFile_.seekSet(folderPos_ + (uint32_t)k * sizeof(Folder)))
+      idxFile_.write(&folder_, sizeof(folder_));
+  }
+
+  return(count + songs);
+}
+
+uint16_t PlaylistIndex::skip (uint16_t k, uint8_t len, uint8_t depth)
+// Take the songs of folder 'k', just read into folder_, from the index
+// rather than walking it, then check its subfolders as scan() does
+{
+  SDFILE    f;
+  uint16_t  count = folder_.songs_;
+
+  fingerprint_ += folder_.fingerprint_;
+  for (uint16_t i = 0; i < folderCount_; i++)
+  {
+    if (keys_[i].parent_ == keys_[k].path_ && readFolder(i) && f.open(folder_.path_, O_READ))
+    {
+      strcpy(path_, folder_.path_);
+      count += scan(f, strlen(path_), depth + 1, nullptr, nullptr);
+      f.close();
+    }
+  }
+  path_[len] = '\0';
+
+  return(count);
+}
+
+int32_t PlaylistIndex::findFolder (uint32_t path)
+// Folder of the index being checked with the path hashing to 'path', -1 if
+// there is none
+{
+  for (uint16_t i = 0; keys_ != nullptr && i < folderCount_; i++)
+  {
+    if (keys_[i].path_ == path)
+      return(i);
+  }
+
+  return(-1);
+}
+
+bool PlaylistIndex::readFolder (uint16_t k)
+// Read folder 'k' of the index into folder_
+{
+  if (!idxFile_.seekSet(folderPos_ + (uint32_t)k * sizeof(Folder)) ||
+      idxFile_.read(&folder_, sizeof(folder_)) != sizeof(folder_))
+    return(false);
+
+  folder_.path_[PLI_PATH_SIZE - 1] = '\0';
+  return(true);
+}
+
+bool PlaylistIndex::loadFolders (const Header& h)
+// Keep the path hashes of the folders in the index open in idxFile_, to
+// find them again while checking the card
+{
+  folderCount_ = h.folders_;
+  folderPos_ = sizeof(Header) + (uint32_t)h.count_ * (sizeof(Entry) + sizeof(Meta));
+  keys_ = (FolderKey*)malloc(folderCount_ * sizeof(FolderKey));
+  if (keys_ == nullptr)
+    return(false);
+
+  for (uint16_t i = 0; i < folderCount_; i++)
+  {
+    uint8_t n, p;
+
+    if (!readFolder(i))
+    {
+      free(keys_);
+      keys_ = nullptr;
+      return(false);
+    }
+
+    // the parent's path ends at the '/' before the last one
+    n = strlen(folder_.path_);
+    p = (n > 1) ? n - 1 : 0;
+    while (p > 0 && folder_.path_[p - 1] != '/')
+      p--;
+
+    keys_[i].path_ = FNV_OFFSET;
+    hash(keys_[i].path_, folder_.path_, n);
+    keys_[i].parent_ = FNV_OFFSET;
+    hash(keys_[i].parent_, folder_.path_, p);
+  }
+
+  return(true);
+}
+
+bool PlaylistIndex::readHeader (Header& h)
+// Read the header of the index open in idxFile_, false if it is not usable
+{
+  return(idxFile_.seekSet(0) && idxFile_.read(&h, sizeof(h)) == sizeof(h) &&
+         memcmp(h.magic_, "RPIX", sizeof(h.magic_)) == 0 &&
+         h.version_ == PLI_VERSION && h.recSize_ == sizeof(Entry) &&
+         h.metaSize_ == sizeof(Meta) && h.folderSize_ == sizeof(Folder));
+}
+
+bool PlaylistIndex::rebuild ()
+// Write a new index. The songs are collected in scan order in a temporary
+// file and the folders in another, then copied to the index with the
+// songs sorted by path and an empty song information table after them.
+// The header is written last so a half written index is never taken as
+// valid, and if anything cannot be written or read back the index is
+// removed and the rebuild given up.
+{
+  SDFILE    tmp, dirs, idx;
+  SDFILE    root;
+  Header    h;
+  Entry     e;
+  Meta      m;
+  SortKey*  keys = nullptr;
+  bool      b;
+
+  b = tmp.open(PLI_TEMP_FILE, O_RDWR | O_CREAT | O_TRUNC) &&
+      dirs.open(PLI_FOLDER_FILE, O_RDWR | O_CREAT | O_TRUNC) &&
+      root.open("/", O_READ);
+  if (b)
+  {
+    fingerprint_ = 0;
+    folderCount_ = 0;
+    strcpy(path_, "/");
+    count_ = scan(root, 1, 0, &tmp, &dirs);
+    hash(fingerprint_, &count_, sizeof(count_));
+    b = tmp.fileSize() == (uint32_t)count_ * sizeof(Entry) &&
+        dirs.fileSize() == (uint32_t)folderCount_ * sizeof(Folder);
+  }
+  root.close();
+
+  // Sort on the whole path. If there is no memory for it the index is
+  // still usable, just in directory order.
+  if (b)
+  {
+    keys = (SortKey*)malloc(count_ * sizeof(SortKey));
+    b = (keys == nullptr) || sortKeys(tmp, keys, count_);
+  }
+
+  memset(&h, 0, sizeof(h));
+  b = b && idx.open(PLI_FILE, O_RDWR | O_CREAT | O_TRUNC) &&
+      idx.write(&h, sizeof(h)) == sizeof(h);
+  for (uint16_t i = 0; b && i < count_; i++)
+  {
+    uint16_t rec = (keys != nullptr) ? keys[i].rec_ : i;
+
+    b = tmp.seekSet((uint32_t)rec * sizeof(Entry)) && tmp.read(&e, sizeof(e)) == sizeof(e) &&
+        idx.write(&e, sizeof(e)) == sizeof(e);
+  }
+  free(keys);
+
+  memset(&m, 0, sizeof(m));
+  for (uint16_t i = 0; b && i < count_; i++)
+    b = idx.write(&m, sizeof(m)) == sizeof(m);
+
+  b = b && dirs.seekSet(0);
+  for (uint16_t i = 0; b && i < folderCount_; i++)
+    b = dirs.read(&folder_, sizeof(folder_)) == sizeof(folder_) &&
+        idx.write(&folder_, sizeof(folder_)) == sizeof(folder_);
+
+  tmp.close();
+  dirs.close();
+  sd_.remove(PLI_TEMP_FILE);
+  sd_.remove(PLI_FOLDER_FILE);
+
+  // The temporary files were in the root when it was hashed. Hash it
+  // again now they are gone and the index has its size, so the next
+  // check skips it. The root is the last folder written by scan().
+  b = b && idx.sync() && root.open("/", O_READ);
+  if (b)
+  {
+    folder_.dirHash_ = dirHash(root);
+    root.close();
+    b = idx.seekSet(idx.curPosition() - sizeof(Folder)) && idx.write(&folder_, sizeof(folder_)) == sizeof(folder_);
+  }
+
+  if (b)
+  {
+    memcpy(h.magic_, "RPIX", sizeof(h.magic_));
+    h.version_ = PLI_VERSION;
+    h.recSize_ = sizeof(Entry);
+    h.count_ = count_;
+    h.metaSize_ = sizeof(Meta);
+    h.fingerprint_ = fingerprint_;
+    h.folders_ = folderCount_;
+    h.folderSize_ = sizeof(Folder);
+    b = idx.seekSet(0) && idx.write(&h, sizeof(h)) == sizeof(h) && idx.sync();
+  }
+  idx.close();
+
+  if (!b)
+  {
+    sd_.remove(PLI_FILE);
+    count_ = 0;
+    DEBUGS("\nIndex not written");
+    return(false);
+  }
+
+  DEBUG("\nIndex written ", count_);
+  return(true);
+}
+
+int16_t PlaylistIndex::open ()
+// Check the index against the card and rebuild it if anything changed.
+// Returns the number of songs, or -1 if the index cannot be used.
+{
+  SDFILE    root;
+  Header    h;
+  uint16_t  count;
+  bool      bValid;
+
+  close();
+
+  bValid = idxFile_.open(PLI_FILE, O_RDWR) && readHeader(h) && loadFolders(h);
+  if (!root.open("/", O_READ))
+  {
+    close();
+    return(-1);
+  }
+  fingerprint_ = 0;
+  strcpy(path_, "/");
+  count = scan(root, 1, 0, nullptr, nullptr);
+  root.close();
+  hash(fingerprint_, &count, sizeof(count));
+
+  if (bValid && h.count_ == count && h.fingerprint_ == fingerprint_)
+  {
+    DEBUG("\nIndex up to date ", count);
+    free(keys_);
+    keys_ = nullptr;
+    count_ = count;
+    idxFile_.sync();    // folder hashes brought up to date by scan()
+    return(count_);
+  }
+
+  close();
+  if (!rebuild() || !idxFile_.open(PLI_FILE, O_RDWR))
+    return(-1);
+
+  return(count_);
+}
+
+void PlaylistIndex::close ()
+{
+  if (idxFile_.isOpen())
+    idxFile_.close();
+  free(keys_);
+  keys_ = nullptr;
+  count_ = 0;
+}
+
+bool PlaylistIndex::get (uint16_t idx, Entry& e)
+// Read entry 'idx', a single seek and read
+{
+  if (idx >= count_ || !idxFile_.isOpen())
+    return(false);
+
+  idxFile_.seekSet(sizeof(Header) + (uint32_t)idx * sizeof(Entry));
+  return(idxFile_.read(&e, sizeof(e)) == sizeof(e));
+}
+
+uint32_t PlaylistIndex::metaPos (uint16_t idx)
+{
+  return(sizeof(Header) + (uint32_t)count_ * sizeof(Entry) + (uint32_t)idx * sizeof(Meta));
+}
+
+bool PlaylistIndex::getMeta (uint16_t idx, Meta& m)
+// Read the song information of entry 'idx', a single seek and read
+{
+  if (idx >= count_ || !idxFile_.isOpen())
+    return(false);
+
+  idxFile_.seekSet(metaPos(idx));
+  return(idxFile_.read(&m, sizeof(m)) == sizeof(m));
+}
+
+bool PlaylistIndex::putMeta (uint16_t idx, const Meta& m)
+// Keep the song information of entry 'idx' in the index
+{
+  if (idx >= count_ || !idxFile_.isOpen())
+    return(false);
+
+  idxFile_.seekSet(metaPos(idx));
+  if (idxFile_.write(&m, sizeof(m)) != sizeof(m))
+    return(false);
+
+  return(idxFile_.sync());
+}
@@ -0,0 +1,130 @@
+#ifndef PlaylistIndex_h
+#define PlaylistIndex_h
+
+#include <stdint.h>
+#include <SdFat.h>
+#include <MD_MIDIFile.h>
+
+/*
+ * Binary playlist index kept on the SD card.
+ *
+ * The index holds one fixed size record per song found in the root
+ * directory and its subdirectories, sorted by path, so any entry can be
+ * read with a single seek. A fingerprint of the names, sizes and
+ * modification times of the songs is stored in the header and the index
+ * is only rebuilt when the card contents have changed.
+ *
+ * Checking the card is kept cheap with a table of the folders at the end
+ * of the index. Each Folder holds a hash of the folder's raw directory
+ * entries, read without opening anything, and the songs found in it. A
+ * folder whose entries hash the same is not walked again, its songs and
+ * subfolders are taken from the table.
+ *
+ * After the entries comes a table of song information, one Meta record
+ * per entry. It starts out empty and is filled in as the songs are looked
+ * at, see SongInfo, so it is kept until the index is rebuilt.
+ */
+
+#define PLI_FILE          "PLAYLIST.IDX"
+#define PLI_TEMP_FILE     "PLAYLIST.TMP"
+#define PLI_FOLDER_FILE   "PLAYLIST.DIR"
+#define PLI_VERSION       3
+#define PLI_PATH_SIZE     116     // full path including the terminating '\0'
+#define PLI_MAX_DEPTH     4       // subdirectory levels scanned below the root
+#define PLI_SORT_KEY      24      // path characters read at a time when sorting
+#define PLI_DIR_ENTRY     32      // bytes read at a time to hash a directory
+#define PLI_TITLE_SIZE    20      // song title including the terminating '\0'
+
+#define PLI_META_NONE     0       // not looked at yet
+#define PLI_META_OK       1
+#define PLI_META_BAD      2       // not a MIDI file that could be read
+
+class PlaylistIndex
+{
+
+public:
+  typedef struct
+  {
+    char      magic_[4];      ///< "RPIX"
+    uint16_t  version_;       ///< PLI_VERSION
+    uint16_t  recSize_;       ///< sizeof(Entry)
+    uint16_t  count_;         ///< Number of entries
+    uint16_t  metaSize_;      ///< sizeof(Meta)
+    uint32_t  fingerprint_;   ///< Hash over name, size and date of every song
+    uint16_t  folders_;       ///< Number of folders
+    uint16_t  folderSize_;    ///< sizeof(Folder)
+  } Header;
+
+  typedef struct
+  {
+    char      path_[PLI_PATH_SIZE]; ///< Full path from the root
+    uint8_t   nameOffset_;          ///< Start of the file name in path_
+    uint8_t   depth_;               ///< Subdirectory level, 0 for the root
+    uint16_t  reserved_;
+    uint32_t  size_;                ///< File size in bytes
+    uint32_t  modified_;            ///< FAT date << 16 | FAT time
+  } Entry;
+
+  typedef struct
+  {
+    uint8_t   state_;                 ///< PLI_META_NONE, PLI_META_OK or PLI_META_BAD
+    uint8_t   tracks_;                ///< Track chunks, 255 for more
+    uint8_t   timeSigNum_;            ///< Time signature at the start
+    uint8_t   timeSigDen_;
+    uint32_t  usPerQuarter_;          ///< Tempo at the start
+    uint32_t  durationMs_;
+    char      title_[PLI_TITLE_SIZE]; ///< First track name or text in the first track
+  } Meta;
+
+  typedef struct
+  {
+    char      path_[PLI_PATH_SIZE]; ///< Full path from the root, ending in '/'
+    uint8_t   depth_;               ///< Subdirectory level, 0 for the root
+    uint8_t   reserved_;
+    uint16_t  songs_;               ///< Songs directly in the folder
+    uint32_t  dirHash_;             ///< Hash over the raw directory entries
+    uint32_t  fingerprint_;         ///< Hash over the path and its songs
+  } Folder;
+
+  typedef bool (*FileFilter)(const char* name);
+
+  PlaylistIndex (SDFAT& sd, FileFilter ff);
+
+  int16_t open();
+  void close();
+  bool get(uint16_t idx, Entry& e);
+  bool getMeta(uint16_t idx, Meta& m);
+  bool putMeta(uint16_t idx, const Meta& m);
+  uint16_t getCount() { return count_; }
+
+private:
+  typedef struct
+  {
+    uint32_t  path_;          ///< Hash of the folder's path
+    uint32_t  parent_;        ///< Hash of its parent's path
+  } FolderKey;
+
+  uint16_t scan(SDFILE& dir, uint8_t len, uint8_t depth, SDFILE* out, SDFILE* folders);
+  uint16_t skip(uint16_t k, uint8_t len, uint8_t depth);
+  bool rebuild();
+  bool readHeader(Header& h);
+  bool loadFolders(const Header& h);
+  int32_t findFolder(uint32_t path);
+  bool readFolder(uint16_t k);
+  uint32_t metaPos(uint16_t idx);
+  static uint32_t dirHash(SDFILE& dir);
+  static void hash(uint32_t& h, const void* data, size_t size);
+
+  SDFAT&      sd_;
+  FileFilter  ff_;
+  SDFILE      idxFile_;
+  uint16_t    count_;
+  uint32_t    fingerprint_;   ///< Accumulated by scan()
+  char        path_[PLI_PATH_SIZE];
+  Folder      folder_;        ///< Record being read or written by scan()
+  FolderKey*  keys_;          ///< Folders of the index being checked, nullptr if none
+  uint16_t    folderCount_;
+  uint32_t    folderPos_;     ///< Start of the folder table in the index
+};
+
+#endif // PlaylistIndex_h
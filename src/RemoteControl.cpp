@@ -0,0 +1,128 @@
+#include "Debug_def.h"
+#include "RemoteControl.h"
+#include <string.h>
+
+// Remote Control ******************************************************
+
+static const uint8_t FIELD_BYTES[RemoteControl::RF_COUNT] = { 1, 2, 2, 3, 2, 2 };
+
+RemoteControl::RemoteControl (WriteHandler wh, uint8_t id)
+:wh_(wh), id_(id), head_(0), tail_(0), changed_(0), watched_(false), lastPush_(0)
+{
+  memset(field_, 0, sizeof(field_));
+  resetStats();
+};
+
+void RemoteControl::resetStats ()
+{
+  commands_ = rejected_ = pushes_ = 0;
+  memset(&latency_, 0, sizeof(latency_));
+}
+
+bool RemoteControl::decode (const uint8_t* data, uint16_t length, uint32_t nowUs)
+// Take a frame from Serial2 apart, 'data' is what came between F0 and F7,
+// the id included. Status requests are answered here, the other commands
+// are queued for the FSMs. Returns false if it is not a valid command.
+{
+  static const uint8_t ARGS[] = { 2, 0, 0, 0, 3, 2, 0, 1, 0, 1 };  // bytes, RC_SELECT on
+  Command c;
+
+  if (length < 2 || data[0] != id_ || !isCommand(data[1]) || length != 2 + ARGS[data[1] - RC_SELECT])
+  {
+    rejected_++;
+    return(false);
+  }
+
+  c.cmd_ = (command)data[1];
+  c.value_ = 0;
+  c.arrivedUs_ = nowUs;
+  for (uint16_t i = 2; i < length; i++)
+    c.value_ = (c.value_ << 7) | (data[i] & 0x7f);
+
+  switch (c.cmd_)
+  {
+  case RC_STATUS:
+    changed_ = (1 << RF_COUNT) - 1;
+    send(nowUs);
+    return(true);
+
+  case RC_WATCH:
+    watched_ = (c.value_ != 0);
+    changed_ = watched_ ? (1 << RF_COUNT) - 1 : 0;
+    lastPush_ = nowUs - RC_PUSH_US;   // the whole status goes with the next push
+    return(true);
+
+  default:
+    break;
+  }
+
+  if (((tail_ + 1) & (RC_QUEUE - 1)) == head_)
+  {
+    rejected_++;
+    return(false);
+  }
+  queue_[tail_] = c;
+  tail_ = (tail_ + 1) & (RC_QUEUE - 1);
+
+  return(true);
+}
+
+const RemoteControl::Command* RemoteControl::next ()
+// The command to act on next, nullptr if there is none. It stays in the
+// queue until done() is called, so an FSM can leave it for another.
+{
+  return((head_ == tail_) ? nullptr : &queue_[head_]);
+}
+
+void RemoteControl::done (uint32_t nowUs)
+// The command from next() has been acted on
+{
+  if (head_ == tail_)
+    return;
+
+  LatencyStats::record(latency_, nowUs - queue_[head_].arrivedUs_);
+  commands_++;
+  head_ = (head_ + 1) & (RC_QUEUE - 1);
+}
+
+void RemoteControl::set (field f, uint32_t v)
+{
+  if (field_[f] != v)
+  {
+    field_[f] = v;
+    changed_ |= (1 << f);
+  }
+}
+
+void RemoteControl::push (uint32_t nowUs)
+// Send the fields that have changed, if the controller is watching and
+// the last push is old enough
+{
+  if (watched_ && changed_ != 0 && nowUs - lastPush_ >= RC_PUSH_US)
+    send(nowUs);
+}
+
+void RemoteControl::send (uint32_t nowUs)
+// One status frame with the fields that have changed
+{
+  uint8_t frame[4 + RF_COUNT * 3 + 1];
+  uint8_t n = 0;
+
+  frame[n++] = 0xf0;
+  frame[n++] = id_;
+  frame[n++] = RC_STATE_PUSH;
+  frame[n++] = changed_;
+  for (uint8_t f = 0; f < RF_COUNT; f++)
+  {
+    if ((changed_ & (1 << f)) == 0)
+      continue;
+    for (int8_t b = FIELD_BYTES[f] - 1; b >= 0; b--)
+      frame[n++] = (field_[f] >> (7 * b)) & 0x7f;
+  }
+  frame[n++] = 0xf7;
+
+  wh_(frame, n);
+  changed_ = 0;
+  lastPush_ = nowUs;
+  pushes_++;
+}
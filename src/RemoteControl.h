@@ -0,0 +1,129 @@
+#ifndef RemoteControl_h
+#define RemoteControl_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "LatencyStats.h"
+
+/*
+ * Binary remote control on Serial2, framed like the operator queries:
+ *
+ *  F0 id command [arguments] F7
+ *
+ * with every argument byte 7 bits, numbers most significant first.
+ *
+ *  RC_SELECT msb lsb       select playlist entry, first 0. Stops the song
+ *                          playing, RC_PLAY starts the new one.
+ *  RC_PLAY                 play the song selected, or carry on after a pause
+ *  RC_STOP                 stop playing
+ *  RC_PAUSE                pause the song playing
+ *  RC_TEMPO b2 b1 b0       tempo in 1/TEMPO_FRAC BPM, reached over a ramp
+ *  RC_SEEK msb lsb         jump to bar, first 0
+ *  RC_STATUS               send every status field now
+ *  RC_WATCH 0|1            stop or start the status pushes
+ *  RC_CLOCK source         follow the clock of source from the next song
+ *                          on, 0 none (send our own), 1 BLE, 2 Serial2.
+ *                          Kept on the card with the other settings.
+ *
+ * decode() takes a frame apart and queues the command. The UI task reads
+ * Serial2 at the top of its pass, and the FSMs take the commands with
+ * next() and done() in the same pass, in the order they came.
+ *
+ * The player set()s the status fields once a pass. While the controller
+ * watches, the fields that changed are pushed together in one frame
+ *
+ *  F0 id RC_STATE_PUSH mask fields F7
+ *
+ * with bit n of the mask set for each field n that follows, each in the
+ * number of bytes given with the field. A push goes out at once if the last
+ * one is RC_PUSH_US old, otherwise the changes wait until it is, so a
+ * burst of changes costs one frame. Nothing is sent while nothing changes.
+ *
+ * Only the UI task uses this.
+ */
+
+#define RC_QUEUE          8       // commands waiting for the FSMs, must be a power of 2
+#define RC_PUSH_US        10000   // least time between status pushes
+
+class RemoteControl
+{
+
+public:
+  enum command : uint8_t
+  {
+    RC_SELECT = 0x10,
+    RC_PLAY = 0x11,
+    RC_STOP = 0x12,
+    RC_PAUSE = 0x13,
+    RC_TEMPO = 0x14,
+    RC_SEEK = 0x15,
+    RC_STATUS = 0x16,
+    RC_WATCH = 0x17,
+    RC_STATE_PUSH = 0x18,   ///< Status frame sent
+    RC_CLOCK = 0x19,
+  };
+
+  enum field : uint8_t
+  {
+    RF_STATE,       ///< 1 byte, player state, one of the play_state values
+    RF_SONG,        ///< 2 bytes, playlist entry selected or playing
+    RF_SONGS,       ///< 2 bytes, entries in the playlist
+    RF_TEMPO,       ///< 3 bytes, tempo the song is heading for, 1/TEMPO_FRAC BPM
+    RF_BAR,         ///< 2 bytes, bar reached, first 0
+    RF_TIMESIG,     ///< 2 bytes, numerator and denominator
+    RF_COUNT
+  };
+
+  enum play_state : uint8_t { RS_STOPPED, RS_PLAYING, RS_PAUSED };
+
+  typedef struct
+  {
+    command   cmd_;
+    uint32_t  value_;     ///< The argument, if the command has one
+    uint32_t  arrivedUs_;
+  } Command;
+
+  typedef size_t (*WriteHandler)(const uint8_t* data, size_t size);
+
+  RemoteControl (WriteHandler wh, uint8_t id);
+
+  static bool isCommand(uint8_t command) { return (command >= RC_SELECT && command <= RC_WATCH) || command == RC_CLOCK; }
+  bool decode(const uint8_t* data, uint16_t length, uint32_t nowUs);
+
+  // FSM side
+  const Command* next();
+  void done(uint32_t nowUs);
+
+  // Status
+  void set(field f, uint32_t v);
+  void push(uint32_t nowUs);
+  bool isWatched() { return watched_; }
+
+  uint32_t getCommands() { return commands_; }
+  uint32_t getRejected() { return rejected_; }
+  uint32_t getPushes() { return pushes_; }
+  const LatencyStats::Histogram& getLatency() { return latency_; }
+  void resetStats();
+
+private:
+  void send(uint32_t nowUs);
+
+  WriteHandler wh_;
+  uint8_t   id_;              ///< SysEx id of the frames
+
+  Command   queue_[RC_QUEUE];
+  uint8_t   head_;
+  uint8_t   tail_;
+
+  uint32_t  field_[RF_COUNT];
+  uint8_t   changed_;         ///< Fields not pushed yet, bit per field
+  bool      watched_;
+  uint32_t  lastPush_;        ///< Time of the last push
+
+  uint32_t  commands_;        ///< Commands taken by the FSMs
+  uint32_t  rejected_;        ///< Frames that were not a valid command, or found the queue full
+  uint32_t  pushes_;          ///< Status frames sent
+  LatencyStats::Histogram latency_; ///< Frame in to command taken, us
+};
+
+#endif // RemoteControl_h
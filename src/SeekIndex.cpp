@@ -0,0 +1,223 @@
+#include "Debug_def.h"
+#include "SeekIndex.h"
+#include <string.h>
+
+// Seek Index **********************************************************
+
+// Controllers put back on a seek, bank select first so the program change
+// that follows picks the right bank
+static const uint8_t restoreCC[] = { 0, 32, 1, 7, 10, 11, 64, 71, 72, 73, 74, 91, 93 };
+static_assert(sizeof(restoreCC) == SEEK_RESTORE_CC, "SEEK_RESTORE_CC is the size of the restore list");
+
+SeekIndex::SeekIndex ()
+{
+  clear();
+};
+
+void SeekIndex::clear ()
+{
+  count_ = 0;
+  barLen_ = 0;
+  timeSig_ = 0;
+  bMarker_ = false;
+  bMarkers_ = false;
+}
+
+void SeekIndex::saveImage (uint8_t* buf)
+// Copy the finished index to 'buf', getImageSize() bytes
+{
+  memcpy(buf, &count_, sizeof(count_));
+  memcpy(buf + sizeof(count_), bars_, count_ * sizeof(Bar));
+  memcpy(buf + sizeof(count_) + count_ * sizeof(Bar), snap_, snapCount(count_) * sizeof(State));
+}
+
+bool SeekIndex::loadImage (const uint8_t* buf, uint32_t size)
+// Take the index from a saveImage() copy. Returns false if it is not one.
+{
+  uint16_t count;
+
+  clear();
+  if (size < sizeof(count))
+    return(false);
+  memcpy(&count, buf, sizeof(count));
+  if (count > SEEK_MAX_BARS || size != sizeof(count) + count * sizeof(Bar) + snapCount(count) * sizeof(State))
+    return(false);
+
+  memcpy(bars_, buf + sizeof(count), count * sizeof(Bar));
+  memcpy(snap_, buf + sizeof(count) + count * sizeof(Bar), snapCount(count) * sizeof(State));
+  count_ = count;
+
+  return(true);
+}
+
+void SeekIndex::update (uint32_t tick, uint16_t timeSig, uint16_t ticksPerQuarter, uint16_t event)
+// Called for every tick while the song is loaded, after the events of the
+// tick have been processed. 'event' is the stream event count before them.
+{
+  bool bNew = (count_ == 0) || (tick - bars_[count_ - 1].tick_ >= barLen_);
+
+  // a time signature change part way through a bar starts a new one
+  if (count_ > 0 && timeSig != timeSig_ && tick != bars_[count_ - 1].tick_)
+    bNew = true;
+
+  timeSig_ = timeSig;
+  if ((timeSig & 0xff) != 0)
+    barLen_ = ((uint32_t)ticksPerQuarter * 4 * (timeSig >> 8)) / (timeSig & 0xff);
+  if (barLen_ == 0)
+    barLen_ = ticksPerQuarter * 4;
+
+  if (bMarker_ && !bNew && count_ > 0 && tick == bars_[count_ - 1].tick_)
+  {
+    bars_[count_ - 1].section_ = 1;   // marker on the first tick of the bar
+    bMarker_ = false;
+    bMarkers_ = true;
+  }
+
+  if (!bNew || count_ >= SEEK_MAX_BARS)
+    return;
+
+  bars_[count_].tick_ = tick;
+  bars_[count_].event_ = event;
+  bars_[count_].section_ = bMarker_ || count_ == 0;
+  bars_[count_].reserved_ = 0;
+  bMarkers_ |= bMarker_;
+  bMarker_ = false;
+  count_++;
+}
+
+void SeekIndex::end (uint32_t tick, MidiEventStream& song)
+// Finish building, 'tick' is the length of 'song'. Without markers the
+// song is cut into equal sections. The snapshots are taken in one pass
+// over the song.
+{
+  State st;
+
+  while (count_ > 1 && bars_[count_ - 1].tick_ >= tick)
+    count_--;     // the end of track tick does not start a bar
+
+  if (!bMarkers_)
+    for (uint16_t i = 0; i < count_; i++)
+      bars_[i].section_ = (i % SEEK_SECTION_BARS) == 0;
+
+  memset(&st, 0xff, sizeof(st));
+  for (uint16_t i = 0; i < snapCount(count_); i++)
+  {
+    scan(song, (i == 0) ? 0 : bars_[(i - 1) * SEEK_SNAP_BARS].event_, bars_[i * SEEK_SNAP_BARS].event_, st);
+    snap_[i] = st;
+  }
+
+  DEBUG("\nSeek index bars ", count_);
+  DEBUG(" markers ", bMarkers_);
+}
+
+uint16_t SeekIndex::barAt (uint32_t tick)
+// Bar that 'tick' is in
+{
+  uint16_t lo = 0, hi = count_;
+
+  while (hi - lo > 1)
+  {
+    uint16_t mid = (lo + hi) / 2;
+
+    if (bars_[mid].tick_ <= tick)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return(lo);
+}
+
+uint16_t SeekIndex::prevSection (uint16_t bar)
+// Start of the section 'bar' is in, or of the one before if 'bar' is the
+// first bar of its section
+{
+  if (count_ == 0)
+    return(0);
+  if (bar >= count_)
+    bar = count_ - 1;
+
+  if (bar > 0 && bars_[bar].section_)
+    bar--;
+  while (bar > 0 && !bars_[bar].section_)
+    bar--;
+
+  return(bar);
+}
+
+uint16_t SeekIndex::nextSection (uint16_t bar)
+// Start of the section after the one 'bar' is in, count if there is none
+{
+  for (bar++; bar < count_; bar++)
+    if (bars_[bar].section_)
+      break;
+
+  return(bar);
+}
+
+void SeekIndex::scan (MidiEventStream& song, uint16_t from, uint16_t to, State& st)
+// Bring 'st' from the state at event 'from' to the state at event 'to'
+{
+  for (uint16_t i = from; i < to && i < song.getEventCount(); i++)
+  {
+    const MidiEventStream::Event* pev = song.getEvent(i);
+    uint8_t ch = pev->status_ & 0x0f;
+
+    switch (pev->status_ & 0xf0)
+    {
+    case 0xb0:
+      for (uint8_t j = 0; j < sizeof(restoreCC); j++)
+        if (restoreCC[j] == pev->data_[0])
+          st.cc_[ch][j] = pev->data_[1];
+      break;
+
+    case 0xc0:
+      st.program_[ch] = pev->data_[0];
+      break;
+
+    case 0xe0:
+      st.bend_[ch] = pev->data_[0] | (pev->data_[1] << 7);
+      break;
+    }
+  }
+}
+
+uint16_t SeekIndex::restoreState (MidiEventStream& song, uint16_t bar, SendHandler sh)
+// Send the program, pitch bend and restore list controller values each
+// channel has at the start of 'bar', as the song left them. Channels and
+// values the song has not touched are left alone. Returns the number of
+// messages sent.
+{
+  State     st = snap_[bar / SEEK_SNAP_BARS];
+  uint16_t  count = 0;
+
+  scan(song, bars_[bar - bar % SEEK_SNAP_BARS].event_, bars_[bar].event_, st);
+
+  for (uint8_t ch = 0; ch < 16; ch++)
+  {
+    for (uint8_t j = 0; j < sizeof(restoreCC); j++)
+    {
+      if (st.cc_[ch][j] != 0xff)
+      {
+        uint8_t msg[3] = { (uint8_t)(0xb0 | ch), restoreCC[j], st.cc_[ch][j] };
+
+        count += sh(msg, sizeof(msg));
+      }
+      if (j == 1 && st.program_[ch] != 0xff)
+      {
+        uint8_t msg[2] = { (uint8_t)(0xc0 | ch), st.program_[ch] };
+
+        count += sh(msg, sizeof(msg));
+      }
+    }
+
+    if (st.bend_[ch] != 0xffff)
+    {
+      uint8_t msg[3] = { (uint8_t)(0xe0 | ch), (uint8_t)(st.bend_[ch] & 0x7f), (uint8_t)(st.bend_[ch] >> 7) };
+
+      count += sh(msg, sizeof(msg));
+    }
+  }
+
+  return(count);
+}
@@ -0,0 +1,85 @@
+#ifndef SeekIndex_h
+#define SeekIndex_h
+
+#include <stdint.h>
+#include "MidiEventStream.h"
+
+/*
+ * Bar and section index of the song in the RAM event stream.
+ *
+ * Built alongside the event stream at load time: update() is called once
+ * per tick and starts a new bar whenever a bar of the current time
+ * signature has gone by. Each bar records its tick and the first event at
+ * or after it. Sections start at Marker meta events, or every
+ * SEEK_SECTION_BARS bars if the song has none.
+ *
+ * On a seek the channel state (program, pitch bend and the controllers
+ * in the restore list) in effect at the bar is sent as one message per
+ * value rather than replaying the song. end() keeps a snapshot of that
+ * state every SEEK_SNAP_BARS bars, so a seek starts from the snapshot at
+ * or before the bar and only scans the events in between. A snapshot of
+ * every bar would take 256 bytes a bar, 128K for the longest song.
+ */
+
+#define SEEK_MAX_BARS     512
+#define SEEK_SECTION_BARS 8       // bars per section when there are no markers
+#define SEEK_SNAP_BARS    32      // bars between channel state snapshots
+#define SEEK_RESTORE_CC   13      // controllers in the restore list
+
+class SeekIndex
+{
+
+public:
+  typedef struct
+  {
+    uint32_t  tick_;          ///< First tick of the bar
+    uint16_t  event_;         ///< First event at or after tick_
+    uint8_t   section_;       ///< Non zero if a section starts here
+    uint8_t   reserved_;
+  } Bar;
+
+  typedef struct
+  {
+    uint8_t   cc_[16][SEEK_RESTORE_CC]; ///< 0xff if the song has not set it
+    uint8_t   program_[16];             ///< 0xff if the song has not set it
+    uint16_t  bend_[16];                ///< 0xffff if the song has not set it
+  } State;
+
+  typedef bool (*SendHandler)(const uint8_t* data, uint8_t size);
+
+  SeekIndex ();
+
+  // Building the index
+  void clear();
+  void update(uint32_t tick, uint16_t timeSig, uint16_t ticksPerQuarter, uint16_t event);
+  void marker() { bMarker_ = true; }
+  void end(uint32_t tick, MidiEventStream& song);
+
+  // Compact copies, e.g. for the song cache
+  uint32_t getImageSize() { return sizeof(uint16_t) + count_ * sizeof(Bar) + snapCount(count_) * sizeof(State); }
+  void saveImage(uint8_t* buf);
+  bool loadImage(const uint8_t* buf, uint32_t size);
+
+  // Using the index
+  uint16_t getBarCount() { return count_; }
+  const Bar& getBar(uint16_t n) { return bars_[n]; }
+  uint16_t barAt(uint32_t tick);
+  uint16_t prevSection(uint16_t bar);
+  uint16_t nextSection(uint16_t bar);
+
+  uint16_t restoreState(MidiEventStream& song, uint16_t bar, SendHandler sh);
+
+private:
+  static uint16_t snapCount(uint16_t bars) { return (bars + SEEK_SNAP_BARS - 1) / SEEK_SNAP_BARS; }
+  static void scan(MidiEventStream& song, uint16_t from, uint16_t to, State& st);
+
+  Bar       bars_[SEEK_MAX_BARS];
+  State     snap_[SEEK_MAX_BARS / SEEK_SNAP_BARS];  ///< State at every SEEK_SNAP_BARS'th bar
+  uint16_t  count_;
+  uint32_t  barLen_;        ///< Length of the current bar in ticks
+  uint16_t  timeSig_;       ///< Time signature of the current bar
+  bool      bMarker_;       ///< Marker seen, a section starts at the next new bar
+  bool      bMarkers_;      ///< Song has markers
+};
+
+#endif // SeekIndex_h
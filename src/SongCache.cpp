@@ -0,0 +1,232 @@
+#include "Debug_def.h"
+#include "SongCache.h"
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Song Cache **********************************************************
+
+SongCache::SongCache (SysExSender& sx)
+:sx_(sx), count_(0), used_(0), budget_(0), uses_(0),
+ hits_(0), misses_(0), evictions_(0), savedUs_(0)
+{};
+
+SongCache::Key SongCache::makeKey (const PlaylistIndex::Entry& e)
+{
+  Key k;
+
+  // FNV-1a over the path
+  k.pathHash_ = 2166136261UL;
+  for (const char* p = e.path_; *p != '\0'; p++)
+    k.pathHash_ = (k.pathHash_ ^ (uint8_t)*p) * 16777619UL;
+  k.size_ = e.size_;
+  k.modified_ = e.modified_;
+
+  return(k);
+}
+
+void* SongCache::alloc (uint32_t size)
+{
+#if defined(BOARD_HAS_PSRAM)
+  return(ps_malloc(size));
+#else
+  return(malloc(size));
+#endif
+}
+
+void SongCache::setBudget (uint32_t bytes)
+// Memory the entries may take, songs are dropped if it shrinks
+{
+  budget_ = bytes;
+  while (count_ > 0 && used_ > budget_)
+    makeRoom(0);
+}
+
+void SongCache::clear ()
+{
+  while (count_ > 0)
+    drop(count_ - 1);
+}
+
+int8_t SongCache::find (const Key& k)
+{
+  for (uint8_t i = 0; i < count_; i++)
+    if (entry_[i].key_.pathHash_ == k.pathHash_ && entry_[i].key_.size_ == k.size_ &&
+        entry_[i].key_.modified_ == k.modified_)
+      return(i);
+
+  return(-1);
+}
+
+void SongCache::drop (uint8_t i)
+{
+  free(entry_[i].data_);
+  used_ -= entry_[i].size_;
+  entry_[i] = entry_[--count_];
+}
+
+bool SongCache::makeRoom (uint32_t size)
+// Drop the least recently used songs until 'size' bytes more fit.
+// Returns false if they never can.
+{
+  if (size > budget_)
+    return(false);
+
+  while (count_ >= SCACHE_ENTRIES || used_ + size > budget_)
+  {
+    uint8_t lru = 0;
+
+    if (count_ == 0)
+      return(false);
+    for (uint8_t i = 1; i < count_; i++)
+      if (entry_[i].lastUse_ < entry_[lru].lastUse_)
+        lru = i;
+    drop(lru);
+    evictions_++;
+  }
+
+  return(true);
+}
+
+bool SongCache::put (const Key& k, MidiEventStream& song, SeekIndex& index, uint32_t loadUs)
+// Keep a copy of a finished song and its index, replacing any older one.
+// 'loadUs' is what loading it took, for the statistics.
+// Returns false if it could not be kept.
+{
+  uint16_t ids[SYSX_BLOCKS];
+  uint8_t nIds = 0;
+  uint32_t sysexSize = 1;
+  int8_t old = find(k);
+
+  if (old >= 0)
+    drop(old);
+  if (!song.isValid())
+    return(false);
+
+  // the SysEx blocks the song refers to, each once
+  for (uint16_t i = 0; i < song.getEventCount(); i++)
+  {
+    const MidiEventStream::Event* pev = song.getEvent(i);
+    uint16_t id = pev->data_[0] | (pev->data_[1] << 7);
+    const uint8_t* data;
+    uint8_t j;
+
+    if (pev->status_ != 0xf0)
+      continue;
+    for (j = 0; j < nIds && ids[j] != id; j++)
+      ;
+    if (j < nIds)
+      continue;
+    if (nIds == SYSX_BLOCKS)
+      return(false);
+    ids[nIds++] = id;
+    sysexSize += sizeof(uint16_t) + 1 + sx_.getBlock(id, data);
+  }
+
+  Entry e;
+
+  e.key_ = k;
+  e.streamSize_ = song.getImageSize();
+  e.indexSize_ = index.getImageSize();
+  e.size_ = e.streamSize_ + e.indexSize_ + sysexSize;
+  e.loadUs_ = loadUs;
+  e.lastUse_ = ++uses_;
+
+  if (!makeRoom(e.size_) || (e.data_ = (uint8_t*)alloc(e.size_)) == nullptr)
+    return(false);
+
+  uint8_t* p = e.data_;
+
+  song.saveImage(p);
+  p += e.streamSize_;
+  index.saveImage(p);
+  p += e.indexSize_;
+  *p++ = nIds;
+  for (uint8_t j = 0; j < nIds; j++)
+  {
+    const uint8_t* data;
+    uint8_t size = sx_.getBlock(ids[j], data);
+
+    memcpy(p, &ids[j], sizeof(ids[j]));
+    p += sizeof(ids[j]);
+    *p++ = size;
+    if (size != 0)
+      memcpy(p, data, size);
+    p += size;
+  }
+
+  entry_[count_++] = e;
+  used_ += e.size_;
+  DEBUG("\nCached song bytes ", e.size_);
+  DEBUG(" used ", used_);
+
+  return(true);
+}
+
+bool SongCache::get (const Key& k, MidiEventStream& song, SeekIndex& index)
+// Copy a kept song and its index back, ready to play from the top. The
+// SysEx blocks are stored with the sender again, they may have new ids.
+// Returns false if the song is not kept.
+{
+  uint32_t start = micros();
+  int8_t i = find(k);
+
+  if (i < 0)
+  {
+    misses_++;
+    return(false);
+  }
+
+  Entry* e = &entry_[i];
+  const uint8_t* p = e->data_;
+
+  if (!song.loadImage(p, e->streamSize_) || !index.loadImage(p + e->streamSize_, e->indexSize_))
+  {
+    drop(i);
+    misses_++;
+    return(false);
+  }
+  p += e->streamSize_ + e->indexSize_;
+
+  uint16_t oldIds[SYSX_BLOCKS];
+  int16_t newIds[SYSX_BLOCKS];
+  uint8_t nIds = *p++;
+
+  for (uint8_t j = 0; j < nIds; j++)
+  {
+    uint8_t size;
+
+    memcpy(&oldIds[j], p, sizeof(oldIds[j]));
+    p += sizeof(oldIds[j]);
+    size = *p++;
+    newIds[j] = sx_.store(p, size);
+    p += size;
+  }
+
+  for (uint16_t n = 0; nIds != 0 && n < song.getEventCount(); n++)
+  {
+    MidiEventStream::Event ev = *song.getEvent(n);
+    uint16_t id = ev.data_[0] | (ev.data_[1] << 7);
+    uint8_t j;
+
+    if (ev.status_ != 0xf0)
+      continue;
+    for (j = 0; j < nIds && oldIds[j] != id; j++)
+      ;
+    // a block that could not be stored again gets an id the sender rejects
+    id = (j < nIds && newIds[j] >= 0) ? newIds[j] : 0x3fff;
+    ev.data_[0] = id & 0x7f;
+    ev.data_[1] = id >> 7;
+    song.setEvent(n, ev);
+  }
+
+  e->lastUse_ = ++uses_;
+  hits_++;
+
+  uint32_t copyUs = micros() - start;
+
+  if (e->loadUs_ > copyUs)
+    savedUs_ += e->loadUs_ - copyUs;
+
+  return(true);
+}
@@ -0,0 +1,85 @@
+#ifndef SongCache_h
+#define SongCache_h
+
+#include <stdint.h>
+#include "MidiEventStream.h"
+#include "SeekIndex.h"
+#include "SysExSender.h"
+#include "PlaylistIndex.h"
+
+/*
+ * Songs already converted for RAM playback, kept so that coming back to
+ * one needs neither the SD card nor the parser.
+ *
+ * Each entry is a compact copy of the event stream and seek index of a
+ * song, sized to the song, and the SysEx blocks it refers to. Entries
+ * are keyed by the playlist entry: the path, and the size and date of
+ * the file so that a changed file is parsed again. When the memory
+ * budget or the entry table is full, the least recently used songs are
+ * dropped to make room. Memory comes from PSRAM on boards that have it.
+ *
+ * Only the player task uses the cache.
+ */
+
+#define SCACHE_ENTRIES    16      // songs kept at most
+
+class SongCache
+{
+
+public:
+  typedef struct
+  {
+    uint32_t  pathHash_;
+    uint32_t  size_;
+    uint32_t  modified_;
+  } Key;
+
+  SongCache (SysExSender& sx);
+
+  static Key makeKey(const PlaylistIndex::Entry& e);
+
+  void setBudget(uint32_t bytes);
+  bool get(const Key& k, MidiEventStream& song, SeekIndex& index);
+  bool put(const Key& k, MidiEventStream& song, SeekIndex& index, uint32_t loadUs);
+  void clear();
+
+  uint8_t getCount() { return count_; }
+  uint32_t getUsed() { return used_; }
+  uint32_t getBudget() { return budget_; }
+  uint32_t getHits() { return hits_; }
+  uint32_t getMisses() { return misses_; }
+  uint32_t getEvictions() { return evictions_; }
+  uint32_t getSavedUs() { return savedUs_; }
+  void resetStats() { hits_ = misses_ = evictions_ = savedUs_ = 0; }
+
+private:
+  typedef struct
+  {
+    Key       key_;
+    uint8_t*  data_;        ///< Stream image, index image, then the SysEx
+    uint32_t  size_;        ///< Bytes at data_
+    uint32_t  streamSize_;
+    uint32_t  indexSize_;
+    uint32_t  loadUs_;      ///< What loading the song from the card took
+    uint32_t  lastUse_;     ///< Use count at the last get() or put()
+  } Entry;
+
+  int8_t find(const Key& k);
+  void drop(uint8_t i);
+  bool makeRoom(uint32_t size);
+  static void* alloc(uint32_t size);
+
+  SysExSender& sx_;
+  Entry     entry_[SCACHE_ENTRIES];
+  uint8_t   count_;
+  uint32_t  used_;          ///< Bytes held by the entries
+  uint32_t  budget_;
+  uint32_t  uses_;          ///< Counts get() and put(), for the LRU order
+
+  uint32_t  hits_;
+  uint32_t  misses_;
+  uint32_t  evictions_;
+  uint32_t  savedUs_;       ///< Load time saved by the hits, less the copying
+};
+
+#endif // SongCache_h
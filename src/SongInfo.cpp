@@ -0,0 +1,458 @@
+#include "Debug_def.h"
+#include "SongInfo.h"
+#include "StreamPlayer.h"
+#include <Arduino.h>
+#include <string.h>
+
+// Song Information ****************************************************
+
+static const uint32_t ID_MTHD = 0x4d546864;   // "MThd"
+static const uint32_t ID_MTRK = 0x4d54726b;   // "MTrk"
+static const uint32_t ID_RPSF = 0x52505346;   // "RPSF"
+static const uint32_t DEFAULT_TEMPO = 500000; // 120 BPM
+
+SongInfo::SongInfo (PlaylistIndex& pl)
+:pl_(pl), state_(SIIdle), scanned_(0), reads_(0)
+{
+  reset();
+};
+
+void SongInfo::reset ()
+// Forget the window and stop scanning, e.g. when the index is opened again
+{
+  if (file_.isOpen())
+    file_.close();
+  state_ = SIIdle;
+  for (uint8_t i = 0; i < SINFO_WINDOW; i++)
+    window_[i].idx_ = UINT16_MAX;
+}
+
+SongInfo::Slot* SongInfo::slot (uint16_t idx, bool bRead)
+// The window slot holding entry 'idx'. If it is not there it is read
+// from the index when 'bRead' is set, otherwise nullptr is returned.
+{
+  Slot* s = &window_[idx % SINFO_WINDOW];
+
+  if (s->idx_ == idx)
+    return(s);
+  if (!bRead)
+    return(nullptr);
+
+  reads_++;
+  if (!pl_.get(idx, s->e_) || !pl_.getMeta(idx, s->m_))
+  {
+    s->idx_ = UINT16_MAX;
+    return(nullptr);
+  }
+  s->idx_ = idx;
+
+  return(s);
+}
+
+bool SongInfo::get (uint16_t idx, PlaylistIndex::Entry& e, PlaylistIndex::Meta& m)
+// Entry 'idx' and what is known about the song so far, from the window
+// if it is there. Returns false if it could not be read.
+{
+  Slot* s = slot(idx, true);
+
+  if (s == nullptr)
+    return(false);
+
+  e = s->e_;
+  m = s->m_;
+
+  return(true);
+}
+
+bool SongInfo::step (uint16_t cursor, uint32_t budgetUs)
+// Carry on filling in the songs around 'cursor' for up to 'budgetUs',
+// nearest first. Returns true when the song at the cursor is done.
+{
+  if (state_ != SIIdle)
+    return(scan(budgetUs) && idx_ == cursor);
+
+  // the nearest song not looked at yet, one index read per call at most
+  for (uint16_t d = 0; d <= SINFO_AHEAD; d++)
+  {
+    for (int8_t dir = 1; dir >= -1; dir -= 2)
+    {
+      int32_t i = (int32_t)cursor + d * dir;
+      Slot* s;
+
+      if (i < 0 || i >= pl_.getCount() || (d == 0 && dir < 0))
+        continue;
+
+      if ((s = slot(i, false)) == nullptr)
+      {
+        slot(i, true);
+        return(false);
+      }
+      if (s->m_.state_ == PLI_META_NONE)
+        return(begin(i, s->e_.path_) && scan(budgetUs) && idx_ == cursor);
+    }
+  }
+
+  return(false);
+}
+
+bool SongInfo::begin (uint16_t idx, const char* path)
+// Start on the song of entry 'idx'
+{
+  memset(&m_, 0, sizeof(m_));
+  m_.timeSigNum_ = 4;
+  m_.timeSigDen_ = 4;
+  m_.usPerQuarter_ = DEFAULT_TEMPO;
+  idx_ = idx;
+  bEOF_ = false;
+  pos_ = 0;
+  track_ = 0;
+  endTick_ = 0;
+  titleType_ = 0;
+  tempoCount_ = 0;
+
+  if (!file_.open(path, O_READ))
+  {
+    finish(false);
+    return(false);
+  }
+  state_ = SIHeader;
+
+  return(true);
+}
+
+void SongInfo::finish (bool bOk)
+// Work out the length from the tempo changes and keep the information
+// in the index and the window
+{
+  file_.close();
+  state_ = SIIdle;
+  scanned_++;
+
+  m_.state_ = bOk ? PLI_META_OK : PLI_META_BAD;
+  m_.tracks_ = (track_ > 255) ? 255 : track_;
+
+  if (bOk && division_ != 0)
+  {
+    if (division_ & 0x8000)
+    {
+      // SMPTE frames per second and ticks per frame
+      uint32_t perSec = (uint32_t)(-(int8_t)(division_ >> 8)) * (division_ & 0xff);
+
+      m_.durationMs_ = (perSec != 0) ? (uint64_t)endTick_ * 1000 / perSec : 0;
+    }
+    else
+    {
+      uint64_t t = 0;           // ticks * us per quarter
+      uint32_t tick = 0;
+      uint32_t usPerQuarter = DEFAULT_TEMPO;
+
+      for (uint8_t i = 0; i < tempoCount_ && tempo_[i].tick_ < endTick_; i++)
+      {
+        t += (uint64_t)(tempo_[i].tick_ - tick) * usPerQuarter;
+        tick = tempo_[i].tick_;
+        usPerQuarter = tempo_[i].usPerQuarter_;
+      }
+      t += (uint64_t)(endTick_ - tick) * usPerQuarter;
+      m_.durationMs_ = t / division_ / 1000;
+    }
+
+    for (uint8_t i = 0; i < tempoCount_ && tempo_[i].tick_ == 0; i++)
+      m_.usPerQuarter_ = tempo_[i].usPerQuarter_;
+  }
+
+  pl_.putMeta(idx_, m_);
+
+  Slot* s = slot(idx_, false);
+
+  if (s != nullptr)
+    s->m_ = m_;
+}
+
+bool SongInfo::scan (uint32_t budgetUs)
+// Read on through the song for up to 'budgetUs'. Returns true when done.
+{
+  uint32_t start = micros();
+
+  while (state_ != SIIdle)
+  {
+    switch (state_)
+    {
+    case SIHeader:
+      {
+        uint32_t id = readFixed(4);
+        uint32_t len;
+
+        if (id == ID_RPSF)
+        {
+          readRps();
+          break;
+        }
+
+        len = readFixed(4);
+        readFixed(2);       // format
+        trackCount_ = readFixed(2);
+        division_ = readFixed(2);
+        if (id != ID_MTHD || len < 6 || division_ == 0 || bEOF_)
+        {
+          finish(false);
+          break;
+        }
+        skip(len - 6);
+        state_ = SITrack;
+      }
+      break;
+
+    case SITrack:
+      {
+        uint32_t id, len;
+
+        if (track_ == trackCount_)
+        {
+          finish(true);
+          break;
+        }
+
+        id = readFixed(4);
+        len = readFixed(4);
+        if (bEOF_)
+          finish(track_ != 0);  // cut short, what was read stands
+        else if (id != ID_MTRK)
+          skip(len);            // not a track, e.g. a vendor chunk
+        else
+        {
+          track_++;
+          trackEnd_ = pos_ + len;
+          tick_ = 0;
+          runStatus_ = 0;
+          state_ = SIEvents;
+        }
+      }
+      break;
+
+    case SIEvents:
+      if (pos_ >= trackEnd_ || !readEvent())
+      {
+        if (tick_ > endTick_)
+          endTick_ = tick_;
+        if (pos_ != trackEnd_ && !bEOF_)
+        {
+          file_.seekSet(trackEnd_);
+          pos_ = trackEnd_;
+        }
+        state_ = SITrack;
+      }
+      break;
+
+    default:
+      finish(false);
+      break;
+    }
+
+    if (state_ != SIIdle && micros() - start >= budgetUs)
+      return(false);
+  }
+
+  return(true);
+}
+
+int16_t SongInfo::readByte ()
+{
+  int c = file_.read();
+
+  if (c < 0)
+  {
+    bEOF_ = true;
+    return(-1);
+  }
+  pos_++;
+
+  return(c);
+}
+
+uint32_t SongInfo::readVar ()
+// MIDI variable length quantity
+{
+  uint32_t v = 0;
+  int16_t c;
+
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    if ((c = readByte()) < 0)
+      break;
+    v = (v << 7) | (c & 0x7f);
+    if ((c & 0x80) == 0)
+      break;
+  }
+
+  return(v);
+}
+
+uint32_t SongInfo::readFixed (uint8_t size)
+// Big endian number of 'size' bytes
+{
+  uint32_t v = 0;
+
+  while (size--)
+    v = (v << 8) | (readByte() & 0xff);
+
+  return(v);
+}
+
+void SongInfo::skip (uint32_t n)
+{
+  if (n == 0)
+    return;
+
+  if (file_.seekSet(pos_ + n))
+    pos_ += n;
+  else
+    bEOF_ = true;
+}
+
+bool SongInfo::readEvent ()
+// Take in one event of the track. Returns false at the end of the track
+// or if it cannot be read.
+{
+  int16_t b;
+
+  tick_ += readVar();
+  if ((b = readByte()) < 0)
+    return(false);
+
+  if (b < 0x80)
+  {
+    // running status, that was the first data byte
+    if (runStatus_ == 0)
+      return(false);
+    skip(((runStatus_ & 0xe0) == 0xc0) ? 0 : 1);
+    return(!bEOF_);
+  }
+
+  if (b < 0xf0)
+  {
+    runStatus_ = b;
+    skip(((b & 0xe0) == 0xc0) ? 1 : 2);
+    return(!bEOF_);
+  }
+
+  if (b == 0xf0 || b == 0xf7)
+  {
+    skip(readVar());
+    return(!bEOF_);
+  }
+
+  if (b != 0xff)
+    return(false);
+
+  // meta event
+  uint8_t type = readByte();
+  uint32_t len = readVar();
+
+  switch (type)
+  {
+  case 0x51:  // tempo, kept in tick order for the length
+    if (len == 3)
+    {
+      uint32_t us = readFixed(3);
+      uint8_t i = tempoCount_;
+
+      if (us == 0 || tempoCount_ == SINFO_TEMPOS)
+        break;
+      for (; i > 0 && tempo_[i - 1].tick_ > tick_; i--)
+        tempo_[i] = tempo_[i - 1];
+      tempo_[i].tick_ = tick_;
+      tempo_[i].usPerQuarter_ = us;
+      tempoCount_++;
+    }
+    else
+      skip(len);
+    break;
+
+  case 0x58:  // time signature, the one at the start
+    if (len >= 2 && tick_ == 0)
+    {
+      uint8_t num = readByte();
+      uint8_t den = readByte();
+
+      if (num != 0 && den < 8)
+      {
+        m_.timeSigNum_ = num;
+        m_.timeSigDen_ = 1 << den;
+      }
+      skip(len - 2);
+    }
+    else
+      skip(len);
+    break;
+
+  case 0x01:  // text
+  case 0x03:  // track name, taken over text
+    if (track_ == 1 && (titleType_ == 0 || (titleType_ == 0x01 && type == 0x03)))
+    {
+      char title[PLI_TITLE_SIZE];
+      uint8_t n = 0;
+
+      for (; len > 0 && n < sizeof(title) - 1; len--)
+      {
+        int16_t c = readByte();
+
+        // only what the LCD can show, and no leading spaces
+        if (c < ' ' || c > '~')
+          c = ' ';
+        if (c != ' ' || n != 0)
+          title[n++] = c;
+      }
+      while (n > 0 && title[n - 1] == ' ')
+        n--;
+      title[n] = '\0';
+      skip(len);
+
+      if (n != 0)
+      {
+        strcpy(m_.title_, title);
+        titleType_ = type;
+      }
+    }
+    else
+      skip(len);
+    break;
+
+  case 0x2f:  // end of track
+    skip(len);
+    return(false);
+
+  default:
+    skip(len);
+    break;
+  }
+
+  return(!bEOF_);
+}
+
+void SongInfo::readRps ()
+// An RPS file, the header and the first tempo map entry say it all
+{
+  StreamPlayer::Header h;
+  StreamPlayer::MapEntry me;
+
+  division_ = 0;
+  file_.seekSet(0);
+  if (file_.read(&h, sizeof(h)) != sizeof(h) || memcmp(h.magic_, "RPSF", sizeof(h.magic_)) != 0 ||
+      h.version_ != RPS_VERSION)
+  {
+    finish(false);
+    return;
+  }
+
+  m_.durationMs_ = h.duration_ / 1000;
+  if (h.mapCount_ > 0 && file_.read(&me, sizeof(me)) == sizeof(me))
+  {
+    m_.usPerQuarter_ = me.usPerQuarter_;
+    if ((me.timeSig_ >> 8) != 0 && (me.timeSig_ & 0xff) != 0)
+    {
+      m_.timeSigNum_ = me.timeSig_ >> 8;
+      m_.timeSigDen_ = me.timeSig_ & 0xff;
+    }
+  }
+  finish(true);
+}
@@ -0,0 +1,98 @@
+#ifndef SongInfo_h
+#define SongInfo_h
+
+#include <stdint.h>
+#include <SdFat.h>
+#include <MD_MIDIFile.h>
+#include "PlaylistIndex.h"
+
+/*
+ * Song information for the browse screen: the tempo and time signature
+ * at the start, the length, the number of tracks and the title.
+ *
+ * The information is taken from the songs in the background, in short
+ * slices, nearest to the cursor first and SINFO_AHEAD songs either way,
+ * and kept in the playlist index so that each song is only read once.
+ * A window of entries with their information is held in RAM, so moving
+ * the cursor within it needs no card access at all.
+ *
+ * MIDI files are walked through chunk by chunk without the player. The
+ * title is the first track name, or failing that text, in the first
+ * track. The length comes from the last event of the longest track and
+ * the first SINFO_TEMPOS tempo changes. RPS files only have their header
+ * read, they have no tracks or title.
+ *
+ * Only the UI task uses this.
+ */
+
+#define SINFO_AHEAD       8       // songs either side of the cursor looked at
+#define SINFO_WINDOW      24      // entries held in RAM, more than 2*SINFO_AHEAD+1
+#define SINFO_TEMPOS      32      // tempo changes used for the length
+
+class SongInfo
+{
+
+public:
+  SongInfo (PlaylistIndex& pl);
+
+  void reset();
+  bool get(uint16_t idx, PlaylistIndex::Entry& e, PlaylistIndex::Meta& m);
+  bool step(uint16_t cursor, uint32_t budgetUs);
+
+  uint32_t getScanned() { return scanned_; }
+  uint32_t getReads() { return reads_; }
+
+private:
+  enum scan_state { SIIdle, SIHeader, SITrack, SIEvents };
+
+  typedef struct
+  {
+    uint16_t  idx_;           ///< Playlist entry, UINT16_MAX if the slot is free
+    PlaylistIndex::Entry e_;
+    PlaylistIndex::Meta m_;
+  } Slot;
+
+  typedef struct
+  {
+    uint32_t  tick_;
+    uint32_t  usPerQuarter_;
+  } Tempo;
+
+  Slot* slot(uint16_t idx, bool bRead);
+  bool begin(uint16_t idx, const char* path);
+  bool scan(uint32_t budgetUs);
+  void finish(bool bOk);
+
+  // reading the file
+  int16_t readByte();
+  uint32_t readVar();
+  uint32_t readFixed(uint8_t size);
+  void skip(uint32_t n);
+  bool readEvent();
+  void readRps();
+
+  PlaylistIndex& pl_;
+  Slot      window_[SINFO_WINDOW];
+
+  SDFILE    file_;
+  scan_state state_;
+  uint16_t  idx_;           ///< Entry being scanned
+  PlaylistIndex::Meta m_;   ///< Its information so far
+  bool      bEOF_;          ///< Ran off the end of the file
+  uint32_t  pos_;           ///< File position
+  uint16_t  trackCount_;    ///< From the header
+  uint16_t  division_;
+  uint16_t  track_;         ///< Track chunks read
+  uint32_t  trackEnd_;      ///< File position after the track
+  uint32_t  tick_;          ///< In the track
+  uint32_t  endTick_;       ///< Of the longest track so far
+  uint8_t   runStatus_;
+  uint8_t   titleType_;     ///< Meta event type the title came from, 0 for none
+  Tempo     tempo_[SINFO_TEMPOS];
+  uint8_t   tempoCount_;
+
+  uint32_t  scanned_;       ///< Songs scanned
+  uint32_t  reads_;         ///< Index reads for the window
+};
+
+#endif // SongInfo_h
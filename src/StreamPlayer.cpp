@@ -0,0 +1,183 @@
+#include "Debug_def.h"
+#include "StreamPlayer.h"
+#include <string.h>
+
+// Stream Player *******************************************************
+
+StreamPlayer::StreamPlayer (TempoEngine& te)
+:te_(te), mapIdx_(0), looping_(false), eof_(true), bufLen_(0), bufPos_(0),
+ dataLeft_(0), songUs_(0), eventUs_(0), status_(0), bPending_(false), size_(0)
+{
+  memset(&hdr_, 0, sizeof(hdr_));
+  memset(map_, 0, sizeof(map_));
+};
+
+bool StreamPlayer::open (const char* path)
+// Open a converted song and check its header. Returns false if the file
+// cannot be played.
+{
+  close();
+
+  if (!file_.open(path, O_READ))
+    return(false);
+
+  if (file_.read(&hdr_, sizeof(hdr_)) != sizeof(hdr_) ||
+      memcmp(hdr_.magic_, "RPSF", sizeof(hdr_.magic_)) != 0 ||
+      hdr_.version_ != RPS_VERSION || hdr_.mapCount_ == 0 || hdr_.mapCount_ > RPS_MAP_SIZE ||
+      file_.read(map_, hdr_.mapCount_ * sizeof(MapEntry)) != (int)(hdr_.mapCount_ * sizeof(MapEntry)))
+  {
+    DEBUGS("\nRPS header fail");
+    close();
+    return(false);
+  }
+
+  DEBUG("\nRPS events ", hdr_.events_);
+  DEBUG(" bytes ", hdr_.dataSize_);
+  DEBUG(" us ", hdr_.duration_);
+  restart();
+
+  return(true);
+}
+
+void StreamPlayer::close ()
+{
+  if (file_.isOpen())
+    file_.close();
+  eof_ = true;
+}
+
+void StreamPlayer::restart ()
+// Back to the first event. The tempo engine is restarted separately by
+// the player, or carries on when looping.
+{
+  file_.seekSet(hdr_.dataOffset_);
+  bufLen_ = bufPos_ = 0;
+  dataLeft_ = hdr_.dataSize_;
+  songUs_ = 0;
+  eventUs_ = 0;
+  status_ = 0;
+  bPending_ = false;
+  eof_ = false;
+  mapIdx_ = 0;
+  te_.setQuarter(map_[0].usPerQuarter_, hdr_.ticksPerQuarter_);
+}
+
+bool StreamPlayer::readByte (uint8_t& b)
+// Next byte of event data, reading the file a block at a time
+{
+  if (bufPos_ >= bufLen_)
+  {
+    uint16_t n = (dataLeft_ < RPS_BLOCK_SIZE) ? dataLeft_ : RPS_BLOCK_SIZE;
+
+    if (n == 0 || file_.read(buf_, n) != n)
+      return(false);
+    bufLen_ = n;
+    bufPos_ = 0;
+    dataLeft_ -= n;
+  }
+
+  b = buf_[bufPos_++];
+  return(true);
+}
+
+bool StreamPlayer::nextEvent ()
+// Decode the next event into msg_. Returns false at the end of the data.
+{
+  uint32_t delta = 0;
+  uint8_t b;
+
+  do
+  {
+    if (!readByte(b))
+      return(false);
+    delta = (delta << 7) | (b & 0x7f);
+  } while (b & 0x80);
+
+  if (!readByte(b))
+    return(false);
+  if (b & 0x80)
+  {
+    status_ = b;
+    if (!readByte(b))
+      return(false);
+  }
+
+  msg_[0] = status_;
+  msg_[1] = b;
+  size_ = ((status_ & 0xf0) == 0xc0 || (status_ & 0xf0) == 0xd0) ? 2 : 3;
+  if (size_ > 2 && !readByte(msg_[2]))
+    return(false);
+
+  eventUs_ += delta;
+  bPending_ = true;
+  return(true);
+}
+
+uint32_t StreamPlayer::timeAt (uint32_t us, const uint32_t* horizon)
+// Adjusted song time of unadjusted time 'us', advancing the tempo engine
+// to it and stepping through the tempo changes on the way. With a
+// 'horizon' the engine is moved on RPS_TIME_STEP at a time and stops once
+// it is past it, short of 'us', as MidiEventStream does.
+{
+  for (;;)
+  {
+    while (mapIdx_ + 1 < hdr_.mapCount_ && map_[mapIdx_ + 1].time_ <= songUs_)
+      te_.setQuarter(map_[++mapIdx_].usPerQuarter_, hdr_.ticksPerQuarter_);
+
+    if (songUs_ >= us)
+      break;
+    if (horizon != nullptr && (int32_t)(*horizon - te_.getTime()) <= 0)
+      break;
+
+    uint32_t next = us;
+
+    if (mapIdx_ + 1 < hdr_.mapCount_ && map_[mapIdx_ + 1].time_ < us)
+      next = map_[mapIdx_ + 1].time_;
+    if (horizon != nullptr && next - songUs_ > RPS_TIME_STEP)
+      next = songUs_ + RPS_TIME_STEP;
+    te_.advanceUs(next - songUs_);
+    songUs_ = next;
+  }
+
+  return(te_.getTime());
+}
+
+bool StreamPlayer::fill (MidiScheduler& sched, uint32_t horizon)
+// Queue the events due before 'horizon' (song time), reading on through
+// the file as needed. Returns true if any events were queued.
+{
+  bool bEvents = false;
+
+  if (eof_)
+    return(false);
+
+  while (sched.space() >= SCHED_FILL_MARGIN)
+  {
+    if (!bPending_ && !nextEvent())
+    {
+      if (!looping_ || hdr_.events_ == 0)
+      {
+        eof_ = true;
+        break;
+      }
+
+      // wrap around to the top, carrying the song time on
+      timeAt(hdr_.duration_, &horizon);
+      if (songUs_ < hdr_.duration_)
+        break;
+      restart();
+      continue;
+    }
+
+    uint32_t due = timeAt(eventUs_, &horizon);
+
+    if ((int32_t)(horizon - due) <= 0)
+      break;
+
+    sched.push(due, msg_, size_);
+    bPending_ = false;
+    bEvents = true;
+  }
+
+  return(bEvents);
+}
@@ -0,0 +1,92 @@
+#ifndef StreamPlayer_h
+#define StreamPlayer_h
+
+#include <stdint.h>
+#include <SdFat.h>
+#include <MD_MIDIFile.h>
+#include "MidiScheduler.h"
+#include "TempoEngine.h"
+
+/*
+ * Player for songs converted to the RPS streaming format by tools/smf2rps.
+ *
+ * An RPS file is a Header, the tempo map, then the events of all tracks
+ * merged in time order. Each event is the time since the previous one in
+ * microseconds at the written tempo, as a MIDI variable length quantity,
+ * followed by the message with MIDI running status applied. The data is
+ * read front to back in RPS_BLOCK_SIZE reads, with no seeks except to go
+ * back to the top when looping.
+ */
+
+#define RPS_EXT           ".RPS"
+#define RPS_VERSION       1
+#define RPS_MAP_SIZE      64      // tempo/time signature changes
+#define RPS_BLOCK_SIZE    4096    // bytes per SD card read
+#define RPS_TIME_STEP     125000  // us the tempo engine moves on at a time when filling
+
+class StreamPlayer
+{
+
+public:
+  typedef struct __attribute__((packed))
+  {
+    char      magic_[4];        ///< "RPSF"
+    uint8_t   version_;         ///< RPS_VERSION
+    uint8_t   mapCount_;        ///< MapEntry records following the header
+    uint16_t  ticksPerQuarter_; ///< Of the original file
+    uint32_t  duration_;        ///< Song length in us at the written tempo
+    uint32_t  events_;          ///< Number of events
+    uint32_t  dataOffset_;      ///< File offset of the first event
+    uint32_t  dataSize_;        ///< Bytes of event data
+  } Header;
+
+  typedef struct __attribute__((packed))
+  {
+    uint32_t  time_;            ///< Song time this entry applies from
+    uint32_t  usPerQuarter_;    ///< Tempo in microseconds per quarter note
+    uint16_t  timeSig_;         ///< Time signature as returned by getTimeSignature()
+    uint16_t  reserved_;
+  } MapEntry;
+
+  StreamPlayer (TempoEngine& te);
+
+  bool open(const char* path);
+  void close();
+  bool isOpen() { return file_.isOpen(); }
+
+  void restart();
+  bool fill(MidiScheduler& sched, uint32_t horizon);
+  bool isEOF() { return eof_; }
+  void looping(bool bMode) { looping_ = bMode; }
+
+  uint16_t getTimeSignature() { return map_[mapIdx_].timeSig_; }
+  uint32_t getDuration() { return hdr_.duration_; }
+  uint32_t getEndTime() { return timeAt(hdr_.duration_); }
+
+private:
+  bool readByte(uint8_t& b);
+  bool nextEvent();
+  uint32_t timeAt(uint32_t us, const uint32_t* horizon = nullptr);
+
+  TempoEngine& te_;
+  SDFILE    file_;
+  Header    hdr_;
+  MapEntry  map_[RPS_MAP_SIZE];
+  uint8_t   mapIdx_;        ///< Map entry in effect at songUs_
+  bool      looping_;
+  bool      eof_;
+
+  uint8_t   buf_[RPS_BLOCK_SIZE];
+  uint16_t  bufLen_;
+  uint16_t  bufPos_;
+  uint32_t  dataLeft_;      ///< Event bytes not read from the file yet
+
+  uint32_t  songUs_;        ///< Unadjusted song time the tempo engine has reached
+  uint32_t  eventUs_;       ///< Unadjusted song time of the last event read
+  uint8_t   status_;        ///< Running status of the data
+  bool      bPending_;      ///< msg_ holds an event not scheduled yet
+  uint8_t   msg_[3];
+  uint8_t   size_;
+};
+
+#endif // StreamPlayer_h
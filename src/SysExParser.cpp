@@ -0,0 +1,53 @@
+#include "Debug_def.h"
+#include "SysExParser.h"
+
+// SysEx Parser ********************************************************
+
+SysExParser::SysExParser (uint8_t* buf, uint16_t size)
+:buf_(buf), size_(size), len_(0), state_(IDLE), overruns_(0), broken_(0)
+{};
+
+bool SysExParser::parse (uint8_t b)
+// Feed one received byte. Returns true when it completes a frame.
+{
+  if (b == 0xf0)
+  {
+    if (state_ == IN_FRAME)
+      broken_++;
+    state_ = IN_FRAME;
+    len_ = 0;
+    return(false);
+  }
+
+  if (b >= 0xf8)
+    return(false);    // real time bytes may appear anywhere
+
+  switch (state_)
+  {
+  case IN_FRAME:
+    if (b == 0xf7)
+    {
+      state_ = IDLE;
+      return(true);
+    }
+    if (len_ >= size_)
+    {
+      overruns_++;
+      state_ = SKIP_FRAME;
+      len_ = 0;
+    }
+    else
+      buf_[len_++] = b;
+    break;
+
+  case SKIP_FRAME:
+    if (b == 0xf7)
+      state_ = IDLE;
+    break;
+
+  default:
+    break;            // noise between frames
+  }
+
+  return(false);
+}
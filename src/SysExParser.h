@@ -0,0 +1,41 @@
+#ifndef SysExParser_h
+#define SysExParser_h
+
+#include <stdint.h>
+
+/*
+ * Incremental parser for F0 ... F7 framed messages on a serial link.
+ *
+ * Bytes are fed in one at a time as they arrive, so a partial frame never
+ * blocks the caller. parse() returns true when a complete frame is in the
+ * buffer; getData() then gives the payload between F0 and F7.
+ * Frames longer than the buffer are dropped whole and counted as overruns.
+ */
+
+class SysExParser
+{
+
+public:
+  SysExParser (uint8_t* buf, uint16_t size);
+
+  bool parse(uint8_t b);
+  void reset() { state_ = IDLE; len_ = 0; }
+
+  const uint8_t* getData() { return buf_; }
+  uint16_t getLength() { return len_; }
+
+  uint32_t getOverruns() { return overruns_; }
+  uint32_t getBroken() { return broken_; }
+
+private:
+  enum parse_state { IDLE, IN_FRAME, SKIP_FRAME };
+
+  uint8_t*    buf_;
+  uint16_t    size_;
+  uint16_t    len_;
+  parse_state state_;
+  uint32_t    overruns_;    ///< Frames too long for the buffer
+  uint32_t    broken_;      ///< Frames cut short by a new F0
+};
+
+#endif // SysExParser_h
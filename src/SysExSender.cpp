@@ -0,0 +1,216 @@
+#include "Debug_def.h"
+#include "SysExSender.h"
+#include <string.h>
+
+// SysEx Sender ********************************************************
+
+SysExSender::SysExSender (MidiOutput& out)
+:out_(out), gapUs_(0), repeatSize_(UINT16_MAX), count_(0), used_(0), gen_(0),
+ head_(0), tail_(0), len_(0), pos_(0), lastUs_(0), waitUs_(0),
+ sent_(0), skipped_(0), bytes_(0), rejected_(0)
+{};
+
+uint32_t SysExSender::hash (const uint8_t* data, uint16_t size)
+// FNV-1a over the block
+{
+  uint32_t h = 2166136261UL;
+
+  for (uint16_t i = 0; i < size; i++)
+    h = (h ^ data[i]) * 16777619UL;
+
+  return(h);
+}
+
+int16_t SysExSender::store (const uint8_t* data, uint16_t size)
+// Keep a complete SysEx, F0 to F7. Returns its id, or -1 if it is cut
+// short, too long, or there is no room left for it.
+{
+  uint16_t count = count_.load(std::memory_order_relaxed);
+  uint16_t id = count;
+  uint32_t h;
+
+  if (size < 2 || size > SYSX_BLOCK_MAX || data[0] != 0xf0 || data[size - 1] != 0xf7)
+  {
+    rejected_++;
+    return(-1);
+  }
+
+  h = hash(data, size);
+  for (uint16_t i = 0; i < count; i++)
+  {
+    if (block_[i].hash_ == h && block_[i].size_ == size &&
+        memcmp(&pool_[block_[i].offset_], data, size) == 0)
+    {
+      block_[i].gen_ = gen_;
+      return(i);
+    }
+    if (block_[i].size_ == 0 && id == count)
+      id = i;       // freed, given out again
+  }
+
+  if (id >= SYSX_BLOCKS || used_ + size > SYSX_POOL_SIZE)
+  {
+    rejected_++;
+    return(-1);
+  }
+
+  memcpy(&pool_[used_], data, size);
+  block_[id].offset_ = used_;
+  block_[id].size_ = size;
+  block_[id].sent_ = false;
+  block_[id].hash_ = h;
+  block_[id].gen_ = gen_;
+  used_ += size;
+  if (id == count)
+    count_.store(count + 1, std::memory_order_release);
+
+  return(id);
+}
+
+uint8_t SysExSender::getBlock (uint16_t id, const uint8_t*& data)
+// The stored block 'id', returns its size, 0 if there is none
+{
+  if (id >= count_.load(std::memory_order_relaxed) || block_[id].size_ == 0)
+    return(0);
+
+  data = &pool_[block_[id].offset_];
+  return(block_[id].size_);
+}
+
+void SysExSender::clear ()
+// Forget the stored blocks and those waiting to be sent. A block being
+// written is finished from its copy.
+{
+  std::lock_guard<std::mutex> guard(lock_);
+
+  count_ = 0;
+  used_ = 0;
+  head_ = tail_ = 0;
+}
+
+uint16_t SysExSender::release (uint16_t gen)
+// Free the blocks last stored before generation 'gen' and move the others
+// down over them. None of the freed ids may still be scheduled or queued.
+// Returns the bytes freed.
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  uint16_t count = count_.load(std::memory_order_relaxed);
+  uint16_t used = 0, freed = used_;
+
+  // the blocks kept lie in the pool in the order they were stored, move
+  // each down in turn, lowest offset first
+  for (;;)
+  {
+    Block* next = nullptr;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+      Block* b = &block_[i];
+
+      if (b->size_ != 0 && (int16_t)(b->gen_ - gen) < 0)
+        b->size_ = 0;
+      else if (b->size_ != 0 && b->offset_ >= used && (next == nullptr || b->offset_ < next->offset_))
+        next = b;
+    }
+    if (next == nullptr)
+      break;
+
+    memmove(&pool_[used], &pool_[next->offset_], next->size_);
+    next->offset_ = used;
+    used += next->size_;
+  }
+
+  used_ = used;
+
+  return(freed - used);
+}
+
+bool SysExSender::queue (uint16_t id)
+// Send block 'id' once the blocks before it have gone.
+// Returns false if the id is unknown or the queue is full.
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  uint8_t n = (tail_ + 1) & (SYSX_QUEUE_SIZE - 1);
+
+  if (id >= count_.load(std::memory_order_acquire) || block_[id].size_ == 0 || n == head_)
+  {
+    rejected_++;
+    return(false);
+  }
+
+  queue_[tail_] = id;
+  tail_ = n;
+
+  return(true);
+}
+
+bool SysExSender::poll (uint32_t nowUs)
+// Write the next chunk if it is time. Returns true while a block is
+// only partly written, nothing but real time may go to the output then.
+{
+  std::lock_guard<std::mutex> guard(lock_);
+
+  // elapsed time stays right however long the sender has been idle
+  if (nowUs - lastUs_ < waitUs_)
+    return(len_ != 0);
+
+  while (len_ == 0)
+  {
+    if (head_ == tail_)
+      return(false);
+
+    Block* b = &block_[queue_[head_]];
+
+    if (b->sent_ && b->size_ >= repeatSize_)
+    {
+      head_ = (head_ + 1) & (SYSX_QUEUE_SIZE - 1);
+      skipped_++;
+      continue;
+    }
+
+    // the whole block must fit the output before the first chunk, or it
+    // would be cut short. Try again when the port could have taken a chunk.
+    if (!out_.reserve(b->size_))
+    {
+      lastUs_ = nowUs;
+      waitUs_ = SYSX_CHUNK * SYSX_BYTE_US;
+      return(false);
+    }
+
+    head_ = (head_ + 1) & (SYSX_QUEUE_SIZE - 1);
+    memcpy(cur_, &pool_[b->offset_], b->size_);
+    len_ = b->size_;
+    pos_ = 0;
+    b->sent_ = true;
+    out_.mirror(cur_, len_);
+  }
+
+  uint8_t n = (len_ - pos_ < SYSX_CHUNK) ? len_ - pos_ : SYSX_CHUNK;
+
+  out_.write(&cur_[pos_], n, false);
+  pos_ += n;
+  bytes_ += n;
+  lastUs_ = nowUs;
+  waitUs_ = n * SYSX_BYTE_US;
+
+  if (pos_ < len_)
+    return(true);
+
+  len_ = 0;
+  waitUs_ += gapUs_;
+  sent_++;
+
+  return(false);
+}
+
+uint32_t SysExSender::getWait (uint32_t nowUs)
+// us until poll() has something to do, UINT32_MAX if nothing is waiting
+{
+  if (!isPending())
+    return(UINT32_MAX);
+
+  if (nowUs - lastUs_ >= waitUs_)
+    return(0);
+
+  return(waitUs_ - (nowUs - lastUs_));
+}
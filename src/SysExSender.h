@@ -0,0 +1,109 @@
+#ifndef SysExSender_h
+#define SysExSender_h
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include "MidiOutput.h"
+
+/*
+ * System Exclusive blocks from the song, kept in RAM and sent to the
+ * output in paced chunks.
+ *
+ * The player store()s each SysEx as it parses the song and schedules
+ * only the id it gets back, the same block stored again gets the same
+ * id. When the id is due the output task queue()s it, and poll() then
+ * writes the block a chunk at a time, no faster than the MIDI wire takes
+ * it, so the task never waits on the UART. A block is only started once
+ * the output has room for all of it. Channel messages cannot go
+ * out in the middle of a SysEx, so they are held only while a block is
+ * being written, and there is a gap after each block for slow receivers.
+ *
+ * Blocks of at least the repeat size are only sent once until clear(),
+ * so the patch dumps at the top of a looping song go out on the first
+ * pass only. Shorter ones, e.g. GM/GS/XG resets, are sent every time.
+ *
+ * Songs played one after the other keep their blocks in the same pool.
+ * Each block carries the generation it was last stored in, the player
+ * starts a new one for every song, and release() frees the blocks of
+ * the songs before and closes the pool up. The ids of the blocks kept
+ * stay as they are, freed ids are given out again.
+ *
+ * store(), release() and clear() are called by the player task, queue()
+ * and poll() by the output task.
+ */
+
+#define SYSX_POOL_SIZE    4096    // bytes of SysEx kept
+#define SYSX_BLOCKS       64      // distinct blocks kept
+#define SYSX_BLOCK_MAX    255     // longest block, F0 and F7 included
+#define SYSX_QUEUE_SIZE   16      // blocks waiting to be sent, must be a power of 2
+#define SYSX_CHUNK        16      // bytes written to the output at a time
+#define SYSX_BYTE_US      320     // wire time of a byte at 31250 baud
+
+class SysExSender
+{
+
+public:
+  SysExSender (MidiOutput& out);
+
+  void setPacing(uint32_t gapUs, uint16_t repeatSize) { gapUs_ = gapUs; repeatSize_ = repeatSize; }
+
+  // Player side
+  int16_t store(const uint8_t* data, uint16_t size);
+  uint8_t getBlock(uint16_t id, const uint8_t*& data);
+  uint16_t newGeneration() { return ++gen_; }
+  uint16_t release(uint16_t gen);
+  void clear();
+  uint16_t getUsed() { return used_; }
+
+  // Output task side
+  bool queue(uint16_t id);
+  bool poll(uint32_t nowUs);
+  bool isSending() { return len_ != 0; }
+  bool isPending() { return len_ != 0 || head_ != tail_; }
+  uint32_t getWait(uint32_t nowUs);
+
+  uint32_t getSent() { return sent_; }
+  uint32_t getSkipped() { return skipped_; }
+  uint32_t getBytes() { return bytes_; }
+  uint32_t getRejected() { return rejected_; }
+  void resetStats() { sent_ = skipped_ = bytes_ = rejected_ = 0; }
+
+private:
+  typedef struct
+  {
+    uint16_t  offset_;      ///< In pool_
+    uint8_t   size_;        ///< 0 for a freed id
+    bool      sent_;        ///< Sent since clear()
+    uint32_t  hash_;
+    uint16_t  gen_;         ///< Generation of the last store()
+  } Block;
+
+  static uint32_t hash(const uint8_t* data, uint16_t size);
+
+  MidiOutput& out_;
+  uint32_t  gapUs_;         ///< After each block
+  uint16_t  repeatSize_;    ///< Blocks this long or longer are sent once
+
+  uint8_t   pool_[SYSX_POOL_SIZE];
+  Block     block_[SYSX_BLOCKS];
+  std::atomic<uint16_t> count_; ///< Blocks stored, published by store()
+  uint16_t  used_;          ///< Bytes of pool_ in use
+  uint16_t  gen_;           ///< Generation stored in
+
+  uint16_t  queue_[SYSX_QUEUE_SIZE];
+  uint8_t   head_, tail_;   ///< Both owned by the output task
+  uint8_t   cur_[SYSX_BLOCK_MAX]; ///< Block being sent, copied out of the pool
+  uint8_t   len_;           ///< Size of cur_, 0 between blocks
+  uint8_t   pos_;           ///< Next byte of cur_ to write
+  uint32_t  lastUs_;        ///< Time of the last write
+  uint32_t  waitUs_;        ///< Least time from lastUs_ to the next write
+  std::mutex lock_;         ///< Between clear() and the output task
+
+  uint32_t  sent_;          ///< Blocks sent
+  uint32_t  skipped_;       ///< Repeats not sent again
+  uint32_t  bytes_;
+  uint32_t  rejected_;      ///< Cut short, too long, or no room to keep or queue
+};
+
+#endif // SysExSender_h
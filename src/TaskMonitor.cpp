@@ -0,0 +1,61 @@
+#include "Debug_def.h"
+#include "TaskMonitor.h"
+#include <string.h>
+
+// Task Monitor ********************************************************
+
+TaskMonitor::TaskMonitor ()
+:count_(0), lastUs_(0)
+{
+  for (uint8_t i = 0; i < TMON_TASKS; i++)
+  {
+    task_[i] = nullptr;
+    start_[i] = lastUsed_[i] = 0;
+    used_[i] = 0;
+  }
+  memset(sample_, 0, sizeof(sample_));
+};
+
+void TaskMonitor::watch (uint8_t id, const char* name, TaskHandle_t task)
+// Start watching a task in slot 'id'
+{
+  if (id >= TMON_TASKS)
+    return;
+
+  task_[id] = task;
+  sample_[id].name_ = name;
+  if (id >= count_)
+    count_ = id + 1;
+}
+
+bool TaskMonitor::sample (uint32_t nowUs)
+// Take a sample if the window is over. Returns true if one was taken.
+{
+  uint32_t window = nowUs - lastUs_;
+
+  if (window < TMON_WINDOW_MS * 1000UL)
+    return(false);
+
+  for (uint8_t i = 0; i < count_; i++)
+  {
+    Sample* s = &sample_[i];
+    uint32_t used = used_[i].load();
+
+    s->load_ = ((uint64_t)(used - lastUsed_[i]) * 1000) / window;
+    if (s->load_ > s->peakLoad_)
+      s->peakLoad_ = s->load_;
+    lastUsed_[i] = used;
+
+    // ESP-IDF counts the stack in bytes
+    s->stackFree_ = (task_[i] != nullptr) ? uxTaskGetStackHighWaterMark(task_[i]) : 0;
+  }
+  lastUs_ = nowUs;
+
+  return(true);
+}
+
+void TaskMonitor::resetPeaks ()
+{
+  for (uint8_t i = 0; i < count_; i++)
+    sample_[i].peakLoad_ = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef TaskMonitor_h
+#define TaskMonitor_h
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Stack and CPU use of the player's tasks, for reporting at run time.
+ *
+ * Each task brackets its work with busy() and idle(). sample() is called
+ * once a window from one place, and takes the share of the window each
+ * task spent between the two, and the least stack each task has had
+ * free. A task preempted while busy is charged for the time it waited.
+ */
+
+#define TMON_TASKS      4         // tasks that can be watched
+#define TMON_WINDOW_MS  1000      // between samples
+
+class TaskMonitor
+{
+
+public:
+  typedef struct
+  {
+    const char* name_;
+    uint32_t  stackFree_;     ///< Least stack left, bytes
+    uint16_t  load_;          ///< Busy in the last window, 1/1000
+    uint16_t  peakLoad_;      ///< Worst window so far
+  } Sample;
+
+  TaskMonitor ();
+
+  void watch(uint8_t id, const char* name, TaskHandle_t task);
+  void busy(uint8_t id, uint32_t nowUs) { start_[id] = nowUs; }
+  void idle(uint8_t id, uint32_t nowUs) { used_[id] += nowUs - start_[id]; }
+
+  bool sample(uint32_t nowUs);
+  uint8_t getCount() { return count_; }
+  const Sample& get(uint8_t id) { return sample_[id]; }
+  void resetPeaks();
+
+private:
+  uint8_t   count_;                       ///< Slots watched, highest id + 1
+  TaskHandle_t task_[TMON_TASKS];
+  uint32_t  start_[TMON_TASKS];           ///< Written by the task only
+  std::atomic<uint32_t> used_[TMON_TASKS];///< Busy us, written by the task only
+  uint32_t  lastUsed_[TMON_TASKS];        ///< used_ at the last sample
+  uint32_t  lastUs_;                      ///< Time of the last sample
+  Sample    sample_[TMON_TASKS];
+};
+
+#endif // TaskMonitor_h
@@ -0,0 +1,193 @@
+#include "Debug_def.h"
+#include "TempoEngine.h"
+
+// Tempo Engine ********************************************************
+
+TempoEngine::TempoEngine ()
+:usPerQuarter_(500000), ticksPerQuarter_(480), tickLen_(0), scale_(1UL << 16), time_(0), frac_(0),
+ adjust_(0), from_(0), target_(0), rampStart_(0), rampLen_(0), ramping_(false),
+ ph_(nullptr), pulseLeft_(0)
+{
+  update();
+};
+
+void TempoEngine::reset (uint32_t time)
+// New song starting at song time 'time', drop the adjustment
+{
+  adjust_ = from_ = target_ = 0;
+  ramping_ = false;
+  update();
+  restart(time);
+}
+
+void TempoEngine::restart (uint32_t time)
+// Back to the top of the song, which starts at song time 'time'.
+// A ramp in progress is completed.
+{
+  if (ramping_)
+  {
+    adjust_ = target_;
+    ramping_ = false;
+    update();
+  }
+  time_ = time;
+  frac_ = 0;
+  pulseLeft_ = 0;
+}
+
+void TempoEngine::pulseFrom (uint32_t tick)
+// The position is song tick 'tick', e.g. after a seek, for the clock
+// pulses to carry on in step with the quarter notes
+{
+  uint32_t phase = ((uint64_t)tick * TEMPO_PPQ) % ticksPerQuarter_;
+
+  pulseLeft_ = (phase == 0) ? 0 : ticksPerQuarter_ - phase;
+}
+
+void TempoEngine::pulseStep (uint64_t units, uint64_t len, uint32_t pulseLen)
+// The position has just moved on by 'units', each 1/TEMPO_PPQ of 'len'
+// us << 16 long. Hand out the pulses passed on the way, the one landing
+// on the new position is left for the next step.
+{
+  uint64_t now = ((uint64_t)time_ << 16) | frac_;
+
+  while (pulseLeft_ < units)
+  {
+    units -= pulseLeft_;
+    ph_((uint32_t)((now - units * len / TEMPO_PPQ) >> 16));
+    pulseLeft_ = pulseLen;
+  }
+  pulseLeft_ -= units;
+}
+
+void TempoEngine::setQuarter (uint32_t usPerQuarter, uint16_t ticksPerQuarter)
+// Tempo of the song from the current position on
+{
+  if (usPerQuarter == usPerQuarter_ && ticksPerQuarter == ticksPerQuarter_)
+    return;
+
+  usPerQuarter_ = (usPerQuarter == 0) ? 1 : usPerQuarter;
+  ticksPerQuarter_ = (ticksPerQuarter == 0) ? 1 : ticksPerQuarter;
+  update();
+}
+
+uint32_t TempoEngine::getTempo ()
+// Tempo the song is heading for in 1/TEMPO_FRAC BPM, adjustment included
+{
+  int32_t t = (int32_t)((60000000ULL * TEMPO_FRAC) / usPerQuarter_) + target_;
+
+  return(t < TEMPO_MIN ? TEMPO_MIN : t);
+}
+
+void TempoEngine::update ()
+// Work out the tick length for the song tempo and the adjustment in effect
+{
+  if (adjust_ == 0)
+  {
+    tickLen_ = ((uint64_t)usPerQuarter_ << 16) / ticksPerQuarter_;
+    scale_ = 1UL << 16;
+    return;
+  }
+
+  int32_t song = (int32_t)((60000000ULL * TEMPO_FRAC) / usPerQuarter_);
+  int32_t t = song + adjust_;
+
+  if (t < TEMPO_MIN)
+    t = TEMPO_MIN;
+  tickLen_ = ((60000000ULL * TEMPO_FRAC) << 16) / ((uint64_t)t * ticksPerQuarter_);
+  scale_ = ((uint64_t)song << 16) / t;
+}
+
+void TempoEngine::rampStep ()
+// Bring the adjustment up to date with the song time during a ramp
+{
+  uint32_t elapsed = time_ - rampStart_;
+  int32_t adjust = target_;
+
+  if (elapsed < rampLen_)
+    adjust = from_ + (int32_t)(((int64_t)(target_ - from_) * elapsed) / rampLen_);
+  else
+    ramping_ = false;
+
+  if (adjust != adjust_)
+  {
+    adjust_ = adjust;
+    update();
+  }
+}
+
+uint32_t TempoEngine::advance (uint32_t ticks)
+// Move the song position on by 'ticks' and return the new song time.
+// While ramping the adjustment is brought up to date every tick.
+{
+  while (ticks > 0)
+  {
+    uint32_t n = ramping_ ? 1 : ticks;
+    uint64_t t = tickLen_ * n + frac_;
+
+    if (ph_ != nullptr && pulseLeft_ == 0)
+    {
+      ph_(time_);
+      pulseLeft_ = ticksPerQuarter_;
+    }
+
+    time_ += (uint32_t)(t >> 16);
+    frac_ = (uint16_t)t;
+    ticks -= n;
+    if (ph_ != nullptr)
+      pulseStep((uint64_t)n * TEMPO_PPQ, tickLen_, ticksPerQuarter_);
+
+    if (ramping_)
+      rampStep();
+  }
+
+  return(time_);
+}
+
+uint32_t TempoEngine::advanceUs (uint32_t us)
+// Move the song position on by 'us' of song time at the unadjusted tempo,
+// for songs already converted to time, and return the new song time.
+{
+  while (us > 0)
+  {
+    uint32_t n = (ramping_ && us > TEMPO_RAMP_STEP) ? TEMPO_RAMP_STEP : us;
+    uint64_t t = (uint64_t)n * scale_ + frac_;
+
+    if (ph_ != nullptr && pulseLeft_ == 0)
+    {
+      ph_(time_);
+      pulseLeft_ = usPerQuarter_;
+    }
+
+    time_ += (uint32_t)(t >> 16);
+    frac_ = (uint16_t)t;
+    us -= n;
+    if (ph_ != nullptr)
+      pulseStep((uint64_t)n * TEMPO_PPQ, scale_, usPerQuarter_);
+
+    if (ramping_)
+      rampStep();
+  }
+
+  return(time_);
+}
+
+void TempoEngine::rampTo (int32_t adjust, uint32_t rampUs)
+// Move the adjustment to 'adjust' over 'rampUs' of song time, starting
+// from the current position and from wherever a previous ramp had got to
+{
+  target_ = adjust;
+
+  if (rampUs == 0)
+  {
+    ramping_ = false;
+    adjust_ = adjust;
+    update();
+    return;
+  }
+
+  from_ = adjust_;
+  rampStart_ = time_;
+  rampLen_ = rampUs;
+  ramping_ = true;
+}
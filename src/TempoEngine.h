@@ -0,0 +1,77 @@
+#ifndef TempoEngine_h
+#define TempoEngine_h
+
+#include <stdint.h>
+
+/*
+ * Tick to song time conversion with a user tempo adjustment.
+ *
+ * The tick length is kept in microseconds with a 16 bit fraction, and the
+ * fraction carried from one tick to the next, so the song time never
+ * drifts from the tempo map however long the song.
+ *
+ * The adjustment is an offset to the song tempo in 1/TEMPO_FRAC BPM. It
+ * can be ramped towards a new value over a period of song time. The song
+ * position is only ever advanced, so changes never move or repeat events
+ * already worked out.
+ *
+ * With a pulse handler set, the song time of every 1/TEMPO_PPQ of a
+ * quarter note the position passes is handed to it, for MIDI clock. The
+ * pulses are worked out at the exact fraction of a tick they fall on, and
+ * the one at the current position only goes out with the next advance,
+ * so a pulse is never sent twice.
+ */
+
+#define TEMPO_FRAC        100       // adjustment units per BPM
+#define TEMPO_MIN         (10 * TEMPO_FRAC)   // slowest effective tempo
+#define TEMPO_RAMP_STEP   1000      // us between ramp updates in advanceUs()
+#define TEMPO_PPQ         24        // clock pulses per quarter note
+
+class TempoEngine
+{
+
+public:
+  typedef void (*PulseHandler)(uint32_t time);
+
+  TempoEngine ();
+
+  void setPulseHandler(PulseHandler ph) { ph_ = ph; }
+  void pulseFrom(uint32_t tick);
+
+  void reset(uint32_t time = 0);
+  void restart(uint32_t time = 0);
+
+  void setQuarter(uint32_t usPerQuarter, uint16_t ticksPerQuarter);
+  uint32_t advance(uint32_t ticks);
+  uint32_t advanceUs(uint32_t us);
+  uint32_t getTime() { return time_; }
+
+  void rampTo(int32_t adjust, uint32_t rampUs);
+  int32_t getAdjust() { return target_; }
+  bool isRamping() { return ramping_; }
+  uint32_t getTempo();
+
+private:
+  void update();
+  void rampStep();
+  void pulseStep(uint64_t units, uint64_t len, uint32_t pulseLen);
+
+  uint32_t  usPerQuarter_;
+  uint16_t  ticksPerQuarter_;
+  uint64_t  tickLen_;       ///< Tick length in us << 16 with the adjustment applied
+  uint32_t  scale_;         ///< Song time to adjusted time ratio << 16
+  uint32_t  time_;          ///< Song time in us
+  uint16_t  frac_;          ///< Fraction of a us carried to the next tick
+
+  int32_t   adjust_;        ///< Adjustment in effect
+  int32_t   from_;          ///< Ramp start value
+  int32_t   target_;        ///< Ramp end value
+  uint32_t  rampStart_;     ///< Song time the ramp started
+  uint32_t  rampLen_;       ///< Length of the ramp in us
+  bool      ramping_;
+
+  PulseHandler ph_;
+  uint32_t  pulseLeft_;     ///< To the next pulse in 1/TEMPO_PPQ ticks, or us for advanceUs()
+};
+
+#endif // TempoEngine_h
@@ -8,6 +8,26 @@
 #include <MD_MIDIFile.h>
 #include <LiquidCrystal.h>
 #include "IRRemoteTinyReceiver.h"
+#include "MidiScheduler.h"
+#include "MidiEventStream.h"
+#include "TempoEngine.h"
+#include "MidiClock.h"
+#include "SeekIndex.h"
+#include "StreamPlayer.h"
+#include "MidiOutput.h"
+#include "MidiMerge.h"
+#include "MidiTransform.h"
+#include "SysExSender.h"
+#include "SongCache.h"
+#include "PlaylistIndex.h"
+#include "SongInfo.h"
+#include "LcdShadow.h"
+#include "SysExParser.h"
+#include "LatencyStats.h"
+#include "RemoteControl.h"
+#include "BleMidiPacker.h"
+#include "BleMidiInput.h"
+#include "TaskMonitor.h"
 #include "Debug_def.h"
 
 #include <BLEMIDI_Transport.h>
@@ -30,6 +50,10 @@ MIDI_NAMESPACE::MidiInterface<BLEMIDI_NAMESPACE::BLEMIDI_Transport<BLEMIDI_NAMES
 
 void Serial2WriteData(byte* data, int length);
 void ReadCB(void *parameter);       //Continuos Read function (See FreeRTOS multitasks)
+void OutputCB(void *parameter);     //MIDI output task, the only writer of the MIDI port
+void UICB(void *parameter);         //Everything else, one uiLoop() pass at a time
+void uiLoop(void);
+void serial2Wake(void);             //Wakes the UI task when Serial2 has bytes
 
 unsigned long t0 = millis();
 bool isConnected = false;
@@ -71,16 +95,152 @@ IRRemoteTinyReceiver::IRRemoteRxKeyValue kv[] =
 
 // Library objects -------------
 LiquidCrystal LCD(LCD_RS, LCD_ENA, LCD_D4, LCD_D5, LCD_D6, LCD_D7);
+LcdShadow lcdShadow(LCD);
 SDFAT SD;
 MD_MIDIFile SMF;
 IRRemoteTinyReceiver irRx_(kv, ARRAY_SIZE(kv));
 
+size_t midiPortWrite(const uint8_t* data, size_t size);
+MidiOutput midiOutput(midiPortWrite);
+MidiMerge midiMerge(midiOutput);
+MidiTransform midiXform;   // channel map, transpose, velocity and filters from XFORM.CFG
+SysExSender sysexOut(midiOutput);
+const uint32_t SYSEX_GAP_US = 20000;  // after each SysEx block, for slow receivers
+const uint16_t SYSEX_REPEAT_SIZE = 32;// blocks this long are only sent on the first pass
+const uint32_t SYSEX_RELEASE_US = 500000;// after a handover, for the last blocks of the song before
+
+// Task layout ---------
+// Core 1 runs only the real-time path. MIDI-OUT is woken by the scheduler
+// timer and by the message sources: it emits the song events that are due,
+// drains the merge queues to the UART and packs the BLE output.
+// Core 0, with the BLE stack and the esp_timer task, runs the rest: UI
+// (IR, LCD, the FSMs, Serial2, and reading the song from the SD card ahead
+// of the clock) and MIDI-READ (BLE input). The Arduino loop task is not used.
+// The cores only meet in bounded queues: song events in the scheduler
+// queue, live and control messages in the merge queues, and the latency
+// stamps coming back.
+const BaseType_t RT_CORE = 1;
+const BaseType_t IO_CORE = 0;
+const uint32_t OUTPUT_STACK = 4096;           // bytes, BLE writes go through NimBLE
+const uint32_t UI_STACK = 8192;               // as the Arduino loop task had
+const uint32_t READ_STACK = 3072;
+const UBaseType_t OUTPUT_PRIO = configMAX_PRIORITIES - 2;
+const UBaseType_t READ_PRIO = 2;              // live input before the UI
+const UBaseType_t UI_PRIO = 1;
+enum task_id { TASK_OUTPUT, TASK_UI, TASK_READ };
+TaskHandle_t outputTask = NULL;
+TaskHandle_t uiTask = NULL;
+TaskHandle_t readTask = NULL;
+TaskMonitor taskMon;
+
+// The output is mirrored to the BLE server, packed by the output task.
+// The read task takes the server's notifications itself, and publishes
+// the link for the output task.
+bool bleSend(const uint8_t* data, uint8_t size);
+BleMidiPacker bleOut(bleSend);
+BleMidiInput bleIn;
+LatencyStats liveStats;                         // BLE notification to UART
+std::atomic<NimBLERemoteCharacteristic*> bleChr(nullptr); // server MIDI characteristic while linked
+std::atomic<uint16_t> bleMtu(0);                // of the link, 0 when down
+std::atomic<uint32_t> bleIntervalUs(0);
+const uint32_t BLE_POLL_MS = 100;               // BLE-MIDI library upkeep, scan and connect
+const char* BLE_MIDI_SERVICE = "03b80e5a-ede8-4b33-a751-6ce34ec4c700";
+const char* BLE_MIDI_CHARACTERISTIC = "7772e5db-3868-4112-a1a9-f2669d106bf3";
+
+void midiOut(const uint8_t* data, uint8_t size, uint32_t due);
+uint32_t schedClock(void) { return(micros()); }
+MidiScheduler midiSched(midiOut, schedClock);
+uint32_t  parseUs = 0;    // song time in microseconds the parser has reached
+LatencyStats latStats;
+
+TempoEngine tempoEngine;
+const int16_t TEMPO_KEY_STEP = TEMPO_FRAC / 2;  // Up/Down change, 1/TEMPO_FRAC BPM
+const uint32_t TEMPO_KEY_RAMP = 250000;       // us of song time to reach it
+
+// MIDI clock. The song sends its own, 24 pulses per quarter worked out by
+// the tempo engine, with Start, Stop, Continue and Song Position Pointer
+// around it. They are queued on a scheduler of their own that keeps to
+// the song clock, and its timer writes them straight to the port, so they
+// never wait for the song's messages. Or the song follows the clock of
+// another device on BLE or Serial2 instead, see MidiClock.
+// The source is a setting, changed with RC_CLOCK or by holding Down in the
+// song list, and taken up when the next song is loaded.
+enum clock_source : uint8_t { CSInternal, CSBle, CSSerial2, CSCount };
+const char* const CLOCK_NAMES[CSCount] = { "internal", "ble", "serial2" };
+const bool CLOCK_OUT = true;                  // send clock when not following one
+const char* SETTINGS_FILE = "SETTINGS.CFG";   // settings kept on the card, key=value a line
+clock_source clockSetting = CSInternal;       // where the tempo comes from, kept in SETTINGS_FILE
+std::atomic<clock_source> clockFollow(CSInternal); // where it comes from for the song loaded
+const uint32_t CLOCK_RAMP_US = 20000;         // us of song time to reach each tempo followed
+void clockSend(const uint8_t* data, uint8_t size, uint32_t due);
+MidiScheduler clockSched(clockSend, schedClock); // started, flushed and paused with midiSched
+MidiClock midiClock;
+LatencyStats clockStats;                      // clock pulse due to UART
+bool  bClockWait = false; // the song starts or continues with the next pulse
+
+// Remote control on Serial2, see RemoteControl. The UI task is woken as
+// soon as something arrives, and the commands are acted on in that pass.
+size_t serial2Write(const uint8_t* data, size_t size);
+RemoteControl remote(serial2Write, SERIAL2_QUERY_ID);
+
+#if DEBUG_ON && DEBUG_LOG
+DebugLog debugLog(serial2Write, SERIAL2_QUERY_ID);
+#endif
+
+MidiEventStream ramSong(tempoEngine);
+uint32_t  parseTick = 0;  // tick the preload has reached
+bool  bPreload = false;   // events go to preSong rather than the scheduler
+bool  bRamPlay = false;   // current song plays from ramSong
+StreamPlayer rpsSong(tempoEngine);
+bool  bRpsPlay = false;   // current song is a converted RPS file
+SeekIndex seekIndex;
+int32_t seekBar = -1;     // bar to jump to, from a remote request
+
+// Set list play: each song plays once and the next one in the playlist
+// follows on its last tick. The next song is preloaded in the background.
+enum next_state { NSNone, NSParse, NSReady, NSLater };
+bool  bSetList = false;   // set list mode chosen on the song list
+bool  bAdvance = false;   // the song playing goes on to the next one
+TempoEngine nextTempo;    // only used while building nextSong
+MidiEventStream nextSong(nextTempo);
+SeekIndex nextSeek;
+next_state nextState = NSNone;
+bool  bNextRam = false;   // the next song is in nextSong
+bool  bNextBuffer = false; // nextSong's buffer has been asked for
+const uint32_t PRELOAD_SLICE_US = 2000;   // background preload per loop() pass
+
+MidiEventStream* preSong = &ramSong;      // stream and index being preloaded
+SeekIndex* preIndex = &seekIndex;
+uint32_t preloadUs = 0;                   // time spent loading and converting it
+
+// Songs converted before are kept for coming back to, the budget is heap
+// unless the board has PSRAM. Without it the cache only gets what the heap
+// can spare once everything else has started.
+SongCache songCache(sysexOut);
+#if defined(BOARD_HAS_PSRAM)
+const uint32_t SONG_CACHE_BYTES = 2048 * 1024UL;
+#else
+const uint32_t SONG_CACHE_BYTES = 48 * 1024UL;
+const uint32_t SONG_CACHE_SPARE = MES_BUFFER_SIZE + 40 * 1024UL;   // heap kept for a set list's next song and the rest
+#endif
+SongCache::Key nextKey;                   // of the song in nextSong
+uint16_t nextGen = 0;                     // SysEx generation of the next song
+bool  bSysexRelease = false;              // the blocks of the song before are to be freed
+uint16_t sysexReleaseGen = 0;             // those last stored before this generation
+uint32_t sysexReleaseUs = 0;              // once the song clock is past this
+
 // Playlist handling -----------
-const uint8_t FNAME_SIZE = 13;               // file names 8.3 to fit onto LCD display
-const char* PLAYLIST_FILE = "PLAYLIST.TXT"; // file of file names
 const char* MIDI_EXT = ".MID";               // MIDI file extension
+const char* STREAM_EXT = RPS_EXT;            // converted song extension
 uint16_t  plCount = 0;
-char fname[FNAME_SIZE+1];
+uint16_t  plIndex = 0;                       // playlist entry selected or playing
+char fname[PLI_PATH_SIZE];                   // full path of the selected song
+SongCache::Key fkey;                         // song cache key of the selected song
+
+bool hasExt(const char* name, const char* ext);
+bool isSongFile(const char* name);
+PlaylistIndex playlist(SD, isSongFile);
+SongInfo songInfo(playlist);                 // tempo, length and title for the browse screen
 
 // Enumerated types for the FSM(s)
 enum lcd_state  { LSBegin, LSSelect, LSShowFile };
@@ -89,20 +249,196 @@ enum seq_state  { LCDSeq, MIDISeq };
 
 // MIDI callback functions for MIDIFile library ---------------
 
+size_t midiPortWrite(const uint8_t* data, size_t size)
+// Bulk write of the output buffer to the midi communications interface
+{
+#if !DEBUG_SERIAL
+  return(Serial.write(data, size));
+#else
+  return(size);
+#endif
+}
+
+void midiOut(const uint8_t* data, uint8_t size, uint32_t due)
+// Queue a complete message for the midi communications interface.
+// Called by the scheduler when the message is due, the scheduler
+// wakes the output task after each batch.
+{
+  uint32_t late = midiSched.now() - due;
+
+  if (data[0] == 0xf0)
+  {
+    midiMerge.pushSysEx(MidiMerge::SRC_PLAYER, data[1] | (data[2] << 7));
+    return;
+  }
+  if (!midiMerge.push(MidiMerge::SRC_PLAYER, data, size))
+    return;         // dropped and counted, no stamp to wait for its write
+  latStats.markDue(micros() - late);
+}
+
+void clockSend(const uint8_t* data, uint8_t size, uint32_t due)
+// Called by the clock scheduler from its timer when a clock or transport
+// message is due. Real time messages are written to the port at once,
+// ahead of the song's messages in the merge and the output buffer, and
+// go to BLE through the merge. Song Position Pointer has to keep its
+// place among the song's messages, so it goes through the merge, and
+// the clock follows it there until it has reached the port.
+{
+  static bool bBehind = false;    // a Song Position Pointer is on its way
+  uint32_t late = clockSched.now() - due;
+
+  if (bBehind)
+    bBehind = midiMerge.space(MidiMerge::SRC_CLOCK) != MMRG_QUEUE_SIZE - 1 || midiOutput.pending() != 0;
+
+  if (data[0] < 0xf8 || bBehind)
+  {
+    bBehind = true;
+    midiMerge.push(MidiMerge::SRC_CLOCK, data, size);
+  }
+  else if (midiOutput.writeNow(data[0]))
+  {
+    if (data[0] == 0xf8)
+    {
+      clockStats.markDue(micros() - late);
+      clockStats.markSent(clockStats.mark(), micros());
+    }
+    midiMerge.pushMirror(MidiMerge::SRC_CLOCK, data[0]);
+  }
+  midiMerge.wake();
+}
+
+bool sysexQueue(uint16_t id)
+// The merge has reached a SysEx block of the song
+{
+  return(sysexOut.queue(id));
+}
+
+void bleMirror(const uint8_t* data, uint8_t size)
+// Every message the output stage writes, except live input, also goes to BLE
+{
+  bleOut.write(data, size, micros());
+}
+
+bool bleSend(const uint8_t* data, uint8_t size)
+// Write one packet to the server without waiting for a response
+{
+  NimBLERemoteCharacteristic* chr = bleChr;
+
+  return(chr != nullptr && chr->writeValue(data, size, false));
+}
+
+void bleLink(void)
+// Size the output packets for the link the read task has found, the MTU
+// and connection interval may change while connected
+{
+  static uint16_t linkMtu = 0;
+  static uint32_t linkUs = 0;
+  uint16_t mtu = bleMtu;
+  uint32_t intervalUs = bleIntervalUs;
+
+  if (mtu != linkMtu || intervalUs != linkUs)
+  {
+    linkMtu = mtu;
+    linkUs = intervalUs;
+    bleOut.setLink(mtu, intervalUs);
+  }
+}
+
+void bleNotify(NimBLERemoteCharacteristic* chr, uint8_t* data, size_t length, bool isNotify)
+// Called by the BLE stack for each packet from the server
+{
+  if (bleIn.receive(data, length, micros()) && readTask != NULL)
+    xTaskNotifyGive(readTask);
+}
+
+void bleAttach(void)
+// Follow the BLE connection from the read task, after the BLE-MIDI library
+// has connected and subscribed. The server's notifications are then
+// taken over, so that they wake the read task rather than waiting to be
+// polled, and the characteristic and link are published.
+{
+  NimBLEClient* client;
+
+  if (!isConnected)
+  {
+    bleChr = nullptr;
+    bleMtu = 0;
+    bleIntervalUs = 0;
+    return;
+  }
+
+  if (NimBLEDevice::getClientListSize() == 0 || (client = NimBLEDevice::getClientList()->front()) == nullptr)
+    return;
+
+  if (bleChr == nullptr)
+  {
+    NimBLERemoteService* svc = client->getService(BLE_MIDI_SERVICE);
+    NimBLERemoteCharacteristic* chr = (svc == nullptr) ? nullptr : svc->getCharacteristic(BLE_MIDI_CHARACTERISTIC);
+
+    if (chr == nullptr || !chr->subscribe(true, bleNotify))
+      return;
+    bleIn.reset();
+    bleChr = chr;
+  }
+
+  bleMtu = client->getMTU();
+  bleIntervalUs = client->getConnInfo().getConnInterval() * 1250UL;
+}
+
+bool clockMessage(uint8_t status)
+// Clock, Start, Continue or Stop
+{
+  return(status == 0xf8 || (status >= 0xfa && status <= 0xfc));
+}
+
+void bleLive(const uint8_t* data, uint16_t size, uint32_t arrivedUs)
+// Pass a message from BLE on to the output as it came, waiting for room
+// if it is a long SysEx. The clock being followed is taken out.
+{
+  if (clockFollow == CSBle && clockMessage(data[0]))
+  {
+    midiClock.receive(data[0], arrivedUs);
+    return;
+  }
+  while (size > 3 && midiMerge.space(MidiMerge::SRC_LIVE) < (size + 2) / 3)
+  {
+    midiMerge.wake();
+    delay(1);
+  }
+  if (!midiMerge.push(MidiMerge::SRC_LIVE, data, size))
+    return;         // dropped and counted, the output task is far behind
+  liveStats.markDue(arrivedUs);
+
+  if ((data[0] & 0xf0) == 0x90 && data[2] != 0)
+    digitalWrite(LED_BUILTIN, LOW);
+  else if ((data[0] & 0xf0) == 0x80 || (data[0] & 0xf0) == 0x90)
+    digitalWrite(LED_BUILTIN, HIGH);
+}
+
+void midiWake(void)
+// Wake the output task to send whatever the sources have queued
+{
+  if (outputTask != NULL)
+    xTaskNotifyGive(outputTask);
+}
+
 void midiCallback(midi_event *pev)
 // Called by the MIDIFile library when a file event needs to be processed
-// thru the midi communications interface.
+// thru the midi communications interface. The event is queued in the
+// scheduler, stamped with the song time the parser has reached.
+// While preloading, the event is added to the in-RAM stream instead.
 // This callback is set up in the setup() function.
 {
-#if !DEBUG_ON
+  uint8_t msg[sizeof(pev->data)];
+
+  memcpy(msg, pev->data, pev->size);
   if ((pev->data[0] >= 0x80) && (pev->data[0] <= 0xe0))
-  {
-    Serial.write(pev->data[0] | pev->channel);
-    Serial.write(&pev->data[1], pev->size-1);
-  }
+    msg[0] |= pev->channel;
+
+  if (bPreload)
+    preSong->append(parseTick, msg, pev->size);
   else
-    Serial.write(pev->data, pev->size);
-#endif
+    midiSched.push(parseUs, msg, pev->size);
   DEBUG("\nM T", pev->track);
   DEBUG(":  Ch ", pev->channel+1);
   DEBUGS(" Data");
@@ -112,154 +448,789 @@ void midiCallback(midi_event *pev)
 
 void sysexCallback(sysex_event *pev)
 // Called by the MIDIFile library when a System Exclusive (sysex) file event needs 
-// to be processed thru the midi communications interface. Most sysex events cannot 
-// really be processed, so we just ignore it here.
+// to be processed thru the midi communications interface. The data is kept
+// by the SysEx sender and only its id is scheduled, or added to the in-RAM
+// stream while preloading. SysEx longer than the library buffer arrives cut
+// short, and is left out.
 // This callback is set up in the setup() function.
 {
+  int16_t id = sysexOut.store(pev->data, pev->size);
+  uint8_t msg[3] = { 0xf0, (uint8_t)(id & 0x7f), (uint8_t)(id >> 7) };
+
   DEBUG("\nS T", pev->track);
-  DEBUGS(": Data");
-  for (uint8_t i = 0; i < pev->size; i++)
-    DEBUGX(" ", pev->data[i]);
+  DEBUG(": Id ", id);
+  if (id < 0)
+    return;
+
+  if (bPreload)
+    preSong->append(parseTick, msg, sizeof(msg));
+  else
+    midiSched.push(parseUs, msg, sizeof(msg));
+}
+
+void metaCallback(const meta_event *mev)
+// Called by the MIDIFile library for meta events. Markers start a new
+// section in the seek index while the song is preloaded.
+{
+  if (bPreload && mev->type == 0x06)
+    preIndex->marker();
 }
 
 void midiSilence(void)
-// Turn everything off on every channel.
-// Some midi files are badly behaved and leave notes hanging, so between songs turn
-// off all the notes and sound
+// Turn off every note still sounding.
+// Some midi files are badly behaved and leave notes hanging, so between songs
+// and on pause the output task sends a Note Off for each note it knows to be
+// on, and lifts the sustain pedals.
+{
+  midiMerge.release();
+  midiMerge.wake();
+}
+
+bool midiFill(void)
+// Parse the song ahead of the scheduler clock, one tick at a time, until
+// the look ahead window or the queue is full.
+// Returns true if any events were queued.
 {
-  midi_event ev;
+  bool bEvents = false;
+  uint32_t horizon = midiSched.now() + SCHED_LOOKAHEAD_US;
 
-  // All sound off
-  // When All Sound Off is received all oscillators will turn off, and their volume
-  // envelopes are set to zero as soon as possible.
-  ev.size = 0;
-  ev.data[ev.size++] = 0xb0;
-  ev.data[ev.size++] = 120;
-  ev.data[ev.size++] = 0;
+  if (bRamPlay)
+    return(ramSong.fill(midiSched, horizon));
+  if (bRpsPlay)
+    return(rpsSong.fill(midiSched, horizon));
 
-  for (ev.channel = 0; ev.channel < 16; ev.channel++)
-    midiCallback(&ev);
+  while (!SMF.isEOF() && (int32_t)(horizon - parseUs) > 0 &&
+         midiSched.space() >= SCHED_FILL_MARGIN)
+  {
+    bEvents |= SMF.processEvents(1);
+    tempoEngine.setQuarter(SMF.getMicrosecondPerQuarterNote(), SMF.getTicksPerQuarterNote());
+    parseUs = tempoEngine.advance(1);
+  }
+
+  return(bEvents);
 }
 
-// LCD Message Helper functions -----------------
-void LCDMessage(uint8_t r, uint8_t c, const char *msg, bool clrEol = false)
-// Display a message on the LCD screen with optional spaces padding the end
+void clockPulse(uint32_t time)
+// Called by the tempo engine for every clock pulse the song passes. The
+// pulse goes out with the song, or is held against the clock followed.
+{
+  static const uint8_t msg[] = { 0xf8 };
+
+  if (clockFollow != CSInternal)
+    midiClock.local(time);
+  else if (CLOCK_OUT)
+    clockSched.push(time, msg, sizeof(msg));
+}
+
+void clockQueue(const uint8_t* data, uint8_t size, uint32_t due)
+// Queue a transport message with the song, ahead of the pulse due with it
+{
+  if (CLOCK_OUT && clockFollow == CSInternal)
+    clockSched.push(due, data, size);
+}
+
+void midiRestart(bool bStart = true)
+// Start the scheduler clock from the top of the song, and the device
+// following the clock with it unless 'bStart' is false
+{
+  static const uint8_t start[] = { 0xfa };
+
+  midiSched.start();
+  tempoEngine.restart();
+  ramSong.restart();
+  if (bRpsPlay)
+    rpsSong.restart();
+  midiOutput.resetRunningStatus();
+  parseUs = 0;
+  if (bStart)
+    clockQueue(start, sizeof(start), 0);
+}
+
+int midiLoad(const char* name)
+// Open a MIDI file, timing it as the first part of the preload
 {
-  LCD.setCursor(c, r);
-  LCD.print(msg);
-  if (clrEol)
+  uint32_t start = micros();
+  int err = SMF.load(name);
+
+  preloadUs = micros() - start;
+  return(err);
+}
+
+void midiPreloadBegin(MidiEventStream& song, SeekIndex& index)
+// Start converting the loaded file into 'song' and its seek index
+{
+  preSong = &song;
+  preIndex = &index;
+  song.clear(SMF.getTicksPerQuarterNote());
+  index.clear();
+  SMF.looping(false);
+  parseTick = 0;
+  bPreload = true;
+}
+
+bool midiPreloadStep(uint32_t budgetUs)
+// Carry on converting, one tick at a time, for up to 'budgetUs'.
+// Returns true when the song is done or has turned out not to fit.
+{
+  uint32_t start = micros();
+
+  while (!SMF.isEOF() && preSong->isValid())
   {
-    c += strlen(msg);
-    while (c++ < LCD_COLS)
-      LCD.write(' ');
+    uint16_t event = preSong->getEventCount();
+
+    SMF.processEvents(1);
+    preSong->setState(parseTick, SMF.getMicrosecondPerQuarterNote(), SMF.getTimeSignature());
+    preIndex->update(parseTick, SMF.getTimeSignature(), SMF.getTicksPerQuarterNote(), event);
+    parseTick++;
+
+    if (micros() - start >= budgetUs)
+    {
+      preloadUs += micros() - start;
+      return(false);
+    }
   }
+  preloadUs += micros() - start;
+
+  return(true);
 }
 
-void LCDErrMessage(const char *msg, bool fStop)
+bool midiPreloadEnd(bool bLoop)
+// Finish the conversion and leave the file ready to stream from the top
+// in case it did not fit. Returns true if the song is in RAM.
 {
-  LCDMessage(1, 0, msg, true);
-  DEBUG("\nLCDErr: ", msg);
-  while (fStop) { yield(); }; // stop here (busy loop) if told to
-  delay(2000);      // if not stop, pause to show message
+  bPreload = false;
+  preSong->end(parseTick);
+  preIndex->end(parseTick, *preSong);
+  preSong->looping(bLoop);
+  SMF.looping(bLoop);
+  SMF.restart();
+
+  return(preSong->isValid());
 }
 
-// Create list of files for menu --------------
+bool midiPreload(void)
+// Convert the loaded file into the merged in-RAM event stream, stepping
+// through it one tick at a time, and keep it in the song cache. Returns
+// false if the song does not fit, in which case it is played by streaming
+// from the SD card.
+{
+  bool bRam;
 
-uint16_t createPlaylistFile(void)
-// create a play list file on the SD card with the names of the files.
-// This will then be used in the menu.
+  midiPreloadBegin(ramSong, seekIndex);
+  midiPreloadStep(UINT32_MAX);
+  bRam = midiPreloadEnd(!bAdvance);
+  if (bRam)
+    songCache.put(fkey, ramSong, seekIndex, preloadUs);
+
+  return(bRam);
+}
+
+uint32_t midiEndTime(void)
+// Song time at the end of the song that has been scheduled to the end
 {
-  SDFILE    plFile;   // play list file
-  SDFILE    mFile;    // MIDI file
-  SDDIR     dir;      // directory folder
-  uint16_t  count = 0;// count of files
-  char      fname[FNAME_SIZE+1];
+  if (bRpsPlay)
+    return(rpsSong.getEndTime());
 
-  // Open/create the display list and directory files
-  // Errors will stop execution...
-  if (!dir.open("/", O_READ))
+  return(bRamPlay ? ramSong.getEndTime() : parseUs);
+}
+
+bool midiNextName(char* name, SongCache::Key& key)
+// Path and cache key of the song after the current one in the playlist
+{
+  PlaylistIndex::Entry e;
+
+  if (plIndex + 1 >= plCount || !playlist.get(plIndex + 1, e))
+    return(false);
+
+  strcpy(name, e.path_);
+  key = SongCache::makeKey(e);
+  return(true);
+}
+
+void midiNextStep(void)
+// Get the next set list song ready while the current one plays. MIDI files
+// are preloaded a slice at a time, which needs the file reader, so they
+// are only preloaded if the current song does not stream through it.
+// Cached songs are taken either way.
+{
+  char name[PLI_PATH_SIZE];
+
+  // the SysEx blocks only the song before used, once the last has gone
+  if (bSysexRelease && (int32_t)(midiSched.now() - sysexReleaseUs) >= 0 && !sysexOut.isPending())
+  {
+    [[maybe_unused]] uint16_t freed = sysexOut.release(sysexReleaseGen);
+
+    bSysexRelease = false;
+    DEBUG("\nSysEx bytes released ", freed);
+  }
+
+  if (nextState == NSNone && midiNextName(name, nextKey))
+  {
+    nextGen = sysexOut.newGeneration();
+    if (!bNextBuffer)
+    {
+      // only a set list needs room for a second song, taken the first time
+      bNextBuffer = true;
+      if (!nextSong.begin())
+        DEBUGS("\nNo RAM for next song buffer");
+    }
+
+    if (!hasExt(name, STREAM_EXT) && songCache.get(nextKey, nextSong, nextSeek))
+    {
+      DEBUG("\nCached next ", name);
+      nextSong.looping(false);
+      bNextRam = true;
+      nextState = NSReady;
+    }
+    else if (!hasExt(name, STREAM_EXT) && (bRamPlay || bRpsPlay) && midiLoad(name) == MD_MIDIFile::E_OK)
+    {
+      DEBUG("\nPreload next ", name);
+      midiPreloadBegin(nextSong, nextSeek);
+      nextState = NSParse;
+    }
+    else
+      nextState = NSLater;    // opened at the handover
+  }
+
+  if (nextState == NSParse && midiPreloadStep(PRELOAD_SLICE_US))
   {
-    DEBUGX("\nDir open fail, err ", dir.getError());
-    LCDErrMessage("Dir open fail", true);
+    bNextRam = midiPreloadEnd(false);
+    if (bNextRam)
+      songCache.put(nextKey, nextSong, nextSeek, preloadUs);
+    nextState = NSReady;
   }
+}
 
-  if (!plFile.open(PLAYLIST_FILE, O_CREAT | O_WRITE))
+void midiNextCancel(void)
+{
+  if (nextState == NSParse)
   {
-    DEBUGX("\nPL Create fail, err ", plFile.getError());
-    LCDErrMessage("PL create fail", true);
+    bPreload = false;
+    SMF.close();
   }
+  nextState = NSNone;
+}
+
+bool midiNext(void)
+// Hand over to the next set list song once the current one has been
+// scheduled to the end. The new song starts on the last tick of the old
+// one, with the scheduler clock running on. Returns false at the end of
+// the playlist or if the next song cannot be played.
+{
+  uint32_t startUs = midiEndTime();
+  int32_t gap;
 
-  while (mFile.openNext(&dir, O_READ))
+  if (!midiNextName(fname, fkey))
+    return(false);
+  plIndex++;
+
+  if (nextState == NSParse)
   {
-    mFile.getName(fname, FNAME_SIZE);
+    // not done in the background, finish it now
+    midiPreloadStep(UINT32_MAX);
+    bNextRam = midiPreloadEnd(false);
+    if (bNextRam)
+      songCache.put(nextKey, nextSong, nextSeek, preloadUs);
+    nextState = NSReady;
+  }
 
-    DEBUG("\n", count);
-    DEBUG(" ", fname);
+  tempoEngine.reset(startUs);
+  parseUs = startUs;
+  bRpsPlay = hasExt(fname, STREAM_EXT);
+  if (bRpsPlay)
+  {
+    bRamPlay = false;
+    if (!rpsSong.open(fname))
+      bRpsPlay = false;
+    rpsSong.looping(false);
+  }
+  else if (nextState == NSReady && bNextRam)
+  {
+    ramSong.swap(nextSong);
+    seekIndex = nextSeek;
+    bRamPlay = true;
+  }
+  else if (nextState == NSReady)
+    bRamPlay = false;     // preloaded, but too big, stream it
+  else
+  {
+    // nothing prepared, it follows a song streamed from the card or
+    // could not be loaded ahead. It is streamed too, so the gap is only
+    // the time to open the file, not to convert it.
+    nextGen = sysexOut.newGeneration();
+    if (midiLoad(fname) != MD_MIDIFile::E_OK)
+      return(false);
+    SMF.looping(false);
+    bRamPlay = false;
+  }
+  nextState = NSNone;
+
+  if (hasExt(fname, STREAM_EXT) && !bRpsPlay)
+    return(false);
 
-    if (mFile.isFile() && !mFile.isHidden())
+  // nothing the new song stores is older than nextGen, a song streamed
+  // from here stores its blocks as it goes
+  sysexReleaseGen = nextGen;
+  sysexReleaseUs = startUs + SYSEX_RELEASE_US;
+  bSysexRelease = true;
+
+  static const uint8_t start[] = { 0xfa };
+
+  clockQueue(start, sizeof(start), startUs);
+  gap = (int32_t)(midiSched.now() - startUs);
+  latStats.transition(gap > 0 ? gap : 0);
+  DEBUG("\nNext song ", fname);
+  DEBUG(" gap us ", gap > 0 ? gap : 0);
+
+  return(true);
+}
+
+bool midiControl(const uint8_t* data, uint8_t size)
+// Queue a control message, waiting for the output task to make room
+{
+  while (midiMerge.space(MidiMerge::SRC_CONTROL) == 0)
+  {
+    midiMerge.wake();
+    delay(1);
+  }
+
+  return(midiMerge.push(MidiMerge::SRC_CONTROL, data, size));
+}
+
+void clockNow(uint8_t status)
+// Send Stop or Continue to the device following the clock straight away
+{
+  if (CLOCK_OUT && clockFollow == CSInternal)
+    midiControl(&status, 1);
+}
+
+
+void midiTempoSet(uint32_t tempo, uint32_t rampUs)
+// Head for 'tempo' in 1/TEMPO_FRAC BPM over 'rampUs', whatever the song's
+// own tempo is
+{
+  int32_t song = (int32_t)tempoEngine.getTempo() - tempoEngine.getAdjust();
+
+  tempoEngine.rampTo((int32_t)tempo - song, rampUs);
+}
+
+void midiFollow(void)
+// Act on the transport messages of the clock followed and take up its
+// tempo. After Start or Continue the song waits for the next pulse.
+{
+  MidiClock::Message m;
+  bool bPulse = false;
+
+  while (midiClock.read(m))
+  {
+    switch (m.status_)
     {
-      // only include files with MIDI extension
-      if (strcasecmp(MIDI_EXT, &fname[strlen(fname) - strlen(MIDI_EXT)]) == 0)
+    case 0xfa:    // Start, from the top
+      midiSched.flush();
+      midiSilence();
+      if (!bRpsPlay && !bRamPlay)
+        SMF.restart();
+      midiRestart(false);
+      midiSched.pause(true);
+      bClockWait = true;
+      break;
+
+    case 0xfb:    // Continue, from where it stopped
+      bClockWait = midiSched.isPaused();
+      break;
+
+    case 0xfc:    // Stop
+      midiSched.pause(true);
+      midiSilence();
+      bClockWait = false;
+      break;
+
+    case 0xf8:
+      if (bClockWait)
       {
-        DEBUGS(" -> W");
-        if (plFile.write(fname, FNAME_SIZE) == 0)
-          DEBUGS(" error");
-        else
-          DEBUGS(" OK");
-        count++;
+        midiSched.pause(false);
+        midiClock.start(midiSched.now());
+        bClockWait = false;
       }
-      else
-        DEBUGS(" -> not MIDI");
+      if (!midiSched.isPaused())
+      {
+        // the song time it arrived at
+        midiClock.pulse(m.arrivedUs_ - (micros() - midiSched.now()));
+        bPulse = true;
+      }
+      break;
     }
-    else
-      DEBUGS(" -> folder/hidden");
+  }
+
+  if (bPulse && midiClock.hasTempo())
+    midiTempoSet(midiClock.getTempo(), CLOCK_RAMP_US);
+}
 
-    mFile.close();
+bool midiSeek(uint16_t bar)
+// Jump to the start of 'bar' and carry on from there. The channel state
+// is put back as the song had it at that point rather than replaying the
+// events. Only a song playing from RAM can seek.
+{
+  if (!bRamPlay || bar >= seekIndex.getBarCount())
+    return(false);
+
+  const SeekIndex::Bar& b = seekIndex.getBar(bar);
+  uint32_t spp = (uint64_t)b.tick_ * 4 / ramSong.getTicksPerQuarter();  // 16ths
+  const uint8_t pos[] = { 0xf2, (uint8_t)(spp & 0x7f), (uint8_t)((spp >> 7) & 0x7f) };
+  static const uint8_t cont[] = { 0xfb };
+
+  DEBUG("\nSeek bar ", bar);
+  midiSched.flush();
+  clockNow(0xfc);
+  midiSilence();
+  seekIndex.restoreState(ramSong, bar, midiControl);
+  midiMerge.wake();
+  midiRestart(false);
+  ramSong.seek(b.event_, b.tick_);
+  tempoEngine.pulseFrom(b.tick_);
+  clockQueue(pos, sizeof(pos), 0);
+  if (!midiSched.isPaused())
+    clockQueue(cont, sizeof(cont), 0);    // otherwise sent when play carries on
+
+  return(true);
+}
 
-  }
-  // close the control files
-  plFile.close();
-  dir.close();
-  DEBUGS("\nList completed");
+uint16_t midiBar(void)
+// Bar the player has reached
+{
+  return(seekIndex.barAt(ramSong.getTick()));
+}
+
+bool midiEOF(void)
+{
+  if (bRpsPlay)
+    return(rpsSong.isEOF());
+
+  return(bRamPlay ? ramSong.isEOF() : SMF.isEOF());
+}
+
+uint16_t midiTimeSignature(void)
+{
+  if (bRpsPlay)
+    return(rpsSong.getTimeSignature());
+
+  return(bRamPlay ? ramSong.getTimeSignature() : SMF.getTimeSignature());
+}
+
+void midiTempoStep(int16_t step)
+// Nudge the tempo by 'step' 1/TEMPO_FRAC BPM, ramping to it from the
+// parser position, up to one look ahead from now.
+{
+  tempoEngine.rampTo(tempoEngine.getAdjust() + step, TEMPO_KEY_RAMP);
+}
+
+// LCD Message Helper functions -----------------
+void LCDMessage(uint8_t r, uint8_t c, const char *msg, bool clrEol = false)
+// Display a message on the LCD screen with optional spaces padding the end.
+// Only the shadow buffer is written here, the changes reach the display
+// with the next LCDFlush() from loop().
+{
+  lcdShadow.write(r, c, msg, clrEol);
+}
+
+void LCDFlush(bool bForce = false)
+{
+  lcdShadow.flush(millis(), bForce);
+}
+
+void LCDTempo(void)
+// Show the tempo the song is heading for, to 1/10 BPM
+{
+  char  sBuf[10];
+  uint32_t t = tempoEngine.getTempo();
+  uint16_t bpm = (t / TEMPO_FRAC > 999) ? 999 : t / TEMPO_FRAC;   // the width on screen
+
+  snprintf(sBuf, sizeof(sBuf), "T:%3u.%u", bpm, (unsigned)((t % TEMPO_FRAC) * 10 / TEMPO_FRAC) % 10);
+  LCDMessage(0, LCD_COLS-strlen(sBuf), sBuf, true);
+}
+
+void LCDErrMessage(const char *msg, bool fStop)
+{
+  LCDMessage(1, 0, msg, true);
+  LCDFlush(true);
+  DEBUG("\nLCDErr: ", msg);
+  while (fStop) { yield(); }; // stop here (busy loop) if told to
+  delay(2000);      // if not stop, pause to show message
+}
+
+// Settings kept on the card --------------
+void settingsLoad(void)
+// Read the settings from SETTINGS_FILE. The defaults stay if there is no
+// file, and for lines that cannot be used.
+{
+  SDFILE f;
+  char line[24];
+  uint8_t len = 0;
+  int c;
+
+  if (!f.open(SETTINGS_FILE, O_READ))
+    return;
+
+  do
+  {
+    c = f.read();
+    if (c >= 0 && c != '\n' && c != '\r' && len < sizeof(line) - 1)
+    {
+      line[len++] = c;
+      continue;
+    }
+    if (c >= 0 && c != '\n')
+      continue;       // too long, or the CR of a CR LF
+
+    line[len] = '\0';
+    len = 0;
+    if (strncmp(line, "clock=", 6) == 0)
+      for (uint8_t i = 0; i < CSCount; i++)
+        if (strcmp(&line[6], CLOCK_NAMES[i]) == 0)
+          clockSetting = (clock_source)i;
+  } while (c >= 0);
+
+  f.close();
+  clockFollow = clockSetting;
+  DEBUG("\nClock follow ", clockSetting);
+}
+
+bool settingsSave(void)
+// Write the settings to SETTINGS_FILE, false if the card would not take them
+{
+  SDFILE f;
+  char line[24];
+  int n;
+  bool bOk;
+
+  if (!f.open(SETTINGS_FILE, O_RDWR | O_CREAT | O_TRUNC))
+    return(false);
+
+  n = snprintf(line, sizeof(line), "clock=%s\n", CLOCK_NAMES[clockSetting]);
+  bOk = (f.write(line, n) == (size_t)n);
+  f.close();
+
+  return(bOk);
+}
+
+void clockSet(uint32_t src, bool bNow)
+// Follow the clock of 'src' from the next song on, or straight away if
+// 'bNow' as no song is loaded, and keep the setting on the card
+{
+  if (src >= CSCount)
+    return;
+
+  if (bNow)
+    clockFollow = (clock_source)src;
+  if (src == clockSetting)
+    return;
+
+  clockSetting = (clock_source)src;
+  DEBUG("\nClock follow ", clockSetting);
+  if (!settingsSave())
+    LCDErrMessage("SETTINGS.CFG err", false);
+}
+
+// Create list of files for menu --------------
+
+bool hasExt(const char* name, const char* ext)
+{
+  size_t len = strlen(name);
+
+  return(len > strlen(ext) && strcasecmp(ext, &name[len - strlen(ext)]) == 0);
+}
+
+bool isSongFile(const char* name)
+// Only include MIDI files and converted songs in the playlist
+{
+  return(hasExt(name, MIDI_EXT) || hasExt(name, STREAM_EXT));
+}
+
+uint16_t createPlaylistFile(void)
+// Bring the playlist index on the SD card up to date with the files on
+// the card, including subfolders. It is only rewritten if songs have been
+// added, removed or changed. This will then be used in the menu.
+{
+  int16_t count = playlist.open();
+
+  songInfo.reset();
+
+  // Errors will stop execution...
+  if (count < 0)
+    LCDErrMessage("PL index fail", true);
+
+  DEBUG("\nList completed ", count);
 
   return(count);
 }
 
+bool plSelect(uint16_t idx)
+// Make playlist entry 'idx' the song selected, false if there is none
+{
+  PlaylistIndex::Entry e;
+
+  if (idx >= plCount || !playlist.get(idx, e))
+    return(false);
+
+  plIndex = idx;
+  strcpy(fname, e.path_);
+  fkey = SongCache::makeKey(e);
+
+  return(true);
+}
+
+void midiPause(bool bMode)
+// Pause or carry on, and tell the device following the clock
+{
+  char sBuf[2];
+
+  if (bMode == midiSched.isPaused())
+    return;
+
+  if (!bMode)
+    clockNow(0xfb);     // before the pulses carry on
+  midiSched.pause(bMode);
+  if (bMode)
+  {
+    midiSilence();
+    clockNow(0xfc);
+  }
+  sprintf(sBuf, "%c", bMode ? '\1' : '>');
+  LCDMessage(0, 5, sBuf);
+}
+
 // FINITE STATE MACHINES -----------------------------
 
+IRRemoteTinyReceiver::KeyResult keyRead(const char* repeatKeys)
+// Read the next IR key result. Repeats of a held key are reported as a
+// press for the keys listed in repeatKeys and dropped for the others.
+{
+  IRRemoteTinyReceiver::KeyResult kr = irRx_.read();
+
+  if (kr == IRRemoteTinyReceiver::KEY_RPTPRESS)
+    kr = (strchr(repeatKeys, irRx_.getKey()) != NULL) ? IRRemoteTinyReceiver::KEY_PRESS : IRRemoteTinyReceiver::KEY_NULL;
+
+  return(kr);
+}
+
 seq_state lcdFSM(seq_state curSS)
 // Handle selecting a file name from the list (user input)
 {
   static lcd_state s = LSBegin;
-  static uint8_t plIndex = 0;
-  static SDFILE plFile;  // play list file
+  static bool bHeader = true;   // the mode stays shown until the cursor moves
+  IRRemoteTinyReceiver::KeyResult kr;
+  const RemoteControl::Command* pc;
+
+  // remote commands, a song selected and played in the same pass
+  while (curSS == LCDSeq && (pc = remote.next()) != nullptr)
+  {
+    switch (pc->cmd_)
+    {
+    case RemoteControl::RC_SELECT:
+      if (plSelect(pc->value_))
+      {
+        bHeader = false;
+        s = LSShowFile;
+      }
+      break;
+
+    case RemoteControl::RC_PLAY:
+      if (plSelect(plIndex))
+      {
+        curSS = MIDISeq;
+        s = LSBegin;
+      }
+      break;
+
+    case RemoteControl::RC_CLOCK:
+      clockSet(pc->value_, true);
+      break;
+
+    default:      // the rest need a song playing
+      break;
+    }
+    remote.done(micros());
+  }
+  if (curSS != LCDSeq)
+    return(curSS);
 
   // LCD state machine
   switch (s)
   {
   case LSBegin:
-    LCDMessage(0, 0, "Select play:", true);
-    if (!plFile.isOpen())
-    {
-      if (!plFile.open(PLAYLIST_FILE, O_READ))
-        LCDErrMessage("PL file no read open", true);
-    }
+    LCDMessage(0, 0, bSetList ? "Set list play:" : "Select play:", true);
+    bHeader = true;
     s = LSShowFile;
     break;
 
   case LSShowFile:
-    plFile.seekSet(FNAME_SIZE * plIndex);
-    plFile.read(fname, FNAME_SIZE);
+    {
+      PlaylistIndex::Entry e;
+      PlaylistIndex::Meta m;
+      char sName[LCD_COLS-1];   // leave room for the arrows
+      bool bInfo;
+
+      if (!songInfo.get(plIndex, e, m))
+        LCDErrMessage("PL read fail", true);
+      strcpy(fname, e.path_);
+      fkey = SongCache::makeKey(e);
+      bInfo = (m.state_ == PLI_META_OK);
+
+      // tempo, time signature, length and tracks once they are known
+      if (bInfo && !bHeader)
+      {
+        char sInfo[LCD_COLS+1];
+
+        uint8_t n;
 
-    LCDMessage(1, 0, fname, true);
-    LCD.setCursor(LCD_COLS-2, 1);
-    LCD.print(plIndex == 0 ? ' ' : '<');
-    LCD.print(plIndex == plCount-1 ? ' ' : '>');
+        n = snprintf(sInfo, sizeof(sInfo), "%u %u/%u %u:%02u",
+                     (unsigned)((60000000UL + m.usPerQuarter_/2) / m.usPerQuarter_), m.timeSigNum_, m.timeSigDen_,
+                     (unsigned)(m.durationMs_ / 60000), (unsigned)((m.durationMs_ / 1000) % 60));
+        if (m.tracks_ != 0 && n < sizeof(sInfo))
+          snprintf(&sInfo[n], sizeof(sInfo) - n, " %uT", m.tracks_);   // RPS files have none
+        LCDMessage(0, 0, sInfo, true);
+      }
+      else if (!bHeader)
+        LCDMessage(0, 0, bSetList ? "Set list play:" : "Select play:", true);
+
+      // the title if the song has one, else the file name
+      strncpy(sName, (bInfo && m.title_[0] != '\0') ? m.title_ : &e.path_[e.nameOffset_], sizeof(sName)-1);
+      sName[sizeof(sName)-1] = '\0';
+      LCDMessage(1, 0, sName, true);
+    }
+    {
+      char sArrows[3] = { plIndex == 0 ? ' ' : '<', plIndex == plCount-1 ? ' ' : '>', '\0' };
+
+      LCDMessage(1, LCD_COLS-2, sArrows);
+    }
     s = LSSelect;
     break;
 
   case LSSelect:
-    if (irRx_.read() == IRRemoteTinyReceiver::KEY_PRESS)
+    // look at the songs around the cursor while waiting for a key
+    if (songInfo.step(plIndex, PRELOAD_SLICE_US) && !bHeader)
+      s = LSShowFile;
+
+    kr = keyRead("LR");
+    if (kr == IRRemoteTinyReceiver::KEY_LONGPRESS && irRx_.getKey() == 'U')
+    {
+      // Long Up switches between single songs and playing the list through
+      bSetList = !bSetList;
+      DEBUG("\n>Set list ", bSetList);
+      s = LSBegin;
+    }
+    else if (kr == IRRemoteTinyReceiver::KEY_LONGPRESS && irRx_.getKey() == 'D')
+    {
+      // Long Down steps through the clock sources to follow
+      char sBuf[LCD_COLS+1];
+
+      clockSet((clockSetting + 1) % CSCount, true);
+      snprintf(sBuf, sizeof(sBuf), "Clock: %s", CLOCK_NAMES[clockSetting]);
+      LCDMessage(0, 0, sBuf, true);
+      bHeader = true;
+      s = LSShowFile;
+    }
+    else if (kr == IRRemoteTinyReceiver::KEY_PRESS)
     {
       switch (irRx_.getKey())
         // Keys are mapped as follows:
@@ -268,6 +1239,8 @@ seq_state lcdFSM(seq_state curSS)
         // Right:   use the next file name (move forward one file name)
         // Up:      move to the first file name
         // Down:    move to the last file name
+        // Up held: toggle set list play
+        // Down held: next clock source to follow
       {
       case 'S': // Select
         DEBUGS("\n>Play");
@@ -279,18 +1252,21 @@ seq_state lcdFSM(seq_state curSS)
         DEBUGS("\n>Previous");
         if (plIndex != 0)
           plIndex--;
+        bHeader = false;
         s = LSShowFile;
         break;
 
       case 'U': // Up
         DEBUGS("\n>First");
         plIndex = 0;
+        bHeader = false;
         s = LSShowFile;
         break;
 
       case 'D': // Down
         DEBUGS("\n>Last");
         plIndex = plCount - 1;
+        bHeader = false;
         s = LSShowFile;
         break;
 
@@ -298,6 +1274,7 @@ seq_state lcdFSM(seq_state curSS)
         DEBUGS("\n>Next");
         if (plIndex != plCount - 1)
           plIndex++;
+        bHeader = false;
         s = LSShowFile;
         break;
       }
@@ -317,12 +1294,14 @@ seq_state midiFSM(seq_state curSS)
 {
   static midi_state s = MSBegin;
   char  sBuf[10];
+  IRRemoteTinyReceiver::KeyResult kr;
+  const RemoteControl::Command* pc;
   switch (s)
   {
   case MSBegin:
     // Set up the LCD 
-    LCDMessage(0, 0, "Player:> +-", true);
-    LCDMessage(1, 0, "<:K  >:\xdb", true);   // string of user defined characters
+    LCDMessage(0, 0, "Play:> +-", true);
+    LCDMessage(1, 0, "<>:Sect", true);
     s = MSLoad;
     break;
 
@@ -331,9 +1310,46 @@ seq_state midiFSM(seq_state curSS)
     {
       int  err;
 
+      tempoEngine.reset();
+      midiNextCancel();
+      clockFollow = clockSetting;
+      bAdvance = bSetList;
+      bRamPlay = false;
+      bRpsPlay = hasExt(fname, STREAM_EXT);
+
+      // Converted songs stream straight from the card
+      if (bRpsPlay)
+      {
+        if (rpsSong.open(fname))
+        {
+          rpsSong.looping(!bAdvance);
+          midiRestart();
+          s = MSProcess;
+        }
+        else
+        {
+          LCDErrMessage("RPS file error", false);
+          bRpsPlay = false;
+          s = MSClose;
+        }
+      }
+      // A song played before needs no card access
+      else if (songCache.get(fkey, ramSong, seekIndex))
+      {
+        DEBUGS("\nPlay from cache");
+        ramSong.looping(!bAdvance);
+        bRamPlay = true;
+        midiRestart();
+        s = MSProcess;
+      }
       // Attempt to load the file
-      if ((err = SMF.load(fname)) == MD_MIDIFile::E_OK)
+      else if ((err = midiLoad(fname)) == MD_MIDIFile::E_OK)
+      {
+        bRamPlay = midiPreload();
+        DEBUG("\nPlay from RAM ", bRamPlay);
+        midiRestart();
         s = MSProcess;
+      }
       else
       {
         char aErr[16];
@@ -342,65 +1358,136 @@ seq_state midiFSM(seq_state curSS)
         LCDErrMessage(aErr, false);
         s = MSClose;
       }
+
+      // following a clock, the song waits for it to start
+      if (s == MSProcess && clockFollow != CSInternal)
+      {
+        MidiClock::Message m;
+
+        while (midiClock.read(m))
+          ;
+        midiSched.pause(true);
+        bClockWait = false;
+      }
     }
     break;
 
   case MSProcess:
+    if (clockFollow != CSInternal)
+      midiFollow();
+
+    // In a set list get the next song ready, and start it as soon as this
+    // one has been scheduled to the end
+    if (bAdvance)
+    {
+      midiNextStep();
+      if (midiEOF() && !midiNext())
+        bAdvance = false;     // end of the list, let this song finish
+    }
+
     // Play the MIDI file
-    if (!SMF.isEOF())
+    if (!midiEOF() || !midiSched.isEmpty())
     {
-      if (SMF.getNextEvent())
+      if (!midiSched.isPaused() && midiFill())
       {
-        sprintf(sBuf, "T:%3d", SMF.getTempo());
-        LCDMessage(0, LCD_COLS-strlen(sBuf), sBuf, true);
-        sprintf(sBuf, "S:%d/%d", SMF.getTimeSignature()>>8, SMF.getTimeSignature() & 0xf);
+        LCDTempo();
+        sprintf(sBuf, "S:%d/%d", midiTimeSignature()>>8, midiTimeSignature() & 0xf);
         LCDMessage(1, LCD_COLS-strlen(sBuf), sBuf, true);
       };
     }    
     else
       s = MSClose;
 
-    // check the keys
-    if (irRx_.read() == IRRemoteTinyReceiver::KEY_PRESS)
+    if (seekBar >= 0)
+    {
+      midiSeek(seekBar);
+      seekBar = -1;
+    }
+
+    // remote commands, another song is selected once this one has stopped
+    while (s == MSProcess && (pc = remote.next()) != nullptr)
+    {
+      switch (pc->cmd_)
+      {
+      case RemoteControl::RC_SELECT:
+      case RemoteControl::RC_STOP:
+        midiSched.flush();
+        midiSilence();
+        s = MSClose;
+        break;
+
+      case RemoteControl::RC_PLAY:
+        midiPause(false);
+        break;
+
+      case RemoteControl::RC_PAUSE:
+        midiPause(true);
+        break;
+
+      case RemoteControl::RC_TEMPO:
+        midiTempoSet(pc->value_, TEMPO_KEY_RAMP);
+        LCDTempo();
+        break;
+
+      case RemoteControl::RC_SEEK:
+        midiSeek(pc->value_);
+        break;
+
+      case RemoteControl::RC_CLOCK:
+        clockSet(pc->value_, false);
+        break;
+
+      default:
+        break;
+      }
+      if (pc->cmd_ != RemoteControl::RC_SELECT)
+        remote.done(micros());
+    }
+    if (s == MSClose)
+      return(midiFSM(curSS));   // closed in this pass
+
+    // check the keys, holding Up or Down keeps stepping the tempo.
+    // While paused Up and Down step through the sections instead, one a
+    // press, and Select carries on from there.
+    kr = keyRead(midiSched.isPaused() ? "" : "UD");
+    if (kr == IRRemoteTinyReceiver::KEY_PRESS)
     {
       switch (irRx_.getKey())
       {
-      case 'L': midiSilence();  SMF.restart();    break;  // Rewind
-      case 'R': midiSilence();  s = MSClose;                      break;  // Stop
-      case 'U':
+      case 'L':   // Rewind, staying paused if it is
+          if (midiSched.isPaused() && midiSeek(0))
+            break;
+          midiSched.flush();
+          midiSilence();
+          if (!bRpsPlay && !bRamPlay)
+            SMF.restart();
+          midiRestart();
+          break;
+      case 'R':   // Stop
+          midiSched.flush();
+          midiSilence();
+          s = MSClose;
+          break;
+      case 'U':   // Faster, or the next section
+          if (midiSched.isPaused())
+            midiSeek(seekIndex.nextSection(midiBar()));
+          else
           {
-            if (!SMF.isEOF())
-            {
-              if (SMF.getNextEvent())
-              {
-                SMF.setTempo(SMF.getTempo()+1);
-                sprintf(sBuf, "T:%3d", SMF.getTempo());
-                LCDMessage(0, LCD_COLS-strlen(sBuf), sBuf, true);
-              };
-            }  
-          }   
+            midiTempoStep(TEMPO_KEY_STEP);
+            LCDTempo();
+          }
           break;
-      case 'D':
+      case 'D':   // Slower, or back a section
+          if (midiSched.isPaused())
+            midiSeek(seekIndex.prevSection(midiBar()));
+          else
           {
-            if (!SMF.isEOF())
-            {
-              if (SMF.getNextEvent())
-              {
-                SMF.setTempo(SMF.getTempo()-1);
-                sprintf(sBuf, "T:%3d", SMF.getTempo());
-                LCDMessage(0, LCD_COLS-strlen(sBuf), sBuf, true);
-              };
-            } 
+            midiTempoStep(-TEMPO_KEY_STEP);
+            LCDTempo();
           }
-          break; 
+          break;
       case 'S': 
-          {
-            SMF.pause(!SMF.isPaused());
-            if (SMF.isPaused())
-              midiSilence();
-            sprintf(sBuf, "%c", SMF.isPaused()?'\1':'>');
-            LCDMessage(0, 7, sBuf);
-          }    
+          midiPause(!midiSched.isPaused());
           break;  // Pause or Play
       }
     }
@@ -408,8 +1495,46 @@ seq_state midiFSM(seq_state curSS)
 
   case MSClose:
     // close the file and switch mode to user input
+    midiNextCancel();
     SMF.close();
+    rpsSong.close();
+    bRpsPlay = false;
+    midiSched.pause(false);
+    midiSched.flush();
+    clockNow(0xfc);
+    bClockWait = false;
+    sysexOut.clear();
+    bSysexRelease = false;
+    seekBar = -1;
     midiSilence();
+    DEBUG("\nOut bytes ", midiOutput.getBytesIn());
+    DEBUG(" saved ", midiOutput.getBytesSaved());
+    DEBUG(" peak queue ", midiOutput.getPeakDepth());
+    DEBUG(" out dropped ", midiOutput.getDropped());
+    DEBUG(" dropped ", midiMerge.getDropped(MidiMerge::SRC_PLAYER));
+    DEBUG("\nSysEx sent ", sysexOut.getSent());
+    DEBUG(" repeats skipped ", sysexOut.getSkipped());
+    DEBUG(" rejected ", sysexOut.getRejected());
+    DEBUG("\nCache songs ", songCache.getCount());
+    DEBUG(" hits ", songCache.getHits());
+    DEBUG(" misses ", songCache.getMisses());
+    DEBUG(" saved ms ", songCache.getSavedUs() / 1000);
+    DEBUG("\nBLE messages ", bleOut.getMessages());
+    DEBUG(" packets ", bleOut.getPackets());
+    DEBUG(" bytes ", bleOut.getBytes());
+    DEBUG(" held max us ", bleOut.getHeld().max_);
+    DEBUG("\nBLE in packets ", bleIn.getPackets());
+    DEBUG(" lost ", bleIn.getOverruns());
+    DEBUG(" errors ", bleIn.getErrors());
+    DEBUG(" live max us ", liveStats.getLateness().max_);
+    for (uint8_t i = 0; i < taskMon.getCount(); i++)
+    {
+      DEBUG("\nTask ", taskMon.get(i).name_);
+      DEBUG(" stack free ", taskMon.get(i).stackFree_);
+      DEBUG(" load/1000 ", taskMon.get(i).load_);
+      DEBUG(" peak ", taskMon.get(i).peakLoad_);
+    }
+    midiOutput.resetStats();
     curSS = LCDSeq;
     // fall through to default state
 
@@ -445,28 +1570,14 @@ void initBLEMIDI()
                                   digitalWrite(LED_BUILTIN, LOW);
                                 });
 
-  MIDI.setHandleNoteOn([](byte channel, byte note, byte velocity)
-                       {
-                         Serial.write(0x91);
-                         Serial.write(note);
-                         Serial.write(velocity);
-                         digitalWrite(LED_BUILTIN, LOW);
-                       });
-  MIDI.setHandleNoteOff([](byte channel, byte note, byte velocity)
-                        {
-                         Serial.write(0x81);
-                         Serial.write(note);
-                         Serial.write(velocity);
-                         digitalWrite(LED_BUILTIN, HIGH);
-                        });
-
   xTaskCreatePinnedToCore(ReadCB,           //See FreeRTOS for more multitask info  
                           "MIDI-READ",
-                          3000,
-                          NULL,
-                          1,
+                          READ_STACK,
                           NULL,
-                          1); //Core0 or Core1
+                          READ_PRIO,
+                          &readTask,
+                          IO_CORE);
+  taskMon.watch(TASK_READ, "MIDI-READ", readTask);
 
     pinMode(LED_BUILTIN, OUTPUT);
     digitalWrite(LED_BUILTIN, LOW);
@@ -474,13 +1585,12 @@ void initBLEMIDI()
 
 void setup(void)
 {
-  int  err;
-
   pinMode(4, OUTPUT);       // Hand Shake Pin
   digitalWrite(4, HIGH);
 
   Serial.begin(SERIAL_RATE);
   Serial2.begin(SERIAL2_RATE, SERIAL_8E1);
+  Serial2.onReceive(serial2Wake);
 
   DEBUGS("\n[Rhythm Performer]");
   
@@ -490,11 +1600,18 @@ void setup(void)
   LCD.begin(LCD_COLS, LCD_ROWS);
   LCD.clear();
   LCD.noCursor();
+  lcdShadow.begin();
   LCDMessage(0, 0, "Rhythm Performer", false);
   LCDMessage(1, 0, "--(C)PopuMusic--", false);
+  LCDFlush(true);
 
     // Load characters to the LCD
   LCD.createChar(PAUSE, cPause);
+
+  // Reserve the song buffer while the heap is still in one piece, the
+  // one for the next song in a set list is only taken if one is played
+  if (!ramSong.begin())
+    DEBUGS("\nNo RAM for song buffer");
   
   initBLEMIDI();
 
@@ -507,88 +1624,452 @@ void setup(void)
   if (plCount == 0)
     LCDErrMessage("No files", true);
 
+  settingsLoad();
+
+  // Output transforms, before the output task starts using them
+  if (!midiXform.load())
+    LCDErrMessage("XFORM.CFG error", false);
+  midiMerge.setTransform(midiXform.isIdentity() ? nullptr : &midiXform);
+
   // Initialize MIDIFile
   SMF.begin(&SD);
   SMF.setMidiHandler(midiCallback);
   SMF.setSysexHandler(sysexCallback);
+  SMF.setMetaHandler(metaCallback);
   SMF.looping(true);
+  tempoEngine.setPulseHandler(clockPulse);
+  midiMerge.setWakeHandler(midiWake);
+  midiMerge.setSysExHandler(sysexQueue);
+  midiOutput.setMirror(bleMirror);
+  sysexOut.setPacing(SYSEX_GAP_US, SYSEX_REPEAT_SIZE);
+  xTaskCreatePinnedToCore(OutputCB,
+                          "MIDI-OUT",
+                          OUTPUT_STACK,
+                          NULL,
+                          OUTPUT_PRIO,
+                          &outputTask,
+                          RT_CORE);
+  taskMon.watch(TASK_OUTPUT, "MIDI-OUT", outputTask);
+  midiSched.setAlarmHandler(midiWake);
+  midiSched.setFollower(&clockSched);
+  midiSched.begin();
+  clockSched.begin();     // no alarm handler, the pulses go out from the timer
 
   delay(4000);   // allow the welcome to be read on the LCD
 
-  IRRemoteTinyReceiver::Init();
+  irRx_.enableRepeat(true);
+  irRx_.enableRepeatResult(true);
+  irRx_.enableLongPress(true);
+
+#if defined(BOARD_HAS_PSRAM)
+  songCache.setBudget(SONG_CACHE_BYTES);
+#else
+  {
+    uint32_t heap = ESP.getFreeHeap();
+
+    songCache.setBudget((heap > SONG_CACHE_SPARE) ? std::min(SONG_CACHE_BYTES, heap - SONG_CACHE_SPARE) : 0);
+  }
+#endif
+  DEBUG("\nSong cache budget ", songCache.getBudget());
+
+  xTaskCreatePinnedToCore(UICB,
+                          "UI",
+                          UI_STACK,
+                          NULL,
+                          UI_PRIO,
+                          &uiTask,
+                          IO_CORE);
+  taskMon.watch(TASK_UI, "UI", uiTask);
 }
 
-byte serial2ReadBuffer[80];
-size_t serial2ReadLenght;
+byte serial2ReadBuffer[SERIAL2_FRAME_SIZE];
+SysExParser serial2Parser(serial2ReadBuffer, sizeof(serial2ReadBuffer));
 char deviceAddr[24];
 bool hasMidiBegin_ = false;
 
 char myBLEAddString[24];
 
+// Operator queries on Serial2, F0 SERIAL2_QUERY_ID <command> F7
+const uint8_t Q_STATS = 0x01;         // send the statistics snapshot
+const uint8_t Q_STATS_RESET = 0x02;   // send the snapshot, then clear it
+const uint8_t Q_SEEK_BAR = 0x03;      // jump to bar <msb> <lsb>, 7 bits each, first bar 0
+const uint8_t Q_TASKS = 0x04;         // send the task snapshot
+const uint8_t Q_CACHE = 0x05;         // send the song cache snapshot
+const uint8_t Q_CLOCK = 0x06;         // send the MIDI clock snapshot
+const uint8_t Q_REMOTE = 0x07;        // send the remote control snapshot
+// 0x10 and on are the remote control commands, see RemoteControl.h
+const uint8_t Q_STATS_VERSION = 6;    // layout of the snapshot
+
+void serial2PutValue(uint32_t v)
+// Send a 32 bit value as five 7 bit bytes, most significant first
+{
+  for (int8_t shift = 28; shift >= 0; shift -= 7)
+    Serial2.write((uint8_t)((v >> shift) & 0x7f));
+}
+
+void serial2PutHistogram(const LatencyStats::Histogram& h)
+{
+  serial2PutValue(h.count_);
+  serial2PutValue(h.max_);
+  for (uint8_t i = 0; i < LAT_BUCKETS; i++)
+    serial2PutValue(h.bucket_[i]);
+}
+
+void serial2Stats(uint8_t command)
+// Answer a statistics query with
+//  F0 SERIAL2_QUERY_ID command version
+//     lateness histogram, loop histogram,
+//     stamps missed, Serial2 overruns, Serial2 broken frames,
+//     merge dropped (player, live, control, clock), scheduler overruns,
+//     set list transitions, last and worst transition gap,
+//     BLE messages, packets, bytes, messages dropped, packet hold histogram,
+//     live lateness histogram, BLE packets in, lost, bytes out of place,
+//     SysEx blocks sent, repeats skipped, bytes, blocks rejected
+//  F7
+// Histograms are count, max and LAT_BUCKETS buckets, all values in
+// microseconds or events as five 7 bit bytes.
+{
+  Serial2.write(0xf0);
+  Serial2.write(SERIAL2_QUERY_ID);
+  Serial2.write(command);
+  Serial2.write(Q_STATS_VERSION);
+  serial2PutHistogram(latStats.getLateness());
+  serial2PutHistogram(latStats.getLoop());
+  serial2PutValue(latStats.getMissed());
+  serial2PutValue(serial2Parser.getOverruns());
+  serial2PutValue(serial2Parser.getBroken());
+  for (uint8_t src = 0; src < MidiMerge::SRC_COUNT; src++)
+    serial2PutValue(midiMerge.getDropped((MidiMerge::Source)src));
+  serial2PutValue(midiSched.getOverruns());
+  serial2PutValue(latStats.getTransitions());
+  serial2PutValue(latStats.getLastGap());
+  serial2PutValue(latStats.getMaxGap());
+  serial2PutValue(bleOut.getMessages());
+  serial2PutValue(bleOut.getPackets());
+  serial2PutValue(bleOut.getBytes());
+  serial2PutValue(bleOut.getDropped());
+  serial2PutHistogram(bleOut.getHeld());
+  serial2PutHistogram(liveStats.getLateness());
+  serial2PutValue(bleIn.getPackets());
+  serial2PutValue(bleIn.getOverruns());
+  serial2PutValue(bleIn.getErrors());
+  serial2PutValue(sysexOut.getSent());
+  serial2PutValue(sysexOut.getSkipped());
+  serial2PutValue(sysexOut.getBytes());
+  serial2PutValue(sysexOut.getRejected());
+  Serial2.write(0xf7);
+
+  if (command == Q_STATS_RESET)
+  {
+    latStats.reset();
+    liveStats.reset();
+    bleOut.resetStats();
+    sysexOut.resetStats();
+    clockStats.reset();
+    midiClock.resetStats();
+    remote.resetStats();
+  }
+}
+
+void serial2Tasks(void)
+// Answer a task query with
+//  F0 SERIAL2_QUERY_ID Q_TASKS count
+//     for MIDI-OUT, UI and MIDI-READ: stack bytes never used,
+//     busy in the last second and in the worst second, 1/1000 each
+//  F7
+{
+  Serial2.write(0xf0);
+  Serial2.write(SERIAL2_QUERY_ID);
+  Serial2.write(Q_TASKS);
+  Serial2.write(taskMon.getCount());
+  for (uint8_t i = 0; i < taskMon.getCount(); i++)
+  {
+    serial2PutValue(taskMon.get(i).stackFree_);
+    serial2PutValue(taskMon.get(i).load_);
+    serial2PutValue(taskMon.get(i).peakLoad_);
+  }
+  Serial2.write(0xf7);
+}
+
+void serial2Cache(void)
+// Answer a song cache query with
+//  F0 SERIAL2_QUERY_ID Q_CACHE songs
+//     bytes used, budget, hits, misses, songs dropped for room,
+//     load time saved by the hits in ms
+//  F7
+{
+  Serial2.write(0xf0);
+  Serial2.write(SERIAL2_QUERY_ID);
+  Serial2.write(Q_CACHE);
+  Serial2.write(songCache.getCount());
+  serial2PutValue(songCache.getUsed());
+  serial2PutValue(songCache.getBudget());
+  serial2PutValue(songCache.getHits());
+  serial2PutValue(songCache.getMisses());
+  serial2PutValue(songCache.getEvictions());
+  serial2PutValue(songCache.getSavedUs() / 1000);
+  Serial2.write(0xf7);
+}
+
+void serial2Clock(void)
+// Answer a MIDI clock query with
+//  F0 SERIAL2_QUERY_ID Q_CLOCK source locked
+//     tempo followed in 1/TEMPO_FRAC BPM, smoothed phase error in us
+//     (signed, + when the song is ahead), time to lock in us,
+//     pulses taken, worst pulse jitter in us, messages lost,
+//     lateness histogram of the pulses sent
+//  F7
+{
+  Serial2.write(0xf0);
+  Serial2.write(SERIAL2_QUERY_ID);
+  Serial2.write(Q_CLOCK);
+  Serial2.write((uint8_t)clockFollow.load());
+  Serial2.write(midiClock.isLocked() ? 1 : 0);
+  serial2PutValue(midiClock.getTempo());
+  serial2PutValue((uint32_t)midiClock.getPhase());
+  serial2PutValue(midiClock.getLockUs());
+  serial2PutValue(midiClock.getPulses());
+  serial2PutValue(midiClock.getJitter());
+  serial2PutValue(midiClock.getOverruns());
+  serial2PutHistogram(clockStats.getLateness());
+  Serial2.write(0xf7);
+}
+
+void serial2Remote(void)
+// Answer a remote control query with
+//  F0 SERIAL2_QUERY_ID Q_REMOTE
+//     commands acted on, frames rejected, status pushes,
+//     histogram of the time from frame in to command acted on
+//  F7
+{
+  Serial2.write(0xf0);
+  Serial2.write(SERIAL2_QUERY_ID);
+  Serial2.write(Q_REMOTE);
+  serial2PutValue(remote.getCommands());
+  serial2PutValue(remote.getRejected());
+  serial2PutValue(remote.getPushes());
+  serial2PutHistogram(remote.getLatency());
+  Serial2.write(0xf7);
+}
+
+void serial2Frame(const byte* data, size_t length)
+// Handle a complete F0..F7 frame from Serial2, data excludes F0 and F7.
+// Operator queries are answered directly. Otherwise the first frame
+// carries the BLE name to connect to, and every frame is answered with
+// our own BLE address.
+{
+  if (length >= 2 && data[0] == SERIAL2_QUERY_ID)
+  {
+    if (data[1] == Q_STATS || data[1] == Q_STATS_RESET)
+      serial2Stats(data[1]);
+    else if (data[1] == Q_SEEK_BAR && length == 4)
+      seekBar = (data[2] << 7) | data[3];
+    else if (data[1] == Q_TASKS)
+      serial2Tasks();
+    else if (data[1] == Q_CACHE)
+      serial2Cache();
+    else if (data[1] == Q_CLOCK)
+      serial2Clock();
+    else if (data[1] == Q_REMOTE)
+      serial2Remote();
+    else
+      remote.decode(data, length, micros());
+    return;
+  }
+
+  digitalWrite(LED_BUILTIN, HIGH);
+  if (hasMidiBegin_ == false)
+  {
+    hasMidiBegin_ = true;
+    if (length > sizeof(deviceAddr) - 1)
+      length = sizeof(deviceAddr) - 1;
+    memcpy(deviceAddr, data, length);
+    deviceAddr[length] = '\0';
+    BLEMIDI.setName(deviceAddr);
+
+    MIDI.begin(MIDI_CHANNEL_OMNI);
+
+    BLEAddress myBLEAddr = BLEDevice::getAddress();
+    sprintf(myBLEAddString, "\xF0%s\xF7", myBLEAddr.toString().c_str());
+  }
+
+  Serial2WriteData((byte*)myBLEAddString, strlen(myBLEAddString));
+}
+
 void loop(void)
+// The Arduino loop task is not used, see the task layout
 {
+  vTaskDelete(NULL);
+}
+
+void UICB(void *parameter)
+// A uiLoop() pass every tick, so that the idle task of the core, which the
+// task watchdog looks after, gets to run, or as soon as Serial2 has
+// something. The IR receiver is started here to have its pin interrupt on
+// this core.
+{
+  IRRemoteTinyReceiver::Init();
+
+  for (;;)
+  {
+    uiLoop();
+#if DEBUG_ON && DEBUG_LOG
+    // the rest of the tick goes to the debug log, as much as Serial2 takes
+    // without blocking
+    while (Serial2.availableForWrite() >= DLOG_FRAME_MAX && debugLog.drain())
+      ;
+#endif
+    ulTaskNotifyTake(pdTRUE, 1);
+  }
+}
+
+void serial2Wake(void)
+// Called by the UART driver task when bytes have arrived on Serial2
+{
+  if (uiTask != NULL)
+    xTaskNotifyGive(uiTask);
+}
+
+void remoteStatus(seq_state ss)
+// Bring the remote status up to date, and push what has changed
+{
+  bool bPlaying = (ss == MIDISeq);
+  uint16_t ts = bPlaying ? midiTimeSignature() : 0;
+
+  remote.set(RemoteControl::RF_STATE, !bPlaying ? RemoteControl::RS_STOPPED :
+             midiSched.isPaused() ? RemoteControl::RS_PAUSED : RemoteControl::RS_PLAYING);
+  remote.set(RemoteControl::RF_SONG, plIndex);
+  remote.set(RemoteControl::RF_SONGS, plCount);
+  remote.set(RemoteControl::RF_TEMPO, bPlaying ? tempoEngine.getTempo() : 0);
+  remote.set(RemoteControl::RF_BAR, (bPlaying && bRamPlay) ? midiBar() : 0);
+  remote.set(RemoteControl::RF_TIMESIG, (((ts >> 8) & 0x7f) << 7) | (ts & 0x7f));
+  remote.push(micros());
+}
+
+void uiLoop(void)
+{
+  taskMon.busy(TASK_UI, micros());
+  latStats.loopTime(micros());
   irRx_.Update();
 
+  // Take what has arrived on Serial2 without waiting for the rest of a
+  // frame, and only so much per pass that control traffic cannot hold up
+  // the player. The clock being followed may come in the middle of a frame.
+  // This comes first, for the FSMs to act on remote commands straight away.
+  for (uint8_t n = 0; n < SERIAL2_LOOP_BYTES && Serial2.available(); n++)
+  {
+    uint8_t b = Serial2.read();
+
+    if (clockFollow == CSSerial2 && clockMessage(b))
+      midiClock.receive(b, micros());
+    else if (serial2Parser.parse(b))
+      serial2Frame(serial2Parser.getData(), serial2Parser.getLength());
+  }
+
   static seq_state s = LCDSeq;
 
   switch (s)
   {
     case LCDSeq:  s = lcdFSM(s);	break;
-    case MIDISeq: s = midiFSM(s);	break;
+    case MIDISeq:
+      s = midiFSM(s);
+      if (s == LCDSeq && remote.next() != nullptr)
+        s = lcdFSM(s);  // the song selected while another one played
+      break;
     default: s = LCDSeq;
   }
 
-  if (Serial2.available())
-  {
-    serial2ReadLenght = Serial2.readBytesUntil('\xF7', serial2ReadBuffer, 80);
-
-    // if (serial2ReadLenght > 0)
-    // {
-    //   digitalWrite(LED_BUILTIN, HIGH);
-    //   Serial2WriteData(serial2ReadBuffer, serial2ReadLenght);
-    // }
+  LCDFlush();
+  remoteStatus(s);
 
-    if (serial2ReadBuffer[0] == '\xF0')
-    {
-      digitalWrite(LED_BUILTIN, HIGH);
-      if (hasMidiBegin_ == false)
-      {
-        hasMidiBegin_ = true;
-        strncpy(deviceAddr, (char *)(serial2ReadBuffer + 1), serial2ReadLenght - 1);
-        BLEMIDI.setName(deviceAddr);
+  taskMon.idle(TASK_UI, micros());
+  taskMon.sample(micros());
+}
 
-        MIDI.begin(MIDI_CHANNEL_OMNI);
+void Serial2WriteData(byte* data, int length)
+{
+  for (int i = 0; i < length; i++)
+      Serial2.write(*(data+i));
+}
 
-        BLEAddress myBLEAddr = BLEDevice::getAddress();
-        sprintf(myBLEAddString, "\xF0%s\xF7", myBLEAddr.toString().c_str());
-      }
+size_t serial2Write(const uint8_t* data, size_t size)
+{
+  return(Serial2.write(data, size));
+}
 
-      Serial2WriteData((byte*)myBLEAddString, strlen(myBLEAddString));
-    }
+/**
+ * MIDI output task. Sleeps until a source wakes it, then moves the queued
+ * messages to the output buffer and writes them to the MIDI port. Nothing
+ * else writes to Serial, so messages from different sources never mix.
+*/
+void midiDrain(MidiMerge& merge, SysExSender& sx, uint32_t nowUs)
+// Move the merged messages and the SysEx chunks that are due to the output.
+// Only real time may come between the bytes of a SysEx. The song's
+// messages queued after a SysEx block wait until it has been written, the
+// ones before it go first. The clock the song sends does not wait.
+{
+  if (sx.poll(nowUs))
+  {
+    merge.drain(0, true);
+    return;
   }
+
+  merge.drain(sx.isPending() ? (1 << MidiMerge::SRC_PLAYER) : 0);
+  if (sx.poll(nowUs))
+    merge.drain(0, true);     // a block the drain has just reached
 }
 
-void Serial2WriteData(byte* data, int length)
+void OutputCB(void *parameter)
 {
-  for (int i = 0; i < length; i++)
-      Serial2.write(*(data+i));
+  for (;;)
+  {
+    uint32_t wait = std::min(bleOut.getWait(micros()), sysexOut.getWait(micros()));
+
+    // sleep until woken, or until the open BLE packet or the next SysEx chunk has to go
+    ulTaskNotifyTake(pdTRUE, (wait == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(wait / 1000) + 1);
+    taskMon.busy(TASK_OUTPUT, micros());
+    bleLink();
+    midiSched.run();
+
+    uint16_t mark = latStats.mark();
+    uint16_t liveMark = liveStats.mark();
+
+    midiDrain(midiMerge, sysexOut, micros());
+    midiOutput.flush();
+    latStats.markSent(mark, micros());
+    liveStats.markSent(liveMark, micros());
+    bleOut.poll(micros());
+    taskMon.idle(TASK_OUTPUT, micros());
+  }
 }
 
 /**
  * This function is called by xTaskCreatePinnedToCore() to perform a multitask execution.
- * In this task, read() is called every millisecond (approx.).
- * read() function performs connection, reconnection and scan-BLE functions.
- * Call read() method repeatedly to perform a successfull connection with the server 
- * in case connection is lost.
+ * The task sleeps until a BLE notification wakes it, and passes the
+ * messages straight on to the output task.
+ * read() function performs connection, reconnection and scan-BLE functions,
+ * and is called every BLE_POLL_MS to perform a successfull connection with
+ * the server in case connection is lost.
 */
 void ReadCB(void *parameter)
 {
 //  Serial.print("READ Task is started on core: ");
 //  Serial.println(xPortGetCoreID());
+  uint32_t pollMs = 0;
+
   for (;;)
   {
-    MIDI.read(); 
-    vTaskDelay(1 / portTICK_PERIOD_MS); //Feed the watchdog of FreeRTOS.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BLE_POLL_MS));
+    taskMon.busy(TASK_READ, micros());
+    if (bleIn.process(bleLive) != 0)
+      midiMerge.wake();
+    if (millis() - pollMs >= BLE_POLL_MS)
+    {
+      pollMs = millis();
+      MIDI.read();
+      bleAttach();
+    }
+    taskMon.idle(TASK_READ, micros());
     //Serial.println(uxTaskGetStackHighWaterMark(NULL)); //Only for debug. You can see the watermark of the free resources assigned by the xTaskCreatePinnedToCore() function.
   }
   vTaskDelay(1);
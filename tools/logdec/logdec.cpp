@@ -0,0 +1,160 @@
+// Decoder for the binary debug log the player sends on Serial2 when built
+// with DEBUG_ON and DEBUG_LOG, built for the host by [env:logdec].
+//
+//  pio run -e logdec && .pio/build/logdec/program [CAPTURE.BIN]
+//
+// Reads the bytes captured from Serial2, or stdin as they arrive, and
+// prints the text the DEBUG macros would have printed on Serial, with the
+// player's time in seconds at the start of each line. Frames other than
+// the log, such as query answers, are skipped. The counts go to stderr at
+// the end.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Debug_def.h"
+#include "DebugLog.h"
+#include "SysExParser.h"
+
+static std::vector<std::string> formats(DLOG_FORMATS);
+static bool bLineStart = true;
+static uint32_t entries = 0, lost = 0, frames = 0, unknown = 0;
+
+static uint32_t getValue(const uint8_t*& p, const uint8_t* end, uint8_t bytes)
+// 'bytes' 7 bit bytes, most significant first
+{
+  uint32_t v = 0;
+
+  while (bytes-- > 0 && p < end)
+    v = (v << 7) | *p++;
+
+  return(v);
+}
+
+static std::string getText(const uint8_t*& p, const uint8_t* end)
+{
+  std::string s;
+
+  while (p < end && *p != 0)
+    s += (char)*p++;
+  if (p < end)
+    p++;
+
+  return(s);
+}
+
+static void print(const std::string& text, uint32_t us)
+// The text as DEBUG printed it, the time after each new line
+{
+  for (char c : text)
+  {
+    if (c == '\n')
+    {
+      putchar('\n');
+      bLineStart = true;
+      continue;
+    }
+    if (bLineStart)
+    {
+      printf("[%4u.%06u] ", us / 1000000, us % 1000000);
+      bLineStart = false;
+    }
+    putchar(c);
+  }
+}
+
+static void frame(const uint8_t* data, uint16_t length)
+// One log frame, 'data' from the id on
+{
+  const uint8_t* p = data + 2;
+  const uint8_t* end = data + length;
+  uint32_t us = 0;
+
+  frames++;
+  while (p < end)
+  {
+    uint8_t record = *p++;
+
+    if (record == DebugLog::DLR_TIME)
+      us = getValue(p, end, 5);
+    else if (record == DebugLog::DLR_DEFINE && p < end)
+    {
+      uint8_t f = *p++;
+      std::string text = getText(p, end);
+
+      if (f < DLOG_FORMATS)
+        formats[f] = text;
+    }
+    else if (record >= DebugLog::DLR_ENTRY && record <= DebugLog::DLR_ENTRY + 5 && p + 2 <= end)
+    {
+      us += getValue(p, end, record - DebugLog::DLR_ENTRY);
+
+      uint8_t f = *p++;
+      uint8_t type = *p & 0x07;
+      uint8_t bytes = *p++ >> 3;
+      std::string text = (f < DLOG_FORMATS) ? formats[f] : "";
+      char sBuf[16];
+
+      switch (type)
+      {
+      case DebugLog::DLT_INT:  snprintf(sBuf, sizeof(sBuf), "%d", (int32_t)getValue(p, end, bytes)); text += sBuf; break;
+      case DebugLog::DLT_UINT: snprintf(sBuf, sizeof(sBuf), "%u", getValue(p, end, bytes)); text += sBuf; break;
+      case DebugLog::DLT_HEX:  snprintf(sBuf, sizeof(sBuf), "0x%X", getValue(p, end, bytes)); text += sBuf; break;
+      case DebugLog::DLT_TEXT: text += getText(p, end); break;
+      default: break;
+      }
+      print(text, us);
+      entries++;
+    }
+    else if (record == DebugLog::DLR_LOST)
+    {
+      uint32_t n = getValue(p, end, 5);
+
+      printf("%s[%u records lost]", bLineStart ? "" : "\n", n);
+      bLineStart = false;
+      lost += n;
+    }
+    else
+    {
+      unknown++;
+      return;
+    }
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+  FILE* f = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+  uint8_t buf[SERIAL2_FRAME_SIZE];
+  SysExParser parser(buf, sizeof(buf));
+  int c;
+
+  if (f == nullptr)
+  {
+    fprintf(stderr, "logdec: cannot open %s\n", argv[1]);
+    return(1);
+  }
+
+  while ((c = fgetc(f)) != EOF)
+  {
+    if (parser.parse((uint8_t)c))
+    {
+      const uint8_t* data = parser.getData();
+      uint16_t length = parser.getLength();
+
+      if (length >= 2 && data[0] == SERIAL2_QUERY_ID && data[1] == DLOG_FRAME)
+        frame(data, length);
+    }
+  }
+  if (!bLineStart)
+    putchar('\n');
+
+  fprintf(stderr, "logdec: %u entries in %u frames, %u lost, %u bad records\n", entries, frames, lost, unknown);
+  if (f != stdin)
+    fclose(f);
+
+  return(0);
+}
@@ -0,0 +1,184 @@
+// Convert standard MIDI files to the RPS streaming format played by
+// StreamPlayer, built for the host by [env:smf2rps].
+//
+//  pio run -e smf2rps && .pio/build/smf2rps/program SONG.MID [SONG.RPS]
+//
+// The file is read with the same MIDI file library as the player and
+// stepped through one tick at a time, so the converted song plays exactly
+// as the original would. The events of all tracks are merged, stamped in
+// microseconds and written with running status after a header holding
+// the tempo map and the length of the song. SysEx events are not carried
+// over and are counted in the summary.
+
+#include <Arduino.h>
+#include <MD_MIDIFile.h>
+#include <libgen.h>
+#include <vector>
+
+#include "StreamPlayer.h"
+#include "TempoEngine.h"
+
+typedef struct
+{
+  uint32_t  time_;
+  uint8_t   size_;
+  uint8_t   data_[3];
+} Event;
+
+static SDFAT SD;
+static MD_MIDIFile SMF;
+static std::vector<Event> events;
+static uint32_t eventTime = 0;
+static uint32_t sysexCount = 0;
+
+static void midiCallback(midi_event *pev)
+{
+  Event e;
+
+  if (pev->size < 2 || pev->size > 3)
+    return;
+
+  e.time_ = eventTime;
+  e.size_ = pev->size;
+  memcpy(e.data_, pev->data, pev->size);
+  if ((pev->data[0] >= 0x80) && (pev->data[0] <= 0xe0))
+    e.data_[0] |= pev->channel;
+  events.push_back(e);
+}
+
+static void sysexCallback(sysex_event*)
+{
+  sysexCount++;
+}
+
+static void putVLQ(std::vector<uint8_t>& v, uint32_t n)
+{
+  uint8_t b[5];
+  int8_t  i = 0;
+
+  b[i++] = n & 0x7f;
+  while (n >>= 7)
+    b[i++] = 0x80 | (n & 0x7f);
+  while (i > 0)
+    v.push_back(b[--i]);
+}
+
+int main(int argc, char* argv[])
+{
+  char inDir[FS_PATH_MAX], inName[FS_PATH_MAX], outPath[FS_PATH_MAX];
+  TempoEngine te;
+  std::vector<StreamPlayer::MapEntry> map;
+  std::vector<uint8_t> data;
+  StreamPlayer::Header h;
+  uint32_t tick;
+  int err;
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s SONG.MID [SONG%s]\n", argv[0], RPS_EXT);
+    return(1);
+  }
+
+  // the input directory is the card root for the library
+  snprintf(inDir, sizeof(inDir), "%s", argv[1]);
+  snprintf(inName, sizeof(inName), "%s", argv[1]);
+  halSdRoot(dirname(inDir));
+
+  if (argc > 2)
+    snprintf(outPath, sizeof(outPath), "%s", argv[2]);
+  else
+  {
+    char* dot;
+
+    // leave room for the extension
+    snprintf(outPath, sizeof(outPath) - (sizeof(RPS_EXT) - 1), "%s", argv[1]);
+    if ((dot = strrchr(outPath, '.')) != nullptr && strchr(dot, '/') == nullptr)
+      *dot = '\0';
+    strcat(outPath, RPS_EXT);
+  }
+
+  SD.begin(0, SPI_FULL_SPEED);
+  SMF.begin(&SD);
+  SMF.setMidiHandler(midiCallback);
+  SMF.setSysexHandler(sysexCallback);
+  SMF.looping(false);
+
+  if ((err = SMF.load(basename(inName))) != MD_MIDIFile::E_OK)
+  {
+    fprintf(stderr, "%s: load error %d\n", argv[1], err);
+    return(2);
+  }
+
+  // Step through the song as the player does: the events of a tick are
+  // due at the time reached so far, then the tempo in effect moves it on
+  for (tick = 0; !SMF.isEOF(); tick++)
+  {
+    eventTime = te.getTime();
+    SMF.processEvents(1);
+
+    uint32_t usPerQuarter = SMF.getMicrosecondPerQuarterNote();
+    uint16_t timeSig = SMF.getTimeSignature();
+
+    if (map.empty() || map.back().usPerQuarter_ != usPerQuarter || map.back().timeSig_ != timeSig)
+    {
+      StreamPlayer::MapEntry m = { eventTime, usPerQuarter, timeSig, 0 };
+
+      if (!map.empty() && map.back().time_ == eventTime)
+        map.back() = m;
+      else
+        map.push_back(m);
+    }
+
+    te.setQuarter(usPerQuarter, SMF.getTicksPerQuarterNote());
+    te.advance(1);
+  }
+
+  if (map.size() > RPS_MAP_SIZE)
+  {
+    fprintf(stderr, "%s: %zu tempo changes, at most %d can be converted\n", argv[1], map.size(), RPS_MAP_SIZE);
+    return(3);
+  }
+
+  // events with running status
+  uint32_t last = 0;
+  uint8_t status = 0;
+
+  for (const Event& e : events)
+  {
+    putVLQ(data, e.time_ - last);
+    last = e.time_;
+    if (e.data_[0] != status)
+      data.push_back(e.data_[0]);
+    status = e.data_[0];
+    data.insert(data.end(), &e.data_[1], &e.data_[e.size_]);
+  }
+
+  memcpy(h.magic_, "RPSF", sizeof(h.magic_));
+  h.version_ = RPS_VERSION;
+  h.mapCount_ = map.size();
+  h.ticksPerQuarter_ = SMF.getTicksPerQuarterNote();
+  h.duration_ = te.getTime();
+  h.events_ = events.size();
+  h.dataOffset_ = sizeof(h) + map.size() * sizeof(StreamPlayer::MapEntry);
+  h.dataSize_ = data.size();
+
+  FILE* f = fopen(outPath, "wb");
+
+  if (f == nullptr ||
+      fwrite(&h, sizeof(h), 1, f) != 1 ||
+      fwrite(map.data(), sizeof(StreamPlayer::MapEntry), map.size(), f) != map.size() ||
+      fwrite(data.data(), 1, data.size(), f) != data.size())
+  {
+    fprintf(stderr, "%s: write error\n", outPath);
+    return(4);
+  }
+  fclose(f);
+
+  printf("%s: %u ticks, %u events, %zu tempo map entries, %u.%03u s, %u bytes of events",
+         outPath, tick, h.events_, map.size(), h.duration_ / 1000000, (h.duration_ / 1000) % 1000, h.dataSize_);
+  if (sysexCount != 0)
+    printf(", %u SysEx events left out", sysexCount);
+  printf("\n");
+
+  return(0);
+}